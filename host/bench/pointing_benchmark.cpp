@@ -0,0 +1,583 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Pointing-accuracy benchmark: replays satellite pass command streams through the unmodified
+// firmware on a virtual clock against the rotator model, faster than real time.
+//
+// Usage: pointing_benchmark [options] [<pass file>...]
+//   --synthetic N          add N generated passes (default when no files are given: 8)
+//   --seed N               random seed for the generated passes
+//   --azimuth DEGREES      rotator azimuth at the start of each pass
+//   --loop-us N            simulated duration of one loop() iteration
+//   --min-rate, --max-rate, --time-constant, --encoder-error   rotator model parameters
+//   --calibrate            run CALIBRATE after boot, so that the passes use the identified motion model
+//   --sweep                run SWEEP after boot, so that the passes use the measured encoder correction
+//
+// A pass file has one "<seconds> <command>" line per command sent to the controller, for
+// example "12.0 AZ 181.5". Lines starting with '#' are ignored.
+//
+// For each pass the benchmark reports the RMS and maximum pointing error while tracking, the
+// time to target and overshoot of step commands (target changes over STEP_THRESHOLD degrees,
+// including the initial slew to the start of a pass)
+// and the number of relay switches. Each pass runs in a forked copy of the booted firmware,
+// so all passes start from the same state.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+
+#include "config.h"
+#include "encoder_correction.h"
+#include "settings.h"
+#include "sim_hardware.h"
+#include "rotator_model.h"
+
+#define STEP_THRESHOLD 5.0 // degrees
+#define TARGET_TOLERANCE 1.0 // degrees
+#define SAMPLE_INTERVAL_US 10000
+#define SETTLE_TIME_US 300000000 // Longest wait for the rotator to stop after the last command
+#define CALIBRATION_TIMEOUT_US 1800000000ULL // Longest wait for CALIBRATE to finish
+#define CALIBRATION_BOOT_TIME_US 1000000
+#define SWEEP_TIMEOUT_US 1800000000ULL // Longest wait for SWEEP to finish
+
+#define SYNTHETIC_PASS_DURATION 600.0 // seconds
+#define SYNTHETIC_COMMAND_INTERVAL 1.0 // seconds
+
+void setup();
+void loop();
+
+struct PassCommand {
+    double time;
+    std::string command;
+};
+
+struct Pass {
+    std::string name;
+    std::vector<PassCommand> commands;
+};
+
+struct PassResult {
+    double duration;
+    unsigned int commands;
+    unsigned int command_errors;
+    double rms_error;
+    double max_error;
+    unsigned int steps;
+    unsigned int steps_unreached;
+    double time_to_target_mean;
+    double time_to_target_max;
+    double overshoot_mean;
+    double overshoot_max;
+    unsigned int relay_switches;
+};
+
+struct Step {
+    bool active;
+    bool reached;
+    uint64_t start_us;
+    double target;
+    double direction;
+    double overshoot;
+};
+
+static RotatorModel *model;
+static unsigned int command_errors;
+static std::string serial_line;
+
+static void update_model(uint64_t now_us)
+{
+    model->update(now_us);
+}
+
+static void serial_output(const uint8_t *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        char c = static_cast<char>(data[i]);
+        if (c == '\n') {
+            if (serial_line.compare(0, 5, "ERROR") == 0) {
+                command_errors++;
+            }
+            serial_line.clear();
+        } else if (c != '\r') {
+            serial_line += c;
+        }
+    }
+}
+
+static bool parse_az(const std::string &command, double &az)
+{
+    return sscanf(command.c_str(), "AZ %lf", &az) == 1;
+}
+
+static bool load_pass(const char *file_name, Pass &pass)
+{
+    FILE *input = fopen(file_name, "r");
+    if (input == nullptr) {
+        return false;
+    }
+
+    char line[256];
+    pass.name = file_name;
+    while (fgets(line, sizeof(line), input) != nullptr) {
+        line[strcspn(line, "\r\n")] = '\0';
+        double time;
+        int offset;
+        if (line[0] == '#' || sscanf(line, "%lf %n", &time, &offset) != 1) {
+            continue;
+        }
+        pass.commands.push_back({time, line + offset});
+    }
+    fclose(input);
+
+    std::stable_sort(pass.commands.begin(), pass.commands.end(),
+            [](const PassCommand &a, const PassCommand &b) { return a.time < b.time; });
+
+    return !pass.commands.empty();
+}
+
+/**
+ * Straight ground track past the station: the closer the track, the faster the azimuth swings
+ * at the time of closest approach. Azimuths are unwrapped into the rotator range.
+ */
+static Pass synthesize_pass(int index, std::mt19937 &random)
+{
+    std::uniform_real_distribution<double> heading_distribution(0, 360);
+    std::uniform_real_distribution<double> distance_distribution(0.05, 1.5);
+    double heading = heading_distribution(random);
+    double distance = distance_distribution(random);
+
+    Pass pass;
+    char name[64];
+    snprintf(name, sizeof(name), "synthetic-%d (d=%.2f)", index, distance);
+    pass.name = name;
+
+    std::vector<double> path;
+    for (double time = 0; time <= SYNTHETIC_PASS_DURATION; time += SYNTHETIC_COMMAND_INTERVAL) {
+        double along_track = 6 * (time / SYNTHETIC_PASS_DURATION - 0.5);
+        double az = heading + atan2(along_track, distance) * 180 / M_PI;
+        if (!path.empty()) {
+            while (az - path.back() > 180) {
+                az -= 360;
+            }
+            while (az - path.back() < -180) {
+                az += 360;
+            }
+        }
+        path.push_back(az);
+    }
+
+    double minimum = *std::min_element(path.begin(), path.end());
+    double shift = -360 * floor(minimum / 360);
+    double maximum = *std::max_element(path.begin(), path.end()) + shift;
+    if (maximum > AZIMUTH_MAXIMUM && minimum + shift - 360 >= AZIMUTH_MINIMUM) {
+        shift -= 360;
+    }
+
+    for (size_t i = 0; i < path.size(); i++) {
+        char command[32];
+        snprintf(command, sizeof(command), "AZ %.1f", path[i] + shift);
+        pass.commands.push_back({static_cast<double>(i) * SYNTHETIC_COMMAND_INTERVAL, command});
+    }
+
+    return pass;
+}
+
+static Pass step_pass()
+{
+    Pass pass;
+    pass.name = "steps";
+    const double targets[] = {90, 270, 45, 400, -60, 180, 181, 0};
+    double time = 0;
+    for (double target : targets) {
+        char command[32];
+        snprintf(command, sizeof(command), "AZ %.1f", target);
+        pass.commands.push_back({time, command});
+        time += 180;
+    }
+    return pass;
+}
+
+static double reference_azimuth(const Pass &pass, size_t next, double time)
+{
+    double previous_az, next_az;
+    if (next == 0 || !parse_az(pass.commands[next - 1].command, previous_az)) {
+        return NAN;
+    }
+    if (next >= pass.commands.size() || !parse_az(pass.commands[next].command, next_az)
+        || fabs(next_az - previous_az) >= STEP_THRESHOLD) {
+        return previous_az;
+    }
+
+    // Consecutive tracking updates sample a continuous path
+    double previous_time = pass.commands[next - 1].time;
+    double next_time = pass.commands[next].time;
+    return previous_az + (next_az - previous_az) * (time - previous_time) / (next_time - previous_time);
+}
+
+static void finish_step(Step &step, PassResult &result, double &overshoot_total)
+{
+    if (!step.active) {
+        return;
+    }
+    if (!step.reached) {
+        result.steps_unreached++;
+    }
+    overshoot_total += step.overshoot;
+    result.overshoot_max = std::max(result.overshoot_max, step.overshoot);
+    step.active = false;
+}
+
+static PassResult run_pass(const Pass &pass, const RotatorModelConfig &config, uint32_t loop_us)
+{
+    PassResult result{};
+    Step step{};
+    double time_to_target_total = 0;
+    double overshoot_total = 0;
+    double squares = 0;
+    unsigned long tracking_samples = 0;
+
+    model = new RotatorModel(config);
+    model->update(sim_clock_micros());
+    command_errors = 0;
+
+    uint32_t relay_changes = sim_pin_output_changes(PIN_CW) + sim_pin_output_changes(PIN_CCW);
+    uint64_t start_us = sim_clock_micros();
+    uint64_t last_command_us = static_cast<uint64_t>(pass.commands.back().time * 1e6);
+    uint64_t end_us = last_command_us + SETTLE_TIME_US;
+    uint64_t next_sample_us = 0;
+    size_t next = 0;
+    double target = 0;
+    bool has_target = false;
+
+    while (true) {
+        uint64_t now_us = sim_clock_micros() - start_us;
+        double now = static_cast<double>(now_us) / 1e6;
+
+        while (next < pass.commands.size() && pass.commands[next].time <= now) {
+            const std::string &command = pass.commands[next].command;
+            double az;
+
+            if (parse_az(command, az)) {
+                double from = has_target ? target : model->get_position();
+
+                if (fabs(az - from) > STEP_THRESHOLD) {
+                    finish_step(step, result, overshoot_total);
+                    step = {true, false, now_us, az, az > model->get_position() ? 1.0 : -1.0, 0};
+                    result.steps++;
+                } else if (step.active) {
+                    // Tracking updates continue a step: measure against the latest target
+                    step.target = az;
+                }
+
+                target = az;
+                has_target = true;
+            }
+
+            sim_serial_inject((command + "\n").c_str());
+            result.commands++;
+            next++;
+        }
+
+        if (now_us >= next_sample_us) {
+            next_sample_us += SAMPLE_INTERVAL_US;
+            double az = model->get_position();
+
+            if (step.active) {
+                double past_target = step.direction * (az - step.target);
+                if (!step.reached && fabs(az - step.target) <= TARGET_TOLERANCE) {
+                    step.reached = true;
+                    double time_to_target = static_cast<double>(now_us - step.start_us) / 1e6;
+                    time_to_target_total += time_to_target;
+                    result.time_to_target_max = std::max(result.time_to_target_max, time_to_target);
+                }
+                if (past_target > step.overshoot) {
+                    step.overshoot = past_target;
+                }
+            }
+
+            double reference = reference_azimuth(pass, next, now);
+            if ((!step.active || step.reached) && !std::isnan(reference) && now_us <= last_command_us) {
+                double error = fabs(az - reference);
+                squares += error * error;
+                result.max_error = std::max(result.max_error, error);
+                tracking_samples++;
+            }
+
+            bool moving = sim_pin_read(PIN_CW) || sim_pin_read(PIN_CCW) || fabs(model->get_rate()) > 0.01;
+            if (now_us >= end_us || (next >= pass.commands.size() && now_us > last_command_us && !moving)) {
+                break;
+            }
+        }
+
+        loop();
+        delayMicroseconds(loop_us);
+    }
+
+    finish_step(step, result, overshoot_total);
+
+    result.duration = static_cast<double>(sim_clock_micros() - start_us) / 1e6;
+    result.command_errors = command_errors;
+    result.rms_error = tracking_samples > 0 ? sqrt(squares / static_cast<double>(tracking_samples)) : 0;
+    unsigned int reached = result.steps - result.steps_unreached;
+    result.time_to_target_mean = reached > 0 ? time_to_target_total / reached : 0;
+    result.overshoot_mean = result.steps > 0 ? overshoot_total / result.steps : 0;
+    result.relay_switches = sim_pin_output_changes(PIN_CW) + sim_pin_output_changes(PIN_CCW) - relay_changes;
+
+    return result;
+}
+
+static bool run_pass_isolated(const Pass &pass, const RotatorModelConfig &config, uint32_t loop_us,
+        PassResult &result)
+{
+    int fds[2];
+    if (pipe(fds) < 0) {
+        return false;
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        PassResult child_result = run_pass(pass, config, loop_us);
+        ssize_t written = write(fds[1], &child_result, sizeof(child_result));
+        _exit(written == sizeof(child_result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t length = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+
+    return length == sizeof(result);
+}
+
+/**
+ * Runs the firmware until the condition holds or the timeout, returns false on timeout.
+ */
+template<typename CONDITION>
+static bool run_until(CONDITION condition, uint64_t timeout_us, uint32_t loop_us)
+{
+    uint64_t end_us = sim_clock_micros() + timeout_us;
+
+    while (!condition()) {
+        if (sim_clock_micros() >= end_us) {
+            return false;
+        }
+        loop();
+        delayMicroseconds(loop_us);
+    }
+
+    return true;
+}
+
+/**
+ * Runs the firmware until the first encoder pulses have given a valid position.
+ */
+static void boot(uint32_t loop_us)
+{
+    uint64_t boot_us = sim_clock_micros();
+    run_until([boot_us] { return sim_clock_micros() - boot_us >= CALIBRATION_BOOT_TIME_US; }, CALIBRATION_BOOT_TIME_US,
+            loop_us);
+}
+
+static bool return_to_start(const RotatorModelConfig &config, uint32_t loop_us)
+{
+    char command[32];
+    snprintf(command, sizeof(command), "AZ %.1f\n", config.position);
+    sim_serial_inject(command);
+
+    return run_until([&config] {
+        return fabs(model->get_position() - config.position) <= TARGET_TOLERANCE && !sim_pin_read(PIN_CW)
+               && !sim_pin_read(PIN_CCW) && fabs(model->get_rate()) < 0.01;
+    }, SETTLE_TIME_US, loop_us);
+}
+
+/**
+ * Identifies the motion model of the azimuth axis and returns the rotator to the start position.
+ */
+static bool calibrate(const RotatorModelConfig &config, uint32_t loop_us)
+{
+    boot(loop_us);
+
+    sim_serial_inject("CALIBRATE\n");
+    if (!run_until([] { return settings.azimuth_model.valid != 0; }, CALIBRATION_TIMEOUT_US, loop_us)) {
+        return false;
+    }
+
+    return return_to_start(config, loop_us);
+}
+
+/**
+ * Measures the encoder correction of the azimuth axis and returns the rotator to the start position.
+ */
+static bool sweep(const RotatorModelConfig &config, uint32_t loop_us)
+{
+    boot(loop_us);
+
+    sim_serial_inject("SWEEP\n");
+    if (!run_until([] { return encoder_corrections[AXIS_AZIMUTH].get_table().knot_count != 0; }, SWEEP_TIMEOUT_US,
+            loop_us)) {
+        return false;
+    }
+
+    return return_to_start(config, loop_us);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--synthetic N] [--seed N] [--azimuth DEGREES] [--loop-us N] [--min-rate DEG_PER_S] "
+                    "[--max-rate DEG_PER_S] [--time-constant S] [--encoder-error DEGREES] [--calibrate] [--sweep] "
+                    "[<pass file>...]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    RotatorModelConfig config;
+    std::vector<Pass> passes;
+    int synthetic = -1;
+    unsigned long seed = 1;
+    uint32_t loop_us = 200;
+    bool calibrate_model = false;
+    bool sweep_encoder = false;
+
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i];
+        bool has_value = (i + 1 < argc);
+
+        if (strcmp(option, "--synthetic") == 0 && has_value) {
+            synthetic = atoi(argv[++i]);
+        } else if (strcmp(option, "--seed") == 0 && has_value) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(option, "--azimuth") == 0 && has_value) {
+            config.position = atof(argv[++i]);
+        } else if (strcmp(option, "--loop-us") == 0 && has_value) {
+            loop_us = static_cast<uint32_t>(atoi(argv[++i]));
+        } else if (strcmp(option, "--min-rate") == 0 && has_value) {
+            config.min_rate = atof(argv[++i]);
+        } else if (strcmp(option, "--max-rate") == 0 && has_value) {
+            config.max_rate = atof(argv[++i]);
+        } else if (strcmp(option, "--time-constant") == 0 && has_value) {
+            config.time_constant = atof(argv[++i]);
+        } else if (strcmp(option, "--encoder-error") == 0 && has_value) {
+            config.encoder_error = atof(argv[++i]);
+        } else if (strcmp(option, "--calibrate") == 0) {
+            calibrate_model = true;
+        } else if (strcmp(option, "--sweep") == 0) {
+            sweep_encoder = true;
+        } else if (option[0] != '-') {
+            Pass pass;
+            if (!load_pass(option, pass)) {
+                fprintf(stderr, "Cannot read pass commands from %s\n", option);
+                return 1;
+            }
+            passes.push_back(pass);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (synthetic < 0) {
+        synthetic = passes.empty() ? 8 : 0;
+    }
+    if (synthetic > 0) {
+        std::mt19937 random(seed);
+        passes.push_back(step_pass());
+        for (int i = 0; i < synthetic; i++) {
+            passes.push_back(synthesize_pass(i + 1, random));
+        }
+    }
+
+    sim_clock_set_virtual(true);
+    sim_serial_set_stdin_enabled(false);
+    sim_serial_set_output_handler(serial_output);
+    sim_network_set_enabled(false);
+
+    // Boot once, every pass continues from a copy of this state
+    model = new RotatorModel(config);
+    sim_clock_set_sleep_hook(update_model);
+    setup();
+
+    if (calibrate_model && !calibrate(config, loop_us)) {
+        fprintf(stderr, "Calibration did not finish\n");
+        return 1;
+    }
+    if (sweep_encoder && !sweep(config, loop_us)) {
+        fprintf(stderr, "Encoder sweep did not finish\n");
+        return 1;
+    }
+
+    printf("%-26s %8s %5s %4s %8s %8s %5s %4s %8s %8s %9s %9s %6s\n", "pass", "time_s", "cmds", "err",
+            "rms_deg", "max_deg", "steps", "miss", "t2t_avg", "t2t_max", "over_avg", "over_max", "relay");
+
+    PassResult total{};
+    double rms_squares = 0;
+    unsigned int completed = 0;
+
+    for (auto &pass : passes) {
+        PassResult result{};
+        if (!run_pass_isolated(pass, config, loop_us, result)) {
+            printf("%-26s failed\n", pass.name.c_str());
+            continue;
+        }
+
+        printf("%-26s %8.1f %5u %4u %8.3f %8.3f %5u %4u %8.2f %8.2f %9.3f %9.3f %6u\n", pass.name.c_str(),
+                result.duration, result.commands, result.command_errors, result.rms_error, result.max_error,
+                result.steps, result.steps_unreached, result.time_to_target_mean, result.time_to_target_max,
+                result.overshoot_mean, result.overshoot_max, result.relay_switches);
+
+        completed++;
+        total.duration += result.duration;
+        total.commands += result.commands;
+        total.command_errors += result.command_errors;
+        rms_squares += result.rms_error * result.rms_error;
+        total.max_error = std::max(total.max_error, result.max_error);
+        total.steps += result.steps;
+        total.steps_unreached += result.steps_unreached;
+        total.time_to_target_mean += result.time_to_target_mean * (result.steps - result.steps_unreached);
+        total.time_to_target_max = std::max(total.time_to_target_max, result.time_to_target_max);
+        total.overshoot_mean += result.overshoot_mean * result.steps;
+        total.overshoot_max = std::max(total.overshoot_max, result.overshoot_max);
+        total.relay_switches += result.relay_switches;
+    }
+
+    if (completed > 0) {
+        unsigned int reached = total.steps - total.steps_unreached;
+        printf("%-26s %8.1f %5u %4u %8.3f %8.3f %5u %4u %8.2f %8.2f %9.3f %9.3f %6u\n", "TOTAL",
+                total.duration, total.commands, total.command_errors, sqrt(rms_squares / completed), total.max_error,
+                total.steps, total.steps_unreached, reached > 0 ? total.time_to_target_mean / reached : 0,
+                total.time_to_target_max, total.steps > 0 ? total.overshoot_mean / total.steps : 0,
+                total.overshoot_max, total.relay_switches);
+    }
+
+    return completed == passes.size() ? 0 : 1;
+}
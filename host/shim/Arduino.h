@@ -0,0 +1,395 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host shim for the subset of the Arduino Due core used by the controller firmware.
+
+#ifndef OH3AAROT_HOST_ARDUINO_H
+#define OH3AAROT_HOST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cstdarg>
+#include <cmath>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 2
+#define FALLING 3
+#define RISING 4
+
+#define DAC0 66
+#define DAC1 67
+
+#define SIM_PIN_COUNT 80
+
+#define VARIANT_MCK 84000000
+
+#define DEC 10
+#define HEX 16
+
+#define digitalPinToInterrupt(p) (p)
+
+#include <algorithm>
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms); // Calls yield() while waiting, as on the Due
+void yield();
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+void analogWrite(uint32_t pin, uint32_t value);
+void analogWriteResolution(int resolution);
+void analogReadResolution(int resolution);
+void attachInterrupt(uint32_t pin, void (*callback)(), uint32_t mode);
+
+void noInterrupts();
+void interrupts();
+#define __disable_irq() noInterrupts()
+#define __enable_irq() interrupts()
+#define __DMB() __sync_synchronize()
+#define __get_PRIMASK() 0u
+#define __set_PRIMASK(primask) ((void) (primask))
+
+// Cortex-M3 debug and trace registers, the cycle counter follows the simulation clock at VARIANT_MCK
+struct SimCoreDebug {
+    uint32_t DEMCR;
+};
+
+class SimCycleCounter {
+public:
+    operator uint32_t() const;
+    SimCycleCounter &operator=(uint32_t value);
+};
+
+struct SimDWT {
+    uint32_t CTRL;
+    SimCycleCounter CYCCNT;
+};
+
+extern SimCoreDebug sim_core_debug;
+extern SimDWT sim_dwt;
+
+#define CoreDebug (&sim_core_debug)
+#define DWT (&sim_dwt)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk (1UL << 0)
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+class String {
+private:
+    std::string s;
+
+public:
+    String() = default;
+    String(const char *cstr) : s(cstr ? cstr : "") {}
+    String(const std::string &str) : s(str) {}
+    String(char c) : s(1, c) {}
+    String(int value, unsigned char base = 10) : s(format_integer(value, base)) {}
+    String(unsigned int value, unsigned char base = 10) : s(format_unsigned(value, base)) {}
+    String(long value, unsigned char base = 10) : s(format_integer(value, base)) {}
+    String(unsigned long value, unsigned char base = 10) : s(format_unsigned(value, base)) {}
+    String(unsigned char value, unsigned char base = 10) : s(format_unsigned(value, base)) {}
+    String(float value, unsigned char decimals = 2) : s(format_double(value, decimals)) {}
+    String(double value, unsigned char decimals = 2) : s(format_double(value, decimals)) {}
+
+    static std::string format_integer(long value, unsigned char base)
+    {
+        if (value < 0 && base == 10) {
+            return "-" + format_unsigned(static_cast<unsigned long>(-value), base);
+        }
+        return format_unsigned(static_cast<unsigned long>(value), base);
+    }
+
+    static std::string format_unsigned(unsigned long value, unsigned char base)
+    {
+        char buf[72];
+        if (base == 16) {
+            snprintf(buf, sizeof(buf), "%lx", value);
+        } else {
+            snprintf(buf, sizeof(buf), "%lu", value);
+        }
+        return buf;
+    }
+
+    static std::string format_double(double value, unsigned char decimals)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+        return buf;
+    }
+
+    unsigned int length() const
+    { return static_cast<unsigned int>(s.length()); }
+
+    const char *c_str() const
+    { return s.c_str(); }
+
+    char charAt(unsigned int index) const
+    { return index < s.length() ? s[index] : 0; }
+
+    char operator[](unsigned int index) const
+    { return charAt(index); }
+
+    bool concat(const String &str)
+    { s += str.s; return true; }
+
+    bool concat(const char *cstr)
+    { s += cstr; return true; }
+
+    bool concat(char c)
+    { s += c; return true; }
+
+    String &operator+=(const String &rhs)
+    { concat(rhs); return *this; }
+
+    String &operator+=(const char *cstr)
+    { concat(cstr); return *this; }
+
+    String &operator+=(char c)
+    { concat(c); return *this; }
+
+    bool equals(const String &rhs) const
+    { return s == rhs.s; }
+
+    bool equals(const char *cstr) const
+    { return s == cstr; }
+
+    bool operator==(const String &rhs) const
+    { return equals(rhs); }
+
+    bool operator==(const char *cstr) const
+    { return equals(cstr); }
+
+    bool operator!=(const String &rhs) const
+    { return !equals(rhs); }
+
+    bool operator!=(const char *cstr) const
+    { return !equals(cstr); }
+
+    bool startsWith(const String &prefix) const
+    { return s.compare(0, prefix.s.length(), prefix.s) == 0; }
+
+    bool endsWith(const String &suffix) const
+    {
+        return s.length() >= suffix.s.length() &&
+               s.compare(s.length() - suffix.s.length(), suffix.s.length(), suffix.s) == 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const
+    {
+        size_t pos = s.find(c, from);
+        return pos == std::string::npos ? -1 : static_cast<int>(pos);
+    }
+
+    int indexOf(const String &str, unsigned int from = 0) const
+    {
+        size_t pos = s.find(str.s, from);
+        return pos == std::string::npos ? -1 : static_cast<int>(pos);
+    }
+
+    String substring(unsigned int begin) const
+    { return begin < s.length() ? String(s.substr(begin)) : String(); }
+
+    String substring(unsigned int begin, unsigned int end) const
+    {
+        if (begin > end) {
+            unsigned int tmp = begin;
+            begin = end;
+            end = tmp;
+        }
+        if (begin >= s.length()) {
+            return String();
+        }
+        return String(s.substr(begin, end - begin));
+    }
+
+    void remove(unsigned int index)
+    { if (index < s.length()) s.erase(index); }
+
+    void remove(unsigned int index, unsigned int count)
+    { if (index < s.length()) s.erase(index, count); }
+
+    void trim()
+    {
+        size_t begin = s.find_first_not_of(" \t\r\n\f\v");
+        if (begin == std::string::npos) {
+            s.clear();
+            return;
+        }
+        size_t end = s.find_last_not_of(" \t\r\n\f\v");
+        s = s.substr(begin, end - begin + 1);
+    }
+
+    void toUpperCase()
+    { for (auto &c : s) c = static_cast<char>(toupper(c)); }
+
+    long toInt() const
+    { return atol(s.c_str()); }
+
+    float toFloat() const
+    { return static_cast<float>(atof(s.c_str())); }
+
+    double toDouble() const
+    { return atof(s.c_str()); }
+
+    friend String operator+(const String &lhs, const String &rhs)
+    { return String(lhs.s + rhs.s); }
+
+    friend String operator+(const String &lhs, const char *rhs)
+    { return String(lhs.s + rhs); }
+};
+
+class Print {
+private:
+    size_t print_number(unsigned long n, uint8_t base)
+    {
+        char buf[72];
+        snprintf(buf, sizeof(buf), base == 16 ? "%lX" : "%lu", n);
+        return write(buf);
+    }
+
+public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t c) = 0;
+
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (size--) {
+            if (write(*buffer++)) {
+                n++;
+            } else {
+                break;
+            }
+        }
+        return n;
+    }
+
+    size_t write(const char *str)
+    { return str ? write(reinterpret_cast<const uint8_t *>(str), strlen(str)) : 0; }
+
+    size_t write(const char *buffer, size_t size)
+    { return write(reinterpret_cast<const uint8_t *>(buffer), size); }
+
+    virtual int availableForWrite()
+    { return 0; }
+
+    virtual void flush()
+    {}
+
+    size_t print(const __FlashStringHelper *str)
+    { return write(reinterpret_cast<const char *>(str)); }
+
+    size_t print(const String &str)
+    { return write(str.c_str(), str.length()); }
+
+    size_t print(const char *str)
+    { return write(str); }
+
+    size_t print(char c)
+    { return write(static_cast<uint8_t>(c)); }
+
+    size_t print(unsigned char n, int base = DEC)
+    { return print(static_cast<unsigned long>(n), base); }
+
+    size_t print(int n, int base = DEC)
+    { return print(static_cast<long>(n), base); }
+
+    size_t print(unsigned int n, int base = DEC)
+    { return print(static_cast<unsigned long>(n), base); }
+
+    size_t print(long n, int base = DEC)
+    {
+        if (base == DEC && n < 0) {
+            return print('-') + print_number(static_cast<unsigned long>(-n), DEC);
+        }
+        return print_number(static_cast<unsigned long>(n), base);
+    }
+
+    size_t print(unsigned long n, int base = DEC)
+    { return print_number(n, base); }
+
+    size_t print(double n, int digits = 2)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", digits, n);
+        return write(buf);
+    }
+
+    size_t println()
+    { return write("\r\n"); }
+
+    template<typename T>
+    size_t println(T value)
+    { return print(value) + println(); }
+
+    template<typename T>
+    size_t println(T value, int format)
+    { return print(value, format) + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+// Serial port backed by the process standard input and output
+class SimSerial : public Stream {
+public:
+    void begin(unsigned long baud);
+    void end();
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    int availableForWrite() override;
+    void flush() override;
+    using Print::write;
+
+    explicit operator bool()
+    { return true; }
+};
+
+extern SimSerial Serial;
+extern SimSerial SerialUSB;
+
+#define SERIAL_PORT_USBVIRTUAL SerialUSB
+
+#endif
@@ -0,0 +1,139 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host shim for the Arduino Ethernet 2.x library backed by POSIX sockets.
+// Like the W5100, the shim has a fixed number of hardware sockets shared
+// between listening servers and connected clients.
+
+#ifndef OH3AAROT_HOST_ETHERNET_H
+#define OH3AAROT_HOST_ETHERNET_H
+
+#include <Arduino.h>
+
+#define MAX_SOCK_NUM 4
+
+enum EthernetHardwareStatus {
+    EthernetNoHardware,
+    EthernetW5100,
+    EthernetW5200,
+    EthernetW5500
+};
+
+enum EthernetLinkStatus {
+    Unknown,
+    LinkON,
+    LinkOFF
+};
+
+class IPAddress {
+private:
+    uint8_t octets[4] = {0, 0, 0, 0};
+
+public:
+    IPAddress() = default;
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets{a, b, c, d} {}
+    explicit IPAddress(uint32_t address)
+    { memcpy(octets, &address, sizeof(octets)); }
+
+    bool fromString(const char *address);
+
+    uint8_t operator[](int index) const
+    { return octets[index]; }
+
+    uint8_t &operator[](int index)
+    { return octets[index]; }
+
+    explicit operator uint32_t() const
+    {
+        uint32_t address;
+        memcpy(&address, octets, sizeof(address));
+        return address;
+    }
+};
+
+class EthernetClient : public Stream {
+private:
+    uint8_t sockindex;
+
+public:
+    EthernetClient() : sockindex(MAX_SOCK_NUM) {}
+    explicit EthernetClient(uint8_t s) : sockindex(s) {}
+
+    uint8_t status();
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char *host, uint16_t port);
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    int availableForWrite() override;
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size);
+    int peek() override;
+    void flush() override;
+    void stop();
+    uint8_t connected();
+
+    // Sockets close right away in the shim
+    void setConnectionTimeout(uint16_t timeout)
+    {}
+
+    using Print::write;
+
+    explicit operator bool()
+    { return sockindex < MAX_SOCK_NUM; }
+
+    bool operator==(const EthernetClient &rhs) const
+    { return sockindex == rhs.sockindex; }
+
+    bool operator!=(const EthernetClient &rhs) const
+    { return !(*this == rhs); }
+
+    uint8_t getSocketNumber() const
+    { return sockindex; }
+
+    uint16_t localPort();
+    IPAddress remoteIP();
+    uint16_t remotePort();
+};
+
+class EthernetServer {
+private:
+    uint16_t port;
+    int listen_fd = -1;
+
+public:
+    explicit EthernetServer(uint16_t port) : port(port) {}
+
+    void begin();
+    EthernetClient available();
+    EthernetClient accept();
+};
+
+class EthernetClass {
+public:
+    static void init(uint8_t sspin = 10);
+    static int begin(uint8_t *mac, unsigned long timeout = 60000, unsigned long responseTimeout = 4000);
+    static void begin(uint8_t *mac, IPAddress ip);
+    static EthernetHardwareStatus hardwareStatus();
+    static EthernetLinkStatus linkStatus();
+    static IPAddress localIP();
+};
+
+extern EthernetClass Ethernet;
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "sim_hardware.h"
+
+SimCoreDebug sim_core_debug;
+SimDWT sim_dwt;
+
+static uint64_t cycle_counter_offset = 0;
+
+SimCycleCounter::operator uint32_t() const
+{
+    return static_cast<uint32_t>(sim_clock_micros() * (VARIANT_MCK / 1000000) - cycle_counter_offset);
+}
+
+SimCycleCounter &SimCycleCounter::operator=(uint32_t value)
+{
+    cycle_counter_offset = sim_clock_micros() * (VARIANT_MCK / 1000000) - value;
+    return *this;
+}
+
+SimSerial Serial;
+SimSerial SerialUSB;
+
+unsigned long millis()
+{
+    return static_cast<unsigned long>(sim_clock_micros() / 1000);
+}
+
+unsigned long micros()
+{
+    return static_cast<unsigned long>(sim_clock_micros());
+}
+
+void delay(unsigned long ms)
+{
+    for (unsigned long i = 0; i < ms; i++) {
+        sim_clock_sleep_micros(1000);
+        yield();
+    }
+}
+
+__attribute__((weak)) void yield()
+{}
+
+void delayMicroseconds(unsigned int us)
+{
+    sim_clock_sleep_micros(us);
+}
+
+void pinMode(uint32_t pin, uint32_t mode)
+{
+    sim_pin_mode(pin, mode);
+}
+
+void digitalWrite(uint32_t pin, uint32_t value)
+{
+    sim_pin_write(pin, value != LOW);
+}
+
+int digitalRead(uint32_t pin)
+{
+    return sim_pin_read(pin) ? HIGH : LOW;
+}
+
+void analogWrite(uint32_t pin, uint32_t value)
+{
+    sim_analog_write(pin, value);
+}
+
+void analogWriteResolution(int resolution)
+{}
+
+void analogReadResolution(int resolution)
+{}
+
+void attachInterrupt(uint32_t pin, void (*callback)(), uint32_t mode)
+{
+    sim_attach_interrupt(pin, callback);
+}
+
+void noInterrupts()
+{}
+
+void interrupts()
+{}
+
+void SimSerial::begin(unsigned long baud)
+{
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+    int flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+}
+
+void SimSerial::end()
+{}
+
+static int serial_peeked = -1;
+static std::string serial_injected;
+static bool serial_stdin_enabled = true;
+static void (*serial_output_handler)(const uint8_t *data, size_t length) = nullptr;
+
+void sim_serial_inject(const char *data)
+{
+    serial_injected += data;
+}
+
+void sim_serial_set_stdin_enabled(bool enable)
+{
+    serial_stdin_enabled = enable;
+}
+
+void sim_serial_set_output_handler(void (*handler)(const uint8_t *data, size_t length))
+{
+    serial_output_handler = handler;
+}
+
+int SimSerial::available()
+{
+    if (serial_peeked >= 0 || !serial_injected.empty()) {
+        return 1;
+    }
+    if (!serial_stdin_enabled) {
+        return 0;
+    }
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN) ? 1 : 0;
+}
+
+int SimSerial::read()
+{
+    if (serial_peeked >= 0) {
+        int c = serial_peeked;
+        serial_peeked = -1;
+        return c;
+    }
+    if (!serial_injected.empty()) {
+        auto c = static_cast<unsigned char>(serial_injected[0]);
+        serial_injected.erase(0, 1);
+        return c;
+    }
+    if (!serial_stdin_enabled) {
+        return -1;
+    }
+    unsigned char c;
+    return ::read(STDIN_FILENO, &c, 1) == 1 ? c : -1;
+}
+
+int SimSerial::peek()
+{
+    if (serial_peeked < 0) {
+        serial_peeked = read();
+    }
+    return serial_peeked;
+}
+
+size_t SimSerial::write(uint8_t c)
+{
+    return write(&c, 1);
+}
+
+size_t SimSerial::write(const uint8_t *buffer, size_t size)
+{
+    if (serial_output_handler != nullptr) {
+        serial_output_handler(buffer, size);
+        return size;
+    }
+    return fwrite(buffer, 1, size, stdout);
+}
+
+int SimSerial::availableForWrite()
+{
+    return 512;
+}
+
+void SimSerial::flush()
+{
+    fflush(stdout);
+}
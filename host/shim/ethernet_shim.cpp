@@ -0,0 +1,443 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Ethernet.h>
+#include <utility/w5100.h>
+
+#include "sim_hardware.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#define SIM_SOCKET_BUFFER_SIZE 2048
+
+EthernetClass Ethernet;
+W5100Class W5100;
+SPIClass SPI;
+
+enum SimSocketState {
+    SIM_SOCKET_CLOSED,
+    SIM_SOCKET_LISTEN,
+    SIM_SOCKET_ESTABLISHED,
+    SIM_SOCKET_CLOSE_WAIT
+};
+
+struct SimSocket {
+    SimSocketState state = SIM_SOCKET_CLOSED;
+    int fd = -1;
+    std::string rx;
+    std::string tx;
+    IPAddress remote_ip;
+    uint16_t remote_port = 0;
+    uint16_t local_port = 0;
+};
+
+static SimSocket sim_sockets[MAX_SOCK_NUM];
+// Even 2 KB split over the four sockets, as set by the Ethernet library
+static uint8_t w5100_tmsr = 0x55;
+static uint8_t w5100_rmsr = 0x55;
+
+static IPAddress local_ip;
+static uint16_t port_offset = 0;
+static bool network_enabled = true;
+
+static void sim_socket_service(SimSocket &s)
+{
+    if (s.state != SIM_SOCKET_ESTABLISHED && s.state != SIM_SOCKET_CLOSE_WAIT) {
+        return;
+    }
+
+    while (!s.tx.empty()) {
+        ssize_t n = send(s.fd, s.tx.data(), s.tx.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                s.tx.clear();
+                s.state = SIM_SOCKET_CLOSE_WAIT;
+            }
+            break;
+        }
+        s.tx.erase(0, static_cast<size_t>(n));
+    }
+
+    if (s.state != SIM_SOCKET_ESTABLISHED) {
+        return;
+    }
+
+    while (s.rx.size() < SIM_SOCKET_BUFFER_SIZE) {
+        char buf[SIM_SOCKET_BUFFER_SIZE];
+        ssize_t n = recv(s.fd, buf, SIM_SOCKET_BUFFER_SIZE - s.rx.size(), MSG_DONTWAIT);
+        if (n > 0) {
+            s.rx.append(buf, static_cast<size_t>(n));
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            s.state = SIM_SOCKET_CLOSE_WAIT;
+        }
+        break;
+    }
+}
+
+static int sim_socket_allocate()
+{
+    for (int i = 0; i < MAX_SOCK_NUM; i++) {
+        if (sim_sockets[i].state == SIM_SOCKET_CLOSED) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int sim_socket_find_listener(uint16_t port)
+{
+    for (int i = 0; i < MAX_SOCK_NUM; i++) {
+        if (sim_sockets[i].state == SIM_SOCKET_LISTEN && sim_sockets[i].local_port == port) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void sim_socket_listen(SimSocket &socket, int fd, uint16_t port)
+{
+    socket.state = SIM_SOCKET_LISTEN;
+    socket.fd = fd;
+    socket.local_port = port;
+}
+
+bool IPAddress::fromString(const char *address)
+{
+    unsigned int a, b, c, d;
+    char tail;
+    if (sscanf(address, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+        return false;
+    }
+    octets[0] = a;
+    octets[1] = b;
+    octets[2] = c;
+    octets[3] = d;
+    return true;
+}
+
+uint8_t EthernetClient::status()
+{
+    return sockindex < MAX_SOCK_NUM ? sim_sockets[sockindex].state : SIM_SOCKET_CLOSED;
+}
+
+int EthernetClient::connect(IPAddress ip, uint16_t port)
+{
+    return 0;
+}
+
+int EthernetClient::connect(const char *host, uint16_t port)
+{
+    return 0;
+}
+
+size_t EthernetClient::write(uint8_t b)
+{
+    return write(&b, 1);
+}
+
+size_t EthernetClient::write(const uint8_t *buf, size_t size)
+{
+    if (sockindex >= MAX_SOCK_NUM) {
+        return 0;
+    }
+    SimSocket &s = sim_sockets[sockindex];
+    if (s.state != SIM_SOCKET_ESTABLISHED) {
+        return 0;
+    }
+    // The W5100 library blocks until the chip has room: model that as an unbounded queue
+    s.tx.append(reinterpret_cast<const char *>(buf), size);
+    sim_socket_service(s);
+    return size;
+}
+
+int EthernetClient::availableForWrite()
+{
+    if (sockindex >= MAX_SOCK_NUM) {
+        return 0;
+    }
+    SimSocket &s = sim_sockets[sockindex];
+    sim_socket_service(s);
+    if (s.state != SIM_SOCKET_ESTABLISHED || s.tx.size() >= SIM_SOCKET_BUFFER_SIZE) {
+        return 0;
+    }
+    return static_cast<int>(SIM_SOCKET_BUFFER_SIZE - s.tx.size());
+}
+
+int EthernetClient::available()
+{
+    if (sockindex >= MAX_SOCK_NUM) {
+        return 0;
+    }
+    SimSocket &s = sim_sockets[sockindex];
+    sim_socket_service(s);
+    return static_cast<int>(s.rx.size());
+}
+
+int EthernetClient::read()
+{
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+}
+
+int EthernetClient::read(uint8_t *buf, size_t size)
+{
+    if (available() <= 0) {
+        return -1;
+    }
+    SimSocket &s = sim_sockets[sockindex];
+    size_t n = size < s.rx.size() ? size : s.rx.size();
+    memcpy(buf, s.rx.data(), n);
+    s.rx.erase(0, n);
+    return static_cast<int>(n);
+}
+
+int EthernetClient::peek()
+{
+    if (available() <= 0) {
+        return -1;
+    }
+    return static_cast<uint8_t>(sim_sockets[sockindex].rx[0]);
+}
+
+void EthernetClient::flush()
+{
+    if (sockindex < MAX_SOCK_NUM) {
+        sim_socket_service(sim_sockets[sockindex]);
+    }
+}
+
+void EthernetClient::stop()
+{
+    if (sockindex >= MAX_SOCK_NUM) {
+        return;
+    }
+    SimSocket &s = sim_sockets[sockindex];
+    if (s.state == SIM_SOCKET_ESTABLISHED || s.state == SIM_SOCKET_CLOSE_WAIT) {
+        sim_socket_service(s);
+        close(s.fd);
+        s = SimSocket();
+    }
+    sockindex = MAX_SOCK_NUM;
+}
+
+uint8_t EthernetClient::connected()
+{
+    if (sockindex >= MAX_SOCK_NUM) {
+        return 0;
+    }
+    SimSocket &s = sim_sockets[sockindex];
+    sim_socket_service(s);
+    return s.state == SIM_SOCKET_ESTABLISHED || (s.state == SIM_SOCKET_CLOSE_WAIT && !s.rx.empty());
+}
+
+uint16_t EthernetClient::localPort()
+{
+    return sockindex < MAX_SOCK_NUM ? sim_sockets[sockindex].local_port : 0;
+}
+
+IPAddress EthernetClient::remoteIP()
+{
+    return sockindex < MAX_SOCK_NUM ? sim_sockets[sockindex].remote_ip : IPAddress();
+}
+
+uint16_t EthernetClient::remotePort()
+{
+    return sockindex < MAX_SOCK_NUM ? sim_sockets[sockindex].remote_port : 0;
+}
+
+void sim_network_set_enabled(bool enable)
+{
+    network_enabled = enable;
+}
+
+void EthernetServer::begin()
+{
+    int s = sim_socket_allocate();
+    if (s < 0) {
+        return;
+    }
+
+    if (!network_enabled) {
+        sim_sockets[s].state = SIM_SOCKET_LISTEN;
+        sim_sockets[s].local_port = port;
+        return;
+    }
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(port + port_offset));
+
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 16) < 0) {
+        perror("sim: cannot listen");
+        close(listen_fd);
+        listen_fd = -1;
+        return;
+    }
+    fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL, 0) | O_NONBLOCK);
+
+    sim_sockets[s].state = SIM_SOCKET_LISTEN;
+    sim_sockets[s].fd = listen_fd;
+    sim_sockets[s].local_port = port;
+}
+
+EthernetClient EthernetServer::available()
+{
+    return accept();
+}
+
+EthernetClient EthernetServer::accept()
+{
+    if (listen_fd < 0) {
+        return EthernetClient();
+    }
+
+    // Like the W5100 library, the listening socket turns into the connection and the server listens
+    // again on a free hardware socket if there is one. Without one, connections wait in the host backlog.
+    int s = sim_socket_find_listener(port);
+    if (s < 0) {
+        s = sim_socket_allocate();
+        if (s < 0) {
+            return EthernetClient();
+        }
+        sim_socket_listen(sim_sockets[s], listen_fd, port);
+    }
+
+    struct sockaddr_in addr{};
+    socklen_t addr_len = sizeof(addr);
+    int fd = ::accept(listen_fd, reinterpret_cast<struct sockaddr *>(&addr), &addr_len);
+    if (fd < 0) {
+        return EthernetClient();
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int nodelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    SimSocket &socket = sim_sockets[s];
+    socket.state = SIM_SOCKET_ESTABLISHED;
+    socket.fd = fd;
+    socket.remote_ip = IPAddress(static_cast<uint32_t>(addr.sin_addr.s_addr));
+    socket.remote_port = ntohs(addr.sin_port);
+    socket.local_port = port;
+
+    int next = sim_socket_allocate();
+    if (next >= 0) {
+        sim_socket_listen(sim_sockets[next], listen_fd, port);
+    }
+
+    return EthernetClient(static_cast<uint8_t>(s));
+}
+
+void EthernetClass::init(uint8_t sspin)
+{
+    const char *offset = getenv("SIM_PORT_OFFSET");
+    if (offset != nullptr) {
+        port_offset = static_cast<uint16_t>(atoi(offset));
+    }
+}
+
+int EthernetClass::begin(uint8_t *mac, unsigned long timeout, unsigned long responseTimeout)
+{
+    return 0;
+}
+
+void EthernetClass::begin(uint8_t *mac, IPAddress ip)
+{
+    local_ip = ip;
+}
+
+EthernetHardwareStatus EthernetClass::hardwareStatus()
+{
+    return EthernetW5100;
+}
+
+EthernetLinkStatus EthernetClass::linkStatus()
+{
+    return LinkON;
+}
+
+IPAddress EthernetClass::localIP()
+{
+    return local_ip;
+}
+
+void sim_w5100_set_memory(uint8_t tmsr, uint8_t rmsr)
+{
+    w5100_tmsr = tmsr;
+    w5100_rmsr = rmsr;
+}
+
+uint8_t W5100Class::readTMSR()
+{
+    return w5100_tmsr;
+}
+
+uint8_t W5100Class::readRMSR()
+{
+    return w5100_rmsr;
+}
+
+uint8_t W5100Class::readSnSR(uint8_t s)
+{
+    if (s >= MAX_SOCK_NUM) {
+        return 0x00;
+    }
+    switch (sim_sockets[s].state) {
+        case SIM_SOCKET_LISTEN:
+            return 0x14;
+        case SIM_SOCKET_ESTABLISHED:
+            return 0x17;
+        case SIM_SOCKET_CLOSE_WAIT:
+            return 0x1C;
+        default:
+            return 0x00;
+    }
+}
+
+uint16_t W5100Class::readSnPORT(uint8_t s)
+{
+    return s < MAX_SOCK_NUM ? sim_sockets[s].local_port : 0;
+}
+
+uint16_t W5100Class::readSnTX_FSR(uint8_t s)
+{
+    if (s >= MAX_SOCK_NUM || sim_sockets[s].state == SIM_SOCKET_CLOSED) {
+        return 0;
+    }
+    size_t used = sim_sockets[s].tx.size();
+    return static_cast<uint16_t>(used < SIM_SOCKET_BUFFER_SIZE ? SIM_SOCKET_BUFFER_SIZE - used : 0);
+}
+
+uint16_t W5100Class::readSnRX_RSR(uint8_t s)
+{
+    return s < MAX_SOCK_NUM ? static_cast<uint16_t>(sim_sockets[s].rx.size()) : 0;
+}
@@ -0,0 +1,88 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Flash storage pages kept in memory and optionally in a file, replaces src/flash_storage.cpp
+
+#include <cstdio>
+
+#include "flash_storage.h"
+#include "sim_hardware.h"
+
+static uint8_t flash_pages[FLASH_STORAGE_PAGE_COUNT][FLASH_STORAGE_PAGE_SIZE];
+static bool flash_initialized = false;
+static const char *flash_file = nullptr;
+static uint32_t flash_page_writes[FLASH_STORAGE_PAGE_COUNT];
+
+static void flash_initialize()
+{
+    if (flash_initialized) {
+        return;
+    }
+    flash_initialized = true;
+    memset(flash_pages, 0xFF, sizeof(flash_pages));
+
+    if (flash_file == nullptr) {
+        return;
+    }
+    FILE *file = fopen(flash_file, "rb");
+    if (file != nullptr) {
+        size_t read = fread(flash_pages, 1, sizeof(flash_pages), file);
+        (void) read;
+        fclose(file);
+    }
+}
+
+void sim_flash_set_file(const char *path)
+{
+    flash_file = path;
+    flash_initialized = false;
+}
+
+uint32_t sim_flash_page_writes(uint32_t index)
+{
+    return (index < FLASH_STORAGE_PAGE_COUNT) ? flash_page_writes[index] : 0;
+}
+
+const uint8_t *FlashStorage::page(uint32_t index)
+{
+    flash_initialize();
+    return flash_pages[index];
+}
+
+bool FlashStorage::write_page(uint32_t index, const uint8_t *data)
+{
+    if (index >= FLASH_STORAGE_PAGE_COUNT) {
+        return false;
+    }
+    flash_initialize();
+
+    memcpy(flash_pages[index], data, FLASH_STORAGE_PAGE_SIZE);
+    flash_page_writes[index]++;
+
+    if (flash_file != nullptr) {
+        FILE *file = fopen(flash_file, "wb");
+        if (file == nullptr) {
+            return false;
+        }
+        bool written = fwrite(flash_pages, 1, sizeof(flash_pages), file) == sizeof(flash_pages);
+        fclose(file);
+        return written;
+    }
+
+    return true;
+}
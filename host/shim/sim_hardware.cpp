@@ -0,0 +1,141 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Arduino.h>
+
+#include <chrono>
+#include <thread>
+
+#include "sim_hardware.h"
+
+struct SimPin {
+    uint32_t mode = INPUT;
+    bool level = false;
+    uint32_t output_changes = 0;
+    uint32_t analog_value = 0;
+    void (*interrupt)() = nullptr;
+};
+
+static SimPin sim_pins[SIM_PIN_COUNT];
+
+static bool clock_virtual = false;
+static uint64_t clock_virtual_us = 0;
+static void (*clock_sleep_hook)(uint64_t now_us) = nullptr;
+
+static uint64_t real_clock_micros()
+{
+    static const auto start = std::chrono::steady_clock::now();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+}
+
+void sim_clock_set_virtual(bool enable)
+{
+    clock_virtual = enable;
+}
+
+bool sim_clock_is_virtual()
+{
+    return clock_virtual;
+}
+
+uint64_t sim_clock_micros()
+{
+    return clock_virtual ? clock_virtual_us : real_clock_micros();
+}
+
+void sim_clock_advance_micros(uint64_t us)
+{
+    clock_virtual_us += us;
+}
+
+void sim_clock_set_sleep_hook(void (*hook)(uint64_t now_us))
+{
+    clock_sleep_hook = hook;
+}
+
+void sim_clock_sleep_micros(uint64_t us)
+{
+    if (clock_virtual) {
+        clock_virtual_us += us;
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+    if (clock_sleep_hook != nullptr) {
+        clock_sleep_hook(sim_clock_micros());
+    }
+}
+
+void sim_pin_mode(uint32_t pin, uint32_t mode)
+{
+    if (pin >= SIM_PIN_COUNT) {
+        return;
+    }
+    sim_pins[pin].mode = mode;
+}
+
+void sim_pin_write(uint32_t pin, bool level)
+{
+    if (pin >= SIM_PIN_COUNT) {
+        return;
+    }
+    if (sim_pins[pin].level != level) {
+        sim_pins[pin].output_changes++;
+    }
+    sim_pins[pin].level = level;
+}
+
+bool sim_pin_read(uint32_t pin)
+{
+    return pin < SIM_PIN_COUNT && sim_pins[pin].level;
+}
+
+void sim_pin_set_input(uint32_t pin, bool level)
+{
+    if (pin >= SIM_PIN_COUNT || sim_pins[pin].level == level) {
+        return;
+    }
+    sim_pins[pin].level = level;
+    if (sim_pins[pin].interrupt != nullptr) {
+        sim_pins[pin].interrupt();
+    }
+}
+
+uint32_t sim_pin_output_changes(uint32_t pin)
+{
+    return pin < SIM_PIN_COUNT ? sim_pins[pin].output_changes : 0;
+}
+
+void sim_analog_write(uint32_t pin, uint32_t value)
+{
+    if (pin < SIM_PIN_COUNT) {
+        sim_pins[pin].analog_value = value;
+    }
+}
+
+uint32_t sim_analog_read_output(uint32_t pin)
+{
+    return pin < SIM_PIN_COUNT ? sim_pins[pin].analog_value : 0;
+}
+
+void sim_attach_interrupt(uint32_t pin, void (*callback)())
+{
+    if (pin < SIM_PIN_COUNT) {
+        sim_pins[pin].interrupt = callback;
+    }
+}
@@ -0,0 +1,61 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Simulated board hardware: clock, GPIO pins, DAC and pin interrupts
+
+#ifndef OH3AAROT_HOST_SIM_HARDWARE_H
+#define OH3AAROT_HOST_SIM_HARDWARE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Clock: real time by default, virtual time when enabled
+void sim_clock_set_virtual(bool enable);
+bool sim_clock_is_virtual();
+uint64_t sim_clock_micros();
+void sim_clock_advance_micros(uint64_t us);
+void sim_clock_sleep_micros(uint64_t us);
+
+// Called whenever simulated time moves forward inside delay()
+void sim_clock_set_sleep_hook(void (*hook)(uint64_t now_us));
+
+void sim_pin_mode(uint32_t pin, uint32_t mode);
+void sim_pin_write(uint32_t pin, bool level);
+bool sim_pin_read(uint32_t pin);
+void sim_pin_set_input(uint32_t pin, bool level);
+uint32_t sim_pin_output_changes(uint32_t pin);
+void sim_analog_write(uint32_t pin, uint32_t value);
+uint32_t sim_analog_read_output(uint32_t pin);
+void sim_attach_interrupt(uint32_t pin, void (*callback)());
+
+// Serial console: input queued by the simulation is read before the standard input
+void sim_serial_inject(const char *data);
+void sim_serial_set_stdin_enabled(bool enable);
+// Output goes to the handler instead of the standard output when set
+void sim_serial_set_output_handler(void (*handler)(const uint8_t *data, size_t length));
+
+// Without network the TCP servers do not open any host sockets
+void sim_network_set_enabled(bool enable);
+// W5100 socket memory split as read back from TMSR and RMSR, the even split by default
+void sim_w5100_set_memory(uint8_t tmsr, uint8_t rmsr);
+
+// Flash storage persists in the file when set, otherwise only for the lifetime of the process
+void sim_flash_set_file(const char *path);
+uint32_t sim_flash_page_writes(uint32_t index);
+
+#endif
@@ -0,0 +1,182 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host shim for tc_lib capture objects. Pulses are injected by the simulation
+// instead of being measured by the SAM3X timer counter.
+
+#ifndef OH3AAROT_HOST_TC_LIB_H
+#define OH3AAROT_HOST_TC_LIB_H
+
+#include <Arduino.h>
+#include <cstdint>
+
+#define capture_tc_declaration(id) \
+void TC##id##_Handler(void) \
+{ \
+  uint32_t status = TC_GetStatus( \
+    arduino_due::tc_lib::tc_info<arduino_due::tc_lib::timer_ids::TIMER_TC##id>::tc_p(), \
+    arduino_due::tc_lib::tc_info<arduino_due::tc_lib::timer_ids::TIMER_TC##id>::channel); \
+  arduino_due::tc_lib::capture<arduino_due::tc_lib::timer_ids::TIMER_TC##id>::tc_interrupt(status); \
+} \
+\
+typedef arduino_due::tc_lib::capture< \
+  arduino_due::tc_lib::timer_ids::TIMER_TC##id \
+> capture_tc##id##_t; \
+\
+capture_tc##id##_t capture_tc##id;
+
+#define capture_tc0_declaration() capture_tc_declaration(0)
+#define capture_tc1_declaration() capture_tc_declaration(1)
+
+namespace arduino_due {
+namespace tc_lib {
+struct Tc;
+}
+}
+
+inline uint32_t TC_GetStatus(arduino_due::tc_lib::Tc *tc, uint32_t channel)
+{
+    return 0;
+}
+
+// Injected pulses arrive at the capture edge, so the counter has not advanced past it
+inline uint32_t TC_ReadCV(arduino_due::tc_lib::Tc *tc, uint32_t channel)
+{
+    return 0;
+}
+
+namespace arduino_due {
+namespace tc_lib {
+
+using callback_t = void (*)(void *);
+
+enum class timer_ids : uint32_t {
+    TIMER_TC0 = 0,
+    TIMER_TC1 = 1,
+    TIMER_TC2 = 2,
+    TIMER_TC3 = 3,
+    TIMER_TC4 = 4,
+    TIMER_TC5 = 5,
+    TIMER_TC6 = 6,
+    TIMER_TC7 = 7,
+    TIMER_TC8 = 8,
+};
+
+struct Tc {
+};
+
+template<timer_ids TIMER>
+struct tc_info {
+    static constexpr const uint32_t channel = static_cast<uint32_t>(TIMER) % 3;
+
+    static Tc *tc_p()
+    {
+        static Tc tc;
+        return &tc;
+    }
+};
+
+template<timer_ids TIMER>
+class capture {
+public:
+    static constexpr const uint32_t DEFAULT_MAX_OVERRUNS = 100;
+
+    enum status_codes : uint32_t {
+        UNSET = 0,
+        SET = 1,
+        OVERRUN = 2,
+        STOPPED = 4
+    };
+
+    capture() = default;
+    capture(const capture &) = delete;
+    capture &operator=(const capture &) = delete;
+
+    bool config(uint32_t the_capture_window, uint32_t the_overruns = DEFAULT_MAX_OVERRUNS)
+    {
+        capture_window = the_capture_window;
+        status = SET;
+        return true;
+    }
+
+    // Pulses are injected directly, the interrupt handler has nothing to do
+    static void tc_interrupt(uint32_t the_status)
+    {}
+
+    static constexpr uint32_t ticks_per_usec()
+    { return 42; }
+
+    uint32_t get_duty_and_period(uint32_t &the_duty, uint32_t &the_period)
+    {
+        uint32_t the_status = status;
+        // The capture stops when no pulse arrives within the capture window (microseconds)
+        if (pulses > 0 && micros() - pulse_time > capture_window) {
+            the_status |= STOPPED;
+        }
+        the_duty = duty;
+        the_period = period;
+        status &= ~OVERRUN;
+        return the_status;
+    }
+
+    uint32_t get_capture_window()
+    { return capture_window; }
+
+    using pulse_callback_t = void (*)(uint32_t, uint32_t);
+
+    void set_pulse_callback(pulse_callback_t the_callback)
+    { pulse_callback = the_callback; }
+
+    bool is_overrun(uint32_t the_status)
+    { return the_status & OVERRUN; }
+
+    bool is_stopped(uint32_t the_status)
+    { return the_status & STOPPED; }
+
+    bool is_unset(uint32_t the_status)
+    { return !the_status; }
+
+    // Simulation: a complete pulse was captured
+    void inject_pulse(uint32_t the_duty, uint32_t the_period)
+    {
+        duty = the_duty;
+        period = the_period;
+        pulse_time = micros();
+        pulses++;
+        if (pulse_callback != nullptr) {
+            pulse_callback(the_duty, the_period);
+        }
+    }
+
+    void inject_overrun()
+    { status |= OVERRUN; }
+
+private:
+    volatile uint32_t duty = 0;
+    volatile uint32_t period = 0;
+    volatile uint32_t pulses = 0;
+    volatile unsigned long pulse_time = 0;
+    volatile uint32_t status = UNSET;
+    uint32_t capture_window = 0;
+    pulse_callback_t pulse_callback = nullptr;
+};
+
+}
+}
+
+#endif
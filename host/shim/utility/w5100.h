@@ -0,0 +1,59 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Host shim for the W5100 driver header of the Arduino Ethernet library
+
+#ifndef OH3AAROT_HOST_W5100_H
+#define OH3AAROT_HOST_W5100_H
+
+#include <Ethernet.h>
+
+struct SPISettings {
+};
+
+class SPIClass {
+public:
+    void beginTransaction(SPISettings settings)
+    {}
+
+    void endTransaction()
+    {}
+};
+
+extern SPIClass SPI;
+
+#define SPI_ETHERNET_SETTINGS SPISettings()
+
+// Register model of the W5100: the socket memory split set by the library at init and socket status
+// registers that follow the simulated sockets
+class W5100Class {
+public:
+    static uint8_t getChip()
+    { return 51; }
+
+    static uint8_t readTMSR();
+    static uint8_t readRMSR();
+    static uint8_t readSnSR(uint8_t s);
+    static uint16_t readSnPORT(uint8_t s);
+    static uint16_t readSnTX_FSR(uint8_t s);
+    static uint16_t readSnRX_RSR(uint8_t s);
+};
+
+extern W5100Class W5100;
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "rotator_model.h"
+
+#include <Arduino.h>
+#include <tc_lib.h>
+#include <cmath>
+
+#include "config.h"
+#include "sim_hardware.h"
+
+// MA3 10-bit PWM output: 1025 us period, pulse width of position code + 1 us
+#define MA3_PERIOD_US 1025
+#define MA3_RESOLUTION 1024
+
+#define MODEL_MAX_STEP_US 1000
+
+typedef arduino_due::tc_lib::capture<arduino_due::tc_lib::timer_ids::TIMER_TC0> capture_tc0_t;
+
+extern capture_tc0_t capture_tc0;
+void TC0_Handler(void);
+
+static void send_azimuth_pulse(uint32_t duty, uint32_t period)
+{
+    capture_tc0.inject_pulse(duty, period);
+    TC0_Handler();
+}
+
+const RotatorModelAxis ROTATOR_MODEL_AZIMUTH = {
+        PIN_CW, PIN_CCW, PIN_THRESHOLD_1, PIN_THRESHOLD_2, PIN_LIMIT_1, PIN_LIMIT_2, PIN_SPEED,
+        AZIMUTH_MINIMUM, AZIMUTH_MAXIMUM, ROTATOR_AZIMUTH_OFFSET_DEGREES, send_azimuth_pulse
+};
+
+#if ELEVATION_AXIS_ENABLED
+typedef arduino_due::tc_lib::capture<arduino_due::tc_lib::timer_ids::TIMER_TC6> capture_tc6_t;
+
+extern capture_tc6_t capture_tc6;
+void TC6_Handler(void);
+
+static void send_elevation_pulse(uint32_t duty, uint32_t period)
+{
+    capture_tc6.inject_pulse(duty, period);
+    TC6_Handler();
+}
+
+const RotatorModelAxis ROTATOR_MODEL_ELEVATION = {
+        PIN_EL_UP, PIN_EL_DOWN, -1, -1, PIN_EL_LIMIT_1, PIN_EL_LIMIT_2, PIN_EL_SPEED,
+        ELEVATION_MINIMUM, ELEVATION_MAXIMUM, ROTATOR_ELEVATION_OFFSET_DEGREES, send_elevation_pulse
+};
+#endif
+
+RotatorModel::RotatorModel(const RotatorModelConfig &model_config, const RotatorModelAxis &model_axis)
+        : config(model_config), axis(model_axis), position(model_config.position)
+{}
+
+void RotatorModel::update(uint64_t now_us)
+{
+    if (!started) {
+        started = true;
+        last_update_us = now_us;
+        next_pulse_us = now_us;
+        start_us = now_us;
+        update_switches();
+    }
+
+    while (last_update_us < now_us) {
+        uint64_t step_us = now_us - last_update_us;
+        if (step_us > MODEL_MAX_STEP_US) {
+            step_us = MODEL_MAX_STEP_US;
+        }
+        last_update_us += step_us;
+
+        step(static_cast<double>(step_us) / 1e6);
+        update_switches();
+
+        bool encoder_lost = config.encoder_loss_time > 0
+                            && last_update_us - start_us >= static_cast<uint64_t>(config.encoder_loss_time * 1e6);
+        if (last_update_us >= next_pulse_us) {
+            if (!encoder_lost) {
+                send_encoder_pulse();
+            }
+            next_pulse_us += MA3_PERIOD_US * ((last_update_us - next_pulse_us) / MA3_PERIOD_US + 1);
+        }
+    }
+}
+
+void RotatorModel::step(double dt)
+{
+    bool cw = sim_pin_read(axis.cw);
+    bool ccw = sim_pin_read(axis.ccw);
+    double speed = static_cast<double>(sim_analog_read_output(axis.speed)) / 4095.0;
+
+    double target_rate = 0;
+    if (cw != ccw) {
+        target_rate = (config.min_rate + (config.max_rate - config.min_rate) * speed) * (cw ? 1 : -1);
+    }
+
+    rate += (target_rate - rate) * (1 - exp(-dt / config.time_constant));
+    position += rate * dt;
+
+    double minimum = axis.minimum - config.end_stop_margin;
+    double maximum = axis.maximum + config.end_stop_margin;
+    if (position < minimum) {
+        position = minimum;
+        rate = 0;
+    } else if (position > maximum) {
+        position = maximum;
+        rate = 0;
+    }
+}
+
+void RotatorModel::update_switches()
+{
+    if (axis.threshold_1 >= 0) {
+        sim_pin_set_input(axis.threshold_1, position < 0);
+        sim_pin_set_input(axis.threshold_2, position > 360);
+    }
+    sim_pin_set_input(axis.limit_1, position <= axis.minimum);
+    sim_pin_set_input(axis.limit_2, position >= axis.maximum);
+}
+
+void RotatorModel::send_encoder_pulse()
+{
+    double angle = fmod(position - axis.offset + config.encoder_offset, 360);
+    if (angle < 0) {
+        angle += 360;
+    }
+    angle = fmod(angle + config.encoder_error * sin(angle * M_PI / 180) + 360, 360);
+
+    auto code = static_cast<uint32_t>(angle / 360 * MA3_RESOLUTION) % MA3_RESOLUTION;
+    uint32_t ticks_per_usec = capture_tc0_t::ticks_per_usec();
+
+    axis.send_pulse((code + 1) * ticks_per_usec, MA3_PERIOD_US * ticks_per_usec);
+}
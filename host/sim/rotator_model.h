@@ -0,0 +1,93 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Physics model of a rotator axis, the MA3 encoder and the threshold and limit switches
+
+#ifndef OH3AAROT_HOST_ROTATOR_MODEL_H
+#define OH3AAROT_HOST_ROTATOR_MODEL_H
+
+#include <cstdint>
+
+#include "config.h"
+
+struct RotatorModelConfig {
+    double position = 0; // degrees, initial position
+    double min_rate = 0.5; // degrees per second at the lowest speed voltage
+    double max_rate = 6.0; // degrees per second at the highest speed voltage
+    double time_constant = 0.3; // seconds, motor spin-up and coasting
+    double end_stop_margin = 5.0; // degrees beyond the limit switches
+    double encoder_offset = 0; // degrees added to the encoder angle
+    double encoder_error = 0; // degrees, amplitude of a once per turn nonlinearity of the encoder
+    double encoder_loss_time = 0; // seconds after the start when the encoder stops sending pulses, 0 never
+};
+
+/**
+ * Board pins and encoder capture of one axis. Axes without threshold switches use -1 for them.
+ */
+struct RotatorModelAxis {
+    int cw;
+    int ccw;
+    int threshold_1; // active below 0 degrees
+    int threshold_2; // active above 360 degrees
+    int limit_1;
+    int limit_2;
+    int speed;
+    double minimum; // limit switch positions
+    double maximum;
+    double offset; // firmware offset subtracted from the position for the encoder angle
+    void (*send_pulse)(uint32_t duty, uint32_t period);
+};
+
+extern const RotatorModelAxis ROTATOR_MODEL_AZIMUTH;
+#if ELEVATION_AXIS_ENABLED
+extern const RotatorModelAxis ROTATOR_MODEL_ELEVATION;
+#endif
+
+/**
+ * Reads the relay outputs and the speed DAC of the simulated board, moves the rotator and feeds
+ * the MA3 encoder PWM to the timer capture and the switch levels to the input pins of the axis.
+ */
+class RotatorModel {
+private:
+    RotatorModelConfig config;
+    RotatorModelAxis axis;
+    double position;
+    double rate = 0;
+    uint64_t last_update_us = 0;
+    uint64_t next_pulse_us = 0;
+    uint64_t start_us = 0;
+    bool started = false;
+
+    void step(double dt);
+    void update_switches();
+    void send_encoder_pulse();
+
+public:
+    explicit RotatorModel(const RotatorModelConfig &model_config,
+            const RotatorModelAxis &model_axis = ROTATOR_MODEL_AZIMUTH);
+
+    void update(uint64_t now_us);
+
+    double get_position() const
+    { return position; }
+
+    double get_rate() const
+    { return rate; }
+};
+
+#endif
@@ -0,0 +1,125 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Runs the controller firmware on the host against the simulated board and rotator.
+//
+// The native protocol and rotctld servers listen on their usual ports, shifted by the
+// SIM_PORT_OFFSET environment variable. The serial console is the standard input and output.
+
+#include <Arduino.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "sim_hardware.h"
+#include "rotator_model.h"
+
+#define SIM_LOOP_INTERVAL_US 100
+
+void setup();
+void loop();
+
+static RotatorModel *model;
+static RotatorModel *elevation_model;
+
+static void update_model(uint64_t now_us)
+{
+    model->update(now_us);
+    if (elevation_model != nullptr) {
+        elevation_model->update(now_us);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --virtual-time         run on simulated time instead of the wall clock\n"
+            "  --duration SECONDS     exit after the given (simulated) time\n"
+            "  --azimuth DEGREES      initial rotator azimuth\n"
+            "  --elevation DEGREES    initial rotator elevation\n"
+            "  --min-rate DEG_PER_S   rotation rate at the lowest speed setting\n"
+            "  --max-rate DEG_PER_S   rotation rate at the highest speed setting\n"
+            "  --time-constant S      motor spin-up and coasting time constant\n"
+            "  --encoder-error DEG    amplitude of a once per turn encoder nonlinearity\n"
+            "  --encoder-loss SECONDS stop the azimuth encoder pulses after the given time\n"
+            "  --flash FILE           keep the settings flash pages in the file\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    RotatorModelConfig config;
+    double elevation = 0;
+    bool virtual_time = false;
+    double duration = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i];
+        bool has_value = (i + 1 < argc);
+
+        if (strcmp(option, "--virtual-time") == 0) {
+            virtual_time = true;
+        } else if (strcmp(option, "--duration") == 0 && has_value) {
+            duration = atof(argv[++i]);
+        } else if (strcmp(option, "--azimuth") == 0 && has_value) {
+            config.position = atof(argv[++i]);
+        } else if (strcmp(option, "--elevation") == 0 && has_value) {
+            elevation = atof(argv[++i]);
+        } else if (strcmp(option, "--min-rate") == 0 && has_value) {
+            config.min_rate = atof(argv[++i]);
+        } else if (strcmp(option, "--max-rate") == 0 && has_value) {
+            config.max_rate = atof(argv[++i]);
+        } else if (strcmp(option, "--time-constant") == 0 && has_value) {
+            config.time_constant = atof(argv[++i]);
+        } else if (strcmp(option, "--encoder-error") == 0 && has_value) {
+            config.encoder_error = atof(argv[++i]);
+        } else if (strcmp(option, "--encoder-loss") == 0 && has_value) {
+            config.encoder_loss_time = atof(argv[++i]);
+        } else if (strcmp(option, "--flash") == 0 && has_value) {
+            sim_flash_set_file(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    sim_clock_set_virtual(virtual_time);
+
+    model = new RotatorModel(config);
+    model->update(sim_clock_micros());
+#if ELEVATION_AXIS_ENABLED
+    RotatorModelConfig elevation_config = config;
+    elevation_config.position = elevation;
+    elevation_config.encoder_loss_time = 0;
+    elevation_model = new RotatorModel(elevation_config, ROTATOR_MODEL_ELEVATION);
+    elevation_model->update(sim_clock_micros());
+#endif
+    sim_clock_set_sleep_hook(update_model);
+
+    auto end_us = static_cast<uint64_t>(duration * 1e6);
+
+    setup();
+    while (duration <= 0 || sim_clock_micros() < end_us) {
+        loop();
+        delayMicroseconds(SIM_LOOP_INTERVAL_US);
+    }
+
+    return 0;
+}
@@ -0,0 +1,329 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Connection admission of the booted firmware: which network client is evicted or refused when a new
+// connection arrives and all client slots are taken. Connects to the native protocol server of the
+// ethernet shim over localhost while running the firmware on the virtual clock.
+//
+//   client_admission_test SCENARIO
+//
+// Scenarios: monitor, refused-monitor, pollers, rejection. The servers listen on the usual ports
+// shifted by SIM_PORT_OFFSET, or by an offset derived from the process id when it is not set.
+
+#include <Arduino.h>
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "network_startup.h"
+#include "sim_hardware.h"
+#include "rotator_model.h"
+
+#define ADMISSION_LOOP_INTERVAL_US 100
+#define ADMISSION_BOOT_TIME_US 1000000
+#define ADMISSION_CONNECT_SPACING_US 10000 // Apart in connected time, so that the oldest is well defined
+#define ADMISSION_TIMEOUT_US 2000000
+#define ADMISSION_PORT_OFFSET_BASE 30000
+#define ADMISSION_PORT_OFFSET_RANGE 20000
+
+void setup();
+void loop();
+
+extern NetworkStartup network_startup;
+
+static RotatorModel *model;
+static RotatorModel *elevation_model;
+static uint16_t port_offset;
+static int failures = 0;
+
+static void update_model(uint64_t now_us)
+{
+    model->update(now_us);
+    if (elevation_model != nullptr) {
+        elevation_model->update(now_us);
+    }
+}
+
+static void discard_output(const uint8_t *data, size_t length)
+{
+}
+
+static void run_for(uint64_t duration_us)
+{
+    uint64_t end_us = sim_clock_micros() + duration_us;
+    while (sim_clock_micros() < end_us) {
+        loop();
+        delayMicroseconds(ADMISSION_LOOP_INTERVAL_US);
+    }
+}
+
+/**
+ * A test client of the native protocol. Replies are read while the firmware runs.
+ */
+class Connection {
+private:
+    const char *name;
+    int fd = -1;
+    std::string received;
+    bool closed = false;
+
+    void receive()
+    {
+        char buffer[512];
+        while (!closed) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n > 0) {
+                received.append(buffer, static_cast<size_t>(n));
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                closed = true;
+            }
+            break;
+        }
+    }
+
+    bool read_line(std::string &line)
+    {
+        uint64_t end_us = sim_clock_micros() + ADMISSION_TIMEOUT_US;
+
+        while (true) {
+            receive();
+            size_t end = received.find('\n');
+            if (end != std::string::npos) {
+                line = received.substr(0, end);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                received.erase(0, end + 1);
+                return true;
+            }
+            if (closed || sim_clock_micros() >= end_us) {
+                return false;
+            }
+            run_for(ADMISSION_LOOP_INTERVAL_US);
+        }
+    }
+
+public:
+    explicit Connection(const char *connection_name)
+    {
+        name = connection_name;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<uint16_t>(SERVER_TCP_PORT + port_offset));
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+            printf("%s: cannot connect: %s\n", name, strerror(errno));
+            failures++;
+            closed = true;
+        }
+        run_for(ADMISSION_CONNECT_SPACING_US);
+    }
+
+    ~Connection()
+    {
+        close(fd);
+    }
+
+    void send_line(const char *line)
+    {
+        std::string data = std::string(line) + "\n";
+        if (!closed && ::send(fd, data.data(), data.size(), MSG_NOSIGNAL) < 0) {
+            closed = true;
+        }
+    }
+
+    /**
+     * Expects the next reply, skipping pushed STATE lines, to start with the given text.
+     */
+    bool expect(const char *prefix)
+    {
+        std::string line;
+        while (read_line(line)) {
+            if (line.compare(0, 9, "OK STATE ") == 0) {
+                continue;
+            }
+            if (line.compare(0, strlen(prefix), prefix) == 0) {
+                return true;
+            }
+            printf("%s: expected '%s', got '%s'\n", name, prefix, line.c_str());
+            failures++;
+            return false;
+        }
+
+        printf("%s: expected '%s', got %s\n", name, prefix, closed ? "the connection closed" : "nothing");
+        failures++;
+        return false;
+    }
+
+    bool command(const char *line, const char *reply_prefix)
+    {
+        send_line(line);
+        return expect(reply_prefix);
+    }
+
+    void expect_closed()
+    {
+        std::string line;
+        while (read_line(line)) {
+            if (line.compare(0, 9, "OK STATE ") != 0) {
+                printf("%s: expected the connection to close, got '%s'\n", name, line.c_str());
+                failures++;
+                return;
+            }
+        }
+        if (!closed) {
+            printf("%s: expected the connection to close\n", name);
+            failures++;
+        }
+    }
+};
+
+// A newer monitor-only client is evicted before an older poller
+static void scenario_monitor()
+{
+    Connection poller("poller");
+    poller.command("AZ?", "OK AZ");
+    Connection monitor("monitor");
+    monitor.command("MONITOR 1", "OK MONITOR 1");
+
+    Connection newcomer("newcomer");
+    monitor.expect("ERROR EVICTED: TOO MANY CONNECTIONS, POLL STATE INSTEAD");
+    monitor.expect_closed();
+    newcomer.command("AZ?", "OK AZ");
+    poller.command("AZ?", "OK AZ");
+}
+
+// The reserved slot refuses a second monitor, which is then evicted as a poller after the monitor
+static void scenario_refused_monitor()
+{
+    Connection monitor("monitor");
+    monitor.command("MONITOR 1", "OK MONITOR 1");
+    Connection second("second monitor");
+    second.command("MONITOR 1", "ERROR TOO MANY MONITORS");
+
+    Connection newcomer("newcomer");
+    monitor.expect("ERROR EVICTED: TOO MANY CONNECTIONS, POLL STATE INSTEAD");
+    monitor.expect_closed();
+    newcomer.command("AZ?", "OK AZ");
+
+    Connection last("last");
+    second.expect("ERROR EVICTED: TOO MANY CONNECTIONS");
+    second.expect_closed();
+    last.command("AZ?", "OK AZ");
+    newcomer.command("AZ?", "OK AZ");
+}
+
+// Pollers make way for a commander oldest first, the commander is kept
+static void scenario_pollers()
+{
+    Connection first("first poller");
+    first.command("TRACKING?", "OK TRACKING");
+    Connection second("second poller");
+    second.command("AZ?", "OK AZ");
+
+    Connection commander("commander");
+    first.expect("ERROR EVICTED: TOO MANY CONNECTIONS");
+    first.expect_closed();
+    commander.command("STOP", "OK STOP");
+
+    Connection newcomer("newcomer");
+    second.expect("ERROR EVICTED: TOO MANY CONNECTIONS");
+    second.expect_closed();
+    newcomer.command("AZ?", "OK AZ");
+    commander.command("AZ?", "OK AZ");
+}
+
+// With every slot held by a commander a new connection is refused
+static void scenario_rejection()
+{
+    Connection first("first commander");
+    first.command("STOP", "OK STOP");
+    Connection second("second commander");
+    second.command("AZ 10", "OK AZ");
+
+    Connection refused("refused");
+    refused.expect("ERROR: TOO MANY CONNECTIONS");
+    refused.expect_closed();
+    first.command("AZ?", "OK AZ");
+    second.command("AZ?", "OK AZ");
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        void (*run)();
+    } scenarios[] = {
+            {"monitor", scenario_monitor},
+            {"refused-monitor", scenario_refused_monitor},
+            {"pollers", scenario_pollers},
+            {"rejection", scenario_rejection},
+    };
+
+    void (*scenario)() = nullptr;
+    for (auto &candidate : scenarios) {
+        if (argc == 2 && strcmp(argv[1], candidate.name) == 0) {
+            scenario = candidate.run;
+        }
+    }
+    if (scenario == nullptr) {
+        fprintf(stderr, "Usage: %s monitor|refused-monitor|pollers|rejection\n", argv[0]);
+        return 1;
+    }
+
+    if (getenv("SIM_PORT_OFFSET") == nullptr) {
+        char offset[16];
+        snprintf(offset, sizeof(offset), "%d", ADMISSION_PORT_OFFSET_BASE + getpid() % ADMISSION_PORT_OFFSET_RANGE);
+        setenv("SIM_PORT_OFFSET", offset, 1);
+    }
+    port_offset = static_cast<uint16_t>(atoi(getenv("SIM_PORT_OFFSET")));
+
+    sim_clock_set_virtual(true);
+    sim_serial_set_stdin_enabled(false);
+    sim_serial_set_output_handler(discard_output);
+
+    RotatorModelConfig config;
+    model = new RotatorModel(config);
+#if ELEVATION_AXIS_ENABLED
+    elevation_model = new RotatorModel(config, ROTATOR_MODEL_ELEVATION);
+#endif
+    sim_clock_set_sleep_hook(update_model);
+
+    setup();
+    run_for(ADMISSION_BOOT_TIME_US);
+    if (!network_startup.is_ready()) {
+        printf("The servers are not listening\n");
+        return 1;
+    }
+
+    scenario();
+
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// The MA3 transfer function of encoder_fraction() at the ENCODER_RESOLUTION the test is built with,
+// against the data sheet formula for every position code and at the spec points, its clamping of
+// pulses outside the period, and the interpolation of EncoderCorrection::apply() between the knots,
+// around the turn and between the last and the first knot.
+
+#include <Arduino.h>
+
+#include <cmath>
+#include <cstdio>
+
+#include "encoder_correction.h"
+
+#define CORRECTION_TICKS_PER_USEC 42
+#define CORRECTION_PERIOD ((ENCODER_RESOLUTION + 1) * CORRECTION_TICKS_PER_USEC) // One code per microsecond
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line)
+{
+    if (!condition) {
+        printf("line %d: check failed: %s\n", line, text);
+        failures++;
+    }
+}
+
+static uint32_t duty_us(double us)
+{
+    return (uint32_t) lround(us * CORRECTION_TICKS_PER_USEC);
+}
+
+static double degrees(int32_t fraction)
+{
+    return fraction * 360.0 / (1 << ENCODER_POSITION_FRACTION_BITS);
+}
+
+static void test_spec_points()
+{
+    // A 1 us pulse is 0 degrees and the longest pulse is the last position code
+    CHECK(encoder_fraction(duty_us(1), CORRECTION_PERIOD) == 0);
+
+    double last_degrees = (ENCODER_RESOLUTION - 1) * 360.0 / ENCODER_RESOLUTION;
+    int32_t last = encoder_fraction(duty_us(ENCODER_RESOLUTION - 1), CORRECTION_PERIOD);
+    CHECK(fabs(degrees(last) - last_degrees) < 360.0 / (1 << ENCODER_POSITION_FRACTION_BITS));
+#if ENCODER_RESOLUTION == 1024
+    CHECK(fabs(degrees(last) - 359.65) < 0.01);
+#elif ENCODER_RESOLUTION == 4096
+    CHECK(fabs(degrees(last) - 359.91) < 0.01);
+#endif
+}
+
+static void test_transfer_function()
+{
+    // x = duty * (N + 2) / period - 1 for every position code, also with a period off by a few ticks
+    const int32_t period_errors[] = {0, -3, 5};
+    for (int32_t period_error : period_errors) {
+        uint32_t period = CORRECTION_PERIOD + period_error;
+        int32_t previous = 0;
+
+        for (uint32_t code = 0; code < ENCODER_RESOLUTION; code++) {
+            uint32_t duty = duty_us(code + 1);
+            double x = (double) duty * (ENCODER_RESOLUTION + 2) / period - 1;
+            double expected = x * (1 << ENCODER_POSITION_FRACTION_BITS) / ENCODER_RESOLUTION;
+            expected = fmin(fmax(expected, 0), ENCODER_POSITION_MASK);
+
+            int32_t fraction = encoder_fraction(duty, period);
+            CHECK(fabs(fraction - expected) <= 1);
+            CHECK(fraction >= previous);
+            previous = fraction;
+        }
+    }
+}
+
+static void test_clamping()
+{
+    CHECK(encoder_fraction(0, CORRECTION_PERIOD) == 0);
+    CHECK(encoder_fraction(duty_us(0.5), CORRECTION_PERIOD) == 0);
+    CHECK(encoder_fraction(CORRECTION_PERIOD, CORRECTION_PERIOD) == ENCODER_POSITION_MASK);
+    CHECK(encoder_fraction(CORRECTION_PERIOD - 1, CORRECTION_PERIOD) == ENCODER_POSITION_MASK);
+    CHECK(encoder_fraction(2 * CORRECTION_PERIOD, CORRECTION_PERIOD) == ENCODER_POSITION_MASK);
+    CHECK(encoder_fraction(duty_us(100), 0) == 0);
+}
+
+static EncoderCorrectionTable table_of(uint16_t knot_count, int16_t value)
+{
+    EncoderCorrectionTable table{};
+    table.knot_count = knot_count;
+    for (uint16_t i = 0; i < knot_count; i++) {
+        table.values[i] = value;
+    }
+    return table;
+}
+
+static void test_apply()
+{
+    EncoderCorrection correction;
+
+    // Disabled until a valid table is set
+    CHECK(correction.apply(1234) == 1234);
+    correction.set_table(table_of(12, 160));
+    CHECK(correction.apply(1234) == 1234);
+    correction.set_table(table_of(ENCODER_CORRECTION_MIN_KNOTS / 2, 160));
+    CHECK(correction.apply(1234) == 1234);
+
+    // A constant correction of 10 positions (160 / 2^4), wrapping around the turn both ways
+    correction.set_table(table_of(ENCODER_CORRECTION_MAX_KNOTS, 160));
+    CHECK(correction.apply(1234) == 1244);
+    CHECK(correction.apply(4090) == 4);
+    correction.set_table(table_of(ENCODER_CORRECTION_MIN_KNOTS, -160));
+    CHECK(correction.apply(1234) == 1224);
+    CHECK(correction.apply(3) == 4089);
+
+    // Rounded to the nearest position
+    correction.set_table(table_of(ENCODER_CORRECTION_MIN_KNOTS, 8));
+    CHECK(correction.apply(100) == 101);
+    correction.set_table(table_of(ENCODER_CORRECTION_MIN_KNOTS, 7));
+    CHECK(correction.apply(100) == 100);
+
+    // Linear between two knots 512 positions apart
+    EncoderCorrectionTable table = table_of(8, 0);
+    table.values[2] = 160;
+    table.values[3] = 480;
+    correction.set_table(table);
+    CHECK(correction.apply(2 * 512) == 2 * 512 + 10);
+    CHECK(correction.apply(2 * 512 + 256) == 2 * 512 + 256 + 20);
+    CHECK(correction.apply(3 * 512) == 3 * 512 + 30);
+    CHECK(correction.apply(3 * 512 + 128) == 3 * 512 + 128 + 23); // 22.5 rounded up
+
+    // From the last knot to the first one around the turn
+    table = table_of(8, 0);
+    table.values[7] = 160;
+    table.values[0] = -160;
+    correction.set_table(table);
+    CHECK(correction.apply(7 * 512) == 7 * 512 + 10);
+    CHECK(correction.apply(7 * 512 + 128) == 7 * 512 + 128 + 5);
+    CHECK(correction.apply(7 * 512 + 256) == 7 * 512 + 256);
+    CHECK(correction.apply(7 * 512 + 384) == 7 * 512 + 384 - 5);
+    CHECK(correction.apply(4095) == 4095 - 10);
+    CHECK(correction.apply(0) == 4096 - 10);
+
+    // Every knot count uses its own spacing
+    for (uint16_t knot_count = ENCODER_CORRECTION_MIN_KNOTS; knot_count <= ENCODER_CORRECTION_MAX_KNOTS;
+         knot_count <<= 1) {
+        table = table_of(knot_count, 0);
+        table.values[knot_count - 1] = 320;
+        correction.set_table(table);
+        int32_t spacing = (1 << ENCODER_POSITION_FRACTION_BITS) / knot_count;
+        CHECK(correction.apply(4096 - spacing) == ((4096 - spacing + 20) & ENCODER_POSITION_MASK));
+        CHECK(correction.apply(4096 - spacing / 2) == ((4096 - spacing / 2 + 10) & ENCODER_POSITION_MASK));
+        CHECK(correction.apply(0) == 0);
+    }
+
+    // The angle of a pulse is the corrected transfer function
+    correction.set_table(table_of(ENCODER_CORRECTION_MIN_KNOTS, 160));
+    int32_t half = encoder_fraction(duty_us(ENCODER_RESOLUTION / 2 + 1), CORRECTION_PERIOD);
+    CHECK(correction.angle(duty_us(ENCODER_RESOLUTION / 2 + 1), CORRECTION_PERIOD) == half + 10);
+
+    correction.clear();
+    CHECK(correction.apply(1234) == 1234);
+}
+
+int main()
+{
+    test_spec_points();
+    test_transfer_function();
+    test_clamping();
+    test_apply();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,412 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Turn tracking of the encoder: publish_encoder_pulse() unwrapping fast wraps, skipped quadrants and
+// single glitched pulses in both directions, and the turns taken from the threshold switches at the
+// first valid position of the booted firmware and the faults when the switches disagree with them.
+// Also a single glitched pulse past the stop position during a turn, which must not stop the rotator,
+// and the alpha-beta estimator of estimate_encoder_pulse() on ramps, a step and a glitch.
+//
+//   encoder_tracking_test SCENARIO
+//
+// Scenarios: pulses, estimator, boot-below-zero, boot-above-360, boot-free, switch-faults,
+// comparator-glitch.
+
+#include <Arduino.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "config.h"
+#include "rotator_axis.h"
+#include "rotator_state.h"
+#include "sim_hardware.h"
+#include "rotator_model.h"
+
+#define TRACKING_LOOP_INTERVAL_US 100
+#define TRACKING_BOOT_TIME_US 1000000
+#define TRACKING_PERIOD (1025 * 42) // MA3 period in capture timer ticks
+#define TRACKING_POSITION_TOLERANCE 0.5 // degrees
+#define TRACKING_TURN_TIMEOUT_US 20000000
+
+void setup();
+void loop();
+
+extern Axis *axes[AXIS_COUNT];
+
+static RotatorModel *model;
+static double glitch_angle = -1; // Encoder angle of the next pulse instead of the modelled one when set
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line)
+{
+    if (!condition) {
+        printf("line %d: check failed: %s\n", line, text);
+        failures++;
+    }
+}
+
+static void update_model(uint64_t now_us)
+{
+    model->update(now_us);
+}
+
+static void discard_output(const uint8_t *data, size_t length)
+{
+}
+
+static void send_glitching_pulse(uint32_t duty, uint32_t period)
+{
+    if (glitch_angle >= 0) {
+        duty = ((uint32_t) (glitch_angle / 360 * ENCODER_RESOLUTION) + 1) * (period / 1025);
+        glitch_angle = -1;
+    }
+    ROTATOR_MODEL_AZIMUTH.send_pulse(duty, period);
+}
+
+static void run_for(uint64_t duration_us)
+{
+    uint64_t end_us = sim_clock_micros() + duration_us;
+    while (sim_clock_micros() < end_us) {
+        loop();
+        delayMicroseconds(TRACKING_LOOP_INTERVAL_US);
+    }
+}
+
+static RotatorInputs pulse(int32_t fraction, uint32_t period = TRACKING_PERIOD)
+{
+    static uint64_t time = 0;
+    time += 1025;
+
+    RotatorInputs published;
+    publish_encoder_pulse(AXIS_AZIMUTH, 0, period, fraction, time, published);
+    return published;
+}
+
+static int test_pulses()
+{
+    // The first pulse takes the fraction as is
+    RotatorInputs inputs = pulse(4000);
+    CHECK(inputs.turns == 0);
+    CHECK(inputs.position == 4000);
+    CHECK(inputs.pulses == 1);
+
+    // Fast clockwise wraps through 0, a large step per pulse
+    inputs = pulse(100);
+    CHECK(inputs.turns == 1);
+    CHECK(inputs.position == 4096 + 100);
+    for (int32_t expected = 4096 + 1100; expected < 4 * 4096; expected += 1000) {
+        inputs = pulse(expected & ENCODER_POSITION_MASK);
+        CHECK(inputs.position == expected);
+        CHECK(inputs.turns == expected / 4096);
+    }
+    int32_t position = inputs.position;
+
+    // Skipped quadrants: a step of almost half a turn is still taken the right way
+    for (int i = 0; i < 6; i++) {
+        position += 2000;
+        inputs = pulse(position & ENCODER_POSITION_MASK);
+        CHECK(inputs.position == position);
+    }
+    for (int i = 0; i < 6; i++) {
+        position -= 2000;
+        inputs = pulse(position & ENCODER_POSITION_MASK);
+        CHECK(inputs.position == position);
+    }
+
+    // Beyond half a turn per pulse the step is taken the other way round
+    inputs = pulse((position + 2100) & ENCODER_POSITION_MASK);
+    CHECK(inputs.position == position + 2100 - 4096);
+    position = inputs.position;
+
+    // Fast counterclockwise wraps down to negative turns
+    int32_t target = -3 * 4096 + 500;
+    while (position - 1500 > target) {
+        position -= 1500;
+        inputs = pulse(position & ENCODER_POSITION_MASK);
+        CHECK(inputs.position == position);
+    }
+    CHECK(inputs.turns < 0);
+    CHECK(inputs.turns == (position >> ENCODER_POSITION_FRACTION_BITS));
+
+    // A single glitched pulse of more than half a turn counts a false turn that the next pulse takes back
+    int32_t steady = (position & ~ENCODER_POSITION_MASK) + 1000;
+    inputs = pulse(1000);
+    CHECK(inputs.position == steady);
+    int32_t steady_turns = inputs.turns;
+
+    inputs = pulse(3500);
+    CHECK(inputs.turns == steady_turns - 1);
+    inputs = pulse(1000);
+    CHECK(inputs.turns == steady_turns);
+    CHECK(inputs.position == steady);
+
+    // The same up through 0
+    inputs = pulse(4000);
+    CHECK(inputs.turns == steady_turns - 1);
+    steady = inputs.position;
+    inputs = pulse(100);
+    CHECK(inputs.turns == steady_turns);
+    inputs = pulse(4000);
+    CHECK(inputs.turns == steady_turns - 1);
+    CHECK(inputs.position == steady);
+
+    // A glitch of less than half a turn does not change the turns
+    inputs = pulse(2500);
+    CHECK(inputs.turns == steady_turns - 1);
+    inputs = pulse(4000);
+    CHECK(inputs.position == steady);
+
+    // A pulse without a period is counted but keeps the position, and the next pulse is not unwrapped
+    uint32_t pulses = inputs.pulses;
+    inputs = pulse(1000, 0);
+    CHECK(inputs.pulses == pulses + 1);
+    CHECK(inputs.position == steady);
+    inputs = pulse(1000);
+    CHECK(inputs.turns == steady_turns - 1);
+    CHECK(inputs.position == (steady & ~ENCODER_POSITION_MASK) + 1000);
+
+    return 0;
+}
+
+static double estimated_position(const RotatorInputs &inputs)
+{
+    return (double) inputs.estimated_position / (1LL << ESTIMATOR_FRACTION_BITS);
+}
+
+static double estimated_velocity(const RotatorInputs &inputs)
+{
+    return (double) inputs.estimated_velocity / (1LL << ESTIMATOR_FRACTION_BITS);
+}
+
+/**
+ * Runs the estimator over count pulses of the position function from pulse from on. Pulse 0 is the
+ * first pulse, which resets the estimate.
+ */
+template<typename POSITION>
+static void estimate(RotatorInputs &inputs, int from, int count, POSITION position)
+{
+    for (int i = from; i < from + count; i++) {
+        inputs.position = position(i);
+        estimate_encoder_pulse(inputs, i == 0);
+    }
+}
+
+static int test_estimator()
+{
+    // The first pulse sets the position and clears the velocity
+    RotatorInputs inputs{};
+    inputs.estimated_velocity = 12345;
+    inputs.position = -777;
+    estimate_encoder_pulse(inputs, true);
+    CHECK(inputs.estimated_position == -777LL * (1LL << ESTIMATOR_FRACTION_BITS));
+    CHECK(inputs.estimated_velocity == 0);
+
+    // Constant velocity in both directions: the estimate locks on without lag
+    estimate(inputs, 0, 3000, [](int i) { return 1000 + 3 * i; });
+    CHECK(fabs(estimated_velocity(inputs) - 3) < 0.001);
+    CHECK(fabs(estimated_position(inputs) - inputs.position) < 0.01);
+
+    estimate(inputs, 0, 3000, [](int i) { return -2 * 4096 - 5 * i; });
+    CHECK(fabs(estimated_velocity(inputs) + 5) < 0.001);
+    CHECK(fabs(estimated_position(inputs) - inputs.position) < 0.01);
+
+    // Far below one encoder step per pulse the velocity still adds up, the position lags by a fraction of a step
+    estimate(inputs, 0, 8000, [](int i) { return i / 8; });
+    CHECK(fabs(estimated_velocity(inputs) - 0.125) < 0.001);
+    CHECK(fabs(estimated_position(inputs) - inputs.position) < 1);
+
+    // A step settles with an overshoot of a fifth at most
+    double peak = 0;
+    estimate(inputs, 0, 1, [](int i) { return 0; });
+    for (int pulse = 1; pulse < 2000; pulse++) {
+        estimate(inputs, pulse, 1, [](int i) { return 100; });
+        peak = max(peak, estimated_position(inputs));
+    }
+    CHECK(peak > 100 && peak < 125);
+    CHECK(fabs(estimated_position(inputs) - 100) < 0.01);
+    CHECK(fabs(estimated_velocity(inputs)) < 0.001);
+
+    // A single glitched pulse moves the estimate by the alpha share of the glitch only
+    estimate(inputs, 0, 2000, [](int i) { return 2 * i; });
+    inputs.position = 2 * 2000 + 2048;
+    estimate_encoder_pulse(inputs, false);
+    double error = estimated_position(inputs) - 2 * 2000;
+    CHECK(error > 0 && error <= (2048 >> ESTIMATOR_ALPHA_SHIFT) + 1);
+    CHECK(fabs(estimated_velocity(inputs) - 2) <= (2048.0 / (1 << ESTIMATOR_BETA_SHIFT)) + 0.01);
+
+    return 0;
+}
+
+/**
+ * Boots the firmware with the rotator at the given position. The axis of the model may leave the
+ * threshold switches alone or alter the encoder pulses.
+ */
+static void boot(double position, const RotatorModelAxis &axis = ROTATOR_MODEL_AZIMUTH)
+{
+    sim_clock_set_virtual(true);
+    sim_serial_set_stdin_enabled(false);
+    sim_serial_set_output_handler(discard_output);
+    sim_network_set_enabled(false);
+
+    RotatorModelConfig config;
+    config.position = position;
+    model = new RotatorModel(config, axis);
+    sim_clock_set_sleep_hook(update_model);
+
+    setup();
+    run_for(TRACKING_BOOT_TIME_US);
+}
+
+static void check_tracking(double position, int32_t turns, bool fault, uint32_t fault_count, int line)
+{
+    loop();
+    const RotatorState &state = axes[AXIS_AZIMUTH]->get_state();
+    check(fabs(state.position - position) < TRACKING_POSITION_TOLERANCE, "position", line);
+    check(state.turns == turns, "turns", line);
+    check(state.fault == fault, "fault", line);
+    check(axes[AXIS_AZIMUTH]->get_fault_count() == fault_count, "fault count", line);
+    if (fabs(state.position - position) >= TRACKING_POSITION_TOLERANCE || state.turns != turns) {
+        printf("line %d: position %.2f turns %ld\n", line, state.position, (long) state.turns);
+    }
+}
+
+static void set_thresholds(bool threshold_1, bool threshold_2)
+{
+    sim_pin_set_input(PIN_THRESHOLD_1, threshold_1);
+    sim_pin_set_input(PIN_THRESHOLD_2, threshold_2);
+    run_for(TRACKING_LOOP_INTERVAL_US);
+}
+
+static int test_switch_faults()
+{
+    RotatorModelAxis axis = ROTATOR_MODEL_AZIMUTH;
+    axis.threshold_1 = -1;
+    axis.threshold_2 = -1;
+
+    // T2 active at an encoder angle below 110 degrees: the axis is past 360
+    sim_pin_set_input(PIN_THRESHOLD_2, true);
+    boot(100, axis);
+    check_tracking(460, 1, false, 0, __LINE__);
+
+    // T2 released while the tracked position is above 360 + ROTATOR_THRESHOLD_TOLERANCE
+    set_thresholds(false, false);
+    check_tracking(460, 1, true, 1, __LINE__);
+
+    set_thresholds(false, true);
+    check_tracking(460, 1, false, 1, __LINE__);
+
+    // T1 active above ROTATOR_THRESHOLD_TOLERANCE
+    set_thresholds(true, true);
+    check_tracking(460, 1, true, 2, __LINE__);
+
+    set_thresholds(false, true);
+    check_tracking(460, 1, false, 2, __LINE__);
+
+    return 0;
+}
+
+/**
+ * Turns to the target with one glitched pulse at the given angle when the axis passes the middle.
+ */
+static void turn_with_glitch(double target, double angle)
+{
+    Axis *axis = axes[AXIS_AZIMUTH];
+    double middle = (axis->get_position() + target) / 2;
+    int8_t direction = (target > axis->get_position()) ? 1 : -1;
+
+    axis->set_target(target);
+    CHECK(axis->get_direction() == direction);
+
+    uint64_t end_us = sim_clock_micros() + TRACKING_TURN_TIMEOUT_US;
+    while ((axis->get_position() - middle) * direction < 0 && sim_clock_micros() < end_us) {
+        run_for(TRACKING_LOOP_INTERVAL_US);
+    }
+    uint32_t fired_count = encoder_comparators[AXIS_AZIMUTH].get_fired_count();
+
+    glitch_angle = angle;
+    run_for(100 * TRACKING_LOOP_INTERVAL_US);
+    CHECK(glitch_angle < 0);
+    CHECK(encoder_comparators[AXIS_AZIMUTH].get_fired_count() == fired_count);
+    CHECK(axis->get_direction() == direction);
+
+    while (axis->get_direction() != 0 && sim_clock_micros() < end_us) {
+        run_for(TRACKING_LOOP_INTERVAL_US);
+    }
+    run_for(TRACKING_BOOT_TIME_US); // Coasting
+    CHECK(fabs(axis->get_position() - target) < TRACKING_POSITION_TOLERANCE);
+}
+
+static int test_comparator_glitch()
+{
+    RotatorModelAxis axis = ROTATOR_MODEL_AZIMUTH;
+    axis.send_pulse = send_glitching_pulse;
+    boot(100, axis);
+
+    // The median filter keeps the glitch out of the main loop, so only the comparator could act on it
+    axes[AXIS_AZIMUTH]->set_filter({3, 0});
+    run_for(TRACKING_BOOT_TIME_US);
+
+    turn_with_glitch(110, 250);
+    turn_with_glitch(100, 10);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s pulses|estimator|boot-below-zero|boot-above-360|boot-free|switch-faults|"
+                "comparator-glitch\n", argv[0]);
+        return 1;
+    }
+
+    const char *scenario = argv[1];
+    if (strcmp(scenario, "pulses") == 0) {
+        test_pulses();
+    } else if (strcmp(scenario, "estimator") == 0) {
+        test_estimator();
+    } else if (strcmp(scenario, "boot-below-zero") == 0) {
+        // T1 active at an encoder angle of 330: one turn down
+        boot(-30);
+        check_tracking(-30, -1, false, 0, __LINE__);
+    } else if (strcmp(scenario, "boot-above-360") == 0) {
+        // T2 active at an encoder angle of 20: one turn up
+        boot(380);
+        check_tracking(380, 1, false, 0, __LINE__);
+    } else if (strcmp(scenario, "boot-free") == 0) {
+        boot(200);
+        check_tracking(200, 0, false, 0, __LINE__);
+    } else if (strcmp(scenario, "switch-faults") == 0) {
+        test_switch_faults();
+    } else if (strcmp(scenario, "comparator-glitch") == 0) {
+        test_comparator_glitch();
+    } else {
+        fprintf(stderr, "Unknown scenario %s\n", scenario);
+        return 1;
+    }
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
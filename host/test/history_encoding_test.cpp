@@ -0,0 +1,271 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Round trip of the HISTORY encoding: raw samples and summaries streamed by HistorySource through the
+// HistoryEncoder, decoded by the history_decode tool and compared with the recorded values. The records
+// cover negative deltas, multi-byte varints, the wraparound of the 32-bit timestamps and records split
+// between the 57-byte base64 lines.
+//
+//   history_encoding_test HISTORY_DECODE
+
+#include <Arduino.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "history_recorder.h"
+
+#define ENCODING_RING_LENGTH 256
+#define ENCODING_RECORD_COUNT 200
+
+static const char *decoder;
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line)
+{
+    if (!condition) {
+        printf("line %d: check failed: %s\n", line, text);
+        failures++;
+    }
+}
+
+class StringOutput : public Print {
+public:
+    std::string text;
+
+    size_t write(uint8_t c) override
+    {
+        text += static_cast<char>(c);
+        return 1;
+    }
+};
+
+static std::string flag_names(uint8_t flags)
+{
+    static const char *names[] = {"T1", "T2", "L1", "L2", "CW", "CCW"};
+    std::string text;
+
+    for (int i = 0; i < 6; i++) {
+        if (flags & (1u << i)) {
+            if (!text.empty()) {
+                text += ',';
+            }
+            text += names[i];
+        }
+    }
+
+    return text.empty() ? "-" : text;
+}
+
+// Controller clock of the request: past two wraps of the 32-bit timestamps, after all records
+static const uint64_t request_time = (2ULL << 32) + 5000000;
+
+static uint64_t record_time(uint32_t timestamp)
+{
+    return request_time - (uint32_t) ((uint32_t) request_time - timestamp);
+}
+
+/**
+ * Timestamps that wrap through 2^32 and include a gap long enough for a five-byte varint.
+ */
+static uint32_t test_timestamp(int i)
+{
+    uint32_t timestamp = 0xFFFF0000u + (uint32_t) i * 1025;
+    if (i >= ENCODING_RECORD_COUNT / 2) {
+        timestamp += 400000000;
+    }
+    return timestamp;
+}
+
+static int32_t test_position(int i)
+{
+    switch (i % 5) {
+        case 0:
+            return -3 * 4096 + i; // Negative position
+        case 1:
+            return 100 - i * 7;
+        case 2:
+            return (1 << 28) + i; // Large deltas both ways
+        case 3:
+            return -(1 << 27) - i;
+        default:
+            return i;
+    }
+}
+
+static int16_t test_velocity(int i)
+{
+    static const int16_t velocities[] = {0, -1, INT16_MAX, INT16_MIN, 300, -300, 1};
+    return velocities[i % 7];
+}
+
+/**
+ * Runs the HISTORY output of the source through the decoder and returns the decoded lines. Also checks
+ * that the base64 lines are full 57-byte lines without padding except for the last one.
+ */
+template<typename RING>
+static std::vector<std::string> round_trip(RING &ring, const char *mode)
+{
+    HistorySource<RING> source(ring, ring.get_first_index(), ring.get_write_index());
+    StringOutput output;
+    output.print("OK HISTORY AXIS=AZ MODE=");
+    output.print(mode);
+    output.print(" TIME=");
+    output.print(std::to_string(request_time).c_str());
+    output.print(" SCALE=1 OFFSET=0 VEL_SCALE=1\n");
+
+    std::vector<size_t> line_lengths;
+    size_t end = output.text.length();
+    while (source.next(output)) {
+        line_lengths.push_back(output.text.length() - end - 1);
+        CHECK(output.text.back() == '\n');
+        end = output.text.length();
+    }
+    // Padding only on the last line, so the lines can be decoded one by one
+    size_t first_padding = output.text.find('=', output.text.find('\n') + 1);
+    CHECK(first_padding > output.text.rfind('\n', end - 2));
+    CHECK(output.text.find("OK HISTORY END LOST=0", end) == end);
+
+    CHECK(line_lengths.size() >= 3);
+    for (size_t i = 0; i + 1 < line_lengths.size(); i++) {
+        CHECK(line_lengths[i] == HISTORY_LINE_BYTES / 3 * 4);
+    }
+    CHECK(!line_lengths.empty() && line_lengths.back() <= HISTORY_LINE_BYTES / 3 * 4);
+
+    char file_name[] = "/tmp/history_encoding_XXXXXX";
+    int fd = mkstemp(file_name);
+    CHECK(fd >= 0);
+    CHECK(write(fd, output.text.c_str(), output.text.length()) == (ssize_t) output.text.length());
+    close(fd);
+
+    std::string command = std::string(decoder) + " < " + file_name;
+    FILE *decoded = popen(command.c_str(), "r");
+    std::vector<std::string> lines;
+    char line[256];
+    while (decoded != nullptr && fgets(line, sizeof(line), decoded) != nullptr) {
+        if (line[0] != '#') {
+            lines.emplace_back(line);
+        }
+    }
+    CHECK(decoded != nullptr && pclose(decoded) == 0);
+    unlink(file_name);
+
+    return lines;
+}
+
+static void test_raw()
+{
+    auto *ring = new HistoryRing<HistorySample, ENCODING_RING_LENGTH>();
+    std::vector<HistorySample> records;
+
+    for (int i = 0; i < ENCODING_RECORD_COUNT; i++) {
+        HistorySample sample;
+        sample.timestamp = test_timestamp(i);
+        sample.position = test_position(i);
+        sample.velocity = test_velocity(i);
+        sample.flags = (uint8_t) ((i * 11) & 0x3F);
+        ring->push(sample);
+        records.push_back(sample);
+    }
+
+    std::vector<std::string> lines = round_trip(*ring, "RAW");
+    CHECK(lines.size() == records.size());
+
+    for (size_t i = 0; i < lines.size() && i < records.size(); i++) {
+        double time;
+        double position;
+        double velocity;
+        char flags[32];
+        bool parsed = sscanf(lines[i].c_str(), "%lf %lf %lf %31s", &time, &position, &velocity, flags) == 4;
+        CHECK(parsed);
+        if (!parsed) {
+            continue;
+        }
+        CHECK(llround(time * 1e6) == (long long) record_time(records[i].timestamp));
+        CHECK(position == records[i].position);
+        CHECK(velocity == records[i].velocity);
+        CHECK(flag_names(records[i].flags) == flags);
+    }
+
+    delete ring;
+}
+
+static void test_summary()
+{
+    auto *ring = new HistoryRing<HistorySummary, ENCODING_RING_LENGTH>();
+    std::vector<HistorySummary> records;
+
+    for (int i = 0; i < ENCODING_RECORD_COUNT; i++) {
+        HistorySummary summary;
+        summary.timestamp = test_timestamp(i);
+        summary.minimum = test_position(i);
+        summary.maximum = summary.minimum + ((i % 3 == 0) ? 0 : i * 1000);
+        summary.velocity = test_velocity(i);
+        summary.flags = (uint8_t) ((i * 7) & 0x3F);
+        ring->push(summary);
+        records.push_back(summary);
+    }
+
+    std::vector<std::string> lines = round_trip(*ring, "SUMMARY");
+    CHECK(lines.size() == records.size());
+
+    for (size_t i = 0; i < lines.size() && i < records.size(); i++) {
+        double time;
+        double minimum;
+        double maximum;
+        double velocity;
+        char flags[32];
+        bool parsed = sscanf(lines[i].c_str(), "%lf %lf %lf %lf %31s", &time, &minimum, &maximum, &velocity,
+                flags) == 5;
+        CHECK(parsed);
+        if (!parsed) {
+            continue;
+        }
+        CHECK(llround(time * 1e6) == (long long) record_time(records[i].timestamp));
+        CHECK(minimum == records[i].minimum);
+        CHECK(maximum == records[i].maximum);
+        CHECK(velocity == records[i].velocity);
+        CHECK(flag_names(records[i].flags) == flags);
+    }
+
+    delete ring;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s HISTORY_DECODE\n", argv[0]);
+        return 1;
+    }
+    decoder = argv[1];
+
+    test_raw();
+    test_summary();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
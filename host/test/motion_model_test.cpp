@@ -0,0 +1,145 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// The interpolation of the CALIBRATE motion model: velocities between and beyond the calibrated speeds,
+// the lowest speed for a velocity, and coasting distances between, below and above the calibrated
+// velocities, including calibrated velocities that do not increase with the speed.
+
+#include <cmath>
+#include <cstdio>
+
+#include "motion_model.h"
+
+#define MODEL_TOLERANCE 1e-9
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+#define CHECK_NEAR(value, expected) check(fabs((value) - (expected)) < MODEL_TOLERANCE, #value " == " #expected, __LINE__)
+
+static void check(bool condition, const char *text, int line)
+{
+    if (!condition) {
+        printf("line %d: check failed: %s\n", line, text);
+        failures++;
+    }
+}
+
+static MotionModel test_model()
+{
+    MotionModel model{};
+    const uint16_t cw_velocity[] = {100, 220, 350, 480, 600};
+    const uint16_t cw_coast[] = {5, 15, 30, 50, 75};
+    // The third speed is no faster than the second, as measured on a sticking axis
+    const uint16_t ccw_velocity[] = {90, 200, 200, 450, 580};
+    const uint16_t ccw_coast[] = {4, 12, 99, 45, 70};
+
+    for (int i = 0; i < MOTION_MODEL_SPEED_COUNT; i++) {
+        model.velocity[MOTION_DIRECTION_CW][i] = cw_velocity[i];
+        model.coast[MOTION_DIRECTION_CW][i] = cw_coast[i];
+        model.velocity[MOTION_DIRECTION_CCW][i] = ccw_velocity[i];
+        model.coast[MOTION_DIRECTION_CCW][i] = ccw_coast[i];
+    }
+    model.valid = 1;
+
+    return model;
+}
+
+static void test_velocity()
+{
+    MotionModel model = test_model();
+
+    // The calibrated speeds
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CW, 20), 1.0);
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CW, 60), 3.5);
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CW, 100), 6.0);
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CCW, 80), 4.5);
+
+    // Between them
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CW, 30), 1.6);
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CW, 95), 5.7);
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CCW, 50), 2.0);
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CCW, 70), 3.25);
+
+    // Towards zero below the lowest calibrated speed, and the fastest above the highest
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CW, 0), 0.0);
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CW, 10), 0.5);
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CCW, 5), 0.225);
+    CHECK_NEAR(motion_model_velocity(model, MOTION_DIRECTION_CW, 120), 6.0);
+
+    // Never decreasing with the speed while the calibrated velocities do not decrease
+    double previous = 0;
+    for (int speed = 0; speed <= 100; speed++) {
+        double velocity = motion_model_velocity(model, MOTION_DIRECTION_CCW, speed);
+        CHECK(velocity >= previous);
+        previous = velocity;
+    }
+}
+
+static void test_speed_for()
+{
+    MotionModel model = test_model();
+
+    // Both directions must reach the velocity, CCW is the slower one here
+    CHECK(motion_model_speed_for(model, 0) == 0);
+    CHECK(motion_model_speed_for(model, 1.0) == 22);
+    CHECK(motion_model_speed_for(model, 4.5) == 80);
+    CHECK(motion_model_speed_for(model, 5.8) == 100);
+    CHECK(motion_model_speed_for(model, 5.81) == -1);
+}
+
+static void test_coast()
+{
+    MotionModel model = test_model();
+
+    // At and between the calibrated velocities
+    CHECK_NEAR(motion_model_coast(model, MOTION_DIRECTION_CW, 1.0), 0.05);
+    CHECK_NEAR(motion_model_coast(model, MOTION_DIRECTION_CW, 4.8), 0.5);
+    CHECK_NEAR(motion_model_coast(model, MOTION_DIRECTION_CW, 2.85), 0.225);
+
+    // Towards zero below the slowest calibrated velocity
+    CHECK_NEAR(motion_model_coast(model, MOTION_DIRECTION_CW, 0), 0.0);
+    CHECK_NEAR(motion_model_coast(model, MOTION_DIRECTION_CW, 0.5), 0.025);
+
+    // Linear in the velocity above the fastest calibrated one
+    CHECK_NEAR(motion_model_coast(model, MOTION_DIRECTION_CW, 12.0), 1.5);
+
+    // A calibrated velocity that does not increase is skipped together with its coasting distance
+    CHECK_NEAR(motion_model_coast(model, MOTION_DIRECTION_CCW, 2.0), 0.12);
+    CHECK_NEAR(motion_model_coast(model, MOTION_DIRECTION_CCW, 3.0), 0.252);
+    CHECK_NEAR(motion_model_coast(model, MOTION_DIRECTION_CCW, 5.8), 0.7);
+
+    // An uncalibrated model has no coasting distance
+    MotionModel empty{};
+    CHECK_NEAR(motion_model_coast(empty, MOTION_DIRECTION_CW, 3.0), 0.0);
+    CHECK_NEAR(motion_model_velocity(empty, MOTION_DIRECTION_CW, 50), 0.0);
+    CHECK(motion_model_speed_for(empty, 1.0) == -1);
+}
+
+int main()
+{
+    test_velocity();
+    test_speed_for();
+    test_coast();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
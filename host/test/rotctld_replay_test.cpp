@@ -0,0 +1,320 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Replays recorded rotctl sessions through RotctldCommandHandler of the booted firmware and diffs
+// the responses against the transcript.
+//
+//   rotctld_replay_test [--record] TRANSCRIPT
+//
+// Transcript lines starting with '>' are commands as rotctl sent them, the following '<' lines
+// the expected response, split at newlines. '! run SECONDS' runs the firmware on the virtual
+// clock and '! closed' expects the previous command to have closed the connection. Lines
+// starting with '#' are comments. With --record the transcript is printed with the responses
+// of this firmware, to record a new session from a file of commands.
+
+#include <Arduino.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "controller_command_handler.h"
+#include "rotctld_command_handler.h"
+#include "sim_hardware.h"
+#include "rotator_model.h"
+
+#define REPLAY_LOOP_INTERVAL_US 100
+#define REPLAY_BOOT_TIME_US 1000000
+#define REPLAY_AZIMUTH 180.0
+#define REPLAY_ELEVATION 45.0
+
+void setup();
+void loop();
+
+extern ControllerCommandHandler *command_handler;
+
+static RotatorModel *model;
+static RotatorModel *elevation_model;
+
+static void update_model(uint64_t now_us)
+{
+    model->update(now_us);
+    elevation_model->update(now_us);
+}
+
+static void discard_output(const uint8_t *data, size_t length)
+{
+}
+
+class ResponseRecorder : public Print {
+public:
+    std::string text;
+
+    size_t write(uint8_t c) override
+    {
+        text += static_cast<char>(c);
+        return 1;
+    }
+};
+
+/**
+ * Client of the replayed session, the handler only uses it to close the connection.
+ */
+class ReplayClient : public ControllerClient {
+protected:
+    int read_transport(uint8_t *buffer, size_t length) override
+    {
+        return 0;
+    }
+
+public:
+    bool stopped = false;
+
+    ReplayClient() : ControllerClient(CLIENT_PROTOCOL_ROTCTLD, true)
+    {
+    }
+
+    void flush_output() override
+    {
+    }
+
+    bool connected() override
+    {
+        return !stopped;
+    }
+
+    void stop() override
+    {
+        stopped = true;
+    }
+
+    bool cleanup() override
+    {
+        return stopped;
+    }
+};
+
+static void run_for(uint64_t duration_us)
+{
+    uint64_t end_us = sim_clock_micros() + duration_us;
+    while (sim_clock_micros() < end_us) {
+        loop();
+        delayMicroseconds(REPLAY_LOOP_INTERVAL_US);
+    }
+}
+
+static std::vector<std::string> split_lines(const std::string &text)
+{
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            lines.push_back(text.substr(start));
+            break;
+        }
+        lines.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+struct Exchange {
+    int line_number;
+    std::string command;
+    std::vector<std::string> expected;
+};
+
+class Replay {
+private:
+    RotctldCommandHandler handler{command_handler};
+    ReplayClient client;
+    bool record;
+    Exchange exchange;
+    bool pending = false;
+    int failures = 0;
+
+    void finish_exchange()
+    {
+        if (!pending) {
+            return;
+        }
+        pending = false;
+
+        ResponseRecorder response;
+        handler.handle_command(String(exchange.command.c_str()), &client, &response);
+        std::vector<std::string> actual = split_lines(response.text);
+
+        if (record) {
+            for (const std::string &line : actual) {
+                printf("< %s\n", line.c_str());
+            }
+            return;
+        }
+        if (actual == exchange.expected) {
+            return;
+        }
+
+        failures++;
+        printf("line %d: > %s\n", exchange.line_number, exchange.command.c_str());
+        for (const std::string &line : exchange.expected) {
+            printf("-< %s\n", line.c_str());
+        }
+        for (const std::string &line : actual) {
+            printf("+< %s\n", line.c_str());
+        }
+    }
+
+    bool directive(int line_number, const std::string &text)
+    {
+        double seconds;
+        if (sscanf(text.c_str(), "run %lf", &seconds) == 1) {
+            run_for(static_cast<uint64_t>(seconds * 1e6));
+        } else if (text == "closed") {
+            if (!client.stopped && !record) {
+                failures++;
+                printf("line %d: connection not closed\n", line_number);
+            }
+        } else {
+            fprintf(stderr, "line %d: unknown directive: %s\n", line_number, text.c_str());
+            return false;
+        }
+        return true;
+    }
+
+public:
+    explicit Replay(bool record_responses)
+    {
+        record = record_responses;
+    }
+
+    bool process_line(int line_number, const std::string &line)
+    {
+        if (line.empty() || line[0] == '#') {
+            finish_exchange();
+            if (record) {
+                printf("%s\n", line.c_str());
+            }
+            return true;
+        }
+
+        std::string text = (line.size() > 2) ? line.substr(2) : std::string();
+        if (line[0] == '<') {
+            if (!pending) {
+                fprintf(stderr, "line %d: response without a command\n", line_number);
+                return false;
+            }
+            exchange.expected.push_back(text);
+            return true;
+        }
+
+        finish_exchange();
+        if (record) {
+            printf("%s\n", line.c_str());
+        }
+
+        if (line[0] == '>') {
+            exchange = Exchange{line_number, text, {}};
+            pending = true;
+            return true;
+        }
+        if (line[0] == '!') {
+            return directive(line_number, text);
+        }
+
+        fprintf(stderr, "line %d: unknown line: %s\n", line_number, line.c_str());
+        return false;
+    }
+
+    int finish()
+    {
+        finish_exchange();
+        return failures;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    bool record = false;
+    const char *file_name = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0) {
+            record = true;
+        } else if (file_name == nullptr) {
+            file_name = argv[i];
+        } else {
+            file_name = nullptr;
+            break;
+        }
+    }
+    if (file_name == nullptr) {
+        fprintf(stderr, "Usage: %s [--record] TRANSCRIPT\n", argv[0]);
+        return 1;
+    }
+
+    FILE *input = fopen(file_name, "r");
+    if (input == nullptr) {
+        fprintf(stderr, "Cannot open %s\n", file_name);
+        return 1;
+    }
+
+    sim_clock_set_virtual(true);
+    sim_serial_set_stdin_enabled(false);
+    sim_serial_set_output_handler(discard_output);
+    sim_network_set_enabled(false);
+
+    RotatorModelConfig config;
+    config.position = REPLAY_AZIMUTH;
+    model = new RotatorModel(config);
+    RotatorModelConfig elevation_config = config;
+    elevation_config.position = REPLAY_ELEVATION;
+    elevation_model = new RotatorModel(elevation_config, ROTATOR_MODEL_ELEVATION);
+    sim_clock_set_sleep_hook(update_model);
+
+    setup();
+    run_for(REPLAY_BOOT_TIME_US);
+
+    Replay replay(record);
+    char buffer[512];
+    int line_number = 0;
+    bool valid = true;
+
+    while (valid && fgets(buffer, sizeof(buffer), input) != nullptr) {
+        line_number++;
+        std::string line(buffer);
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
+            line.pop_back();
+        }
+        valid = replay.process_line(line_number, line);
+    }
+    fclose(input);
+
+    int failures = replay.finish();
+    if (!valid) {
+        return 1;
+    }
+    if (failures > 0) {
+        printf("%d of the responses differ from %s\n", failures, file_name);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,316 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SettingsStore on the in-memory flash of the flash storage shim: the save/load round trip, the
+// rotation over the settings pages, records rejected by their CRC, magic, version or length, the
+// newest sequence number winning across its wraparound, and records of an older, shorter Settings
+// leaving the appended fields at their defaults.
+
+#include <Arduino.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include "settings.h"
+#include "sim_hardware.h"
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line)
+{
+    if (!condition) {
+        printf("line %d: check failed: %s\n", line, text);
+        failures++;
+    }
+}
+
+static void erase_flash()
+{
+    sim_flash_set_file(nullptr);
+}
+
+static void example_settings(Settings &example)
+{
+    SettingsStore::defaults(example);
+    example.azimuth_offset = 12.5;
+    example.azimuth_minimum = -45.0;
+    example.azimuth_maximum = 405.0;
+    example.angle_threshold = 0.1;
+    example.speed = 80;
+    example.filter_median_length = 5;
+    example.filter_smoothing = 0.25f;
+    example.elevation_offset = -1.5;
+    example.elevation_minimum = 5.0;
+    example.elevation_maximum = 85.0;
+}
+
+static uint32_t settings_page_writes(uint32_t index)
+{
+    return sim_flash_page_writes(FLASH_STORAGE_SETTINGS_FIRST_PAGE + index);
+}
+
+/**
+ * Writes a record the way SettingsStore::save() does, with a CRC over the given fields.
+ */
+static void write_record(uint32_t index, uint32_t magic, uint32_t sequence, uint16_t version, uint16_t length,
+        const Settings &record_settings)
+{
+    uint8_t page[FLASH_STORAGE_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+
+    SettingsRecordHeader header;
+    header.magic = magic;
+    header.sequence = sequence;
+    header.version = version;
+    header.length = length;
+    header.crc = 0;
+
+    size_t copied = (length < sizeof(record_settings)) ? length : sizeof(record_settings);
+    memcpy(page + sizeof(header), &record_settings, copied);
+
+    header.crc = FlashStorage::crc32(0, reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+    if (length <= FLASH_STORAGE_PAGE_SIZE - sizeof(header)) {
+        header.crc = FlashStorage::crc32(header.crc, page + sizeof(header), length);
+    }
+    memcpy(page, &header, sizeof(header));
+
+    FlashStorage::write_page(FLASH_STORAGE_SETTINGS_FIRST_PAGE + index, page);
+}
+
+static void test_empty_flash()
+{
+    erase_flash();
+    SettingsStore store;
+    Settings loaded;
+    memset(&loaded, 0xA5, sizeof(loaded));
+
+    CHECK(!store.load(loaded));
+    CHECK(loaded.speed == 0xA5); // Untouched
+    CHECK(store.get_page() == -1);
+    CHECK(store.get_sequence() == 0);
+}
+
+static void test_round_trip()
+{
+    erase_flash();
+    Settings saved;
+    example_settings(saved);
+
+    SettingsStore writer;
+    CHECK(writer.save(saved));
+    CHECK(writer.get_sequence() == 1);
+    CHECK(writer.get_page() == 0);
+
+    SettingsStore reader;
+    Settings loaded;
+    SettingsStore::defaults(loaded);
+    CHECK(reader.load(loaded));
+    CHECK(reader.get_sequence() == 1);
+    CHECK(reader.get_page() == 0);
+
+    CHECK(loaded.azimuth_offset == 12.5);
+    CHECK(loaded.azimuth_minimum == -45.0);
+    CHECK(loaded.azimuth_maximum == 405.0);
+    CHECK(loaded.angle_threshold == 0.1);
+    CHECK(loaded.speed == 80);
+    CHECK(loaded.filter_median_length == 5);
+    CHECK(loaded.filter_smoothing == 0.25f);
+    CHECK(loaded.elevation_offset == -1.5);
+    CHECK(loaded.elevation_minimum == 5.0);
+    CHECK(loaded.elevation_maximum == 85.0);
+}
+
+static void test_rotation()
+{
+    erase_flash();
+    Settings saved;
+    example_settings(saved);
+
+    uint32_t settings_before[FLASH_STORAGE_SETTINGS_PAGE_COUNT];
+    for (uint32_t i = 0; i < FLASH_STORAGE_SETTINGS_PAGE_COUNT; i++) {
+        settings_before[i] = settings_page_writes(i);
+    }
+    uint32_t correction_before = 0;
+    for (uint32_t i = 0; i < FLASH_STORAGE_CORRECTION_PAGE_COUNT; i++) {
+        correction_before += sim_flash_page_writes(FLASH_STORAGE_CORRECTION_FIRST_PAGE + i);
+    }
+
+    // Each page is written once before any is written again
+    SettingsStore store;
+    for (uint32_t i = 0; i < FLASH_STORAGE_SETTINGS_PAGE_COUNT; i++) {
+        saved.speed = (uint8_t) i;
+        CHECK(store.save(saved));
+        CHECK(store.get_page() == (int32_t) i);
+    }
+    for (uint32_t i = 0; i < FLASH_STORAGE_SETTINGS_PAGE_COUNT; i++) {
+        CHECK(settings_page_writes(i) - settings_before[i] == 1);
+    }
+
+    saved.speed = 99;
+    CHECK(store.save(saved));
+    CHECK(store.get_page() == 0);
+    CHECK(store.get_sequence() == FLASH_STORAGE_SETTINGS_PAGE_COUNT + 1);
+    CHECK(settings_page_writes(0) - settings_before[0] == 2);
+
+    uint32_t correction_after = 0;
+    for (uint32_t i = 0; i < FLASH_STORAGE_CORRECTION_PAGE_COUNT; i++) {
+        correction_after += sim_flash_page_writes(FLASH_STORAGE_CORRECTION_FIRST_PAGE + i);
+    }
+    CHECK(correction_after == correction_before);
+
+    // The wrapped record on the first page is the newest one
+    SettingsStore reader;
+    Settings loaded;
+    CHECK(reader.load(loaded));
+    CHECK(loaded.speed == 99);
+    CHECK(reader.get_page() == 0);
+
+    // Saving after a load continues from the loaded page
+    CHECK(reader.save(saved));
+    CHECK(reader.get_page() == 1);
+    CHECK(reader.get_sequence() == FLASH_STORAGE_SETTINGS_PAGE_COUNT + 2);
+}
+
+static void test_crc_mismatch()
+{
+    erase_flash();
+    Settings saved;
+    example_settings(saved);
+
+    SettingsStore store;
+    saved.speed = 10;
+    CHECK(store.save(saved));
+    saved.speed = 20;
+    CHECK(store.save(saved));
+
+    // Flip one payload bit of the newest record: the previous record is loaded instead
+    uint8_t page[FLASH_STORAGE_PAGE_SIZE];
+    memcpy(page, FlashStorage::page(FLASH_STORAGE_SETTINGS_FIRST_PAGE + 1), sizeof(page));
+    page[sizeof(SettingsRecordHeader) + offsetof(Settings, speed)] ^= 0x01;
+    FlashStorage::write_page(FLASH_STORAGE_SETTINGS_FIRST_PAGE + 1, page);
+
+    SettingsStore reader;
+    Settings loaded;
+    CHECK(reader.load(loaded));
+    CHECK(loaded.speed == 10);
+    CHECK(reader.get_page() == 0);
+    CHECK(reader.get_sequence() == 1);
+
+    // The next save replaces the corrupted record
+    CHECK(reader.save(saved));
+    CHECK(reader.get_page() == 1);
+    CHECK(reader.get_sequence() == 2);
+}
+
+static void test_sequence_wraparound()
+{
+    erase_flash();
+    Settings record;
+    example_settings(record);
+
+    record.speed = 1;
+    write_record(3, SETTINGS_MAGIC, 0xFFFFFFFE, SETTINGS_VERSION, sizeof(record), record);
+    record.speed = 2;
+    write_record(4, SETTINGS_MAGIC, 0xFFFFFFFF, SETTINGS_VERSION, sizeof(record), record);
+    record.speed = 3;
+    write_record(5, SETTINGS_MAGIC, 0, SETTINGS_VERSION, sizeof(record), record);
+    record.speed = 4;
+    write_record(6, SETTINGS_MAGIC, 1, SETTINGS_VERSION, sizeof(record), record);
+
+    SettingsStore store;
+    Settings loaded;
+    CHECK(store.load(loaded));
+    CHECK(loaded.speed == 4);
+    CHECK(store.get_page() == 6);
+    CHECK(store.get_sequence() == 1);
+}
+
+static void test_invalid_headers()
+{
+    erase_flash();
+    Settings record;
+    example_settings(record);
+
+    record.speed = 1;
+    write_record(0, SETTINGS_MAGIC, 1, SETTINGS_VERSION, sizeof(record), record);
+    record.speed = 2;
+    write_record(1, SETTINGS_MAGIC + 1, 2, SETTINGS_VERSION, sizeof(record), record);
+    record.speed = 3;
+    write_record(2, SETTINGS_MAGIC, 3, 0, sizeof(record), record);
+    record.speed = 4;
+    write_record(3, SETTINGS_MAGIC, 4, SETTINGS_VERSION + 1, sizeof(record), record);
+    record.speed = 5;
+    write_record(4, SETTINGS_MAGIC, 5, SETTINGS_VERSION,
+            FLASH_STORAGE_PAGE_SIZE - sizeof(SettingsRecordHeader) + 1, record);
+
+    SettingsStore store;
+    Settings loaded;
+    CHECK(store.load(loaded));
+    CHECK(loaded.speed == 1);
+    CHECK(store.get_page() == 0);
+}
+
+static void test_short_record()
+{
+    erase_flash();
+    Settings record;
+    example_settings(record);
+
+    // A record saved before the elevation fields and motion models were appended
+    write_record(2, SETTINGS_MAGIC, 7, SETTINGS_VERSION, offsetof(Settings, elevation_offset), record);
+
+    SettingsStore store;
+    Settings loaded;
+    memset(&loaded, 0xA5, sizeof(loaded));
+    CHECK(store.load(loaded));
+    CHECK(store.get_page() == 2);
+    CHECK(loaded.azimuth_offset == 12.5);
+    CHECK(loaded.azimuth_maximum == 405.0);
+    CHECK(loaded.speed == 80);
+    CHECK(loaded.filter_smoothing == 0.25f);
+    CHECK(loaded.elevation_offset == ROTATOR_ELEVATION_OFFSET_DEGREES);
+    CHECK(loaded.elevation_minimum == ELEVATION_MINIMUM);
+    CHECK(loaded.elevation_maximum == ELEVATION_MAXIMUM);
+
+    Settings defaults;
+    SettingsStore::defaults(defaults);
+    CHECK(memcmp(&loaded.azimuth_model, &defaults.azimuth_model, sizeof(MotionModel)) == 0);
+    CHECK(memcmp(&loaded.elevation_model, &defaults.elevation_model, sizeof(MotionModel)) == 0);
+}
+
+int main()
+{
+    sim_serial_set_output_handler([](const uint8_t *data, size_t length) {});
+
+    test_empty_flash();
+    test_round_trip();
+    test_rotation();
+    test_crc_mismatch();
+    test_sequence_wraparound();
+    test_invalid_headers();
+    test_short_record();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
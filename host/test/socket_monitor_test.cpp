@@ -0,0 +1,148 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// SocketMonitor against the W5100 register model of the ethernet shim: the TMSR/RMSR values for even
+// socket buffers, verify_memory() with matching and mismatched values, and the per-socket TX-full
+// counts and buffer sizes reported by SOCKETS?.
+
+#include <Arduino.h>
+
+#include <cstdio>
+#include <string>
+
+#include "socket_monitor.h"
+#include "sim_hardware.h"
+
+static int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+static void check(bool condition, const char *text, int line)
+{
+    if (!condition) {
+        printf("line %d: check failed: %s\n", line, text);
+        failures++;
+    }
+}
+
+class StringOutput : public Print {
+public:
+    std::string text;
+
+    size_t write(uint8_t c) override
+    {
+        text += static_cast<char>(c);
+        return 1;
+    }
+};
+
+static std::string sockets_reply()
+{
+    SocketStatsSource source;
+    StringOutput output;
+    while (source.next(output)) {
+    }
+    return output.text;
+}
+
+static void test_memory_register()
+{
+    CHECK(SocketMonitor::memory_register(1) == 0x00);
+    CHECK(SocketMonitor::memory_register(2) == 0x55);
+    CHECK(SocketMonitor::memory_register(4) == 0xAA);
+    CHECK(SocketMonitor::memory_register(8) == 0xFF);
+    CHECK(SocketMonitor::memory_register(3) == 0xAA); // Rounded up to the next size
+    CHECK(SocketMonitor::memory_register(16) == 0xFF);
+    CHECK(SocketMonitor::expected_memory_register() == 0x55);
+
+    for (uint8_t socket = 0; socket < ETHERNET_SOCKET_COUNT; socket++) {
+        CHECK(SocketMonitor::buffer_size_kb(0x55, socket) == 2);
+    }
+    CHECK(SocketMonitor::buffer_size_kb(0x06, 0) == 4);
+    CHECK(SocketMonitor::buffer_size_kb(0x06, 1) == 2);
+    CHECK(SocketMonitor::buffer_size_kb(0x06, 2) == 1);
+    CHECK(SocketMonitor::buffer_size_kb(0xC0, 3) == 8);
+}
+
+static void test_verify_memory()
+{
+    SocketMonitor monitor;
+
+    sim_w5100_set_memory(0x55, 0x55);
+    CHECK(monitor.verify_memory());
+
+    sim_w5100_set_memory(0x06, 0x55); // 4 KB, 2 KB, 1 KB, 1 KB
+    CHECK(!monitor.verify_memory());
+
+    sim_w5100_set_memory(0x55, 0x03); // 8 KB for socket 0 only
+    CHECK(!monitor.verify_memory());
+
+    sim_w5100_set_memory(0xAA, 0xAA); // Even, but twice the memory the chip has
+    CHECK(!monitor.verify_memory());
+
+    sim_w5100_set_memory(0x55, 0x55);
+}
+
+static void test_tx_full()
+{
+    SocketMonitor monitor;
+
+    monitor.record_tx_full(0);
+    monitor.record_tx_full(0);
+    monitor.record_tx_full(3);
+    monitor.record_tx_full(ETHERNET_SOCKET_COUNT); // Not a socket, ignored
+
+    CHECK(monitor.get_tx_full(0) == 2);
+    CHECK(monitor.get_tx_full(1) == 0);
+    CHECK(monitor.get_tx_full(2) == 0);
+    CHECK(monitor.get_tx_full(3) == 1);
+    CHECK(monitor.get_tx_full(ETHERNET_SOCKET_COUNT) == 0);
+}
+
+static void test_sockets_reply()
+{
+    socket_monitor.record_tx_full(1);
+    socket_monitor.record_tx_full(1);
+    socket_monitor.record_tx_full(1);
+    sim_w5100_set_memory(0x06, 0x55);
+
+    std::string reply = sockets_reply();
+    CHECK(reply.find("0 STATE=CLOSED PORT=0 TX_KB=4 TX_FREE=0 RX_KB=2 RX_USED=0 TX_FULL=0\n") != std::string::npos);
+    CHECK(reply.find("1 STATE=CLOSED PORT=0 TX_KB=2 TX_FREE=0 RX_KB=2 RX_USED=0 TX_FULL=3\n") != std::string::npos);
+    CHECK(reply.find("2 STATE=CLOSED PORT=0 TX_KB=1 TX_FREE=0 RX_KB=2 RX_USED=0 TX_FULL=0\n") != std::string::npos);
+    CHECK(reply.find("3 STATE=CLOSED PORT=0 TX_KB=1 TX_FREE=0 RX_KB=2 RX_USED=0 TX_FULL=0\n") != std::string::npos);
+    CHECK(reply.find("\nOK SOCKETS END") != std::string::npos);
+
+    sim_w5100_set_memory(0x55, 0x55);
+}
+
+int main()
+{
+    sim_serial_set_output_handler([](const uint8_t *data, size_t length) {});
+
+    test_memory_register();
+    test_verify_memory();
+    test_tx_full();
+    test_sockets_reply();
+
+    if (failures > 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
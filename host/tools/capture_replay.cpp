@@ -0,0 +1,370 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Replays MA3 encoder captures through PwmDataReader and compares filter configurations.
+//
+// Usage: capture_replay [options] [<capture file>]
+//   --filter MEDIAN,SMOOTHING   filter configuration to evaluate, may be repeated
+//   --seed N                    random seed for the synthetic scenarios
+//   --samples N                 pulses per synthetic scenario
+//   --knots N                   knots of the correction table in the transfer function timing
+//
+// The capture file is the output of the CAPTURE command ("<timestamp> <duty> <period>" lines).
+// Recordings have no ground truth, so the reference is a centered median of the raw angles.
+// Without a file, synthetic scenarios with known angles are replayed: static noise, rotation
+// across the 0/360 wrap-around, glitches and period jitter.
+//
+// For each scenario and filter the harness reports the RMS, 99th percentile and maximum angle
+// error, the latency (time for the output to move halfway after a step, in addition to the
+// pulse period) and the host CPU time per sample. The integer transfer function of the capture
+// interrupt is timed separately, without and with a nonlinearity correction table.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <tc_lib.h>
+
+#include "config.h"
+#include "encoder_correction.h"
+#include "pwm_data_reader.h"
+
+#define MA3_PERIOD_US 1025
+#define MA3_RESOLUTION 1024
+
+#define REFERENCE_MEDIAN_LENGTH 9
+
+#define STEP_SAMPLES 200
+#define STEP_FROM_ANGLE 100.0
+#define STEP_TO_ANGLE 110.0
+
+#define TRANSFER_PASSES 100
+#define TRANSFER_CORRECTION_DEGREES 0.5 // Amplitude of the synthetic correction table
+
+typedef arduino_due::tc_lib::capture<arduino_due::tc_lib::timer_ids::TIMER_TC0> capture_tc0_t;
+
+struct ReplaySample {
+    uint64_t timestamp;
+    uint32_t duty;
+    uint32_t period;
+    double reference;
+};
+
+struct Scenario {
+    std::string name;
+    std::vector<ReplaySample> samples;
+};
+
+struct FilterResult {
+    double rms;
+    double p99;
+    double max;
+    double latency_ms;
+    double ns_per_sample;
+};
+
+static double angle_difference(double a, double b)
+{
+    double difference = fmod(a - b, 360);
+    if (difference > 180) {
+        difference -= 360;
+    } else if (difference < -180) {
+        difference += 360;
+    }
+    return difference;
+}
+
+static double normalize_angle(double angle)
+{
+    angle = fmod(angle, 360);
+    return (angle < 0) ? angle + 360 : angle;
+}
+
+static double raw_angle(const ReplaySample &sample)
+{
+    return sample.period > 0 ? 360.0 * sample.duty / sample.period : 0;
+}
+
+static bool load_capture(FILE *input, Scenario &scenario)
+{
+    char line[256];
+    bool first = true;
+    uint32_t previous = 0;
+    uint64_t timestamp = 0;
+
+    while (fgets(line, sizeof(line), input) != nullptr) {
+        unsigned long sample_timestamp, duty, period;
+        if (sscanf(line, "%lu %lu %lu", &sample_timestamp, &duty, &period) != 3) {
+            continue;
+        }
+
+        // micros() wraps around every ~71 minutes
+        if (first) {
+            first = false;
+        } else {
+            timestamp += static_cast<uint32_t>(sample_timestamp - previous);
+        }
+        previous = static_cast<uint32_t>(sample_timestamp);
+
+        scenario.samples.push_back({timestamp, static_cast<uint32_t>(duty), static_cast<uint32_t>(period), 0});
+    }
+
+    // Reference: centered median of the raw angles, unwrapped around the middle sample
+    size_t count = scenario.samples.size();
+    for (size_t i = 0; i < count; i++) {
+        double center = raw_angle(scenario.samples[i]);
+        std::vector<double> values;
+        for (size_t j = (i >= REFERENCE_MEDIAN_LENGTH / 2) ? i - REFERENCE_MEDIAN_LENGTH / 2 : 0;
+             j < count && j <= i + REFERENCE_MEDIAN_LENGTH / 2; j++) {
+            values.push_back(center + angle_difference(raw_angle(scenario.samples[j]), center));
+        }
+        std::sort(values.begin(), values.end());
+        scenario.samples[i].reference = normalize_angle(values[values.size() / 2]);
+    }
+
+    return count > 0;
+}
+
+struct SyntheticOptions {
+    double start_angle;
+    double rate; // degrees per second
+    double noise_codes; // standard deviation of the position code noise
+    double glitch_probability;
+    double period_jitter_us;
+};
+
+static Scenario synthesize(const char *name, const SyntheticOptions &options, size_t count, std::mt19937 &random)
+{
+    Scenario scenario;
+    scenario.name = name;
+
+    std::normal_distribution<double> noise(0, options.noise_codes > 0 ? options.noise_codes : 1);
+    std::normal_distribution<double> jitter(0, options.period_jitter_us > 0 ? options.period_jitter_us : 1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    uint32_t ticks_per_usec = capture_tc0_t::ticks_per_usec();
+    uint64_t timestamp = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        double period_us = MA3_PERIOD_US + (options.period_jitter_us > 0 ? jitter(random) : 0);
+        double angle = normalize_angle(options.start_angle + options.rate * static_cast<double>(timestamp) / 1e6);
+        double code = angle / 360 * MA3_RESOLUTION + (options.noise_codes > 0 ? noise(random) : 0);
+
+        if (options.glitch_probability > 0 && uniform(random) < options.glitch_probability) {
+            code = uniform(random) * MA3_RESOLUTION;
+        }
+
+        auto position = static_cast<uint32_t>(static_cast<long>(floor(code)) & (MA3_RESOLUTION - 1));
+        ReplaySample sample{};
+        sample.timestamp = timestamp;
+        sample.period = static_cast<uint32_t>(period_us * ticks_per_usec);
+        sample.duty = static_cast<uint32_t>((position + 1) * period_us / MA3_PERIOD_US * ticks_per_usec);
+        sample.reference = angle;
+        scenario.samples.push_back(sample);
+
+        timestamp += static_cast<uint64_t>(period_us);
+    }
+
+    return scenario;
+}
+
+// Time from a noiseless 10 degree step until the filter output has moved halfway
+static double step_latency_ms(PwmFilterConfig filter)
+{
+    capture_tc0_t capture;
+    PwmDataReader<arduino_due::tc_lib::timer_ids::TIMER_TC0> reader(capture, PWM_CAPTURE_WINDOW_DURATION, filter);
+    uint32_t ticks_per_usec = capture_tc0_t::ticks_per_usec();
+    uint32_t period = MA3_PERIOD_US * ticks_per_usec;
+
+    for (int i = 0; i < 2 * STEP_SAMPLES; i++) {
+        double angle = (i < STEP_SAMPLES) ? STEP_FROM_ANGLE : STEP_TO_ANGLE;
+        auto position = static_cast<uint32_t>(angle / 360 * MA3_RESOLUTION);
+        capture.inject_pulse((position + 1) * ticks_per_usec, period);
+        reader.read();
+
+        if (i >= STEP_SAMPLES && reader.angle() >= (STEP_FROM_ANGLE + STEP_TO_ANGLE) / 2) {
+            return (i - STEP_SAMPLES) * MA3_PERIOD_US / 1000.0;
+        }
+    }
+
+    return INFINITY;
+}
+
+static FilterResult evaluate(const Scenario &scenario, PwmFilterConfig filter)
+{
+    capture_tc0_t capture;
+    PwmDataReader<arduino_due::tc_lib::timer_ids::TIMER_TC0> reader(capture, PWM_CAPTURE_WINDOW_DURATION, filter);
+
+    size_t count = scenario.samples.size();
+    std::vector<double> output(count);
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        capture.inject_pulse(scenario.samples[i].duty, scenario.samples[i].period);
+        reader.read();
+        output[i] = reader.angle();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    FilterResult result{};
+    result.ns_per_sample = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())
+                           / static_cast<double>(count);
+    result.latency_ms = step_latency_ms(filter);
+
+    // Errors against the reference at the same time, after the filters have settled
+    std::vector<double> errors;
+    double squares = 0;
+    for (size_t i = REFERENCE_MEDIAN_LENGTH; i < count; i++) {
+        double error = fabs(angle_difference(output[i], scenario.samples[i].reference));
+        errors.push_back(error);
+        squares += error * error;
+    }
+    std::sort(errors.begin(), errors.end());
+    if (!errors.empty()) {
+        result.rms = sqrt(squares / static_cast<double>(errors.size()));
+        result.p99 = errors[static_cast<size_t>(0.99 * static_cast<double>(errors.size() - 1))];
+        result.max = errors.back();
+    }
+
+    return result;
+}
+
+// Host CPU time per sample of the transfer function and correction done for each pulse in the capture interrupt
+static double transfer_ns_per_sample(const Scenario &scenario, EncoderCorrection &correction)
+{
+    volatile int32_t sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < TRANSFER_PASSES; pass++) {
+        for (auto &sample : scenario.samples) {
+            sink = correction.apply(encoder_fraction(sample.duty, sample.period));
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    (void) sink;
+
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())
+           / static_cast<double>(scenario.samples.size() * TRANSFER_PASSES);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--filter MEDIAN,SMOOTHING]... [--seed N] [--samples N] [--knots N] [<capture file>]\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<PwmFilterConfig> filters;
+    unsigned long seed = 1;
+    size_t sample_count = 10000;
+    unsigned long knot_count = ENCODER_CORRECTION_DEFAULT_KNOTS;
+    const char *capture_file = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i];
+        bool has_value = (i + 1 < argc);
+
+        if (strcmp(option, "--filter") == 0 && has_value) {
+            unsigned int median_length;
+            double smoothing;
+            if (sscanf(argv[++i], "%u,%lf", &median_length, &smoothing) != 2) {
+                usage(argv[0]);
+                return 1;
+            }
+            filters.push_back({static_cast<uint8_t>(median_length), smoothing});
+        } else if (strcmp(option, "--seed") == 0 && has_value) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(option, "--samples") == 0 && has_value) {
+            sample_count = strtoul(argv[++i], nullptr, 10);
+        } else if (strcmp(option, "--knots") == 0 && has_value) {
+            knot_count = strtoul(argv[++i], nullptr, 10);
+            if (!is_valid_knot_count(knot_count)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (option[0] != '-' && capture_file == nullptr) {
+            capture_file = option;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (filters.empty()) {
+        filters = {{1, 0}, {3, 0}, {5, 0}, {7, 0}, {1, 0.5}, {1, 0.8}, {3, 0.5}, {5, 0.8}};
+    }
+
+    std::vector<Scenario> scenarios;
+
+    if (capture_file != nullptr) {
+        FILE *input = strcmp(capture_file, "-") == 0 ? stdin : fopen(capture_file, "r");
+        Scenario scenario;
+        scenario.name = capture_file;
+        if (input == nullptr || !load_capture(input, scenario)) {
+            fprintf(stderr, "Cannot read captured pulses from %s\n", capture_file);
+            return 1;
+        }
+        scenarios.push_back(scenario);
+    } else {
+        std::mt19937 random(seed);
+        scenarios.push_back(synthesize("static", {123.4, 0, 0.5, 0, 0}, sample_count, random));
+        scenarios.push_back(synthesize("wrap-cw", {355, 6, 0.5, 0, 0}, sample_count, random));
+        scenarios.push_back(synthesize("wrap-ccw", {5, -6, 0.5, 0, 0}, sample_count, random));
+        scenarios.push_back(synthesize("glitch", {200, 3, 0.5, 0.01, 0}, sample_count, random));
+        scenarios.push_back(synthesize("noisy", {90, 3, 2, 0, 2}, sample_count, random));
+    }
+
+    printf("%-12s %-10s %8s %8s %8s %11s %10s\n", "scenario", "filter", "rms", "p99", "max", "latency_ms", "ns/sample");
+
+    for (auto &scenario : scenarios) {
+        for (auto &filter : filters) {
+            FilterResult result = evaluate(scenario, filter);
+            char filter_name[32];
+            snprintf(filter_name, sizeof(filter_name), "%u,%.2f", filter.median_length, filter.smoothing);
+            printf("%-12s %-10s %8.3f %8.3f %8.3f %11.2f %10.1f\n", scenario.name.c_str(), filter_name,
+                    result.rms, result.p99, result.max, result.latency_ms, result.ns_per_sample);
+        }
+    }
+
+    EncoderCorrectionTable table{};
+    table.knot_count = static_cast<uint16_t>(knot_count);
+    for (uint16_t i = 0; i < table.knot_count; i++) {
+        table.values[i] = static_cast<int16_t>(lround(TRANSFER_CORRECTION_DEGREES / 360
+                * (1L << (ENCODER_POSITION_FRACTION_BITS + ENCODER_CORRECTION_FRACTION_BITS))
+                * sin(2 * M_PI * i / table.knot_count)));
+    }
+    EncoderCorrection uncorrected;
+    EncoderCorrection corrected;
+    corrected.set_table(table);
+
+    printf("\n%-12s %-10s %10s\n", "scenario", "knots", "ns/sample");
+
+    for (auto &scenario : scenarios) {
+        printf("%-12s %-10s %10.1f\n", scenario.name.c_str(), "none", transfer_ns_per_sample(scenario, uncorrected));
+        printf("%-12s %-10lu %10.1f\n", scenario.name.c_str(), knot_count, transfer_ns_per_sample(scenario, corrected));
+    }
+
+    return 0;
+}
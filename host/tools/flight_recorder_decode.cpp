@@ -0,0 +1,311 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Decodes a flight recorder DUMP into a readable timeline.
+//
+// Usage: flight_recorder_decode [<host> [<port>]]
+//   Without arguments, reads the DUMP output from standard input.
+//   With a host, connects to the controller, sends DUMP and decodes the response.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "flight_recorder_format.h"
+#include "motion_model.h"
+
+static const char *input_name(uint8_t input)
+{
+    switch (input) {
+        case FLIGHT_RECORDER_INPUT_THRESHOLD_1:
+            return "T1";
+        case FLIGHT_RECORDER_INPUT_THRESHOLD_2:
+            return "T2";
+        case FLIGHT_RECORDER_INPUT_LIMIT_1:
+            return "L1";
+        case FLIGHT_RECORDER_INPUT_LIMIT_2:
+            return "L2";
+        default:
+            return "?";
+    }
+}
+
+static const char *axis_name(uint8_t axis)
+{
+    return axis == 0 ? "az" : (axis == 1 ? "el" : "?");
+}
+
+static uint8_t source_axis(uint8_t source)
+{
+    return source >> FLIGHT_RECORDER_AXIS_SHIFT;
+}
+
+static uint8_t source_code(uint8_t source)
+{
+    return source & ((1 << FLIGHT_RECORDER_AXIS_SHIFT) - 1);
+}
+
+static const char *settings_action_name(uint8_t action)
+{
+    switch (action) {
+        case FLIGHT_RECORDER_SETTINGS_SAVE:
+            return "SAVE";
+        case FLIGHT_RECORDER_SETTINGS_LOAD:
+            return "LOAD";
+        case FLIGHT_RECORDER_SETTINGS_DEFAULTS:
+            return "DEFAULTS";
+        default:
+            return "?";
+    }
+}
+
+static const char *calibration_state_name(uint8_t state)
+{
+    switch (state) {
+        case MOTION_CALIBRATION_RUNNING:
+            return "START";
+        case MOTION_CALIBRATION_DONE:
+            return "DONE";
+        case MOTION_CALIBRATION_ABORTED:
+            return "ABORTED";
+        default:
+            return "?";
+    }
+}
+
+static std::string ip_address_string(int32_t value)
+{
+    auto address = static_cast<uint32_t>(value);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", address & 0xFF, (address >> 8) & 0xFF,
+            (address >> 16) & 0xFF, (address >> 24) & 0xFF);
+    return buf;
+}
+
+static std::string command_name(int32_t value)
+{
+    auto packed = static_cast<uint32_t>(value);
+    std::string name;
+
+    for (int i = 0; i < 4; i++) {
+        char c = static_cast<char>((packed >> (8 * i)) & 0xFF);
+        if (c == '\0') {
+            break;
+        }
+        name += (c >= 0x20 && c < 0x7F) ? c : '?';
+    }
+
+    return name;
+}
+
+static std::string describe(const FlightRecorderEvent &event)
+{
+    char buf[128];
+
+    switch (event.type) {
+        case FLIGHT_RECORDER_EVENT_BOOT:
+            return "BOOT";
+        case FLIGHT_RECORDER_EVENT_COMMAND:
+            snprintf(buf, sizeof(buf), "COMMAND client=%u %s", event.source, command_name(event.value).c_str());
+            return buf;
+        case FLIGHT_RECORDER_EVENT_TARGET_SET:
+            snprintf(buf, sizeof(buf), "TARGET SET %s=%.2f", axis_name(event.source), event.value / 100.0);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_TARGET_REACHED:
+            snprintf(buf, sizeof(buf), "TARGET REACHED %s=%.2f", axis_name(event.source), event.value / 100.0);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_RELAY:
+            snprintf(buf, sizeof(buf), "RELAY %s %s %s", axis_name(source_axis(event.source)),
+                    source_code(event.source) == FLIGHT_RECORDER_RELAY_CW ? "CW" : "CCW", event.data ? "ON" : "OFF");
+            return buf;
+        case FLIGHT_RECORDER_EVENT_INPUT:
+            snprintf(buf, sizeof(buf), "INPUT %s %s %s", axis_name(source_axis(event.source)),
+                    input_name(source_code(event.source)), event.data ? "ON" : "OFF");
+            return buf;
+        case FLIGHT_RECORDER_EVENT_LIMIT_STOP:
+            snprintf(buf, sizeof(buf), "LIMIT STOP %s %s", axis_name(source_axis(event.source)),
+                    input_name(source_code(event.source)));
+            return buf;
+        case FLIGHT_RECORDER_EVENT_EMERGENCY_STOP:
+            snprintf(buf, sizeof(buf), "EMERGENCY STOP latency=%" PRId32 "us", event.value);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_CAPTURE_OVERRUN:
+            snprintf(buf, sizeof(buf), "CAPTURE OVERRUN%s", event.data ? " (capture stopped)" : "");
+            return buf;
+        case FLIGHT_RECORDER_EVENT_CLIENT_CONNECT:
+            snprintf(buf, sizeof(buf), "CLIENT CONNECT client=%u %s:%u", event.source,
+                    ip_address_string(event.value).c_str(), event.data);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_CLIENT_DISCONNECT:
+            snprintf(buf, sizeof(buf), "CLIENT DISCONNECT %s:%u", ip_address_string(event.value).c_str(), event.data);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_CLIENT_REJECT:
+            snprintf(buf, sizeof(buf), "CLIENT REJECT %s:%u", ip_address_string(event.value).c_str(), event.data);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_CLIENT_EVICT:
+            snprintf(buf, sizeof(buf), "CLIENT EVICT client=%u", event.source);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_TRACKING_FAULT:
+            snprintf(buf, sizeof(buf), "TRACKING FAULT %s=%.2f switches=0x%x", axis_name(event.source),
+                    event.value / 100.0, event.data);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_SETTINGS:
+            snprintf(buf, sizeof(buf), "SETTINGS %s sequence=%" PRId32, settings_action_name(event.source), event.value);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_CALIBRATION:
+            snprintf(buf, sizeof(buf), "CALIBRATION %s %s runs=%" PRId32, axis_name(event.source),
+                    calibration_state_name(event.data), event.value);
+            return buf;
+        case FLIGHT_RECORDER_EVENT_ENCODER_LOST:
+            snprintf(buf, sizeof(buf), "ENCODER LOST %s=%.2f", axis_name(event.source), event.value / 100.0);
+            return buf;
+        default:
+            snprintf(buf, sizeof(buf), "UNKNOWN type=%u source=%u data=%u value=%" PRId32,
+                    event.type, event.source, event.data, event.value);
+            return buf;
+    }
+}
+
+static bool parse_event(const char *line, FlightRecorderEvent &event)
+{
+    uint8_t bytes[FLIGHT_RECORDER_EVENT_SIZE];
+
+    if (strlen(line) < FLIGHT_RECORDER_EVENT_SIZE * 2) {
+        return false;
+    }
+
+    for (int i = 0; i < FLIGHT_RECORDER_EVENT_SIZE; i++) {
+        unsigned int value;
+        if (sscanf(line + 2 * i, "%2x", &value) != 1) {
+            return false;
+        }
+        bytes[i] = static_cast<uint8_t>(value);
+    }
+
+    event.timestamp = bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    event.type = bytes[4];
+    event.source = bytes[5];
+    event.data = static_cast<uint16_t>(bytes[6] | (bytes[7] << 8));
+    event.value = static_cast<int32_t>(bytes[8] | (bytes[9] << 8) | (bytes[10] << 16)
+                                       | (static_cast<uint32_t>(bytes[11]) << 24));
+
+    return true;
+}
+
+static FILE *connect_to_controller(const char *host, const char *port)
+{
+    struct addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *result;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        fprintf(stderr, "Cannot resolve %s\n", host);
+        return nullptr;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        fprintf(stderr, "Cannot connect to %s:%s\n", host, port);
+        return nullptr;
+    }
+
+    const char command[] = "DUMP\n";
+    if (write(fd, command, sizeof(command) - 1) != sizeof(command) - 1) {
+        close(fd);
+        return nullptr;
+    }
+
+    return fdopen(fd, "r");
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+
+    if (argc > 1) {
+        input = connect_to_controller(argv[1], argc > 2 ? argv[2] : "1234");
+        if (input == nullptr) {
+            return 1;
+        }
+    }
+
+    char line[256];
+    bool first = true;
+    uint64_t first_timestamp = 0;
+    uint64_t timestamp = 0;
+    uint32_t previous = 0;
+    unsigned long count = 0;
+
+    while (fgets(line, sizeof(line), input) != nullptr) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (strncmp(line, "OK DUMP END", 11) == 0) {
+            printf("# %s\n", line + 3);
+            break;
+        }
+        if (strncmp(line, "OK DUMP", 7) == 0 || strncmp(line, "ERROR", 5) == 0) {
+            printf("# %s\n", line);
+            continue;
+        }
+
+        FlightRecorderEvent event{};
+        if (!parse_event(line, event)) {
+            continue;
+        }
+
+        // micros() wraps around every ~71 minutes
+        if (first) {
+            timestamp = event.timestamp;
+            first_timestamp = timestamp;
+            first = false;
+        } else {
+            timestamp += static_cast<uint32_t>(event.timestamp - previous);
+        }
+        previous = event.timestamp;
+
+        printf("%12.6f  %s\n", static_cast<double>(timestamp - first_timestamp) / 1e6, describe(event).c_str());
+        count++;
+    }
+
+    fprintf(stderr, "%lu events\n", count);
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return 0;
+}
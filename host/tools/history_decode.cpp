@@ -0,0 +1,273 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Decodes a HISTORY transfer into one line per sample or summary, with the time in seconds on the
+// controller clock (see the TIME command).
+//
+// Usage: history_decode [<host> <port> <HISTORY arguments>...]
+//   Without arguments, reads the HISTORY output from standard input.
+//   With a host, connects to the controller, sends HISTORY with the given arguments and decodes the response.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "history_format.h"
+
+struct HistoryHeader {
+    int mode = HISTORY_MODE_RAW;
+    uint64_t time = 0; // Controller clock at the request
+    double scale = 0;
+    double offset = 0;
+    double velocity_scale = 0;
+};
+
+static bool header_value(const char *line, const char *key, double &value)
+{
+    const char *found = strstr(line, key);
+    if (found == nullptr) {
+        return false;
+    }
+    value = atof(found + strlen(key));
+    return true;
+}
+
+static bool parse_header(const char *line, HistoryHeader &header)
+{
+    header.mode = (strstr(line, " MODE=SUMMARY") != nullptr) ? HISTORY_MODE_SUMMARY : HISTORY_MODE_RAW;
+
+    const char *time = strstr(line, " TIME=");
+    if (time != nullptr) {
+        header.time = strtoull(time + 6, nullptr, 10);
+    }
+
+    return header_value(line, " SCALE=", header.scale) && header_value(line, " OFFSET=", header.offset)
+           && header_value(line, " VEL_SCALE=", header.velocity_scale);
+}
+
+static int base64_value(char c)
+{
+    const char *found = strchr(HISTORY_BASE64_DIGITS, c);
+    return (c != '\0' && found != nullptr) ? static_cast<int>(found - HISTORY_BASE64_DIGITS) : -1;
+}
+
+static void decode_base64(const char *line, std::vector<uint8_t> &bytes)
+{
+    uint32_t group = 0;
+    int bits = 0;
+
+    for (const char *c = line; *c != '\0'; c++) {
+        int value = base64_value(*c);
+        if (value < 0) {
+            continue;
+        }
+        group = (group << 6) | static_cast<uint32_t>(value);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            bytes.push_back(static_cast<uint8_t>(group >> bits));
+        }
+    }
+}
+
+class VarintReader {
+private:
+    const std::vector<uint8_t> &bytes;
+    size_t position = 0;
+
+public:
+    explicit VarintReader(const std::vector<uint8_t> &varint_bytes) : bytes(varint_bytes)
+    {}
+
+    bool at_end()
+    {
+        return position >= bytes.size();
+    }
+
+    uint32_t get_unsigned()
+    {
+        uint32_t value = 0;
+        for (int shift = 0; position < bytes.size() && shift < 35; shift += 7) {
+            uint8_t byte = bytes[position++];
+            value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+        return value;
+    }
+
+    int32_t get_signed()
+    {
+        return history_zigzag_decode(get_unsigned());
+    }
+};
+
+static std::string flag_names(uint32_t flags)
+{
+    static const char *names[] = {"T1", "T2", "L1", "L2", "CW", "CCW"};
+    std::string text;
+
+    for (int i = 0; i < 6; i++) {
+        if (flags & (1u << i)) {
+            if (!text.empty()) {
+                text += ',';
+            }
+            text += names[i];
+        }
+    }
+
+    return text.empty() ? "-" : text;
+}
+
+static unsigned long print_records(const HistoryHeader &header, const std::vector<uint8_t> &bytes)
+{
+    VarintReader reader(bytes);
+    uint32_t timestamp = 0;
+    int32_t position = 0;
+    int32_t velocity = 0;
+    unsigned long count = 0;
+
+    while (!reader.at_end()) {
+        timestamp += static_cast<uint32_t>(reader.get_signed());
+        position += reader.get_signed();
+        uint32_t range = (header.mode == HISTORY_MODE_SUMMARY) ? reader.get_unsigned() : 0;
+        velocity += reader.get_signed();
+        uint32_t flags = reader.get_unsigned();
+
+        // Timestamps are the low 32 bits of the controller clock
+        uint64_t record_time = header.time - static_cast<uint32_t>(static_cast<uint32_t>(header.time) - timestamp);
+        double time = static_cast<double>(record_time) / 1e6;
+
+        if (header.mode == HISTORY_MODE_SUMMARY) {
+            printf("%14.6f  %10.3f  %10.3f  %9.3f  %s\n", time, position * header.scale + header.offset,
+                    (position + static_cast<int32_t>(range)) * header.scale + header.offset,
+                    velocity * header.velocity_scale, flag_names(flags).c_str());
+        } else {
+            printf("%14.6f  %10.3f  %9.3f  %s\n", time, position * header.scale + header.offset,
+                    velocity * header.velocity_scale, flag_names(flags).c_str());
+        }
+        count++;
+    }
+
+    return count;
+}
+
+static FILE *connect_to_controller(const char *host, const char *port, const std::string &command)
+{
+    struct addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *result;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        fprintf(stderr, "Cannot resolve %s\n", host);
+        return nullptr;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (fd < 0) {
+        fprintf(stderr, "Cannot connect to %s:%s\n", host, port);
+        return nullptr;
+    }
+
+    if (write(fd, command.c_str(), command.length()) != static_cast<ssize_t>(command.length())) {
+        close(fd);
+        return nullptr;
+    }
+
+    return fdopen(fd, "r");
+}
+
+int main(int argc, char **argv)
+{
+    FILE *input = stdin;
+
+    if (argc > 1) {
+        if (argc < 4) {
+            fprintf(stderr, "Usage: %s [<host> <port> <HISTORY arguments>...]\n", argv[0]);
+            return 1;
+        }
+
+        std::string command = "HISTORY";
+        for (int i = 3; i < argc; i++) {
+            command += ' ';
+            command += argv[i];
+        }
+        command += '\n';
+
+        input = connect_to_controller(argv[1], argv[2], command);
+        if (input == nullptr) {
+            return 1;
+        }
+    }
+
+    char line[256];
+    HistoryHeader header;
+    bool header_found = false;
+    std::vector<uint8_t> bytes;
+
+    while (fgets(line, sizeof(line), input) != nullptr) {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (strncmp(line, "OK HISTORY END", 14) == 0) {
+            printf("# %s\n", line + 3);
+            break;
+        }
+        if (strncmp(line, "OK HISTORY", 10) == 0) {
+            printf("# %s\n", line + 3);
+            header_found = parse_header(line, header);
+            continue;
+        }
+        if (strncmp(line, "ERROR", 5) == 0) {
+            fprintf(stderr, "%s\n", line);
+            break;
+        }
+        if (header_found) {
+            decode_base64(line, bytes);
+        }
+    }
+
+    unsigned long count = header_found ? print_records(header, bytes) : 0;
+    fprintf(stderr, "%lu records\n", count);
+
+    if (input != stdin) {
+        fclose(input);
+    }
+
+    return 0;
+}
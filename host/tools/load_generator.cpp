@@ -0,0 +1,374 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Opens many connections to the controller protocol port and measures how it copes.
+//
+// Usage: load_generator [options] [<host> [<port>]]
+//   --monitors N          connections that send MONITOR 1 and receive STATE pushes
+//   --commanders N        connections that send commands
+//   --rate HZ             commands per second per commander
+//   --command COMMAND     command to send, must reply with a single line (default: AZ?)
+//   --duration SECONDS    length of the measurement
+//
+// Reports command throughput, reply latency percentiles, STATE inter-arrival jitter and
+// connections rejected with "ERROR: TOO MANY CONNECTIONS". Run it against the controller or
+// against oh3aarot_controller_sim on the same machine.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define STATE_PREFIX "OK STATE"
+#define REJECT_LINE "ERROR: TOO MANY CONNECTIONS"
+
+typedef std::chrono::steady_clock Clock;
+
+enum ConnectionRole {
+    ROLE_MONITOR,
+    ROLE_COMMANDER
+};
+
+struct Connection {
+    int fd = -1;
+    ConnectionRole role = ROLE_MONITOR;
+    bool open = false;
+    bool rejected = false;
+    bool answered = false;
+    std::string input;
+    std::string output;
+    std::deque<Clock::time_point> pending;
+    Clock::time_point next_command;
+    Clock::time_point last_state;
+    bool state_seen = false;
+};
+
+struct Results {
+    unsigned long connect_failures = 0;
+    unsigned long rejections = 0;
+    unsigned long disconnects = 0;
+    unsigned long commands_sent = 0;
+    unsigned long replies = 0;
+    unsigned long errors = 0;
+    unsigned long states = 0;
+    unsigned long long bytes_received = 0;
+    std::vector<double> latencies_ms;
+    std::vector<double> state_intervals_ms;
+};
+
+static double elapsed_ms(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static double percentile(std::vector<double> &values, double fraction)
+{
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    auto index = static_cast<size_t>(fraction * static_cast<double>(values.size() - 1) + 0.5);
+    return values[index];
+}
+
+static int open_connection(const char *host, const char *port)
+{
+    struct addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *result;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(result);
+
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    return fd;
+}
+
+static void close_connection(Connection &connection)
+{
+    if (connection.fd >= 0) {
+        close(connection.fd);
+    }
+    connection.fd = -1;
+    connection.open = false;
+}
+
+static void handle_line(Connection &connection, const std::string &line, Clock::time_point now, Results &results)
+{
+    if (line == REJECT_LINE) {
+        connection.rejected = true;
+        results.rejections++;
+        return;
+    }
+
+    if (line.compare(0, strlen(STATE_PREFIX), STATE_PREFIX) == 0 && connection.role == ROLE_MONITOR) {
+        if (connection.state_seen) {
+            results.state_intervals_ms.push_back(elapsed_ms(connection.last_state, now));
+        }
+        connection.last_state = now;
+        connection.state_seen = true;
+        results.states++;
+        return;
+    }
+
+    if (connection.role == ROLE_COMMANDER && !connection.pending.empty()) {
+        results.latencies_ms.push_back(elapsed_ms(connection.pending.front(), now));
+        connection.pending.pop_front();
+        results.replies++;
+        if (line.compare(0, 5, "ERROR") == 0) {
+            results.errors++;
+        }
+    }
+}
+
+static void receive(Connection &connection, Clock::time_point now, Results &results)
+{
+    char buf[4096];
+
+    while (true) {
+        ssize_t length = read(connection.fd, buf, sizeof(buf));
+        if (length == 0) {
+            if (!connection.rejected) {
+                results.disconnects++;
+            }
+            close_connection(connection);
+            return;
+        }
+        if (length < 0) {
+            return;
+        }
+
+        results.bytes_received += static_cast<unsigned long long>(length);
+        connection.answered = true;
+        connection.input.append(buf, static_cast<size_t>(length));
+
+        size_t end;
+        while ((end = connection.input.find('\n')) != std::string::npos) {
+            std::string line = connection.input.substr(0, end);
+            connection.input.erase(0, end + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r') {
+                line.erase(line.size() - 1);
+            }
+            handle_line(connection, line, now, results);
+        }
+    }
+}
+
+static void send_pending(Connection &connection)
+{
+    while (!connection.output.empty()) {
+        ssize_t length = write(connection.fd, connection.output.data(), connection.output.size());
+        if (length <= 0) {
+            return;
+        }
+        connection.output.erase(0, static_cast<size_t>(length));
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [--monitors N] [--commanders N] [--rate HZ] [--command COMMAND] "
+                    "[--duration SECONDS] [<host> [<port>]]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    int monitors = 4;
+    int commanders = 2;
+    double rate = 10;
+    std::string command = "AZ?";
+    double duration = 10;
+    const char *host = "127.0.0.1";
+    const char *port = "1234";
+    int positional = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char *option = argv[i];
+        bool has_value = (i + 1 < argc);
+
+        if (strcmp(option, "--monitors") == 0 && has_value) {
+            monitors = atoi(argv[++i]);
+        } else if (strcmp(option, "--commanders") == 0 && has_value) {
+            commanders = atoi(argv[++i]);
+        } else if (strcmp(option, "--rate") == 0 && has_value) {
+            rate = atof(argv[++i]);
+        } else if (strcmp(option, "--command") == 0 && has_value) {
+            command = argv[++i];
+        } else if (strcmp(option, "--duration") == 0 && has_value) {
+            duration = atof(argv[++i]);
+        } else if (option[0] != '-' && positional == 0) {
+            host = option;
+            positional++;
+        } else if (option[0] != '-' && positional == 1) {
+            port = option;
+            positional++;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (rate <= 0 || duration <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Results results;
+    std::vector<Connection> connections(static_cast<size_t>(monitors + commanders));
+    auto command_interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    Clock::time_point start = Clock::now();
+
+    for (size_t i = 0; i < connections.size(); i++) {
+        Connection &connection = connections[i];
+        connection.role = (i < static_cast<size_t>(monitors)) ? ROLE_MONITOR : ROLE_COMMANDER;
+        connection.fd = open_connection(host, port);
+        if (connection.fd < 0) {
+            results.connect_failures++;
+            continue;
+        }
+        connection.open = true;
+
+        if (connection.role == ROLE_MONITOR) {
+            connection.output = "MONITOR 1\n";
+        } else {
+            // Spread the commanders evenly over the command interval
+            connection.next_command = start + command_interval * static_cast<long>(i) / static_cast<long>(connections.size());
+        }
+        send_pending(connection);
+    }
+
+    Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(duration));
+    std::vector<struct pollfd> fds;
+
+    while (true) {
+        Clock::time_point now = Clock::now();
+        if (now >= end) {
+            break;
+        }
+
+        for (auto &connection : connections) {
+            if (!connection.open || connection.rejected || connection.role != ROLE_COMMANDER) {
+                continue;
+            }
+            while (connection.next_command <= now) {
+                connection.output += command + "\n";
+                connection.pending.push_back(connection.next_command);
+                connection.next_command += command_interval;
+                results.commands_sent++;
+            }
+            send_pending(connection);
+        }
+
+        fds.clear();
+        for (auto &connection : connections) {
+            if (connection.open) {
+                short events = POLLIN;
+                if (!connection.output.empty()) {
+                    events |= POLLOUT;
+                }
+                fds.push_back({connection.fd, events, 0});
+            }
+        }
+
+        poll(fds.data(), fds.size(), 1);
+
+        now = Clock::now();
+        for (auto &connection : connections) {
+            if (connection.open) {
+                receive(connection, now, results);
+            }
+            if (connection.open) {
+                send_pending(connection);
+            }
+        }
+    }
+
+    double seconds = elapsed_ms(start, Clock::now()) / 1000;
+    int connected = 0;
+    int silent = 0;
+    for (auto &connection : connections) {
+        if (connection.open && !connection.rejected) {
+            connected++;
+            if (!connection.answered) {
+                silent++;
+            }
+        }
+        close_connection(connection);
+    }
+
+    double state_mean = 0;
+    for (double interval : results.state_intervals_ms) {
+        state_mean += interval;
+    }
+    if (!results.state_intervals_ms.empty()) {
+        state_mean /= static_cast<double>(results.state_intervals_ms.size());
+    }
+    double state_variance = 0;
+    for (double interval : results.state_intervals_ms) {
+        state_variance += (interval - state_mean) * (interval - state_mean);
+    }
+    if (!results.state_intervals_ms.empty()) {
+        state_variance /= static_cast<double>(results.state_intervals_ms.size());
+    }
+
+    // Silent connections were accepted by the TCP stack but never served, e.g. no free W5100 socket
+    printf("connections   requested=%zu connected=%d silent=%d rejected=%lu failed=%lu disconnected=%lu\n",
+            connections.size(), connected, silent, results.rejections, results.connect_failures, results.disconnects);
+    printf("commands      sent=%lu replies=%lu errors=%lu unanswered=%lu throughput=%.1f/s\n",
+            results.commands_sent, results.replies, results.errors, results.commands_sent - results.replies,
+            static_cast<double>(results.replies) / seconds);
+    printf("latency ms    p50=%.2f p90=%.2f p99=%.2f max=%.2f\n",
+            percentile(results.latencies_ms, 0.5), percentile(results.latencies_ms, 0.9),
+            percentile(results.latencies_ms, 0.99), percentile(results.latencies_ms, 1.0));
+    printf("state         received=%lu rate=%.1f/s\n", results.states, static_cast<double>(results.states) / seconds);
+    printf("state gap ms  mean=%.2f stddev=%.2f p1=%.2f p99=%.2f max=%.2f\n",
+            state_mean, sqrt(state_variance), percentile(results.state_intervals_ms, 0.01),
+            percentile(results.state_intervals_ms, 0.99), percentile(results.state_intervals_ms, 1.0));
+    printf("received      %.1f kB/s\n", static_cast<double>(results.bytes_received) / 1024 / seconds);
+
+    return 0;
+}
@@ -176,6 +176,14 @@ namespace arduino_due
 
 	uint32_t get_capture_window() { return _ctx_.capture_window; }
 
+	using pulse_callback_t=void(*)(uint32_t,uint32_t);
+
+	// NOTE: the pulse callback is called from the interrupt
+	// handler each time a pulse has been captured, with its
+	// duty and period in ticks. Keep it short.
+	void set_pulse_callback(pulse_callback_t the_callback)
+	{ _ctx_.pulse_callback=the_callback; }
+
 	bool is_overrun(uint32_t the_status) 
 	{ return _ctx_.is_overrun(the_status); }
 
@@ -358,6 +366,7 @@ namespace arduino_due
 	  {
 	    period=timer::info::tc_p()->TC_CHANNEL[timer::info::channel].TC_RB;
 	    duty=period-ra; pulses++;
+	    if(pulse_callback) pulse_callback(duty,period);
 	  }
 
 	  void rc_matched() { ra=duty=period=0; }
@@ -373,6 +382,8 @@ namespace arduino_due
 	  uint32_t rc;
 	  uint32_t capture_window;
 	  uint32_t max_overruns;
+
+	  volatile pulse_callback_t pulse_callback=nullptr;
 	};
 
 	static _capture_ctx_ _ctx_;
@@ -0,0 +1,160 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_CAPTURE_RECORDER_H
+#define OH3AAROT_CONTROLLER_CAPTURE_RECORDER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "client_output_buffer.h"
+#include "monotonic_clock.h"
+
+struct CaptureSample {
+    uint64_t timestamp;
+    uint32_t duty;
+    uint32_t period;
+};
+
+/**
+ * Records raw encoder pulses (capture time in microseconds, duty and period in capture ticks) from
+ * the TC0 capture interrupt for the CAPTURE command. The interrupt handler is the only writer
+ * and the main loop the only reader of the ring.
+ */
+class CaptureRecorder {
+private:
+    CaptureSample samples[CAPTURE_RING_LENGTH];
+    volatile uint32_t write_index = 0;
+    volatile uint32_t read_index = 0;
+    volatile uint32_t remaining = 0;
+    volatile uint32_t lost = 0;
+    bool active = false;
+
+public:
+    bool start(uint32_t count)
+    {
+        if (active) {
+            return false;
+        }
+
+        read_index = write_index;
+        lost = 0;
+        active = true;
+        remaining = count;
+
+        return true;
+    }
+
+    void stop()
+    {
+        remaining = 0;
+        active = false;
+    }
+
+    bool is_active()
+    {
+        return active;
+    }
+
+    /**
+     * Called from the capture interrupt handler.
+     */
+    inline void record(uint64_t time, uint32_t duty, uint32_t period)
+    {
+        if (remaining == 0) {
+            return;
+        }
+        remaining--;
+
+        if (write_index - read_index >= CAPTURE_RING_LENGTH) {
+            lost++;
+            return;
+        }
+
+        CaptureSample &sample = samples[write_index & (CAPTURE_RING_LENGTH - 1)];
+        sample.timestamp = time;
+        sample.duty = duty;
+        sample.period = period;
+        __DMB();
+        write_index++;
+    }
+
+    bool read(CaptureSample &sample)
+    {
+        if (read_index == write_index) {
+            return false;
+        }
+
+        sample = samples[read_index & (CAPTURE_RING_LENGTH - 1)];
+        __DMB();
+        read_index++;
+
+        return true;
+    }
+
+    /**
+     * True when all requested pulses have been captured and read.
+     */
+    bool is_complete()
+    {
+        return remaining == 0 && read_index == write_index;
+    }
+
+    uint32_t get_lost()
+    {
+        return lost;
+    }
+};
+
+extern CaptureRecorder capture_recorder;
+
+/**
+ * Streams captured pulses as "<timestamp> <duty> <period>" lines until the requested count has
+ * been captured. Deleting the source (client disconnects) ends the capture.
+ */
+class CaptureSource : public ClientOutputSource {
+public:
+    ~CaptureSource() override
+    {
+        capture_recorder.stop();
+    }
+
+    bool next(Print &output) override
+    {
+        CaptureSample sample{};
+
+        if (capture_recorder.read(sample)) {
+            MonotonicClock::print(output, sample.timestamp);
+            output.print(' ');
+            output.print(sample.duty);
+            output.print(' ');
+            output.print(sample.period);
+            output.print('\n');
+            return true;
+        }
+
+        if (capture_recorder.is_complete()) {
+            output.print("OK CAPTURE END LOST=");
+            output.println(capture_recorder.get_lost());
+            return false;
+        }
+
+        return true;
+    }
+};
+
+#endif
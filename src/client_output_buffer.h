@@ -0,0 +1,338 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_CLIENT_OUTPUT_BUFFER_H
+#define OH3AAROT_CONTROLLER_CLIENT_OUTPUT_BUFFER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define CLIENT_OUTPUT_POLICY_DROP 0
+#define CLIENT_OUTPUT_POLICY_COALESCE 1
+#define CLIENT_OUTPUT_POLICY_DISCONNECT 2
+
+/**
+ * Produces long output (bulk transfers) piece by piece as the client consumes it.
+ */
+class ClientOutputSource {
+public:
+    virtual ~ClientOutputSource() = default;
+
+    /**
+     * Writes the next line, at most CLIENT_OUTPUT_LINE_LENGTH bytes. Returns false after the last line.
+     * Writing nothing and returning true means that the next line is not available yet.
+     */
+    virtual bool next(Print &output) = 0;
+};
+
+/**
+ * Buffers responses to a client so that nothing ever waits for the network.
+ *
+ * Output is collected line by line and a line is queued only if it fits in the buffer as a whole.
+ * flush_to() writes only as many bytes as the transport reports free (W5100 free TX space),
+ * so a slow consumer fills its own buffer instead of stalling the main loop.
+ *
+ * Lines written between begin_coalesce() and end_coalesce() (periodic STATE pushes) are kept in
+ * a separate slot when the policy is COALESCE: a newer line replaces an unsent older one. Such a line
+ * is never split, one longer than CLIENT_OUTPUT_COALESCED_LINE_LENGTH is dropped as a whole.
+ */
+class ClientOutputBuffer : public Print {
+private:
+    char buffer[CLIENT_OUTPUT_BUFFER_LENGTH];
+    size_t head = 0;
+    size_t tail = 0;
+    size_t used = 0;
+
+    char line[CLIENT_OUTPUT_COALESCED_LINE_LENGTH];
+    size_t line_length = 0;
+    bool line_overflow = false;
+
+    char coalesced_line[CLIENT_OUTPUT_COALESCED_LINE_LENGTH];
+    size_t coalesced_line_length = 0;
+    bool coalescing = false;
+
+    ClientOutputSource *source = nullptr;
+
+    byte policy = CLIENT_OUTPUT_DEFAULT_POLICY;
+    unsigned long backlog_since = 0;
+    bool slow = false;
+    bool transport_full = false;
+    bool line_open = false;
+
+    uint32_t dropped_lines = 0;
+    uint32_t coalesced_lines = 0;
+
+    // Running byte counts, compared to tell when a given reply has been sent
+    uint32_t queued_bytes = 0;
+    uint32_t written_bytes = 0;
+
+    size_t free_space()
+    {
+        return CLIENT_OUTPUT_BUFFER_LENGTH - used;
+    }
+
+    bool enqueue(const char *data, size_t length)
+    {
+        if (length > free_space()) {
+            return false;
+        }
+
+        if (used == 0) {
+            backlog_since = millis();
+        }
+
+        for (size_t i = 0; i < length; i++) {
+            buffer[head] = data[i];
+            head = (head + 1) % CLIENT_OUTPUT_BUFFER_LENGTH;
+        }
+        used += length;
+        queued_bytes += length;
+
+        return true;
+    }
+
+    void drop_line()
+    {
+        line_length = 0;
+        line_overflow = false;
+        dropped_lines++;
+    }
+
+    void commit_line()
+    {
+        if (line_overflow) {
+            drop_line();
+            return;
+        }
+        if (line_length == 0) {
+            return;
+        }
+
+        if (coalescing && policy == CLIENT_OUTPUT_POLICY_COALESCE) {
+            if (coalesced_line_length > 0) {
+                coalesced_lines++;
+            }
+            memcpy(coalesced_line, line, line_length);
+            coalesced_line_length = line_length;
+        } else if (!enqueue(line, line_length)) {
+            dropped_lines++;
+            if (policy == CLIENT_OUTPUT_POLICY_DISCONNECT) {
+                slow = true;
+            }
+        }
+
+        line_length = 0;
+    }
+
+    void fill_from_source()
+    {
+        // Leave room for one more line so that replies to commands still fit during long transfers
+        while (source != nullptr && free_space() >= 2 * CLIENT_OUTPUT_LINE_LENGTH) {
+            uint32_t queued_before = queued_bytes;
+            bool more = source->next(*this);
+            commit_line();
+
+            if (!more) {
+                delete source;
+                source = nullptr;
+            } else if (queued_bytes == queued_before) {
+                break;
+            }
+        }
+    }
+
+public:
+    ~ClientOutputBuffer() override
+    {
+        delete source;
+    }
+
+    size_t write(uint8_t c) override
+    {
+        if (coalescing && line_length >= CLIENT_OUTPUT_COALESCED_LINE_LENGTH) {
+            line_overflow = true;
+        }
+        if (line_overflow) {
+            if (c == '\n') {
+                drop_line();
+            }
+            return 1;
+        }
+
+        line[line_length++] = static_cast<char>(c);
+
+        if (c == '\n' || (!coalescing && line_length >= CLIENT_OUTPUT_LINE_LENGTH)) {
+            commit_line();
+        }
+
+        return 1;
+    }
+
+    using Print::write;
+
+    void begin_coalesce()
+    {
+        commit_line();
+        coalescing = true;
+    }
+
+    void end_coalesce()
+    {
+        commit_line();
+        coalescing = false;
+    }
+
+    /**
+     * Streams output from the source after everything written so far. Takes ownership of the source.
+     */
+    bool set_source(ClientOutputSource *output_source)
+    {
+        if (source != nullptr) {
+            delete output_source;
+            return false;
+        }
+
+        source = output_source;
+        return true;
+    }
+
+    bool has_source()
+    {
+        return source != nullptr;
+    }
+
+    /**
+     * Writes queued output to the transport without blocking.
+     */
+    template<typename T>
+    void flush_to(T &transport)
+    {
+        commit_line();
+        transport_full = false;
+
+        while (true) {
+            fill_from_source();
+
+            if (used == 0 && coalesced_line_length > 0) {
+                enqueue(coalesced_line, coalesced_line_length);
+                coalesced_line_length = 0;
+            }
+            if (used == 0) {
+                break;
+            }
+
+            int available = transport.availableForWrite();
+            if (available <= 0) {
+                transport_full = true;
+                break;
+            }
+
+            size_t contiguous = (tail < head) ? (head - tail) : (CLIENT_OUTPUT_BUFFER_LENGTH - tail);
+            size_t length = contiguous;
+            if (length > static_cast<size_t>(available)) {
+                length = static_cast<size_t>(available);
+            }
+
+            size_t written = transport.write(reinterpret_cast<const uint8_t *>(&buffer[tail]), length);
+            if (written == 0) {
+                break;
+            }
+
+            line_open = (buffer[tail + written - 1] != '\n');
+            tail = (tail + written) % CLIENT_OUTPUT_BUFFER_LENGTH;
+            used -= written;
+            written_bytes += written;
+        }
+
+        if (policy == CLIENT_OUTPUT_POLICY_DISCONNECT && used > 0
+            && (millis() - backlog_since) >= CLIENT_SLOW_DISCONNECT_TIMEOUT) {
+            slow = true;
+        }
+    }
+
+    byte get_policy()
+    {
+        return policy;
+    }
+
+    void set_policy(byte output_policy)
+    {
+        this->policy = output_policy;
+        if (policy != CLIENT_OUTPUT_POLICY_COALESCE && coalesced_line_length > 0) {
+            if (!enqueue(coalesced_line, coalesced_line_length)) {
+                dropped_lines++;
+            }
+            coalesced_line_length = 0;
+        }
+    }
+
+    bool is_slow()
+    {
+        return slow;
+    }
+
+    /**
+     * True when the last flush_to() left output queued because the transport had no free space.
+     */
+    bool is_transport_full()
+    {
+        return transport_full;
+    }
+
+    /**
+     * True when the bytes written to the transport so far end in the middle of a line.
+     */
+    bool is_line_open()
+    {
+        return line_open;
+    }
+
+    size_t backlog()
+    {
+        return used + coalesced_line_length;
+    }
+
+    uint32_t get_dropped_lines()
+    {
+        return dropped_lines;
+    }
+
+    uint32_t get_coalesced_lines()
+    {
+        return coalesced_lines;
+    }
+
+    /**
+     * Total bytes queued so far, including the current unfinished line.
+     */
+    uint32_t get_queued_bytes()
+    {
+        commit_line();
+        return queued_bytes;
+    }
+
+    /**
+     * True when everything queued up to the given get_queued_bytes() value has been written.
+     */
+    bool is_written(uint32_t queued_position)
+    {
+        return (int32_t) (written_bytes - queued_position) >= 0;
+    }
+};
+
+#endif
@@ -30,6 +30,7 @@
 
 #define SERVER_IP_ADDRESS "192.168.0.33"
 #define SERVER_TCP_PORT 1234
+#define ROTCTLD_TCP_PORT 4533 // Hamlib rotctld-compatible protocol
 
 // Pin definitions
 
@@ -40,6 +41,14 @@
 #define PIN_LIMIT_1 28 // IN: Indicator for lowest possible azimuth
 #define PIN_LIMIT_2 29 // IN: Indicator for highest possible azimuth
 #define PIN_SPEED DAC1 // OUT DAC1 = PIN 67: Analog voltage from 0.55V to 2.75 V for rotator speed
+// Azimuth encoder PWM: IN pin 2 (TIOA0), captured by TC0
+
+#define PIN_EL_UP 32 // OUT: Turn elevation up
+#define PIN_EL_DOWN 33 // OUT: Turn elevation down
+#define PIN_EL_LIMIT_1 34 // IN: Indicator for lowest possible elevation
+#define PIN_EL_LIMIT_2 35 // IN: Indicator for highest possible elevation
+#define PIN_EL_SPEED DAC0 // OUT DAC0 = PIN 66: Analog voltage for elevation rotator speed
+// Elevation encoder PWM: IN pin 5 (TIOA6), captured by TC6
 
 #define PIN_ETHERNET_CS 10 // CS (chip select) pin for the W5100 Ethernet controller chip
 #define PIN_ETHERNET_RESET 30 // Pin connected to W5100 Ethernet shield reset to allow automatic reset at power-on
@@ -47,22 +56,103 @@
 // Default settings
 
 #define SERIAL_PORT_SPEED 115200
+#define LOG_LEVEL LOG_LEVEL_INFO // LOG_LEVEL_NONE, LOG_LEVEL_ERROR, LOG_LEVEL_WARN, LOG_LEVEL_INFO or LOG_LEVEL_DEBUG
+#define LOG_RING_LENGTH 32 // Log messages waiting for output, power of two
+#define SERIAL_CONSOLE_DEFAULT_MODE SERIAL_CONSOLE_MODE_LOG // SERIAL_CONSOLE_MODE_LOG or SERIAL_CONSOLE_MODE_PROTOCOL
 
 #define AZIMUTH_MINIMUM -90
 #define AZIMUTH_MAXIMUM 450
 #define DEFAULT_SPEED 50 // Range: 0-100
 #define ANGLE_THRESHOLD 0.3
 
+#ifndef ELEVATION_AXIS_ENABLED
+#define ELEVATION_AXIS_ENABLED 0 // 1 to drive an elevation rotator on the PIN_EL_* pins
+#endif
+#define ELEVATION_MINIMUM 0
+#define ELEVATION_MAXIMUM 90
+#define ELEVATION_PARK 0
+
 #define CLIENT_PUSH_INTERVAL 100 // milliseconds
 #define PWM_CAPTURE_WINDOW_DURATION 10 * 1200 * 100 // hundredths of microseconds
+#ifndef ENCODER_RESOLUTION
+#define ENCODER_RESOLUTION 1024 // MA3 positions per turn: 1024 for the 10-bit and 4096 for the 12-bit PWM version
+#endif
+#define PWM_FILTER_MEDIAN_LENGTH 1 // Encoder angle median filter length, 1 to 7, 1 disables
+#define PWM_FILTER_SMOOTHING 0.0 // Encoder angle exponential smoothing, 0 (off) to <1
+#define ESTIMATOR_ALPHA_SHIFT 6 // Position gain 1/64 of the alpha-beta estimator run on every encoder pulse
+#define ESTIMATOR_BETA_SHIFT 13 // Velocity gain 1/8192, about alpha^2 / (2 - alpha) for critical damping
+#define ESTIMATOR_ETA_MINIMUM_VELOCITY 0.5 // degrees per second, slower axes report no ETA
+#define ENCODER_COMPARATOR_CONFIRM_PULSES 2 // Consecutive encoder pulses past the stop position that drop the relay
 
 // Rotator settings
 
 #define ROTATOR_AZIMUTH_OFFSET_DEGREES 0
+#define ROTATOR_THRESHOLD_TOLERANCE 20 // degrees the threshold switch edges may be away from 0 and 360
+#define ROTATOR_ELEVATION_OFFSET_DEGREES 0
+
+// Motion calibration (CALIBRATE)
+
+#define CALIBRATION_MARGIN 10 // degrees kept from the configured minimum and maximum
+#define CALIBRATION_RUN_DEGREES 60 // Longest test move
+#define CALIBRATION_RUN_TIME 10000 // milliseconds, longest test move
+#define CALIBRATION_START_TIMEOUT 5000 // milliseconds without movement after the relay turns on
+#define CALIBRATION_SETTLE_TIME 1000 // milliseconds without position changes to count as stopped
+#define CALIBRATION_MOTION_DEGREES 0.2 // Position change that counts as movement, above the encoder jitter
+
+// Encoder correction (SWEEP)
+
+#define ENCODER_CORRECTION_MAX_KNOTS 256 // Knots per correction table, power of two
+#define ENCODER_CORRECTION_DEFAULT_KNOTS 128
+#define ENCODER_SWEEP_SPEED 50 // Speed of the constant-velocity turns that measure the correction
+#define ENCODER_SWEEP_RUNUP 10 // degrees turned before measuring, to reach a steady velocity
+
+// Persistent settings
+
+#define FLASH_STORAGE_SETTINGS_PAGE_COUNT 16 // 256-byte flash pages at the end of flash that settings saves rotate over
+#define FLASH_STORAGE_CORRECTION_PAGE_COUNT 10 // Two copies of the encoder correction tables, below the settings
+#define FLASH_STORAGE_PAGE_COUNT (FLASH_STORAGE_SETTINGS_PAGE_COUNT + FLASH_STORAGE_CORRECTION_PAGE_COUNT)
+// The settings stay on the last pages of flash, so growing the storage never moves them
+#define FLASH_STORAGE_CORRECTION_FIRST_PAGE 0
+#define FLASH_STORAGE_SETTINGS_FIRST_PAGE (FLASH_STORAGE_CORRECTION_FIRST_PAGE + FLASH_STORAGE_CORRECTION_PAGE_COUNT)
 
 // Network connection handling
 
-#define ETHERNET_CLIENT_COUNT 8
+#define ETHERNET_RESET_DELAY 100 // milliseconds before and after the W5100 reset pulse
+#define ETHERNET_RESET_PULSE_DURATION 200 // milliseconds
+#define ETHERNET_RETRY_INTERVAL 1000 // milliseconds between attempts to find the W5100
+
+#define ETHERNET_SOCKET_COUNT 4 // W5100 hardware sockets
+#define ETHERNET_LISTENER_COUNT 2 // Sockets kept listening: native and rotctld servers
+#define ETHERNET_CLIENT_COUNT (ETHERNET_SOCKET_COUNT - ETHERNET_LISTENER_COUNT)
+#define ETHERNET_RESERVED_CONTROL_CLIENT_COUNT 1 // Client slots that monitor-only connections cannot take
+#define ETHERNET_MONITOR_CLIENT_COUNT (ETHERNET_CLIENT_COUNT - ETHERNET_RESERVED_CONTROL_CLIENT_COUNT)
+#define CONTROLLER_CLIENT_COUNT (ETHERNET_CLIENT_COUNT + 1) // Ethernet clients and the serial console
 #define ETHERNET_CLIENT_COMMAND_LENGTH 32
+// Longest wait in EthernetClient::stop() for the peer to close before the socket is closed anyway.
+// The library default of 1000 ms would stall the main loop on a peer that has stopped reading.
+#define ETHERNET_CLIENT_CLOSE_TIMEOUT 5 // milliseconds
+#define CLIENT_INPUT_BUFFER_LENGTH 128
+#define CLIENT_RECEIVE_CHUNK_LENGTH 32
+#define CLIENT_PENDING_LINE_COUNT 8 // Receive timestamps kept for command latency tracing
+#define CLIENT_ABORT_BYTE 0x18 // ASCII CAN: stops the rotator immediately wherever it appears in the input
+
+// Client output buffering
+
+#define CLIENT_OUTPUT_BUFFER_LENGTH 512
+#define CLIENT_OUTPUT_LINE_LENGTH 128
+#define CLIENT_OUTPUT_COALESCED_LINE_LENGTH 256 // Coalesced lines are never split, so STATE must fit
+#define CLIENT_OUTPUT_DEFAULT_POLICY CLIENT_OUTPUT_POLICY_COALESCE
+#define CLIENT_SLOW_DISCONNECT_TIMEOUT 5000 // milliseconds
+
+// Diagnostics
+
+#define FLIGHT_RECORDER_EVENT_COUNT 512 // 12 bytes per event
+#define CAPTURE_RING_LENGTH 256 // Raw encoder pulses waiting for output in capture mode, power of two
+#define CAPTURE_MAX_COUNT 1000000
+#define HISTORY_SAMPLE_COUNT 1024 // Per axis, one per encoder pulse (about 1 s), 12 bytes each
+#define HISTORY_SUMMARY_LENGTH 64 // Encoder pulses per min/max summary, power of two
+#define HISTORY_SUMMARY_COUNT 512 // Per axis (about 34 s), 16 bytes each
+#define LATENCY_COMMAND_COUNT 12 // Command names traced separately, the last slot collects the rest
+// #define PIN_LATENCY_DEBUG 31 // OUT: Toggled at each command latency stage for a logic analyzer
 
 #endif
@@ -22,37 +22,170 @@
 #include <Ethernet.h>
 #include "print.h"
 #include "config.h"
+#include "client_output_buffer.h"
+#include "flight_recorder.h"
+#include "latency_tracer.h"
+#include "socket_monitor.h"
 
 #define CLIENT_INPUT_NEW_COMMAND 1
 #define CLIENT_INPUT_WAITING 0
 #define CLIENT_INPUT_TOO_LONG -1
+#define CLIENT_INPUT_OVERFLOW -2
 
-String IpAddressToString(const IPAddress &ipAddress)
-{
-    return String(ipAddress[0]) + String(".") +
-           String(ipAddress[1]) + String(".") +
-           String(ipAddress[2]) + String(".") +
-           String(ipAddress[3]);
-}
+#define CLIENT_PROTOCOL_NATIVE 0
+#define CLIENT_PROTOCOL_ROTCTLD 1
+
+static const char NATIVE_STOP_COMMAND[] = "STOP";
+static const char ROTCTLD_STOP_COMMAND[] = "S";
 
 class ControllerClient {
 private:
+    char input_buffer[CLIENT_INPUT_BUFFER_LENGTH];
+    size_t input_head = 0;
+    size_t input_tail = 0;
+    size_t input_used = 0;
+    bool input_dropping = false; // Input is dropped up to the next line that fits in the buffer
+    unsigned long last_receive_time = 0;
+
+    byte protocol;
+
+    // Progress of matching a stop command line while bytes are received, -1 when the line cannot match
+    const char *stop_command;
+    int stop_command_length;
+    int stop_match = 0;
+    unsigned long stop_received_time = 0;
+
+    // Receive times of complete lines waiting in the input buffer
+    unsigned long line_received_times[CLIENT_PENDING_LINE_COUNT];
+    size_t line_times_head = 0;
+    size_t line_times_used = 0;
+    unsigned long command_received_time = 0;
+
     char client_command_buffer[ETHERNET_CLIENT_COMMAND_LENGTH];
     int client_command_length;
     char client_command[ETHERNET_CLIENT_COMMAND_LENGTH];
     bool monitor;
 
+    // Role for admission: network clients that only monitor can be refused or evicted
+    bool network;
+    bool control;
+    unsigned long connected_time;
+
+    static uint8_t &monitor_only_count()
+    {
+        static uint8_t count = 0;
+        return count;
+    }
+
+    void set_role(bool enable_monitor, bool enable_control)
+    {
+        bool was_monitor_only = is_monitor_only();
+        this->monitor = enable_monitor;
+        this->control = enable_control;
+
+        if (network && was_monitor_only != is_monitor_only()) {
+            if (is_monitor_only()) {
+                monitor_only_count()++;
+            } else {
+                monitor_only_count()--;
+            }
+        }
+    }
+
+    bool scan_for_stop(char c)
+    {
+        if (c == CLIENT_ABORT_BYTE) {
+            return true;
+        }
+        if (c == '\r' || c == '\t') {
+            return false;
+        }
+        if (c == '\n') {
+            bool stop = (stop_match == stop_command_length);
+            stop_match = 0;
+            return stop;
+        }
+
+        if (stop_match >= 0 && stop_match < stop_command_length && c == stop_command[stop_match]) {
+            stop_match++;
+        } else {
+            stop_match = -1;
+        }
+
+        return false;
+    }
+
+    void push_line_received_time(unsigned long time)
+    {
+        if (line_times_used >= CLIENT_PENDING_LINE_COUNT) {
+            return;
+        }
+        line_received_times[(line_times_head + line_times_used) % CLIENT_PENDING_LINE_COUNT] = time;
+        line_times_used++;
+    }
+
+    void store_input(char c)
+    {
+        input_buffer[input_head] = c;
+        input_head = (input_head + 1) % CLIENT_INPUT_BUFFER_LENGTH;
+        input_used++;
+    }
+
+    unsigned long pop_line_received_time()
+    {
+        if (line_times_used == 0) {
+            return 0;
+        }
+        unsigned long time = line_received_times[line_times_head];
+        line_times_head = (line_times_head + 1) % CLIENT_PENDING_LINE_COUNT;
+        line_times_used--;
+        return time;
+    }
+
+    int read_input()
+    {
+        if (input_used == 0) {
+            return -1;
+        }
+
+        char c = input_buffer[input_tail];
+        input_tail = (input_tail + 1) % CLIENT_INPUT_BUFFER_LENGTH;
+        input_used--;
+
+        return c;
+    }
+
+protected:
+    virtual int read_transport(uint8_t *buffer, size_t length) = 0;
+
 public:
-    EthernetClient client;
+    ClientOutputBuffer output;
+    LatencyTrace trace{};
 
-    ControllerClient(EthernetClient ethernet_client)
+    explicit ControllerClient(byte client_protocol, bool network_client = false)
     {
-        this->client = ethernet_client;
+        this->protocol = client_protocol;
+        this->stop_command = (protocol == CLIENT_PROTOCOL_ROTCTLD) ? ROTCTLD_STOP_COMMAND : NATIVE_STOP_COMMAND;
+        this->stop_command_length = (int) strlen(stop_command);
         this->monitor = false;
+        this->network = network_client;
+        // rotctld clients are tracking software
+        this->control = (protocol == CLIENT_PROTOCOL_ROTCTLD);
+        this->connected_time = millis();
         client_command[0] = '\0';
         client_command_length = 0;
     }
 
+    virtual ~ControllerClient()
+    {
+        set_role(false, control);
+    }
+
+    byte get_protocol()
+    {
+        return protocol;
+    }
+
     bool is_monitor_enabled()
     {
         return monitor;
@@ -60,15 +193,121 @@ public:
 
     void set_monitor_enabled(bool enable_monitor)
     {
-        this->monitor = enable_monitor;
+        set_role(enable_monitor, control);
+    }
+
+    bool is_control()
+    {
+        return control;
+    }
+
+    /**
+     * Marks the client as control-capable after it has sent a command that moves the rotator.
+     */
+    void set_control()
+    {
+        set_role(monitor, true);
+    }
+
+    bool is_monitor_only()
+    {
+        return monitor && !control;
+    }
+
+    bool is_network()
+    {
+        return network;
+    }
+
+    unsigned long get_connected_time()
+    {
+        return connected_time;
+    }
+
+    /**
+     * Number of network clients that have enabled monitoring without ever sending a control command.
+     */
+    static uint8_t get_monitor_only_count()
+    {
+        return monitor_only_count();
+    }
+
+    /**
+     * Moves received bytes from the transport to the input buffer. Returns true when a stop command
+     * or the abort byte was seen, so that the caller can stop the rotator before anything else.
+     *
+     * Everything the transport has is read and scanned for stop commands, also when the input buffer
+     * is full. The lines that do not fit are dropped, and a CLIENT_ABORT_BYTE in the last slot of the
+     * buffer, which never holds input otherwise, tells process_input() where.
+     */
+    bool receive()
+    {
+        bool stop = false;
+        unsigned long receive_time = micros();
+        // The bytes arrived after the previous poll, the earliest possible receive time
+        unsigned long poll_time = (last_receive_time != 0) ? last_receive_time : receive_time;
+        last_receive_time = receive_time;
+        uint8_t chunk[CLIENT_RECEIVE_CHUNK_LENGTH];
+
+        while (true) {
+            int received = read_transport(chunk, sizeof(chunk));
+            if (received <= 0) {
+                break;
+            }
+
+            for (int i = 0; i < received; i++) {
+                char c = (char) chunk[i];
+
+                if (scan_for_stop(c)) {
+                    stop = true;
+                    stop_received_time = poll_time;
+                }
+                if (c == CLIENT_ABORT_BYTE) {
+                    continue;
+                }
+
+                if (input_dropping) {
+                    // Resume at the start of the next line
+                    input_dropping = (c != '\n');
+                    continue;
+                }
+                if (input_used >= CLIENT_INPUT_BUFFER_LENGTH - 1) {
+                    // The marker ends what was stored of the dropped line, a full buffer already ends with one
+                    if (input_used < CLIENT_INPUT_BUFFER_LENGTH) {
+                        store_input(CLIENT_ABORT_BYTE);
+                    }
+                    input_dropping = (c != '\n');
+                    continue;
+                }
+
+                if (c == '\n') {
+                    push_line_received_time(receive_time);
+                }
+                store_input(c);
+            }
+        }
+
+        return stop;
+    }
+
+    /**
+     * Time of the poll before the one that received the last stop command, so that the stop latency
+     * covers the whole time from the stop arriving to the relays dropping.
+     */
+    unsigned long get_stop_received_time()
+    {
+        return stop_received_time;
     }
 
     int process_input()
     {
-        while (client.available() > 0) {
-            char c = client.read();
+        while (input_used > 0) {
+            char c = (char) read_input();
 
             if (client_command_length >= (ETHERNET_CLIENT_COMMAND_LENGTH - 1)) {
+                if (c == '\n') {
+                    pop_line_received_time();
+                }
                 client_command_buffer[0] = '\0';
                 client_command_length = 0;
                 return CLIENT_INPUT_TOO_LONG;
@@ -77,8 +316,14 @@ public:
             if (c == '\r' || c == '\t') {
                 continue;
             }
+            if (c == CLIENT_ABORT_BYTE) {
+                client_command_buffer[0] = '\0';
+                client_command_length = 0;
+                return CLIENT_INPUT_OVERFLOW;
+            }
             if (c == '\n') {
                 strcpy(client_command, client_command_buffer);
+                command_received_time = pop_line_received_time();
                 client_command_buffer[0] = '\0';
                 client_command_length = 0;
                 return CLIENT_INPUT_NEW_COMMAND;
@@ -97,21 +342,82 @@ public:
         return client_command;
     }
 
-    bool connected()
+    /**
+     * Time when the line of the current command was received, 0 if unknown.
+     */
+    unsigned long get_command_received_time()
+    {
+        return command_received_time;
+    }
+
+    virtual void flush_output() = 0;
+
+    virtual bool connected() = 0;
+
+    virtual void stop() = 0;
+
+    virtual bool cleanup() = 0;
+};
+
+class EthernetControllerClient : public ControllerClient {
+private:
+    EthernetClient client;
+
+protected:
+    int read_transport(uint8_t *buffer, size_t length) override
+    {
+        if (client.available() <= 0) {
+            return 0;
+        }
+
+        return client.read(buffer, length);
+    }
+
+public:
+    explicit EthernetControllerClient(EthernetClient ethernet_client, byte client_protocol = CLIENT_PROTOCOL_NATIVE)
+            : ControllerClient(client_protocol, true)
+    {
+        this->client = ethernet_client;
+        this->client.setConnectionTimeout(ETHERNET_CLIENT_CLOSE_TIMEOUT);
+    }
+
+    void flush_output() override
+    {
+        bool was_full = output.is_transport_full();
+        output.flush_to(client);
+
+        if (output.is_transport_full() && !was_full) {
+            socket_monitor.record_tx_full(client.getSocketNumber());
+        }
+    }
+
+    bool connected() override
     {
         return client && client.connected();
     }
 
-    void stop()
+    void stop() override
     {
         return client.stop();
     }
 
-    bool cleanup()
+    bool cleanup() override
     {
         if (!client.connected()) {
-            p("Closed TCP connection to %s:%d\n", IpAddressToString(client.remoteIP()).c_str(), client.remotePort());
-            delay(2);
+            IPAddress remote_ip = client.remoteIP();
+            LOG_INFO("Closed TCP connection to " LOG_IP_FORMAT ":%d\n", LOG_IP_ARGS(remote_ip), client.remotePort());
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_CLIENT_DISCONNECT, 0, client.remotePort(),
+                    FlightRecorder::pack_ip_address(remote_ip));
+            client.stop();
+            return true;
+        }
+
+        if (output.is_slow()) {
+            IPAddress remote_ip = client.remoteIP();
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_CLIENT_DISCONNECT, 0, client.remotePort(),
+                    FlightRecorder::pack_ip_address(remote_ip));
+            LOG_WARN("Disconnecting slow TCP client " LOG_IP_FORMAT ":%d: dropped %d lines\n",
+                    LOG_IP_ARGS(remote_ip), client.remotePort(), output.get_dropped_lines());
             client.stop();
             return true;
         }
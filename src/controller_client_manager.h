@@ -21,64 +21,203 @@
 
 #include "controller_client.h"
 #include "controller_command_handler.h"
+#include "rotctld_command_handler.h"
 #include "print.h"
+#include "flight_recorder.h"
+#include "latency_tracer.h"
 
 class ControllerClientManager {
 private:
-    ControllerClient *clients[ETHERNET_CLIENT_COUNT]{};
+    ControllerClient *clients[CONTROLLER_CLIENT_COUNT]{};
     ControllerCommandHandler *handler;
+    RotctldCommandHandler *rotctld_handler;
     unsigned long last_client_push_time = 0;
 
 public:
     explicit ControllerClientManager(ControllerCommandHandler *handler)
     {
         this->handler = handler;
+        this->rotctld_handler = new RotctldCommandHandler(handler);
 
         for (auto &client : this->clients) {
             client = nullptr;
         }
     }
 
-    bool add_client(EthernetClient ethernet_client)
+    /**
+     * Returns the slot of the oldest network client that has not sent a control command, monitor-only
+     * clients first, or -1 if there is none.
+     */
+    int find_evictable_client()
     {
-        bool free_client_slot_found = false;
-        p("New TCP connection from %s:%d\n", IpAddressToString(ethernet_client.remoteIP()).c_str(),
+        int oldest = -1;
+
+        for (byte i = 0; i < CONTROLLER_CLIENT_COUNT; i++) {
+            ControllerClient *client = clients[i];
+            if (client == nullptr || !client->is_network() || client->is_control()) {
+                continue;
+            }
+            if (oldest >= 0 && clients[oldest]->is_monitor_only() != client->is_monitor_only()) {
+                if (client->is_monitor_only()) {
+                    oldest = i;
+                }
+                continue;
+            }
+            if (oldest < 0 || (long) (client->get_connected_time() - clients[oldest]->get_connected_time()) < 0) {
+                oldest = i;
+            }
+        }
+
+        return oldest;
+    }
+
+    void evict_client(byte slot)
+    {
+        ControllerClient *client = clients[slot];
+
+        if (client->is_monitor_only()) {
+            client->output.println("ERROR EVICTED: TOO MANY CONNECTIONS, POLL STATE INSTEAD");
+        } else {
+            client->output.println("ERROR EVICTED: TOO MANY CONNECTIONS");
+        }
+        client->flush_output();
+        LOG_WARN("Evicting client %d\n", slot);
+        flight_recorder.record(FLIGHT_RECORDER_EVENT_CLIENT_EVICT, slot);
+        client->stop();
+
+        delete client;
+        clients[slot] = nullptr;
+    }
+
+    bool add_client(EthernetClient ethernet_client, byte protocol = CLIENT_PROTOCOL_NATIVE)
+    {
+        IPAddress remote_ip = ethernet_client.remoteIP();
+        LOG_INFO("New TCP connection from " LOG_IP_FORMAT ":%d\n", LOG_IP_ARGS(remote_ip),
                 ethernet_client.remotePort());
 
-        for (auto &client : clients) {
-            if (client == nullptr) {
-                client = new ControllerClient(ethernet_client);
-                free_client_slot_found = true;
-                break;
+        int slot = -1;
+        byte network_clients = 0;
+
+        for (byte i = 0; i < CONTROLLER_CLIENT_COUNT; i++) {
+            if (clients[i] == nullptr) {
+                if (slot < 0) {
+                    slot = i;
+                }
+            } else if (clients[i]->is_network()) {
+                network_clients++;
             }
         }
 
-        if (!free_client_slot_found) {
+        // Under pressure the oldest connection that does not control the rotator makes way for the new one
+        if (slot < 0 || network_clients >= ETHERNET_CLIENT_COUNT) {
+            slot = find_evictable_client();
+            if (slot >= 0) {
+                evict_client(slot);
+            }
+        }
+
+        if (slot < 0) {
+            // Opening connections must not stall the loop, whatever the peer does with the socket
+            ethernet_client.setConnectionTimeout(ETHERNET_CLIENT_CLOSE_TIMEOUT);
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_CLIENT_REJECT, 0, ethernet_client.remotePort(),
+                    FlightRecorder::pack_ip_address(remote_ip));
             ethernet_client.println("ERROR: TOO MANY CONNECTIONS");
-            p("Cannot handle TCP connection from %s:%d: too many connections\n",
-                    IpAddressToString(ethernet_client.remoteIP()).c_str(), ethernet_client.remotePort());
+            LOG_WARN("Cannot handle TCP connection from " LOG_IP_FORMAT ":%d: too many connections\n",
+                    LOG_IP_ARGS(remote_ip), ethernet_client.remotePort());
             ethernet_client.stop();
             return false;
         }
 
+        clients[slot] = new EthernetControllerClient(ethernet_client, protocol);
+        flight_recorder.record(FLIGHT_RECORDER_EVENT_CLIENT_CONNECT, slot, ethernet_client.remotePort(),
+                FlightRecorder::pack_ip_address(remote_ip));
+
         return true;
     }
 
-    void process_input()
+    bool add_client(ControllerClient *new_client)
+    {
+        for (auto &client : clients) {
+            if (client == nullptr) {
+                client = new_client;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void receive_input()
     {
         for (auto client : clients) {
             if (client == nullptr) {
                 continue;
             }
 
+            if (client->receive()) {
+                client->set_control();
+                handler->emergency_stop(client->get_stop_received_time());
+            }
+        }
+    }
+
+    void handle_command(ControllerClient *client)
+    {
+        unsigned long received_time = client->get_command_received_time();
+        bool traced = (received_time != 0);
+        uint8_t command = 0;
+
+        if (traced) {
+            command = latency_tracer.get_command_index(client->get_command());
+            latency_tracer.record(command, LATENCY_STAGE_PARSE, received_time);
+            latency_tracer.begin_execute(command, received_time);
+        }
+
+        if (ControllerCommandHandler::is_control_command(client->get_command())) {
+            client->set_control();
+        }
+
+        if (client->get_protocol() == CLIENT_PROTOCOL_ROTCTLD) {
+            rotctld_handler->handle_command(String(client->get_command()), client, &client->output);
+        } else {
+            handler->handle_command(String(client->get_command()), client, &client->output);
+        }
+
+        if (traced) {
+            latency_tracer.end_execute();
+            latency_tracer.record(command, LATENCY_STAGE_EXECUTE, received_time);
+
+            client->trace.command = command;
+            client->trace.received_time = received_time;
+            client->trace.output_end = client->output.get_queued_bytes();
+            client->trace.flush_pending = true;
+        }
+    }
+
+    void process_input()
+    {
+        for (byte i = 0; i < CONTROLLER_CLIENT_COUNT; i++) {
+            ControllerClient *client = clients[i];
+            if (client == nullptr) {
+                continue;
+            }
+
             int result = client->process_input();
 
             switch (result) {
                 case CLIENT_INPUT_NEW_COMMAND:
-                    handler->handle_command(String(client->get_command()), client, &client->client);
+                    flight_recorder.record(FLIGHT_RECORDER_EVENT_COMMAND, i, 0,
+                            FlightRecorder::pack_name(client->get_command()));
+                    handle_command(client);
                     break;
                 case CLIENT_INPUT_TOO_LONG:
-                    client->client.println("ERROR COMMAND TOO LONG");
+                case CLIENT_INPUT_OVERFLOW:
+                    if (client->get_protocol() == CLIENT_PROTOCOL_ROTCTLD) {
+                        client->output.print("RPRT -1\n");
+                    } else {
+                        client->output.println((result == CLIENT_INPUT_OVERFLOW) ? "ERROR INPUT OVERFLOW"
+                                                                                 : "ERROR COMMAND TOO LONG");
+                    }
                     break;
                 default:
                     break;
@@ -98,12 +237,30 @@ public:
                 continue;
             }
 
-            handled |= handler->handle_command(String(command), client, &client->client);
+            client->output.begin_coalesce();
+            handled |= handler->handle_command(String(command), client, &client->output);
+            client->output.end_coalesce();
         }
 
         return handled;
     }
 
+    void flush_output()
+    {
+        for (auto client : clients) {
+            if (client == nullptr) {
+                continue;
+            }
+
+            client->flush_output();
+
+            if (client->trace.flush_pending && client->output.is_written(client->trace.output_end)) {
+                latency_tracer.record(client->trace.command, LATENCY_STAGE_FLUSH, client->trace.received_time);
+                client->trace.flush_pending = false;
+            }
+        }
+    }
+
     bool is_client_monitor_enabled(ControllerClient *client)
     {
         return client->is_monitor_enabled();
@@ -128,13 +285,14 @@ public:
 
     void cleanup()
     {
-        for (byte i = 0; i < ETHERNET_CLIENT_COUNT; i++) {
+        for (byte i = 0; i < CONTROLLER_CLIENT_COUNT; i++) {
             if (clients[i] == nullptr) {
                 continue;
             }
 
-            p("Client: %d\n", i);
+            LOG_DEBUG("Client: %d\n", i);
             if (clients[i]->cleanup()) {
+                delete clients[i];
                 clients[i] = nullptr;
             }
         }
@@ -19,157 +19,361 @@
 #ifndef OH3AAROT_CONTROLLER_CONTROLLER_COMMAND_HANDLER_H
 #define OH3AAROT_CONTROLLER_CONTROLLER_COMMAND_HANDLER_H
 
-#include "iointerface.h"
+#include "rotator_axis.h"
 #include "controller_client.h"
-#include "pwm_data_reader.h"
+#include "flight_recorder.h"
+#include "profiler.h"
+#include "latency_tracer.h"
+#include "capture_recorder.h"
+#include "history_recorder.h"
+#include "monotonic_clock.h"
+#include "encoder_sweep.h"
+#include "motion_calibration.h"
+#include "rotator_state.h"
+#include "settings.h"
+#include "network_startup.h"
+
+// Longest STATE line: Print writes a double as at most 14 characters ("-4294967040.00", larger values
+// as "ovf") and a 64-bit time as at most 20 digits
+#define STATE_NUMBER_MAX_LENGTH 14
+#define STATE_TIME_MAX_LENGTH 20
+#define STATE_LINE_MAX_LENGTH (sizeof("OK STATE AZ= EL= SPEED= FLAGS= EL_FLAGS= VEL= EL_VEL= TIME= EL_TIME=\r\n") - 1 \
+        + 4 * STATE_NUMBER_MAX_LENGTH + 3 + 2 * AXIS_FLAGS_MAX_LENGTH + 2 * STATE_TIME_MAX_LENGTH)
+
+static_assert(STATE_LINE_MAX_LENGTH <= CLIENT_OUTPUT_COALESCED_LINE_LENGTH, "STATE pushes do not fit in a coalesced line");
 
 class ControllerCommandHandler {
 private:
-    IOInterface *io;
-    double azimuth_offset;
-    double target_az = 0;
-    bool target_az_set = false;
+    Axis *axes[AXIS_COUNT];
 
-public:
-    explicit ControllerCommandHandler(IOInterface *io, double azimuth_offset)
+    uint32_t emergency_stop_count = 0;
+    unsigned long emergency_stop_latency_last = 0;
+    unsigned long emergency_stop_latency_max = 0;
+
+    MotionCalibration calibration;
+    EncoderSweep sweep;
+
+    Axis *azimuth()
     {
-        this->io = io;
-        this->azimuth_offset = azimuth_offset;
+        return axes[AXIS_AZIMUTH];
     }
 
-    double get_az()
+    Axis *elevation()
     {
-        double angle = pwm_data_reader.angle();
+        return has_elevation() ? axes[AXIS_COUNT - 1] : nullptr;
+    }
 
-        if (io->getThreshold1State()) {
-            if (angle >= 270 && angle < 360) {
-                angle = -(360 - angle);
-            }
-        } else if (io->getThreshold2State()) {
-            if (angle >= 0 && angle < 110) {
-                angle += 360;
-            }
+    /**
+     * Axis selected by an optional AZ or EL argument, nullptr for anything else.
+     */
+    Axis *parse_axis(const String &axis_name)
+    {
+        if (axis_name.length() == 0 || axis_name == "AZ") {
+            return azimuth();
         }
+        if (axis_name == "EL") {
+            return elevation();
+        }
+        return nullptr;
+    }
 
-        return angle + azimuth_offset;
+    const char *get_axis_name(Axis *axis)
+    {
+        return (axis == azimuth()) ? "AZ" : "EL";
     }
 
-    void set_az(double az)
+    bool is_calibrating()
     {
-        double current_az = get_az();
+        return calibration.get_status() == MOTION_CALIBRATION_RUNNING
+               || sweep.get_status() == MOTION_CALIBRATION_RUNNING;
+    }
 
-        target_az = az;
-        target_az_set = true;
+    void abort_calibration()
+    {
+        calibration.abort();
+        sweep.abort();
+    }
 
-        if (current_az < (az - ANGLE_THRESHOLD)) {
-            io->setCounterClockwise(false);
-            io->setClockwise(true);
-        } else if (current_az > (az + ANGLE_THRESHOLD)) {
-            io->setClockwise(false);
-            io->setCounterClockwise(true);
-        } else {
-            io->setClockwise(false);
-            io->setCounterClockwise(false);
+public:
+    explicit ControllerCommandHandler(Axis *const controlled_axes[AXIS_COUNT])
+    {
+        for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+            this->axes[i] = controlled_axes[i];
         }
     }
 
-    void stop_if_direction_target_reached()
+    /**
+     * Applies the current settings to the hardware.
+     */
+    void apply_settings()
     {
-        double current_angle = get_az();
+        for (auto axis : axes) {
+            axis->set_speed(settings.speed);
+            axis->set_filter({settings.filter_median_length, settings.filter_smoothing});
+        }
+    }
 
-        if (target_az_set) {
-            if (io->getClockwise()) {
-                if (current_angle >= (target_az - ANGLE_THRESHOLD)) {
-                    io->setClockwise(false);
-                    target_az_set = false;
-                }
-            }
+    void update_state()
+    {
+        // Keeps the 64-bit clock counting micros() wraps
+        monotonic_clock.micros64();
 
-            if (io->getCounterClockwise()) {
-                if (current_angle <= (target_az + ANGLE_THRESHOLD)) {
-                    io->setCounterClockwise(false);
-                    target_az_set = false;
-                }
+        for (auto axis : axes) {
+            axis->update_state();
+            // The axis has stopped itself, calibration needs the encoder
+            if (axis->get_state().stopped && is_calibrating()) {
+                abort_calibration();
             }
         }
+    }
 
-        if (io->getLimit2State() && io->getClockwise()) {
-            io->setClockwise(false);
-            target_az_set = false;
-        }
-        if (io->getLimit1State() && io->getCounterClockwise()) {
-            io->setCounterClockwise(false);
-            target_az_set = false;
+    void stop_if_direction_target_reached()
+    {
+        for (auto axis : axes) {
+            axis->stop_if_direction_target_reached();
         }
+        calibration.step();
+        sweep.step();
     }
 
-    String get_flags()
+    static bool has_elevation()
     {
-        String flags = String();
+        return AXIS_COUNT > AXIS_ELEVATION;
+    }
 
-        if (io->getClockwise()) {
-            flags.concat("CW,");
-        }
-        if (io->getCounterClockwise()) {
-            flags.concat("CCW,");
-        }
-        if (io->getThreshold1State()) {
-            flags.concat("T1,");
-        }
-        if (io->getThreshold2State()) {
-            flags.concat("T2,");
-        }
-        if (io->getLimit1State()) {
-            flags.concat("L1,");
-        }
-        if (io->getLimit2State()) {
-            flags.concat("L2");
-        }
-        if (flags.endsWith(",")) {
-            flags.remove(flags.length() - 1, 1);
+    const RotatorState &get_state()
+    {
+        return azimuth()->get_state();
+    }
+
+    double get_az()
+    {
+        return azimuth()->get_position();
+    }
+
+    void set_az(double az)
+    {
+        abort_calibration();
+        azimuth()->set_target(az);
+    }
+
+    bool is_valid_az(double az)
+    {
+        return azimuth()->is_in_range(az);
+    }
+
+    double get_el()
+    {
+        return has_elevation() ? elevation()->get_position() : 0.0;
+    }
+
+    void set_el(double el)
+    {
+        abort_calibration();
+        if (has_elevation()) {
+            elevation()->set_target(el);
         }
+    }
 
-        return flags;
+    bool is_valid_el(double el)
+    {
+        return has_elevation() && elevation()->is_in_range(el);
+    }
+
+    String get_flags()
+    {
+        return azimuth()->get_flags();
     }
 
     int get_speed()
     {
-        return io->getSpeed();
+        return azimuth()->get_speed();
     }
 
     void set_speed(int speed)
     {
-        io->setSpeed(speed);
+        abort_calibration();
+        for (auto axis : axes) {
+            axis->set_speed(speed);
+        }
+        settings.speed = (uint8_t) speed;
     }
 
     void stop()
     {
-        io->setClockwise(false);
-        io->setCounterClockwise(false);
-        target_az_set = false;
+        abort_calibration();
+        for (auto axis : axes) {
+            axis->stop();
+        }
+    }
+
+    void emergency_stop(unsigned long received_time)
+    {
+        stop();
+
+        unsigned long latency = micros() - received_time;
+        emergency_stop_count++;
+        emergency_stop_latency_last = latency;
+        if (latency > emergency_stop_latency_max) {
+            emergency_stop_latency_max = latency;
+        }
+        flight_recorder.record(FLIGHT_RECORDER_EVENT_EMERGENCY_STOP, 0, 0, (int32_t) latency);
     }
 
     void park()
     {
-        set_az(0);
+        abort_calibration();
+        for (auto axis : axes) {
+            axis->park();
+        }
     }
 
     void reset()
     {
         stop();
-        io->setSpeed(DEFAULT_SPEED);
+        for (auto axis : axes) {
+            axis->set_speed(settings.speed);
+        }
     }
 
     void move_cw()
     {
-        io->setCounterClockwise(false);
-        io->setClockwise(true);
+        abort_calibration();
+        azimuth()->move_cw();
     }
 
     void move_ccw()
     {
-        io->setClockwise(false);
-        io->setCounterClockwise(true);
+        abort_calibration();
+        azimuth()->move_ccw();
+    }
+
+    void move_up()
+    {
+        abort_calibration();
+        if (has_elevation()) {
+            elevation()->move_cw();
+        }
+    }
+
+    void move_down()
+    {
+        abort_calibration();
+        if (has_elevation()) {
+            elevation()->move_ccw();
+        }
+    }
+
+    /**
+     * Starts moving the axis that has the given direction name, returns false for unknown directions.
+     */
+    bool move(const String &direction)
+    {
+        abort_calibration();
+        for (auto axis : axes) {
+            if (direction == axis->get_cw_name()) {
+                axis->move_cw();
+                return true;
+            }
+            if (direction == axis->get_ccw_name()) {
+                axis->move_ccw();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * True for commands that move or stop the rotator, which make a client control-capable.
+     */
+    static bool is_control_command(const char *command)
+    {
+        static const char *const control_commands[] = {"AZ", "EL", "POS", "MOVE", "STOP", "PARK", "RESET", "SPEED",
+                                                          "RATE", "CALIBRATE", "SWEEP"};
+
+        size_t length = strcspn(command, " ");
+        for (auto control_command : control_commands) {
+            if (strlen(control_command) == length && strncmp(command, control_command, length) == 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static void print_eta(Print *response, Axis *axis)
+    {
+        double seconds;
+        switch (axis->get_eta(seconds)) {
+            case AXIS_ETA_AVAILABLE:
+                response->print(seconds, 1);
+                break;
+            case AXIS_ETA_NO_TARGET:
+                response->print("NONE");
+                break;
+            default:
+                response->print("UNKNOWN");
+                break;
+        }
+    }
+
+    static void print_rate(Print *response, Axis *axis)
+    {
+        const MotionModel &model = axis->get_model();
+        if (!model.valid) {
+            response->print("UNKNOWN");
+            return;
+        }
+
+        int speed = axis->get_speed();
+        response->print((motion_model_velocity(model, MOTION_DIRECTION_CW, speed)
+                         + motion_model_velocity(model, MOTION_DIRECTION_CCW, speed)) / 2, 2);
+    }
+
+    static void print_model_values(Print *response, const uint16_t values[MOTION_MODEL_SPEED_COUNT])
+    {
+        for (int i = 0; i < MOTION_MODEL_SPEED_COUNT; i++) {
+            if (i > 0) {
+                response->print(',');
+            }
+            response->print(values[i] / 100.0, 2);
+        }
+    }
+
+    static void print_model_pair(Print *response, const float values[2], int digits)
+    {
+        response->print(values[MOTION_DIRECTION_CW], digits);
+        response->print(',');
+        response->print(values[MOTION_DIRECTION_CCW], digits);
+    }
+
+    static const char *get_calibration_status_name(uint8_t status)
+    {
+        switch (status) {
+            case MOTION_CALIBRATION_IDLE:
+                return "IDLE";
+            case MOTION_CALIBRATION_RUNNING:
+                return "RUNNING";
+            case MOTION_CALIBRATION_DONE:
+                return "DONE";
+            default:
+                return "ABORTED";
+        }
+    }
+
+    static const char *get_output_policy_name(byte policy)
+    {
+        switch (policy) {
+            case CLIENT_OUTPUT_POLICY_DROP:
+                return "DROP";
+            case CLIENT_OUTPUT_POLICY_COALESCE:
+                return "COALESCE";
+            case CLIENT_OUTPUT_POLICY_DISCONNECT:
+                return "DISCONNECT";
+            default:
+                return "UNKNOWN";
+        }
     }
 
     bool handle_command(String command, ControllerClient *client, Print *response)
@@ -194,7 +398,7 @@ public:
             double az_angle = az_string.toDouble();
             // TODO: detect angle parse errors!
 
-            if (az_angle < AZIMUTH_MINIMUM || az_angle > AZIMUTH_MAXIMUM) {
+            if (!is_valid_az(az_angle)) {
                 response->println("ERROR INVALID AZIMUTH");
                 return false;
             }
@@ -206,15 +410,59 @@ public:
             String az_string = String(get_az(), 1);
             response->print("OK AZ ");
             response->println(az_string.c_str());
+        } else if ((name == "EL" || name == "EL?" || name == "POS" || name == "POS?") && !has_elevation()) {
+            response->println("ERROR NO ELEVATION AXIS");
+            return false;
+        } else if (name == "EL" && first_space > 0) {
+            String el_string = command.substring(first_space + 1);
+            el_string.trim();
+            double el_angle = el_string.toDouble();
+
+            if (!is_valid_el(el_angle)) {
+                response->println("ERROR INVALID ELEVATION");
+                return false;
+            }
+
+            set_el(el_angle);
+            response->print("OK EL ");
+            response->println(el_angle);
+        } else if (name == "EL?") {
+            String el_string = String(get_el(), 1);
+            response->print("OK EL ");
+            response->println(el_string.c_str());
+        } else if (name == "POS" && first_space > 0) {
+            String pos_string = command.substring(first_space + 1);
+            pos_string.trim();
+            int space = pos_string.indexOf(' ');
+            double az_angle = pos_string.substring(0, space).toDouble();
+            double el_angle = pos_string.substring(space + 1).toDouble();
+
+            // Both axes start in the same tick or neither does
+            if (space < 0 || !is_valid_az(az_angle)) {
+                response->println("ERROR INVALID AZIMUTH");
+                return false;
+            }
+            if (!is_valid_el(el_angle)) {
+                response->println("ERROR INVALID ELEVATION");
+                return false;
+            }
+
+            set_az(az_angle);
+            set_el(el_angle);
+            response->print("OK POS ");
+            response->print(az_angle);
+            response->print(' ');
+            response->println(el_angle);
+        } else if (name == "POS?") {
+            response->print("OK POS ");
+            response->print(get_az(), 1);
+            response->print(' ');
+            response->println(get_el(), 1);
         } else if (name == "MOVE" && first_space > 0) {
             String direction = command.substring(first_space + 1);
             direction.trim();
 
-            if (direction == "CW") {
-                move_cw();
-            } else if (direction == "CCW") {
-                move_ccw();
-            } else {
+            if (!move(direction)) {
                 response->println("ERROR INVALID DIRECTION");
                 return false;
             }
@@ -222,15 +470,58 @@ public:
             response->print("OK MOVE ");
             response->println(direction);
         } else if (name == "STATE") {
-            String az_string = String(get_az(), 1);
+            bool now = false;
+            if (first_space > 0) {
+                String option = command.substring(first_space + 1);
+                option.trim();
+
+                if (option != "NOW") {
+                    response->println("ERROR INVALID STATE OPTION");
+                    return false;
+                }
+                now = true;
+            }
+
+            uint64_t time = monotonic_clock.micros64();
+            String az_string = String(now ? azimuth()->get_position_at(time) : get_az(), 1);
             String speed_string = String(get_speed());
 
             response->print("OK STATE AZ=");
             response->print(az_string.c_str());
+            if (has_elevation()) {
+                response->print(" EL=");
+                response->print(now ? elevation()->get_position_at(time) : get_el(), 1);
+            }
             response->print(" SPEED=");
             response->print(speed_string.c_str());
             response->print(" FLAGS=");
-            response->println(get_flags());
+            response->print(get_flags());
+            if (has_elevation()) {
+                response->print(" EL_FLAGS=");
+                response->print(elevation()->get_flags());
+            }
+            response->print(" VEL=");
+            response->print(azimuth()->get_velocity(), 2);
+            if (has_elevation()) {
+                response->print(" EL_VEL=");
+                response->print(elevation()->get_velocity(), 2);
+            }
+            // Capture time of the positions, or the reply time when they are extrapolated to it
+            response->print(" TIME=");
+            MonotonicClock::print(*response, now ? time : azimuth()->get_pulse_time());
+            if (has_elevation() && !now) {
+                response->print(" EL_TIME=");
+                MonotonicClock::print(*response, elevation()->get_pulse_time());
+            }
+            response->println();
+        } else if (name == "ETA?") {
+            response->print("OK ETA AZ=");
+            print_eta(response, azimuth());
+            if (has_elevation()) {
+                response->print(" EL=");
+                print_eta(response, elevation());
+            }
+            response->println();
         } else if (name == "SPEED" && first_space > 0) {
             String speed_string = command.substring(first_space + 1);
             speed_string.trim();
@@ -249,9 +540,247 @@ public:
             String speed_string = String(get_speed());
             response->print("OK SPEED ");
             response->println(speed_string.c_str());
+        } else if (name == "RATE" && first_space > 0) {
+            String rate_string = command.substring(first_space + 1);
+            rate_string.trim();
+            double rate = rate_string.toDouble();
+
+            int speeds[AXIS_COUNT];
+            for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+                if (!axes[i]->get_model().valid) {
+                    response->println("ERROR NOT CALIBRATED");
+                    return false;
+                }
+                speeds[i] = motion_model_speed_for(axes[i]->get_model(), rate);
+                if (rate <= 0 || speeds[i] < 0) {
+                    response->println("ERROR INVALID RATE");
+                    return false;
+                }
+            }
+
+            abort_calibration();
+            for (uint8_t i = 0; i < AXIS_COUNT; i++) {
+                axes[i]->set_speed(speeds[i]);
+            }
+            settings.speed = (uint8_t) speeds[AXIS_AZIMUTH];
+
+            response->print("OK RATE ");
+            response->print(rate, 2);
+            response->print(" SPEED=");
+            response->print(speeds[AXIS_AZIMUTH]);
+            if (has_elevation()) {
+                response->print(" EL_SPEED=");
+                response->print(speeds[AXIS_COUNT - 1]);
+            }
+            response->println();
+        } else if (name == "RATE?") {
+            response->print("OK RATE AZ=");
+            print_rate(response, azimuth());
+            if (has_elevation()) {
+                response->print(" EL=");
+                print_rate(response, elevation());
+            }
+            response->println();
+        } else if (name == "CALIBRATE") {
+            String axis_string = (first_space > 0) ? command.substring(first_space + 1) : String();
+            axis_string.trim();
+            Axis *axis = parse_axis(axis_string);
+
+            if (axis == nullptr) {
+                response->println("ERROR INVALID AXIS");
+                return false;
+            }
+            if (!axis->is_position_valid()) {
+                response->println("ERROR NO POSITION");
+                return false;
+            }
+            if (is_calibrating()) {
+                response->println("ERROR CALIBRATION IN PROGRESS");
+                return false;
+            }
+            if (!calibration.start(axis)) {
+                response->println("ERROR AXIS RANGE TOO SMALL");
+                return false;
+            }
+
+            response->print("OK CALIBRATE AXIS=");
+            response->print(get_axis_name(axis));
+            response->print(" RUNS=");
+            response->println(MOTION_CALIBRATION_RUN_COUNT);
+        } else if (name == "CALIBRATE?") {
+            response->print("OK CALIBRATE STATE=");
+            response->print(get_calibration_status_name(calibration.get_status()));
+            if (calibration.get_status() != MOTION_CALIBRATION_IDLE) {
+                response->print(" AXIS=");
+                response->print(get_axis_name(calibration.get_axis()));
+                response->print(" RUN=");
+                response->print(calibration.get_run());
+                response->print('/');
+                response->print(MOTION_CALIBRATION_RUN_COUNT);
+            }
+            response->println();
+        } else if (name == "MODEL?") {
+            String axis_string = (first_space > 0) ? command.substring(first_space + 1) : String();
+            axis_string.trim();
+            Axis *axis = parse_axis(axis_string);
+
+            if (axis == nullptr) {
+                response->println("ERROR INVALID AXIS");
+                return false;
+            }
+
+            const MotionModel &model = axis->get_model();
+            response->print("OK MODEL AXIS=");
+            response->print(get_axis_name(axis));
+            response->print(" VALID=");
+            response->print(model.valid);
+            response->print(" SPEEDS=");
+            for (int i = 0; i < MOTION_MODEL_SPEED_COUNT; i++) {
+                if (i > 0) {
+                    response->print(',');
+                }
+                response->print(motion_model_speed(i));
+            }
+            response->print(" VEL_CW=");
+            print_model_values(response, model.velocity[MOTION_DIRECTION_CW]);
+            response->print(" VEL_CCW=");
+            print_model_values(response, model.velocity[MOTION_DIRECTION_CCW]);
+            response->print(" COAST_CW=");
+            print_model_values(response, model.coast[MOTION_DIRECTION_CW]);
+            response->print(" COAST_CCW=");
+            print_model_values(response, model.coast[MOTION_DIRECTION_CCW]);
+            response->print(" DELAY=");
+            print_model_pair(response, model.start_delay, 3);
+            response->print(" ACCEL=");
+            print_model_pair(response, model.acceleration, 1);
+            response->print(" STOP=");
+            print_model_pair(response, model.stop_time, 3);
+            response->println();
+        } else if (name == "SWEEP") {
+            String axis_string = (first_space > 0) ? command.substring(first_space + 1) : String();
+            axis_string.trim();
+            String knots_string;
+            int knots_space = axis_string.indexOf(' ');
+            if (knots_space > 0) {
+                knots_string = axis_string.substring(knots_space + 1);
+                knots_string.trim();
+                axis_string = axis_string.substring(0, knots_space);
+            } else if (axis_string.toInt() > 0) {
+                knots_string = axis_string;
+                axis_string = String();
+            }
+
+            Axis *axis = parse_axis(axis_string);
+            long knots = (knots_string.length() > 0) ? knots_string.toInt() : ENCODER_CORRECTION_DEFAULT_KNOTS;
+
+            if (axis == nullptr) {
+                response->println("ERROR INVALID AXIS");
+                return false;
+            }
+            if (knots <= 0 || !is_valid_knot_count((uint32_t) knots)) {
+                response->println("ERROR INVALID KNOTS");
+                return false;
+            }
+            if (!axis->is_position_valid()) {
+                response->println("ERROR NO POSITION");
+                return false;
+            }
+            if (is_calibrating()) {
+                response->println("ERROR CALIBRATION IN PROGRESS");
+                return false;
+            }
+            if (!sweep.start(axis, (uint16_t) knots)) {
+                response->println("ERROR AXIS RANGE TOO SMALL");
+                return false;
+            }
+
+            response->print("OK SWEEP AXIS=");
+            response->print(get_axis_name(axis));
+            response->print(" KNOTS=");
+            response->println(knots);
+        } else if (name == "SWEEP?") {
+            response->print("OK SWEEP STATE=");
+            response->print(get_calibration_status_name(sweep.get_status()));
+            if (sweep.get_status() != MOTION_CALIBRATION_IDLE) {
+                response->print(" AXIS=");
+                response->print(get_axis_name(sweep.get_axis()));
+                response->print(" KNOTS=");
+                response->print(sweep.get_knot_count());
+                response->print(" DIRECTION=");
+                response->print((sweep.get_direction() == MOTION_DIRECTION_CW) ? "CW" : "CCW");
+                response->print(" PROGRESS=");
+                response->print(sweep.get_progress());
+            }
+            response->println();
+        } else if (name == "CORRECTION?") {
+            String axis_string = (first_space > 0) ? command.substring(first_space + 1) : String();
+            axis_string.trim();
+            Axis *axis = parse_axis(axis_string);
+
+            if (axis == nullptr) {
+                response->println("ERROR INVALID AXIS");
+                return false;
+            }
+
+            EncoderCorrection &correction = encoder_corrections[axis->get_index()];
+            if (!client->output.set_source(new EncoderCorrectionSource(correction.get_table()))) {
+                response->println("ERROR TRANSFER IN PROGRESS");
+                return false;
+            }
+
+            response->print("OK CORRECTION AXIS=");
+            response->print(get_axis_name(axis));
+            response->print(" KNOTS=");
+            response->print(correction.get_table().knot_count);
+            response->print(" MAX=");
+            response->print(correction.get_maximum(), 3);
+            response->print(" SAVED=");
+            response->println(encoder_correction_store.get_sequence());
+        } else if (name == "CORRECTION" && first_space > 0) {
+            String option = command.substring(first_space + 1);
+            option.trim();
+
+            if (option == "SAVE") {
+                if (!encoder_correction_store.save()) {
+                    response->println("ERROR SAVE FAILED");
+                    return false;
+                }
+
+                response->print("OK CORRECTION SAVE SEQUENCE=");
+                response->println(encoder_correction_store.get_sequence());
+                return true;
+            }
+
+            if (!option.startsWith("CLEAR")) {
+                response->println("ERROR INVALID COMMAND");
+                return false;
+            }
+            String axis_string = option.substring(5);
+            axis_string.trim();
+            Axis *axis = parse_axis(axis_string);
+
+            if (axis == nullptr) {
+                response->println("ERROR INVALID AXIS");
+                return false;
+            }
+
+            if (sweep.get_axis() == axis) {
+                sweep.abort();
+            }
+            encoder_corrections[axis->get_index()].clear();
+
+            response->print("OK CORRECTION CLEAR AXIS=");
+            response->println(get_axis_name(axis));
         } else if (name == "STOP") {
             stop();
             response->println("OK STOP");
+        } else if (name == "STOPLATENCY?") {
+            response->print("OK STOPLATENCY COUNT=");
+            response->print(emergency_stop_count);
+            response->print(" LAST=");
+            response->print(emergency_stop_latency_last);
+            response->print(" MAX=");
+            response->println(emergency_stop_latency_max);
         } else if (name == "PARK") {
             park();
             response->println("OK PARK");
@@ -262,16 +791,301 @@ public:
             String monitor_string = command.substring(first_space + 1);
             monitor_string.trim();
             bool monitor = monitor_string.toInt() != 0;
+
+            // Keep the reserved slots for control-capable clients
+            if (monitor && client->is_network() && !client->is_control() && !client->is_monitor_enabled()
+                && ControllerClient::get_monitor_only_count() >= ETHERNET_MONITOR_CLIENT_COUNT) {
+                response->println("ERROR TOO MANY MONITORS");
+                return false;
+            }
+
             client->set_monitor_enabled(monitor);
             response->print("OK MONITOR ");
             response->println(monitor ? "1" : "0");
+        } else if (name == "OUTPUT" && first_space > 0) {
+            String policy_string = command.substring(first_space + 1);
+            policy_string.trim();
+
+            if (policy_string == "DROP") {
+                client->output.set_policy(CLIENT_OUTPUT_POLICY_DROP);
+            } else if (policy_string == "COALESCE") {
+                client->output.set_policy(CLIENT_OUTPUT_POLICY_COALESCE);
+            } else if (policy_string == "DISCONNECT") {
+                client->output.set_policy(CLIENT_OUTPUT_POLICY_DISCONNECT);
+            } else {
+                response->println("ERROR INVALID OUTPUT POLICY");
+                return false;
+            }
+
+            response->print("OK OUTPUT ");
+            response->println(policy_string);
+        } else if (name == "OUTPUT?") {
+            response->print("OK OUTPUT POLICY=");
+            response->print(get_output_policy_name(client->output.get_policy()));
+            response->print(" BACKLOG=");
+            response->print(client->output.backlog());
+            response->print(" DROPPED=");
+            response->print(client->output.get_dropped_lines());
+            response->print(" COALESCED=");
+            response->println(client->output.get_coalesced_lines());
+        } else if (name == "CONSOLE" && first_space > 0) {
+            String mode_string = command.substring(first_space + 1);
+            mode_string.trim();
+
+            if (mode_string == "LOG") {
+                set_log_enabled(true);
+            } else if (mode_string == "PROTOCOL") {
+                set_log_enabled(false);
+            } else {
+                response->println("ERROR INVALID CONSOLE MODE");
+                return false;
+            }
+
+            response->print("OK CONSOLE ");
+            response->println(mode_string);
+        } else if (name == "CONSOLE?") {
+            response->print("OK CONSOLE ");
+            response->println(is_log_enabled() ? "LOG" : "PROTOCOL");
+        } else if (name == "LOG?") {
+            response->print("OK LOG LEVEL=");
+            response->print(LOG_LEVEL);
+            response->print(" DROPPED=");
+            response->println(log_dropped_count());
+        } else if (name == "DUMP") {
+            auto source = new FlightRecorderDumpSource();
+            uint32_t count = source->get_count();
+
+            if (!client->output.set_source(source)) {
+                response->println("ERROR TRANSFER IN PROGRESS");
+                return false;
+            }
+
+            response->print("OK DUMP COUNT=");
+            response->print(count);
+            response->print(" TIME=");
+            MonotonicClock::print(*response, monotonic_clock.micros64());
+            response->println();
+        } else if (name == "HISTORY" && first_space > 0) {
+            String range_string = command.substring(first_space + 1);
+            range_string.trim();
+
+            Axis *axis = azimuth();
+            const char *axis_name = "AZ";
+            if (range_string.startsWith("EL ")) {
+                if (!has_elevation()) {
+                    response->println("ERROR NO ELEVATION AXIS");
+                    return false;
+                }
+                axis = elevation();
+                axis_name = "EL";
+                range_string = range_string.substring(3);
+            } else if (range_string.startsWith("AZ ")) {
+                range_string = range_string.substring(3);
+            }
+            range_string.trim();
+
+            int space = range_string.indexOf(' ');
+            long start_ms = ((space >= 0) ? range_string.substring(0, space) : range_string).toInt();
+            long end_ms = (space >= 0) ? range_string.substring(space + 1).toInt() : 0;
+
+            // Record timestamps are the low 32 bits of the clock, so ages wrap after 71 minutes
+            if (start_ms <= 0 || start_ms > 3600000L || end_ms < 0 || end_ms >= start_ms) {
+                response->println("ERROR INVALID HISTORY RANGE");
+                return false;
+            }
+            if (client->output.has_source()) {
+                response->println("ERROR TRANSFER IN PROGRESS");
+                return false;
+            }
+
+            HistoryRecorder &recorder = history_recorders[axis->get_index()];
+            uint64_t time = monotonic_clock.micros64();
+            auto now = (uint32_t) time;
+            uint32_t start_age = (uint32_t) start_ms * 1000;
+            uint32_t end_age = (uint32_t) end_ms * 1000;
+
+            // Raw samples when they reach back far enough, summaries otherwise
+            HistorySample oldest{};
+            bool raw = recorder.samples.read(recorder.samples.get_first_index(), oldest)
+                       && now - oldest.timestamp >= start_age;
+
+            uint32_t start_index;
+            uint32_t end_index;
+            if (raw) {
+                start_index = recorder.samples.find(now, start_age);
+                end_index = (end_age > 0) ? recorder.samples.find(now, end_age - 1) : recorder.samples.get_write_index();
+                client->output.set_source(new HistorySource<HistorySampleRing>(recorder.samples, start_index, end_index));
+            } else {
+                start_index = recorder.summaries.find(now, start_age);
+                end_index = (end_age > 0) ? recorder.summaries.find(now, end_age - 1) : recorder.summaries.get_write_index();
+                client->output.set_source(new HistorySource<HistorySummaryRing>(recorder.summaries, start_index, end_index));
+            }
+
+            response->print("OK HISTORY AXIS=");
+            response->print(axis_name);
+            response->print(raw ? " MODE=RAW" : " MODE=SUMMARY");
+            response->print(" COUNT=");
+            response->print(end_index - start_index);
+            if (!raw) {
+                response->print(" SAMPLES=");
+                response->print(HISTORY_SUMMARY_LENGTH);
+            }
+            response->print(" TIME=");
+            MonotonicClock::print(*response, time);
+            response->print(" SCALE=");
+            response->print(HISTORY_POSITION_SCALE, 9);
+            response->print(" OFFSET=");
+            response->print(axis->get_encoder_offset(), 3);
+            response->print(" VEL_SCALE=");
+            response->println(HISTORY_VELOCITY_SCALE * axis->get_state().pulse_rate, 9);
+        } else if (name == "CAPTURE" && first_space > 0) {
+            String count_string = command.substring(first_space + 1);
+            count_string.trim();
+            long count = count_string.toInt();
+
+            if (count <= 0 || count > CAPTURE_MAX_COUNT) {
+                response->println("ERROR INVALID CAPTURE COUNT");
+                return false;
+            }
+            if (client->output.has_source()) {
+                response->println("ERROR TRANSFER IN PROGRESS");
+                return false;
+            }
+            if (!capture_recorder.start((uint32_t) count)) {
+                response->println("ERROR CAPTURE IN PROGRESS");
+                return false;
+            }
+
+            client->output.set_source(new CaptureSource());
+
+            response->print("OK CAPTURE COUNT=");
+            response->print(count);
+            response->print(" TICKS_PER_USEC=");
+            response->println(azimuth()->ticks_per_usec());
+        } else if (name == "STATS") {
+            String option = (first_space > 0) ? command.substring(first_space + 1) : String();
+            option.trim();
+
+            if (option == "RESET") {
+                profiler.reset();
+                response->println("OK STATS RESET");
+                return true;
+            }
+
+            if (!client->output.set_source(new ProfilerStatsSource())) {
+                response->println("ERROR TRANSFER IN PROGRESS");
+                return false;
+            }
+
+            response->print("OK STATS CPU_MHZ=");
+            response->print(VARIANT_MCK / 1000000);
+            response->print(" OVERHEAD=");
+            response->println(profiler.get_overhead());
+        } else if (name == "LATENCY" && first_space > 0) {
+            String option = command.substring(first_space + 1);
+            option.trim();
+
+            if (option != "RESET") {
+                response->println("ERROR INVALID LATENCY OPTION");
+                return false;
+            }
+
+            latency_tracer.reset();
+            response->println("OK LATENCY RESET");
+        } else if (name == "LATENCY?") {
+            if (!client->output.set_source(new LatencyStatsSource())) {
+                response->println("ERROR TRANSFER IN PROGRESS");
+                return false;
+            }
+
+            response->println("OK LATENCY UNIT=US");
+        } else if (name == "SOCKETS?") {
+            if (!network_startup.is_ready()) {
+                response->println("ERROR NETWORK NOT READY");
+                return false;
+            }
+            if (!client->output.set_source(new SocketStatsSource())) {
+                response->println("ERROR TRANSFER IN PROGRESS");
+                return false;
+            }
+
+            response->print("OK SOCKETS MEMORY=");
+            response->println(socket_monitor.verify_memory() ? "EVEN" : "UNEXPECTED");
+        } else if (name == "STARTUP?") {
+            // NONE until the first valid position and the listening servers
+            response->print("OK STARTUP POSITION_MS=");
+            if (azimuth()->is_position_valid()) {
+                response->print(azimuth()->get_position_time());
+            } else {
+                response->print("NONE");
+            }
+            response->print(" LISTENING_MS=");
+            if (network_startup.is_ready()) {
+                response->print(network_startup.get_ready_time());
+            } else {
+                response->print("NONE");
+            }
+            response->print(" RETRIES=");
+            response->println(network_startup.get_retries());
+        } else if (name == "TRACKING?") {
+            const RotatorState &az_state = azimuth()->get_state();
+            response->print("OK TRACKING TURNS=");
+            response->print(az_state.turns);
+            response->print(" FAULT=");
+            response->print(az_state.fault ? 1 : 0);
+            response->print(" FAULTS=");
+            response->print(azimuth()->get_fault_count());
+            if (has_elevation()) {
+                const RotatorState &el_state = elevation()->get_state();
+                response->print(" EL_TURNS=");
+                response->print(el_state.turns);
+                response->print(" EL_FAULTS=");
+                response->print(elevation()->get_fault_count());
+            }
+            response->println();
+        } else if (name == "TIME") {
+            // For clock offset estimation: the client echo, when the command line arrived and when the
+            // reply was written, both on the 64-bit clock of the capture timestamps
+            uint64_t reply_time = monotonic_clock.micros64();
+            unsigned long received_time = client->get_command_received_time();
+
+            response->print("OK TIME");
+            if (first_space > 0) {
+                String client_time = command.substring(first_space + 1);
+                client_time.trim();
+                response->print(" CLIENT=");
+                response->print(client_time);
+            }
+            response->print(" RX=");
+            MonotonicClock::print(*response, (received_time != 0) ? monotonic_clock.extend(received_time) : reply_time);
+            response->print(" TX=");
+            MonotonicClock::print(*response, reply_time);
+            response->println();
         } else if (name == "INFO") {
             response->println("OK INFO " APP_VERSION_STRING);
+        } else if (name == "AZLIMITS" && first_space > 0) {
+            String limits_string = command.substring(first_space + 1);
+            limits_string.trim();
+            int space = limits_string.indexOf(' ');
+            double az_min = limits_string.substring(0, space).toDouble();
+            double az_max = limits_string.substring(space + 1).toDouble();
+
+            if (space < 0 || az_min < AZIMUTH_MINIMUM || az_max > AZIMUTH_MAXIMUM || az_min >= az_max) {
+                response->println("ERROR INVALID AZIMUTH LIMITS");
+                return false;
+            }
+
+            settings.azimuth_minimum = az_min;
+            settings.azimuth_maximum = az_max;
+            response->print("OK AZLIMITS MIN=");
+            response->print(az_min);
+            response->print(" MAX=");
+            response->println(az_max);
         } else if (name == "AZLIMITS") {
             response->print("OK AZLIMITS MIN=");
-            response->print(AZIMUTH_MINIMUM);
+            response->print(settings.azimuth_minimum);
             response->print(" MAX=");
-            response->println(AZIMUTH_MAXIMUM);
+            response->println(settings.azimuth_maximum);
         } else if (name == "AZOFFSET" && first_space > 0) {
             String az_string = command.substring(first_space + 1);
             az_string.trim();
@@ -283,12 +1097,159 @@ public:
                 return false;
             }
 
-            azimuth_offset = az_offset;
+            settings.azimuth_offset = az_offset;
             response->print("OK AZOFFSET ");
             response->println(az_offset);
         } else if (name == "AZOFFSET?") {
             response->print("OK AZOFFSET ");
-            response->println(azimuth_offset);
+            response->println(settings.azimuth_offset);
+        } else if (name == "ELLIMITS" && first_space > 0) {
+            String limits_string = command.substring(first_space + 1);
+            limits_string.trim();
+            int space = limits_string.indexOf(' ');
+            double el_min = limits_string.substring(0, space).toDouble();
+            double el_max = limits_string.substring(space + 1).toDouble();
+
+            if (space < 0 || el_min < -180 || el_max > 180 || el_min >= el_max) {
+                response->println("ERROR INVALID ELEVATION LIMITS");
+                return false;
+            }
+
+            settings.elevation_minimum = el_min;
+            settings.elevation_maximum = el_max;
+            response->print("OK ELLIMITS MIN=");
+            response->print(el_min);
+            response->print(" MAX=");
+            response->println(el_max);
+        } else if (name == "ELLIMITS") {
+            response->print("OK ELLIMITS MIN=");
+            response->print(settings.elevation_minimum);
+            response->print(" MAX=");
+            response->println(settings.elevation_maximum);
+        } else if (name == "ELOFFSET" && first_space > 0) {
+            String el_string = command.substring(first_space + 1);
+            el_string.trim();
+            double el_offset = el_string.toDouble();
+
+            if (el_offset < -360 || el_offset > 360) {
+                response->println("ERROR INVALID ELEVATION OFFSET");
+                return false;
+            }
+
+            settings.elevation_offset = el_offset;
+            response->print("OK ELOFFSET ");
+            response->println(el_offset);
+        } else if (name == "ELOFFSET?") {
+            response->print("OK ELOFFSET ");
+            response->println(settings.elevation_offset);
+        } else if (name == "THRESHOLD" && first_space > 0) {
+            String threshold_string = command.substring(first_space + 1);
+            threshold_string.trim();
+            double threshold = threshold_string.toDouble();
+
+            if (threshold <= 0 || threshold > 10) {
+                response->println("ERROR INVALID THRESHOLD");
+                return false;
+            }
+
+            settings.angle_threshold = threshold;
+            response->print("OK THRESHOLD ");
+            response->println(threshold);
+        } else if (name == "FILTER" && first_space > 0) {
+            String filter_string = command.substring(first_space + 1);
+            filter_string.trim();
+            int space = filter_string.indexOf(' ');
+            long median_length = filter_string.substring(0, space).toInt();
+            double smoothing = filter_string.substring(space + 1).toDouble();
+
+            if (space < 0 || median_length < 1 || median_length > PWM_FILTER_MAX_MEDIAN_LENGTH
+                || smoothing < 0 || smoothing >= 1) {
+                response->println("ERROR INVALID FILTER");
+                return false;
+            }
+
+            settings.filter_median_length = (uint8_t) median_length;
+            settings.filter_smoothing = (float) smoothing;
+            apply_settings();
+            response->print("OK FILTER MEDIAN=");
+            response->print(median_length);
+            response->print(" SMOOTHING=");
+            response->println(smoothing);
+        } else if (name == "IP" && first_space > 0) {
+            String ip_string = command.substring(first_space + 1);
+            ip_string.trim();
+            IPAddress ip_address;
+
+            if (!ip_address.fromString(ip_string.c_str())) {
+                response->println("ERROR INVALID IP ADDRESS");
+                return false;
+            }
+
+            for (uint8_t i = 0; i < 4; i++) {
+                settings.ip_address[i] = ip_address[i];
+            }
+            response->print("OK IP ");
+            response->println(ip_string);
+        } else if (name == "SETTINGS?") {
+            response->print("OK SETTINGS AZOFFSET=");
+            response->print(settings.azimuth_offset);
+            response->print(" AZMIN=");
+            response->print(settings.azimuth_minimum);
+            response->print(" AZMAX=");
+            response->print(settings.azimuth_maximum);
+            if (has_elevation()) {
+                response->print(" ELOFFSET=");
+                response->print(settings.elevation_offset);
+                response->print(" ELMIN=");
+                response->print(settings.elevation_minimum);
+                response->print(" ELMAX=");
+                response->print(settings.elevation_maximum);
+            }
+            response->print(" THRESHOLD=");
+            response->print(settings.angle_threshold);
+            response->print(" SPEED=");
+            response->print(settings.speed);
+            response->print(" FILTER=");
+            response->print(settings.filter_median_length);
+            response->print(',');
+            response->print(settings.filter_smoothing);
+            response->print(" IP=");
+            for (uint8_t i = 0; i < 4; i++) {
+                if (i > 0) {
+                    response->print('.');
+                }
+                response->print(settings.ip_address[i]);
+            }
+            response->print(" SAVED=");
+            response->println(settings_store.get_sequence());
+        } else if (name == "SAVE") {
+            if (!settings_store.save(settings)) {
+                response->println("ERROR SAVE FAILED");
+                return false;
+            }
+
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_SETTINGS, FLIGHT_RECORDER_SETTINGS_SAVE, 0,
+                    (int32_t) settings_store.get_sequence());
+            response->print("OK SAVE SEQUENCE=");
+            response->print(settings_store.get_sequence());
+            response->print(" PAGE=");
+            response->println(settings_store.get_page());
+        } else if (name == "LOAD") {
+            if (!settings_store.load(settings)) {
+                response->println("ERROR NO SAVED SETTINGS");
+                return false;
+            }
+
+            apply_settings();
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_SETTINGS, FLIGHT_RECORDER_SETTINGS_LOAD, 0,
+                    (int32_t) settings_store.get_sequence());
+            response->print("OK LOAD SEQUENCE=");
+            response->println(settings_store.get_sequence());
+        } else if (name == "DEFAULTS") {
+            SettingsStore::defaults(settings);
+            apply_settings();
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_SETTINGS, FLIGHT_RECORDER_SETTINGS_DEFAULTS);
+            response->println("OK DEFAULTS");
         } else {
             response->println("ERROR INVALID COMMAND");
             return false;
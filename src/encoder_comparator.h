@@ -0,0 +1,124 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_ENCODER_COMPARATOR_H
+#define OH3AAROT_CONTROLLER_ENCODER_COMPARATOR_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "flight_recorder.h"
+#include "profiler.h"
+#include "rotator_state.h"
+
+/**
+ * Stop threshold armed by the control loop and checked in the capture interrupt for each encoder
+ * pulse. ENCODER_COMPARATOR_CONFIRM_PULSES consecutive pulses past the threshold drop the relay of the
+ * armed direction right there, so the stop lags the encoder by a pulse or two instead of one main loop
+ * tick, and a single glitched pulse cannot stop the axis short of its target. The main loop only does
+ * the bookkeeping afterwards.
+ *
+ * Positions are the unwrapped encoder positions published by the interrupt, so the check is one
+ * comparison.
+ */
+class EncoderComparator {
+private:
+    uint8_t axis = 0;
+    int cw_pin = -1;
+    int ccw_pin = -1;
+
+    volatile int8_t direction = 0; // 1: stop at or above the threshold, -1: at or below, 0: disarmed
+    volatile int32_t threshold = 0;
+    volatile uint8_t crossings = 0; // Consecutive pulses past the threshold
+    volatile uint32_t fired_count = 0;
+
+public:
+    void begin(uint8_t comparator_axis, int comparator_cw_pin, int comparator_ccw_pin)
+    {
+        this->axis = comparator_axis;
+        this->cw_pin = comparator_cw_pin;
+        this->ccw_pin = comparator_ccw_pin;
+    }
+
+    static int32_t to_position(double degrees)
+    {
+        return (int32_t) lround(degrees * (1 << ENCODER_POSITION_FRACTION_BITS) / 360);
+    }
+
+    /**
+     * Arms the comparator for the clockwise (direction 1) or counter-clockwise (-1) relay. The
+     * threshold is written first, so an interrupt in between sees a matching pair. Re-arming the same
+     * direction keeps the count of pulses past the threshold.
+     */
+    void arm(int8_t arm_direction, int32_t arm_threshold)
+    {
+        if (direction != arm_direction) {
+            direction = 0;
+            crossings = 0;
+        }
+        threshold = arm_threshold;
+        direction = arm_direction;
+    }
+
+    void disarm()
+    {
+        direction = 0;
+    }
+
+    bool is_armed()
+    {
+        return direction != 0;
+    }
+
+    /**
+     * Count of relay drops, compared by the main loop to tell when the comparator has fired.
+     */
+    uint32_t get_fired_count()
+    {
+        return fired_count;
+    }
+
+    /**
+     * Called from the capture interrupt with the unwrapped position of the pulse.
+     */
+    inline void check(int32_t position)
+    {
+        int8_t armed_direction = direction;
+        if (armed_direction == 0) {
+            return;
+        }
+
+        uint32_t start = Profiler::cycles();
+
+        if (armed_direction > 0 ? (position < threshold) : (position > threshold)) {
+            crossings = 0;
+        } else if (++crossings >= ENCODER_COMPARATOR_CONFIRM_PULSES) {
+            digitalWrite(armed_direction > 0 ? cw_pin : ccw_pin, LOW);
+            direction = 0;
+            crossings = 0;
+            fired_count++;
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_RELAY, FLIGHT_RECORDER_SOURCE(axis,
+                    armed_direction > 0 ? FLIGHT_RECORDER_RELAY_CW : FLIGHT_RECORDER_RELAY_CCW), 0);
+        }
+
+        profiler.record(PROFILER_ISR_COMPARATOR, start);
+    }
+};
+
+extern EncoderComparator encoder_comparators[AXIS_COUNT];
+
+#endif
@@ -0,0 +1,110 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "encoder_correction.h"
+
+EncoderCorrection encoder_corrections[AXIS_COUNT];
+EncoderCorrectionStore encoder_correction_store;
+
+// Too large for the stack next to everything else the main loop has there
+static EncoderCorrectionRecord record_buffer;
+
+static uint32_t record_crc(EncoderCorrectionRecord &record)
+{
+    EncoderCorrectionRecordHeader unsigned_header = record.header;
+    unsigned_header.crc = 0;
+
+    uint32_t crc = FlashStorage::crc32(0, reinterpret_cast<const uint8_t *>(&unsigned_header), sizeof(unsigned_header));
+    return FlashStorage::crc32(crc, reinterpret_cast<const uint8_t *>(record.tables), record.header.length);
+}
+
+bool EncoderCorrectionStore::read(uint8_t slot, EncoderCorrectionRecord &record)
+{
+    auto *data = reinterpret_cast<uint8_t *>(&record);
+    uint32_t first_page = FLASH_STORAGE_CORRECTION_FIRST_PAGE + slot * ENCODER_CORRECTION_SLOT_PAGE_COUNT;
+
+    for (size_t offset = 0; offset < sizeof(record); offset += FLASH_STORAGE_PAGE_SIZE) {
+        size_t length = min(sizeof(record) - offset, (size_t) FLASH_STORAGE_PAGE_SIZE);
+        memcpy(data + offset, FlashStorage::page(first_page + offset / FLASH_STORAGE_PAGE_SIZE), length);
+    }
+
+    return record.header.magic == ENCODER_CORRECTION_MAGIC && record.header.version == ENCODER_CORRECTION_VERSION
+           && record.header.length == sizeof(record.tables) && record_crc(record) == record.header.crc;
+}
+
+bool EncoderCorrectionStore::load()
+{
+    int8_t newest_slot = -1;
+    uint32_t newest_sequence = 0;
+
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        if (!read(slot, record_buffer)) {
+            continue;
+        }
+        if (newest_slot < 0 || (int32_t) (record_buffer.header.sequence - newest_sequence) > 0) {
+            newest_slot = (int8_t) slot;
+            newest_sequence = record_buffer.header.sequence;
+        }
+    }
+
+    if (newest_slot < 0 || !read(newest_slot, record_buffer)) {
+        return false;
+    }
+
+    for (uint8_t axis = 0; axis < AXIS_COUNT; axis++) {
+        encoder_corrections[axis].set_table(record_buffer.tables[axis]);
+    }
+
+    sequence = newest_sequence;
+    current_slot = newest_slot;
+
+    return true;
+}
+
+bool EncoderCorrectionStore::save()
+{
+    memset(&record_buffer, 0, sizeof(record_buffer));
+    record_buffer.header.magic = ENCODER_CORRECTION_MAGIC;
+    record_buffer.header.sequence = sequence + 1;
+    record_buffer.header.version = ENCODER_CORRECTION_VERSION;
+    record_buffer.header.length = sizeof(record_buffer.tables);
+    for (uint8_t axis = 0; axis < AXIS_COUNT; axis++) {
+        record_buffer.tables[axis] = encoder_corrections[axis].get_table();
+    }
+    record_buffer.header.crc = record_crc(record_buffer);
+
+    // The newest copy stays valid until the other one has been written completely
+    auto slot = (uint8_t) ((current_slot + 1) % 2);
+    uint32_t first_page = FLASH_STORAGE_CORRECTION_FIRST_PAGE + slot * ENCODER_CORRECTION_SLOT_PAGE_COUNT;
+    const auto *data = reinterpret_cast<const uint8_t *>(&record_buffer);
+    uint8_t page[FLASH_STORAGE_PAGE_SIZE];
+
+    for (size_t offset = 0; offset < sizeof(record_buffer); offset += FLASH_STORAGE_PAGE_SIZE) {
+        size_t length = min(sizeof(record_buffer) - offset, (size_t) FLASH_STORAGE_PAGE_SIZE);
+        memset(page, 0xFF, sizeof(page));
+        memcpy(page, data + offset, length);
+        if (!FlashStorage::write_page(first_page + offset / FLASH_STORAGE_PAGE_SIZE, page)) {
+            return false;
+        }
+    }
+
+    sequence = record_buffer.header.sequence;
+    current_slot = (int8_t) slot;
+
+    return true;
+}
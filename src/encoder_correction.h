@@ -0,0 +1,244 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_ENCODER_CORRECTION_H
+#define OH3AAROT_CONTROLLER_ENCODER_CORRECTION_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "client_output_buffer.h"
+#include "flash_storage.h"
+#include "profiler.h"
+#include "rotator_state.h"
+
+#define ENCODER_CORRECTION_FRACTION_BITS 4 // Corrections are in 1/65536 turns, finer than the positions
+#define ENCODER_CORRECTION_MIN_KNOTS 8
+
+#define ENCODER_CORRECTION_MAGIC 0x4F484543
+#define ENCODER_CORRECTION_VERSION 1
+#define ENCODER_CORRECTION_SLOT_PAGE_COUNT (FLASH_STORAGE_CORRECTION_PAGE_COUNT / 2)
+
+#define ENCODER_CORRECTION_LINE_VALUES 8 // Knots per line of CORRECTION?
+
+/**
+ * Encoder angle of a pulse in 1/4096 turns by the MA3 transfer function x = duty * (N + 2) / period - 1,
+ * where N is ENCODER_RESOLUTION: a 1 us pulse is 0 degrees and a 1023 us pulse of the 10-bit
+ * version is 359.65 degrees. Integer arithmetic only, so that it can run in the capture interrupt.
+ */
+inline int32_t encoder_fraction(uint32_t duty, uint32_t period)
+{
+    if (period == 0) {
+        return 0;
+    }
+
+    uint32_t ratio = ((duty << ENCODER_POSITION_FRACTION_BITS) + period / 2) / period;
+    int32_t fraction = ((int32_t) (ratio * (ENCODER_RESOLUTION + 2)) - (1 << ENCODER_POSITION_FRACTION_BITS)
+                        + ENCODER_RESOLUTION / 2) / ENCODER_RESOLUTION;
+
+    if (fraction < 0) {
+        return 0;
+    }
+    return (fraction > ENCODER_POSITION_MASK) ? ENCODER_POSITION_MASK : fraction;
+}
+
+/**
+ * Nonlinearity correction of one encoder, measured by SWEEP: knots evenly spaced over a turn of the
+ * uncorrected angle, interpolated linearly between them and around the turn.
+ */
+struct EncoderCorrectionTable {
+    uint16_t knot_count; // Power of two, 0 when the encoder is not corrected
+    int16_t values[ENCODER_CORRECTION_MAX_KNOTS]; // At each knot, in 1/65536 turns
+};
+
+inline bool is_valid_knot_count(uint32_t knot_count)
+{
+    return knot_count >= ENCODER_CORRECTION_MIN_KNOTS && knot_count <= ENCODER_CORRECTION_MAX_KNOTS
+           && (knot_count & (knot_count - 1)) == 0;
+}
+
+/**
+ * Applies the correction table of an axis to each encoder pulse in the capture interrupt. The main
+ * loop only changes the table while the correction is disabled, with barriers that keep the table
+ * writes between disabling and enabling, and the interrupt handler runs to completion, so a pulse
+ * never sees a half-written table.
+ */
+class EncoderCorrection {
+private:
+    EncoderCorrectionTable table{};
+    uint8_t step_bits = 0; // Fraction bits between two knots
+    volatile bool enabled = false;
+
+public:
+    inline int32_t apply(int32_t fraction)
+    {
+        if (!enabled) {
+            return fraction;
+        }
+
+        uint32_t index = (uint32_t) fraction >> step_bits;
+        int32_t remainder = fraction & ((1 << step_bits) - 1);
+        int32_t first = table.values[index];
+        int32_t second = table.values[(index + 1) & (table.knot_count - 1)];
+        int32_t correction = first + (((second - first) * remainder) >> step_bits);
+
+        return (fraction + ((correction + (1 << (ENCODER_CORRECTION_FRACTION_BITS - 1)))
+                            >> ENCODER_CORRECTION_FRACTION_BITS)) & ENCODER_POSITION_MASK;
+    }
+
+    /**
+     * Corrected encoder angle of a pulse in 1/4096 turns, called from the capture interrupt.
+     */
+    inline int32_t angle(uint32_t duty, uint32_t period)
+    {
+        uint32_t start = Profiler::cycles();
+        int32_t fraction = apply(encoder_fraction(duty, period));
+        profiler.record(PROFILER_ISR_CORRECTION, start);
+        return fraction;
+    }
+
+    /**
+     * Replaces the table and enables the correction, a table without valid knots disables it.
+     */
+    void set_table(const EncoderCorrectionTable &new_table)
+    {
+        enabled = false;
+        __DMB();
+        table = new_table;
+        if (!is_valid_knot_count(table.knot_count)) {
+            table.knot_count = 0;
+            return;
+        }
+
+        step_bits = ENCODER_POSITION_FRACTION_BITS;
+        for (uint32_t count = table.knot_count; count > 1; count >>= 1) {
+            step_bits--;
+        }
+        __DMB();
+        enabled = true;
+    }
+
+    void clear()
+    {
+        enabled = false;
+        __DMB();
+        table.knot_count = 0;
+    }
+
+    /**
+     * Turns the correction off and back on without changing the table, while the raw angle is measured.
+     */
+    void suspend(bool suspended)
+    {
+        enabled = !suspended && table.knot_count != 0;
+    }
+
+    const EncoderCorrectionTable &get_table()
+    {
+        return table;
+    }
+
+    /**
+     * Largest correction in degrees.
+     */
+    double get_maximum()
+    {
+        int32_t maximum = 0;
+        for (uint16_t i = 0; i < table.knot_count; i++) {
+            maximum = max(maximum, (int32_t) abs(table.values[i]));
+        }
+        return maximum * 360.0 / (1L << (ENCODER_POSITION_FRACTION_BITS + ENCODER_CORRECTION_FRACTION_BITS));
+    }
+};
+
+struct EncoderCorrectionRecordHeader {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t version;
+    uint16_t length;
+    uint32_t crc; // CRC-32 of the header with this field zeroed and the tables
+};
+
+struct EncoderCorrectionRecord {
+    EncoderCorrectionRecordHeader header;
+    EncoderCorrectionTable tables[AXIS_COUNT];
+};
+
+static_assert(sizeof(EncoderCorrectionRecord) <= ENCODER_CORRECTION_SLOT_PAGE_COUNT * FLASH_STORAGE_PAGE_SIZE,
+        "Encoder correction tables do not fit in their flash pages");
+
+/**
+ * Keeps the correction tables of all axes in two copies in the flash pages below the settings and
+ * writes the older copy, so that the newer one stays valid if a save is interrupted.
+ */
+class EncoderCorrectionStore {
+private:
+    uint32_t sequence = 0;
+    int8_t current_slot = -1;
+
+    static bool read(uint8_t slot, EncoderCorrectionRecord &record);
+
+public:
+    /**
+     * Loads the newest saved tables to the corrections of the axes.
+     */
+    bool load();
+
+    bool save();
+
+    uint32_t get_sequence()
+    {
+        return sequence;
+    }
+};
+
+/**
+ * Streams a correction table in degrees, ENCODER_CORRECTION_LINE_VALUES knots per line after the index
+ * of the first one, for the CORRECTION? command.
+ */
+class EncoderCorrectionSource : public ClientOutputSource {
+private:
+    EncoderCorrectionTable table;
+    uint16_t index = 0;
+
+public:
+    explicit EncoderCorrectionSource(const EncoderCorrectionTable &source_table) : table(source_table)
+    {}
+
+    bool next(Print &output) override
+    {
+        if (index >= table.knot_count) {
+            output.println("OK CORRECTION END");
+            return false;
+        }
+
+        output.print(index);
+        for (uint16_t i = 0; i < ENCODER_CORRECTION_LINE_VALUES && index < table.knot_count; i++, index++) {
+            output.print(' ');
+            output.print(table.values[index] * 360.0
+                         / (1L << (ENCODER_POSITION_FRACTION_BITS + ENCODER_CORRECTION_FRACTION_BITS)), 3);
+        }
+        output.print('\n');
+
+        return true;
+    }
+};
+
+extern EncoderCorrection encoder_corrections[AXIS_COUNT];
+extern EncoderCorrectionStore encoder_correction_store;
+
+#endif
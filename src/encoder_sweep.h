@@ -0,0 +1,379 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_ENCODER_SWEEP_H
+#define OH3AAROT_CONTROLLER_ENCODER_SWEEP_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "encoder_correction.h"
+#include "motion_model.h"
+#include "rotator_axis.h"
+#include "settings.h"
+
+#define ENCODER_SWEEP_PHASE_POSITIONING 0
+#define ENCODER_SWEEP_PHASE_MOVING 1
+#define ENCODER_SWEEP_PHASE_STOPPING 2
+
+#define ENCODER_SWEEP_TURN (1 << ENCODER_POSITION_FRACTION_BITS)
+
+struct EncoderSweepKnot {
+    uint32_t count;
+    double time_sum; // Microseconds from the start of the measured turn
+    double position_sum; // Raw encoder units from the start of the measured turn
+    float correction_sum; // Of the finished directions
+    uint8_t directions;
+};
+
+/**
+ * Measures the nonlinearity of the encoder of one axis: from CALIBRATION_MARGIN above the minimum,
+ * one full turn clockwise and one counter-clockwise at a constant speed with the correction off.
+ * Each raw encoder sample is compared with the straight line between the first and the last sample
+ * of the turn, and the differences are averaged for the nearest knot. Averaging both directions
+ * cancels the lag of the encoder. The correction is applied when both turns are done and saved with
+ * CORRECTION SAVE.
+ *
+ * Stepped once per tick from the control loop like MotionCalibration and uses its status values.
+ * Any other command that moves the axis aborts it and restores the previous correction.
+ */
+class EncoderSweep {
+private:
+    Axis *axis = nullptr;
+    uint8_t status = MOTION_CALIBRATION_IDLE;
+    uint8_t phase = ENCODER_SWEEP_PHASE_POSITIONING;
+    uint8_t direction = MOTION_DIRECTION_CW;
+    uint16_t knot_count = 0;
+    uint8_t step_bits = 0;
+    EncoderSweepKnot *knots = nullptr;
+
+    uint32_t pulses = 0;
+    int32_t origin = 0; // Raw position when the relay was switched on
+    bool measuring = false;
+    int32_t start_position = 0;
+    uint64_t start_time = 0;
+    int32_t turn_progress = 0;
+
+    unsigned long change_time = 0; // Last movement over CALIBRATION_MOTION_DEGREES
+    double change_position = 0;
+
+    EncoderCorrection &get_correction()
+    {
+        return encoder_corrections[axis->get_index()];
+    }
+
+    int8_t get_relay_direction()
+    {
+        return (direction == MOTION_DIRECTION_CW) ? 1 : -1;
+    }
+
+    void finish(uint8_t new_status)
+    {
+        if (new_status == MOTION_CALIBRATION_DONE && !apply()) {
+            new_status = MOTION_CALIBRATION_ABORTED;
+        }
+        if (new_status != MOTION_CALIBRATION_DONE) {
+            get_correction().suspend(false);
+        }
+
+        delete[] knots;
+        knots = nullptr;
+
+        status = new_status;
+        axis->stop();
+        axis->set_speed(settings.speed);
+        LOG_INFO("Encoder sweep of axis %d %s\n", axis->get_index(),
+                (status == MOTION_CALIBRATION_DONE) ? "done" : "aborted");
+    }
+
+    /**
+     * Corrections of both directions averaged to the table of the axis, false if a knot got no samples.
+     */
+    bool apply()
+    {
+        EncoderCorrectionTable table{};
+        table.knot_count = knot_count;
+
+        for (uint16_t i = 0; i < knot_count; i++) {
+            if (knots[i].directions == 0) {
+                LOG_WARN("Encoder sweep: no samples near knot %d\n", i);
+                return false;
+            }
+            double correction = knots[i].correction_sum / knots[i].directions;
+            long value = lround(correction * (1 << ENCODER_CORRECTION_FRACTION_BITS));
+            table.values[i] = (int16_t) max(-32768L, min(value, 32767L));
+        }
+
+        get_correction().set_table(table);
+        return true;
+    }
+
+    void start_run(unsigned long now)
+    {
+        phase = ENCODER_SWEEP_PHASE_MOVING;
+        origin = axis->get_state().encoder_position;
+        pulses = axis->get_state().pulses;
+        measuring = false;
+        turn_progress = 0;
+        change_time = now;
+        change_position = axis->get_position();
+
+        // Also clears a target left set when the positioning move was not needed
+        axis->stop();
+        axis->set_speed(ENCODER_SWEEP_SPEED);
+        if (direction == MOTION_DIRECTION_CW) {
+            axis->move_cw();
+        } else {
+            axis->move_ccw();
+        }
+    }
+
+    /**
+     * Mean-zero difference of the knots to the straight line through the turn.
+     */
+    void stop_run(unsigned long now, int32_t end_position, uint64_t end_time)
+    {
+        double slope = (double) (end_position - start_position) / (double) (end_time - start_time);
+        double mean = 0;
+        uint16_t filled = 0;
+
+        for (uint16_t i = 0; i < knot_count; i++) {
+            EncoderSweepKnot &knot = knots[i];
+            if (knot.count == 0) {
+                continue;
+            }
+            // The deviation replaces the position sum, which is not needed any more
+            knot.position_sum = slope * knot.time_sum / knot.count - knot.position_sum / knot.count;
+            mean += knot.position_sum;
+            filled++;
+        }
+        mean = (filled > 0) ? mean / filled : 0;
+
+        for (uint16_t i = 0; i < knot_count; i++) {
+            EncoderSweepKnot &knot = knots[i];
+            if (knot.count != 0) {
+                knot.correction_sum += (float) (knot.position_sum - mean);
+                knot.directions++;
+            }
+            knot.count = 0;
+            knot.time_sum = 0;
+            knot.position_sum = 0;
+        }
+
+        axis->stop();
+        phase = ENCODER_SWEEP_PHASE_STOPPING;
+        change_time = now;
+        change_position = axis->get_position();
+    }
+
+    void step_moving(unsigned long now, double position)
+    {
+        const RotatorState &state = axis->get_state();
+
+        if (fabs(position - change_position) >= CALIBRATION_MOTION_DEGREES) {
+            change_time = now;
+            change_position = position;
+        } else if (now - change_time >= CALIBRATION_START_TIMEOUT) {
+            finish(MOTION_CALIBRATION_ABORTED);
+            return;
+        }
+
+        bool at_edge = (get_relay_direction() > 0)
+                       ? position >= axis->get_maximum() - CALIBRATION_MARGIN / 2.0
+                       : position <= axis->get_minimum() + CALIBRATION_MARGIN / 2.0;
+        if (at_edge) {
+            finish(MOTION_CALIBRATION_ABORTED);
+            return;
+        }
+
+        if (state.pulses == pulses) {
+            return;
+        }
+        pulses = state.pulses;
+
+        int32_t raw = state.encoder_position;
+        if (!measuring) {
+            if ((raw - origin) * get_relay_direction() >= ENCODER_SWEEP_RUNUP * ENCODER_SWEEP_TURN / 360) {
+                measuring = true;
+                start_position = raw;
+                start_time = state.pulse_time;
+            }
+            return;
+        }
+
+        turn_progress = (raw - start_position) * get_relay_direction();
+        if (turn_progress >= ENCODER_SWEEP_TURN) {
+            stop_run(now, raw, state.pulse_time);
+            return;
+        }
+
+        uint32_t index = (((uint32_t) raw & ENCODER_POSITION_MASK) + (1 << step_bits) / 2) >> step_bits;
+        EncoderSweepKnot &knot = knots[index & (knot_count - 1)];
+        knot.count++;
+        knot.time_sum += (double) (state.pulse_time - start_time);
+        knot.position_sum += raw - start_position;
+    }
+
+    void step_stopping(unsigned long now, double position)
+    {
+        if (fabs(position - change_position) >= CALIBRATION_MOTION_DEGREES) {
+            change_time = now;
+            change_position = position;
+        }
+        if (now - change_time < CALIBRATION_SETTLE_TIME) {
+            return;
+        }
+
+        if (direction == MOTION_DIRECTION_CCW) {
+            finish(MOTION_CALIBRATION_DONE);
+            return;
+        }
+        direction = MOTION_DIRECTION_CCW;
+        start_run(now);
+    }
+
+public:
+    ~EncoderSweep()
+    {
+        delete[] knots;
+    }
+
+    /**
+     * Starts sweeping the encoder of the axis, returns false when its range is shorter than the two turns.
+     */
+    bool start(Axis *swept_axis, uint16_t sweep_knot_count)
+    {
+        double range = swept_axis->get_maximum() - swept_axis->get_minimum() - 2 * CALIBRATION_MARGIN;
+        if (range < 360 + 2 * ENCODER_SWEEP_RUNUP) {
+            return false;
+        }
+
+        abort();
+
+        axis = swept_axis;
+        knot_count = sweep_knot_count;
+        step_bits = ENCODER_POSITION_FRACTION_BITS;
+        for (uint16_t count = knot_count; count > 1; count >>= 1) {
+            step_bits--;
+        }
+        knots = new EncoderSweepKnot[knot_count]();
+
+        status = MOTION_CALIBRATION_RUNNING;
+        phase = ENCODER_SWEEP_PHASE_POSITIONING;
+        direction = MOTION_DIRECTION_CW;
+        turn_progress = 0;
+        change_time = millis();
+        change_position = axis->get_position();
+
+        get_correction().suspend(true);
+        axis->set_speed(100);
+        axis->set_target(axis->get_minimum() + CALIBRATION_MARGIN);
+        LOG_INFO("Encoder sweep of axis %d with %d knots\n", axis->get_index(), knot_count);
+
+        return true;
+    }
+
+    void abort()
+    {
+        if (status == MOTION_CALIBRATION_RUNNING) {
+            finish(MOTION_CALIBRATION_ABORTED);
+        }
+    }
+
+    void step()
+    {
+        if (status != MOTION_CALIBRATION_RUNNING) {
+            return;
+        }
+
+        unsigned long now = millis();
+        double position = axis->get_position();
+        int8_t relay_direction = axis->get_direction();
+
+        if (axis->get_state().fault) {
+            finish(MOTION_CALIBRATION_ABORTED);
+            return;
+        }
+
+        switch (phase) {
+            case ENCODER_SWEEP_PHASE_POSITIONING:
+                if (fabs(position - change_position) >= CALIBRATION_MOTION_DEGREES || relay_direction != 0) {
+                    change_time = now;
+                    change_position = position;
+                } else if (now - change_time >= CALIBRATION_SETTLE_TIME) {
+                    start_run(now);
+                }
+                break;
+            case ENCODER_SWEEP_PHASE_MOVING:
+                // The relay dropped on its own: a limit switch or a stop from elsewhere
+                if (relay_direction != get_relay_direction()) {
+                    finish(MOTION_CALIBRATION_ABORTED);
+                    return;
+                }
+                step_moving(now, position);
+                break;
+            default:
+                if (relay_direction != 0) {
+                    finish(MOTION_CALIBRATION_ABORTED);
+                    return;
+                }
+                step_stopping(now, position);
+                break;
+        }
+    }
+
+    uint8_t get_status()
+    {
+        return status;
+    }
+
+    Axis *get_axis()
+    {
+        return axis;
+    }
+
+    uint16_t get_knot_count()
+    {
+        return knot_count;
+    }
+
+    /**
+     * Direction of the current turn, MOTION_DIRECTION_CW or MOTION_DIRECTION_CCW.
+     */
+    uint8_t get_direction()
+    {
+        return direction;
+    }
+
+    /**
+     * Percentage of both turns measured so far.
+     */
+    uint8_t get_progress()
+    {
+        if (status == MOTION_CALIBRATION_DONE) {
+            return 100;
+        }
+        int32_t measured = (phase == ENCODER_SWEEP_PHASE_MOVING && measuring) ? turn_progress : 0;
+        if (phase == ENCODER_SWEEP_PHASE_STOPPING) {
+            measured = ENCODER_SWEEP_TURN;
+        }
+        return (uint8_t) (((direction == MOTION_DIRECTION_CCW ? ENCODER_SWEEP_TURN : 0) + measured) * 50L
+                          / ENCODER_SWEEP_TURN);
+    }
+};
+
+#endif
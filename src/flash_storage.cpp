@@ -0,0 +1,64 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "flash_storage.h"
+
+// EEFC command: erase page and write page
+#define FLASH_STORAGE_COMMAND_EWP 0x03
+#define FLASH_STORAGE_KEY 0x5A
+
+#define FLASH_STORAGE_FIRST_PAGE (IFLASH1_NB_OF_PAGES - FLASH_STORAGE_PAGE_COUNT)
+
+static_assert(FLASH_STORAGE_PAGE_SIZE == IFLASH1_PAGE_SIZE, "Flash page size mismatch");
+
+const uint8_t *FlashStorage::page(uint32_t index)
+{
+    return reinterpret_cast<const uint8_t *>(IFLASH1_ADDR + (FLASH_STORAGE_FIRST_PAGE + index) * IFLASH1_PAGE_SIZE);
+}
+
+// The firmware runs from the first bank, so code and interrupt handlers keep running while
+// the second bank is being programmed.
+bool FlashStorage::write_page(uint32_t index, const uint8_t *data)
+{
+    if (index >= FLASH_STORAGE_PAGE_COUNT) {
+        return false;
+    }
+
+    // Writes to the page address go to the EEFC latch buffer, 32 bits at a time
+    volatile uint32_t *latch = reinterpret_cast<volatile uint32_t *>(IFLASH1_ADDR
+            + (FLASH_STORAGE_FIRST_PAGE + index) * IFLASH1_PAGE_SIZE);
+    for (uint32_t i = 0; i < FLASH_STORAGE_PAGE_SIZE / 4; i++) {
+        uint32_t word;
+        memcpy(&word, &data[i * 4], sizeof(word));
+        latch[i] = word;
+    }
+
+    EFC1->EEFC_FCR = EEFC_FCR_FKEY(FLASH_STORAGE_KEY) | EEFC_FCR_FARG(FLASH_STORAGE_FIRST_PAGE + index)
+                     | EEFC_FCR_FCMD(FLASH_STORAGE_COMMAND_EWP);
+
+    uint32_t status;
+    do {
+        status = EFC1->EEFC_FSR;
+    } while ((status & EEFC_FSR_FRDY) == 0);
+
+    if (status & (EEFC_FSR_FCMDE | EEFC_FSR_FLOCKE)) {
+        return false;
+    }
+
+    return memcmp(page(index), data, FLASH_STORAGE_PAGE_SIZE) == 0;
+}
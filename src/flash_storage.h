@@ -0,0 +1,58 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_FLASH_STORAGE_H
+#define OH3AAROT_CONTROLLER_FLASH_STORAGE_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#define FLASH_STORAGE_PAGE_SIZE 256 // SAM3X8E flash page
+
+/**
+ * Pages reserved for persistent data at the top of the second flash bank.
+ *
+ * Pages are memory-mapped for reading. A page write erases and programs the whole page, so
+ * callers spread their writes over the pages to level the wear.
+ */
+class FlashStorage {
+public:
+    static const uint8_t *page(uint32_t index);
+
+    /**
+     * Erases and programs a page with FLASH_STORAGE_PAGE_SIZE bytes and verifies the result.
+     */
+    static bool write_page(uint32_t index, const uint8_t *data);
+
+    /**
+     * CRC-32 of the data continuing from a previous value, 0 to start.
+     */
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length)
+    {
+        crc = ~crc;
+        for (size_t i = 0; i < length; i++) {
+            crc ^= data[i];
+            for (uint8_t bit = 0; bit < 8; bit++) {
+                crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+            }
+        }
+        return ~crc;
+    }
+};
+
+#endif
@@ -0,0 +1,142 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_FLIGHT_RECORDER_H
+#define OH3AAROT_CONTROLLER_FLIGHT_RECORDER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "flight_recorder_format.h"
+#include "client_output_buffer.h"
+
+/**
+ * Fixed-size ring of timestamped control and network events, kept in RAM for reconstructing what
+ * happened during a pass. Recording is lock-free and safe from interrupt handlers: it claims a slot
+ * with one atomic increment and fills in 12 bytes. Old events are overwritten.
+ */
+class FlightRecorder {
+private:
+    FlightRecorderEvent events[FLIGHT_RECORDER_EVENT_COUNT];
+    volatile uint32_t write_index = 0;
+
+public:
+    void record(uint8_t type, uint8_t source = 0, uint16_t data = 0, int32_t value = 0)
+    {
+        uint32_t index = __atomic_fetch_add(&write_index, 1, __ATOMIC_RELAXED);
+        FlightRecorderEvent &event = events[index % FLIGHT_RECORDER_EVENT_COUNT];
+
+        event.timestamp = micros();
+        event.type = type;
+        event.source = source;
+        event.data = data;
+        event.value = value;
+    }
+
+    uint32_t get_write_index()
+    {
+        return __atomic_load_n(&write_index, __ATOMIC_ACQUIRE);
+    }
+
+    const FlightRecorderEvent &get_event(uint32_t index)
+    {
+        return events[index % FLIGHT_RECORDER_EVENT_COUNT];
+    }
+
+    static int32_t pack_name(const char *name)
+    {
+        uint32_t packed = 0;
+
+        for (int i = 0; i < 4 && name[i] != '\0' && name[i] != ' '; i++) {
+            packed |= ((uint32_t) (uint8_t) name[i]) << (8 * i);
+        }
+
+        return (int32_t) packed;
+    }
+
+    template<typename T>
+    static int32_t pack_ip_address(const T &ip)
+    {
+        return (int32_t) (ip[0] | (ip[1] << 8) | (ip[2] << 16) | ((uint32_t) ip[3] << 24));
+    }
+};
+
+extern FlightRecorder flight_recorder;
+
+/**
+ * Streams the events recorded before the DUMP command, oldest first, one hex-encoded record per line.
+ * Events that get overwritten while the dump is in progress are skipped and counted.
+ */
+class FlightRecorderDumpSource : public ClientOutputSource {
+private:
+    uint32_t index;
+    uint32_t end_index;
+    uint32_t lost = 0;
+
+    static void print_hex_byte(Print &output, uint8_t value)
+    {
+        static const char digits[] = "0123456789abcdef";
+        output.print(digits[value >> 4]);
+        output.print(digits[value & 0x0F]);
+    }
+
+public:
+    FlightRecorderDumpSource()
+    {
+        end_index = flight_recorder.get_write_index();
+        index = (end_index > FLIGHT_RECORDER_EVENT_COUNT) ? (end_index - FLIGHT_RECORDER_EVENT_COUNT) : 0;
+    }
+
+    uint32_t get_count()
+    {
+        return end_index - index;
+    }
+
+    bool next(Print &output) override
+    {
+        uint32_t current_index = flight_recorder.get_write_index();
+        if (current_index - index > FLIGHT_RECORDER_EVENT_COUNT) {
+            lost += current_index - FLIGHT_RECORDER_EVENT_COUNT - index;
+            index = current_index - FLIGHT_RECORDER_EVENT_COUNT;
+        }
+
+        if ((int32_t) (end_index - index) <= 0) {
+            output.print("OK DUMP END LOST=");
+            output.println(lost);
+            return false;
+        }
+
+        const FlightRecorderEvent &event = flight_recorder.get_event(index++);
+        uint8_t bytes[FLIGHT_RECORDER_EVENT_SIZE] = {
+                (uint8_t) event.timestamp, (uint8_t) (event.timestamp >> 8),
+                (uint8_t) (event.timestamp >> 16), (uint8_t) (event.timestamp >> 24),
+                event.type, event.source,
+                (uint8_t) event.data, (uint8_t) (event.data >> 8),
+                (uint8_t) event.value, (uint8_t) (event.value >> 8),
+                (uint8_t) (event.value >> 16), (uint8_t) (event.value >> 24)
+        };
+
+        for (auto value : bytes) {
+            print_hex_byte(output, value);
+        }
+        output.print('\n');
+
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_FLIGHT_RECORDER_FORMAT_H
+#define OH3AAROT_CONTROLLER_FLIGHT_RECORDER_FORMAT_H
+
+#include <stdint.h>
+
+// Event record layout shared by the firmware and the host-side decoder.
+// DUMP sends each record as 24 hex digits: the 12 bytes below in little-endian order.
+
+#define FLIGHT_RECORDER_EVENT_BOOT 1
+#define FLIGHT_RECORDER_EVENT_COMMAND 2 // source: client slot, value: first four characters of the command
+#define FLIGHT_RECORDER_EVENT_TARGET_SET 3 // source: axis, value: target angle in hundredths of a degree
+#define FLIGHT_RECORDER_EVENT_TARGET_REACHED 4 // source: axis, value: angle in hundredths of a degree
+#define FLIGHT_RECORDER_EVENT_RELAY 5 // source: FLIGHT_RECORDER_RELAY_* and axis, data: new state
+#define FLIGHT_RECORDER_EVENT_INPUT 6 // source: FLIGHT_RECORDER_INPUT_* and axis, data: new state
+#define FLIGHT_RECORDER_EVENT_LIMIT_STOP 7 // source: FLIGHT_RECORDER_INPUT_* and axis that stopped the motion
+#define FLIGHT_RECORDER_EVENT_EMERGENCY_STOP 8 // value: receive-to-relay-off latency in us
+#define FLIGHT_RECORDER_EVENT_CAPTURE_OVERRUN 9 // data: 1 when capture has stopped
+#define FLIGHT_RECORDER_EVENT_CLIENT_CONNECT 10 // source: client slot, data: remote port, value: remote IPv4 address
+#define FLIGHT_RECORDER_EVENT_CLIENT_DISCONNECT 11 // data: remote port, value: remote IPv4 address
+#define FLIGHT_RECORDER_EVENT_CLIENT_REJECT 12 // data: remote port, value: remote IPv4 address
+#define FLIGHT_RECORDER_EVENT_SETTINGS 13 // source: FLIGHT_RECORDER_SETTINGS_*, value: saved settings sequence
+#define FLIGHT_RECORDER_EVENT_CLIENT_EVICT 14 // source: client slot of the evicted client
+#define FLIGHT_RECORDER_EVENT_TRACKING_FAULT 15 // source: axis, data: switches, value: position in hundredths of a degree
+#define FLIGHT_RECORDER_EVENT_CALIBRATION 16 // source: axis, data: MOTION_CALIBRATION_* state, value: completed runs
+#define FLIGHT_RECORDER_EVENT_ENCODER_LOST 17 // source: axis, value: last position in hundredths of a degree
+
+// Relay and input sources carry the axis in the high nibble, azimuth is 0
+#define FLIGHT_RECORDER_AXIS_SHIFT 4
+#define FLIGHT_RECORDER_SOURCE(axis, source) ((uint8_t) (((axis) << FLIGHT_RECORDER_AXIS_SHIFT) | (source)))
+
+#define FLIGHT_RECORDER_RELAY_CW 0
+#define FLIGHT_RECORDER_RELAY_CCW 1
+
+#define FLIGHT_RECORDER_INPUT_THRESHOLD_1 0
+#define FLIGHT_RECORDER_INPUT_THRESHOLD_2 1
+#define FLIGHT_RECORDER_INPUT_LIMIT_1 2
+#define FLIGHT_RECORDER_INPUT_LIMIT_2 3
+
+#define FLIGHT_RECORDER_SETTINGS_SAVE 0
+#define FLIGHT_RECORDER_SETTINGS_LOAD 1
+#define FLIGHT_RECORDER_SETTINGS_DEFAULTS 2
+
+#define FLIGHT_RECORDER_EVENT_SIZE 12
+
+struct FlightRecorderEvent {
+    uint32_t timestamp; // micros()
+    uint8_t type;
+    uint8_t source;
+    uint16_t data;
+    int32_t value;
+};
+
+#endif
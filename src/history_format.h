@@ -0,0 +1,61 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_HISTORY_FORMAT_H
+#define OH3AAROT_CONTROLLER_HISTORY_FORMAT_H
+
+#include <stdint.h>
+
+// Position history encoding shared by the firmware and the host-side decoder.
+// HISTORY sends the records as one byte stream in base64 lines of up to HISTORY_LINE_BYTES bytes each.
+// Every field is a varint (7 bits per byte, least significant first, high bit set on all but the last
+// byte) and signed fields are zigzag encoded. Deltas start from zero, so the first record is absolute.
+//
+// Raw record: time delta (us), position delta, velocity delta, flags
+// Summary record: time delta (us), minimum position delta, maximum minus minimum position, mean velocity
+//                 delta, flags of all samples combined
+//
+// Positions are unwrapped encoder positions in 1/4096 turns and velocities in 1/2^24 turns per encoder
+// pulse, the reply header gives the scales to degrees and degrees per second.
+
+#define HISTORY_MODE_RAW 0
+#define HISTORY_MODE_SUMMARY 1
+
+// Flags: the ROTATOR_SWITCH_* levels in the low bits and the relays
+#define HISTORY_FLAG_THRESHOLD_1 0x01
+#define HISTORY_FLAG_THRESHOLD_2 0x02
+#define HISTORY_FLAG_LIMIT_1 0x04
+#define HISTORY_FLAG_LIMIT_2 0x08
+#define HISTORY_FLAG_CW 0x10
+#define HISTORY_FLAG_CCW 0x20
+
+#define HISTORY_LINE_BYTES 57 // 76 base64 characters
+
+static const char HISTORY_BASE64_DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static inline uint32_t history_zigzag_encode(int32_t value)
+{
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+static inline int32_t history_zigzag_decode(uint32_t value)
+{
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+#endif
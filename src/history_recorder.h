@@ -0,0 +1,323 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_HISTORY_RECORDER_H
+#define OH3AAROT_CONTROLLER_HISTORY_RECORDER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "history_format.h"
+#include "client_output_buffer.h"
+#include "rotator_state.h"
+
+#define HISTORY_VELOCITY_SHIFT (ESTIMATOR_FRACTION_BITS - 12) // Estimated velocity to 1/2^24 turns per pulse
+#define HISTORY_POSITION_SCALE (360.0 / (1L << ENCODER_POSITION_FRACTION_BITS)) // Degrees per position unit
+#define HISTORY_VELOCITY_SCALE (360.0 / (1L << 24)) // Degrees per pulse per velocity unit
+
+struct HistorySample {
+    uint32_t timestamp;
+    int32_t position;
+    int16_t velocity;
+    uint8_t flags;
+};
+
+struct HistorySummary {
+    uint32_t timestamp; // Of the first sample
+    int32_t minimum;
+    int32_t maximum;
+    int16_t velocity; // Mean
+    uint8_t flags; // Combined
+};
+
+/**
+ * Ring of history records with one writer, the capture interrupt. Readers copy a record and then
+ * check that the writer has not reached it again in the meantime.
+ */
+template<typename T, uint32_t LENGTH>
+class HistoryRing {
+private:
+    T records[LENGTH];
+    volatile uint32_t write_index = 0;
+
+public:
+    typedef T record_type;
+
+    inline void push(const T &record)
+    {
+        records[write_index % LENGTH] = record;
+        __DMB();
+        write_index++;
+    }
+
+    uint32_t get_write_index()
+    {
+        return write_index;
+    }
+
+    /**
+     * Index of the oldest record, the slot after it is the next one the interrupt overwrites.
+     */
+    uint32_t get_first_index()
+    {
+        uint32_t index = write_index;
+        return (index >= LENGTH) ? (index - LENGTH + 1) : 0;
+    }
+
+    bool read(uint32_t index, T &record)
+    {
+        record = records[index % LENGTH];
+        __DMB();
+        return (write_index - index) < LENGTH;
+    }
+
+    /**
+     * Index of the first record at most the given number of microseconds older than now.
+     */
+    uint32_t find(uint32_t now, uint32_t age)
+    {
+        uint32_t end = get_write_index();
+        uint32_t index = get_first_index();
+
+        while (index != end && now - records[index % LENGTH].timestamp > age) {
+            index++;
+        }
+
+        return index;
+    }
+};
+
+typedef HistoryRing<HistorySample, HISTORY_SAMPLE_COUNT> HistorySampleRing;
+typedef HistoryRing<HistorySummary, HISTORY_SUMMARY_COUNT> HistorySummaryRing;
+
+/**
+ * Records the position, velocity and flags of one axis for every encoder pulse, and a min/max
+ * summary of every HISTORY_SUMMARY_LENGTH pulses that covers a much longer time for the same memory.
+ */
+class HistoryRecorder {
+private:
+    int cw_pin = -1;
+    int ccw_pin = -1;
+
+    // Summary of the samples since the last complete one, only touched by the interrupt
+    HistorySummary pending{};
+    int32_t velocity_sum = 0;
+    uint32_t pending_count = 0;
+
+    static int16_t to_velocity(int32_t estimated_velocity)
+    {
+        int32_t velocity = estimated_velocity >> HISTORY_VELOCITY_SHIFT;
+        if (velocity > INT16_MAX) {
+            return INT16_MAX;
+        }
+        if (velocity < INT16_MIN) {
+            return INT16_MIN;
+        }
+        return (int16_t) velocity;
+    }
+
+public:
+    HistorySampleRing samples;
+    HistorySummaryRing summaries;
+
+    void begin(int recorder_cw_pin, int recorder_ccw_pin)
+    {
+        this->cw_pin = recorder_cw_pin;
+        this->ccw_pin = recorder_ccw_pin;
+    }
+
+    /**
+     * Called from the capture interrupt with the inputs just published for the pulse.
+     */
+    inline void record(const RotatorInputs &inputs)
+    {
+        if (inputs.period == 0) {
+            return;
+        }
+
+        HistorySample sample;
+        sample.timestamp = (uint32_t) inputs.pulse_time;
+        sample.position = inputs.position;
+        sample.velocity = to_velocity(inputs.estimated_velocity);
+        sample.flags = inputs.switches;
+        if (digitalRead(cw_pin)) {
+            sample.flags |= HISTORY_FLAG_CW;
+        }
+        if (digitalRead(ccw_pin)) {
+            sample.flags |= HISTORY_FLAG_CCW;
+        }
+        samples.push(sample);
+
+        if (pending_count == 0) {
+            pending.timestamp = sample.timestamp;
+            pending.minimum = sample.position;
+            pending.maximum = sample.position;
+            pending.flags = 0;
+            velocity_sum = 0;
+        }
+        if (sample.position < pending.minimum) {
+            pending.minimum = sample.position;
+        }
+        if (sample.position > pending.maximum) {
+            pending.maximum = sample.position;
+        }
+        pending.flags |= sample.flags;
+        velocity_sum += sample.velocity;
+
+        if (++pending_count == HISTORY_SUMMARY_LENGTH) {
+            pending.velocity = (int16_t) (velocity_sum / HISTORY_SUMMARY_LENGTH);
+            summaries.push(pending);
+            pending_count = 0;
+        }
+    }
+};
+
+extern HistoryRecorder history_recorders[AXIS_COUNT];
+
+/**
+ * Collects varint-encoded deltas of history records and writes them as base64 lines.
+ */
+class HistoryEncoder {
+private:
+    uint8_t bytes[HISTORY_LINE_BYTES + 32];
+    size_t length = 0;
+
+    HistorySample previous_sample{};
+    HistorySummary previous_summary{};
+
+    void put_unsigned(uint32_t value)
+    {
+        while (value >= 0x80) {
+            bytes[length++] = (uint8_t) (value | 0x80);
+            value >>= 7;
+        }
+        bytes[length++] = (uint8_t) value;
+    }
+
+    void put_signed(int32_t value)
+    {
+        put_unsigned(history_zigzag_encode(value));
+    }
+
+public:
+    void encode(const HistorySample &sample)
+    {
+        put_signed((int32_t) (sample.timestamp - previous_sample.timestamp));
+        put_signed(sample.position - previous_sample.position);
+        put_signed(sample.velocity - previous_sample.velocity);
+        put_unsigned(sample.flags);
+        previous_sample = sample;
+    }
+
+    void encode(const HistorySummary &summary)
+    {
+        put_signed((int32_t) (summary.timestamp - previous_summary.timestamp));
+        put_signed(summary.minimum - previous_summary.minimum);
+        put_unsigned((uint32_t) (summary.maximum - summary.minimum));
+        put_signed(summary.velocity - previous_summary.velocity);
+        put_unsigned(summary.flags);
+        previous_summary = summary;
+    }
+
+    bool is_line_full()
+    {
+        return length >= HISTORY_LINE_BYTES;
+    }
+
+    bool is_empty()
+    {
+        return length == 0;
+    }
+
+    /**
+     * Writes up to HISTORY_LINE_BYTES of the collected bytes as one base64 line.
+     */
+    void print_line(Print &output)
+    {
+        size_t line_length = (length < HISTORY_LINE_BYTES) ? length : HISTORY_LINE_BYTES;
+
+        for (size_t i = 0; i < line_length; i += 3) {
+            uint32_t group = (uint32_t) bytes[i] << 16;
+            if (i + 1 < line_length) {
+                group |= (uint32_t) bytes[i + 1] << 8;
+            }
+            if (i + 2 < line_length) {
+                group |= bytes[i + 2];
+            }
+
+            output.print(HISTORY_BASE64_DIGITS[(group >> 18) & 0x3F]);
+            output.print(HISTORY_BASE64_DIGITS[(group >> 12) & 0x3F]);
+            output.print((i + 1 < line_length) ? HISTORY_BASE64_DIGITS[(group >> 6) & 0x3F] : '=');
+            output.print((i + 2 < line_length) ? HISTORY_BASE64_DIGITS[group & 0x3F] : '=');
+        }
+        output.print('\n');
+
+        length -= line_length;
+        memmove(bytes, bytes + line_length, length);
+    }
+};
+
+/**
+ * Streams the records of one history ring between two indices selected by the HISTORY command.
+ * Records that get overwritten before they are sent are skipped and counted.
+ */
+template<typename RING>
+class HistorySource : public ClientOutputSource {
+private:
+    RING &ring;
+    uint32_t index;
+    uint32_t end_index;
+    uint32_t lost = 0;
+    HistoryEncoder encoder;
+
+public:
+    HistorySource(RING &history_ring, uint32_t start_index, uint32_t history_end_index)
+            : ring(history_ring), index(start_index), end_index(history_end_index)
+    {}
+
+    bool next(Print &output) override
+    {
+        while (!encoder.is_line_full() && (int32_t) (end_index - index) > 0) {
+            uint32_t first_index = ring.get_first_index();
+            if ((int32_t) (first_index - index) > 0) {
+                uint32_t skipped = ((int32_t) (first_index - end_index) > 0) ? end_index : first_index;
+                lost += skipped - index;
+                index = skipped;
+                continue;
+            }
+
+            typename RING::record_type record;
+            if (ring.read(index, record)) {
+                encoder.encode(record);
+            } else {
+                lost++;
+            }
+            index++;
+        }
+
+        if (!encoder.is_empty()) {
+            encoder.print_line(output);
+            return true;
+        }
+
+        output.print("OK HISTORY END LOST=");
+        output.println(lost);
+        return false;
+    }
+};
+
+#endif
@@ -20,69 +20,80 @@
 
 #include "config.h"
 #include "iointerface.h"
+#include "latency_tracer.h"
 
-IOInterface::IOInterface()
+void IOInterface::begin()
 {
-    pinMode(PIN_CW, OUTPUT);
-    pinMode(PIN_CCW, OUTPUT);
-    pinMode(PIN_THRESHOLD_1, INPUT_PULLUP);
-    pinMode(PIN_THRESHOLD_2, INPUT_PULLUP);
-    pinMode(PIN_LIMIT_1, INPUT_PULLUP);
-    pinMode(PIN_LIMIT_2, INPUT_PULLUP);
-
-    pinMode(PIN_SPEED, OUTPUT);
+    pinMode(pins.cw, OUTPUT);
+    pinMode(pins.ccw, OUTPUT);
+    pinMode(pins.speed, OUTPUT);
 
     analogWriteResolution(12);
     analogReadResolution(12);
 
-    attachInterrupt(digitalPinToInterrupt(PIN_THRESHOLD_1), threshold1Change, CHANGE);
-    attachInterrupt(digitalPinToInterrupt(PIN_THRESHOLD_2), threshold2Change, CHANGE);
-    attachInterrupt(digitalPinToInterrupt(PIN_LIMIT_1), limit1Change, CHANGE);
-    attachInterrupt(digitalPinToInterrupt(PIN_LIMIT_2), limit2Change, CHANGE);
-
     setClockwise(false);
     setCounterClockwise(false);
     setSpeed(DEFAULT_SPEED);
 }
 
+uint8_t IOInterface::getAxis()
+{
+    return pins.axis;
+}
+
+bool IOInterface::hasThresholds()
+{
+    return pins.threshold_1 != PIN_NONE;
+}
+
 void IOInterface::setClockwise(bool active)
 {
-    writePin(PIN_CW, active);
+    if (readPin(pins.cw) != active) {
+        flight_recorder.record(FLIGHT_RECORDER_EVENT_RELAY, FLIGHT_RECORDER_SOURCE(pins.axis, FLIGHT_RECORDER_RELAY_CW),
+                active);
+        latency_tracer.output_changed();
+    }
+    writePin(pins.cw, active);
 }
 
 bool IOInterface::getClockwise()
 {
-    return readPin(PIN_CW);
+    return readPin(pins.cw);
 }
 
 void IOInterface::setCounterClockwise(bool active)
 {
-    writePin(PIN_CCW, active);
+    if (readPin(pins.ccw) != active) {
+        flight_recorder.record(FLIGHT_RECORDER_EVENT_RELAY, FLIGHT_RECORDER_SOURCE(pins.axis, FLIGHT_RECORDER_RELAY_CCW),
+                active);
+        latency_tracer.output_changed();
+    }
+    writePin(pins.ccw, active);
 }
 
 bool IOInterface::getCounterClockwise()
 {
-    return readPin(PIN_CCW);
+    return readPin(pins.ccw);
 }
 
 bool IOInterface::getThreshold1State()
 {
-    return threshold1;
+    return (rotator_inputs[pins.axis].read().switches & ROTATOR_SWITCH_THRESHOLD_1) != 0;
 }
 
 bool IOInterface::getThreshold2State()
 {
-    return threshold2;
+    return (rotator_inputs[pins.axis].read().switches & ROTATOR_SWITCH_THRESHOLD_2) != 0;
 }
 
 bool IOInterface::getLimit1State()
 {
-    return limit1;
+    return (rotator_inputs[pins.axis].read().switches & ROTATOR_SWITCH_LIMIT_1) != 0;
 }
 
 bool IOInterface::getLimit2State()
 {
-    return limit2;
+    return (rotator_inputs[pins.axis].read().switches & ROTATOR_SWITCH_LIMIT_2) != 0;
 }
 
 int IOInterface::getSpeed()
@@ -96,11 +107,5 @@ void IOInterface::setSpeed(int speed)
     if (speed_raw < 4095) {
         speed_raw++;
     }
-    analogWrite(PIN_SPEED, speed_raw);
+    analogWrite(pins.speed, speed_raw);
 }
-
-volatile bool IOInterface::threshold1 = false;
-volatile bool IOInterface::threshold2 = false;
-volatile bool IOInterface::limit1 = false;
-volatile bool IOInterface::limit2 = false;
-volatile int IOInterface::speed_raw = DEFAULT_SPEED;
@@ -19,13 +19,58 @@
 #ifndef OH3AAROT_CONTROLLER_IOINTERFACE_H
 #define OH3AAROT_CONTROLLER_IOINTERFACE_H
 
+#include "config.h"
+#include "flight_recorder.h"
+#include "profiler.h"
+#include "rotator_state.h"
+
+#define PIN_NONE -1
+
+/**
+ * Pin sets of the axes. The clockwise relay moves towards larger angles. Axes without
+ * threshold switches use PIN_NONE for them.
+ */
+struct AzimuthPins {
+    static constexpr uint8_t axis = AXIS_AZIMUTH;
+    static constexpr int cw = PIN_CW;
+    static constexpr int ccw = PIN_CCW;
+    static constexpr int threshold_1 = PIN_THRESHOLD_1;
+    static constexpr int threshold_2 = PIN_THRESHOLD_2;
+    static constexpr int limit_1 = PIN_LIMIT_1;
+    static constexpr int limit_2 = PIN_LIMIT_2;
+    static constexpr int speed = PIN_SPEED;
+};
+
+struct ElevationPins {
+    static constexpr uint8_t axis = AXIS_ELEVATION;
+    static constexpr int cw = PIN_EL_UP;
+    static constexpr int ccw = PIN_EL_DOWN;
+    static constexpr int threshold_1 = PIN_NONE;
+    static constexpr int threshold_2 = PIN_NONE;
+    static constexpr int limit_1 = PIN_EL_LIMIT_1;
+    static constexpr int limit_2 = PIN_EL_LIMIT_2;
+    static constexpr int speed = PIN_EL_SPEED;
+};
+
+struct IOPins {
+    uint8_t axis;
+    int cw;
+    int ccw;
+    int threshold_1;
+    int threshold_2;
+    int limit_1;
+    int limit_2;
+    int speed;
+};
+
+/**
+ * Relays, switches and the speed voltage of one axis. The switch interrupt handlers are
+ * instantiated per pin set, so each axis publishes to its own inputs.
+ */
 class IOInterface {
 private:
-    static volatile bool threshold1;
-    static volatile bool threshold2;
-    static volatile bool limit1;
-    static volatile bool limit2;
-    static volatile int speed_raw;
+    IOPins pins;
+    volatile int speed_raw = DEFAULT_SPEED;
 
     static bool readPin(int pin)
     {
@@ -37,28 +82,51 @@ private:
         digitalWrite(pin, active ? HIGH : LOW);
     }
 
-    static void threshold1Change()
+    template<uint8_t AXIS, int PIN, uint8_t SWITCH, uint8_t INPUT_SOURCE, uint8_t PROFILER_ENTRY>
+    static void switchChange()
     {
-        threshold1 = readPin(PIN_THRESHOLD_1);
+        uint32_t start = Profiler::cycles();
+        bool active = readPin(PIN);
+        publish_switch(AXIS, SWITCH, active);
+        flight_recorder.record(FLIGHT_RECORDER_EVENT_INPUT, FLIGHT_RECORDER_SOURCE(AXIS, INPUT_SOURCE), active);
+        profiler.record(PROFILER_ENTRY, start);
     }
 
-    static void threshold2Change()
+    template<uint8_t AXIS, int PIN, uint8_t SWITCH, uint8_t INPUT_SOURCE, uint8_t PROFILER_ENTRY>
+    static void attachSwitch()
     {
-        threshold2 = readPin(PIN_THRESHOLD_2);
-    }
+        if (PIN == PIN_NONE) {
+            return;
+        }
 
-    static void limit1Change()
-    {
-        limit1 = readPin(PIN_LIMIT_1);
+        pinMode(PIN, INPUT_PULLUP);
+        attachInterrupt(digitalPinToInterrupt(PIN), switchChange<AXIS, PIN, SWITCH, INPUT_SOURCE, PROFILER_ENTRY>,
+                CHANGE);
+        // The interrupts report only changes, so take the level at boot once
+        publish_switch(AXIS, SWITCH, readPin(PIN));
     }
 
-    static void limit2Change()
+    void begin();
+
+public:
+    template<typename PINS>
+    explicit IOInterface(PINS)
+            : pins{PINS::axis, PINS::cw, PINS::ccw, PINS::threshold_1, PINS::threshold_2, PINS::limit_1,
+                   PINS::limit_2, PINS::speed}
     {
-        limit2 = readPin(PIN_LIMIT_2);
+        attachSwitch<PINS::axis, PINS::threshold_1, ROTATOR_SWITCH_THRESHOLD_1, FLIGHT_RECORDER_INPUT_THRESHOLD_1,
+                PROFILER_ISR_THRESHOLD_1>();
+        attachSwitch<PINS::axis, PINS::threshold_2, ROTATOR_SWITCH_THRESHOLD_2, FLIGHT_RECORDER_INPUT_THRESHOLD_2,
+                PROFILER_ISR_THRESHOLD_2>();
+        attachSwitch<PINS::axis, PINS::limit_1, ROTATOR_SWITCH_LIMIT_1, FLIGHT_RECORDER_INPUT_LIMIT_1,
+                PROFILER_ISR_LIMIT_1>();
+        attachSwitch<PINS::axis, PINS::limit_2, ROTATOR_SWITCH_LIMIT_2, FLIGHT_RECORDER_INPUT_LIMIT_2,
+                PROFILER_ISR_LIMIT_2>();
+        begin();
     }
 
-public:
-    IOInterface();
+    uint8_t getAxis();
+    bool hasThresholds();
 
     void setClockwise(bool active);
     bool getClockwise();
@@ -0,0 +1,84 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "latency_tracer.h"
+
+LatencyTracer latency_tracer;
+
+static const char *const latency_stage_names[LATENCY_STAGE_COUNT] = {
+        "PARSE",
+        "EXECUTE",
+        "OUTPUT",
+        "FLUSH",
+};
+
+void LatencyTracer::begin()
+{
+#ifdef PIN_LATENCY_DEBUG
+    pinMode(PIN_LATENCY_DEBUG, OUTPUT);
+    digitalWrite(PIN_LATENCY_DEBUG, LOW);
+#endif
+    reset();
+}
+
+void LatencyTracer::reset()
+{
+    command_count = 0;
+    output_armed = false;
+
+    for (auto &command_entries : entries) {
+        for (auto &entry : command_entries) {
+            entry.clear();
+        }
+    }
+}
+
+uint8_t LatencyTracer::get_command_index(const char *command)
+{
+    char name[LATENCY_COMMAND_NAME_LENGTH];
+    size_t length = 0;
+
+    while (command[length] != '\0' && command[length] != ' ' && length < LATENCY_COMMAND_NAME_LENGTH - 1) {
+        name[length] = command[length];
+        length++;
+    }
+    name[length] = '\0';
+
+    for (uint8_t i = 0; i < command_count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+
+    if (command_count < LATENCY_COMMAND_COUNT - 1) {
+        strcpy(names[command_count], name);
+        return command_count++;
+    }
+
+    if (command_count == LATENCY_COMMAND_COUNT - 1) {
+        strcpy(names[command_count], "OTHER");
+        command_count++;
+    }
+
+    return LATENCY_COMMAND_COUNT - 1;
+}
+
+const char *LatencyTracer::get_stage_name(uint8_t stage)
+{
+    return stage < LATENCY_STAGE_COUNT ? latency_stage_names[stage] : "UNKNOWN";
+}
@@ -0,0 +1,184 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_LATENCY_TRACER_H
+#define OH3AAROT_CONTROLLER_LATENCY_TRACER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "profiler.h"
+#include "client_output_buffer.h"
+
+// Stages measured from the time the command line was received
+#define LATENCY_STAGE_PARSE 0
+#define LATENCY_STAGE_EXECUTE 1
+#define LATENCY_STAGE_OUTPUT 2
+#define LATENCY_STAGE_FLUSH 3
+
+#define LATENCY_STAGE_COUNT 4
+
+#define LATENCY_COMMAND_NAME_LENGTH 12
+#define LATENCY_STAGE_NAME_MAX_LENGTH 7
+
+static_assert(LATENCY_COMMAND_NAME_LENGTH + LATENCY_STAGE_NAME_MAX_LENGTH <= PROFILER_NAME_MAX_LENGTH,
+        "Latency output lines must not be split");
+
+/**
+ * Progress of the last command of one client through the stages.
+ */
+struct LatencyTrace {
+    uint8_t command;
+    unsigned long received_time;
+    uint32_t output_end;
+    bool flush_pending;
+};
+
+/**
+ * Per-command latency histograms in microseconds: from the command line being read from the
+ * W5100 to it being parsed, executed, changing the relay outputs (motion commands) and to the
+ * reply being written to the socket.
+ */
+class LatencyTracer {
+private:
+    char names[LATENCY_COMMAND_COUNT][LATENCY_COMMAND_NAME_LENGTH];
+    ProfilerEntry entries[LATENCY_COMMAND_COUNT][LATENCY_STAGE_COUNT];
+    uint8_t command_count = 0;
+
+    // Command being executed, a relay change is attributed to it
+    bool output_armed = false;
+    uint8_t output_command = 0;
+    unsigned long output_received_time = 0;
+
+    static void toggle_debug_pin()
+    {
+#ifdef PIN_LATENCY_DEBUG
+        digitalWrite(PIN_LATENCY_DEBUG, !digitalRead(PIN_LATENCY_DEBUG));
+#endif
+    }
+
+public:
+    void begin();
+
+    void reset();
+
+    /**
+     * Returns the slot for the name (first word) of the command line.
+     */
+    uint8_t get_command_index(const char *command);
+
+    inline void record(uint8_t command, uint8_t stage, unsigned long received_time)
+    {
+        // Commands in progress during reset() no longer have a slot
+        if (command >= command_count) {
+            return;
+        }
+        entries[command][stage].add(micros() - received_time);
+        toggle_debug_pin();
+    }
+
+    void begin_execute(uint8_t command, unsigned long received_time)
+    {
+        output_command = command;
+        output_received_time = received_time;
+        output_armed = true;
+    }
+
+    void end_execute()
+    {
+        output_armed = false;
+    }
+
+    /**
+     * Called when a relay output changes state.
+     */
+    inline void output_changed()
+    {
+        if (output_armed) {
+            record(output_command, LATENCY_STAGE_OUTPUT, output_received_time);
+            output_armed = false;
+        }
+    }
+
+    uint8_t get_command_count()
+    {
+        return command_count;
+    }
+
+    const char *get_command_name(uint8_t command)
+    {
+        return names[command];
+    }
+
+    const ProfilerEntry &get_entry(uint8_t command, uint8_t stage)
+    {
+        return entries[command][stage];
+    }
+
+    static const char *get_stage_name(uint8_t stage);
+};
+
+extern LatencyTracer latency_tracer;
+
+/**
+ * Streams the latency histograms of commands seen so far for the LATENCY? command.
+ */
+class LatencyStatsSource : public ClientOutputSource {
+private:
+    uint8_t command = 0;
+    uint8_t stage = 0;
+    uint8_t line = 0;
+
+    void next_entry()
+    {
+        line = 0;
+        if (++stage >= LATENCY_STAGE_COUNT) {
+            stage = 0;
+            command++;
+        }
+    }
+
+public:
+    bool next(Print &output) override
+    {
+        while (command < latency_tracer.get_command_count()) {
+            const ProfilerEntry &entry = latency_tracer.get_entry(command, stage);
+
+            if (entry.count == 0) {
+                next_entry();
+                continue;
+            }
+
+            output.print(latency_tracer.get_command_name(command));
+            output.print(' ');
+            output.print(LatencyTracer::get_stage_name(stage));
+            output.print(' ');
+            entry.print_line(output, line);
+            output.print('\n');
+
+            if (++line >= entry.get_line_count()) {
+                next_entry();
+            }
+            return true;
+        }
+
+        output.println("OK LATENCY END");
+        return false;
+    }
+};
+
+#endif
@@ -22,15 +22,26 @@
 
 #include "config.h"
 #include "print.h"
-#include "iointerface.h"
-#include "pwm_data_reader.h"
+#include "rotator_axis.h"
 #include "controller_command_handler.h"
 #include "controller_client_manager.h"
+#include "serial_controller_client.h"
+#include "profiler.h"
+#include "latency_tracer.h"
+#include "capture_recorder.h"
+#include "history_recorder.h"
+#include "monotonic_clock.h"
+#include "rotator_state.h"
+#include "encoder_comparator.h"
+#include "encoder_correction.h"
+#include "settings.h"
+#include "network_startup.h"
 
 // Network settings
 
 IPAddress ip_address;
 const uint16_t tcp_port = SERVER_TCP_PORT;
+const uint16_t rotctld_tcp_port = ROTCTLD_TCP_PORT;
 
 byte mac_address[] = {
         0xDE, 0xAD, 0xBE, 0xEF, 0xFE, 0xED
@@ -38,85 +49,198 @@ byte mac_address[] = {
 
 // Application code
 
-capture_tc0_declaration(); // TC0 and channel 0
-PwmDataReader<arduino_due::tc_lib::timer_ids::TIMER_TC0> pwm_data_reader(capture_tc0, PWM_CAPTURE_WINDOW_DURATION);
+// TC0 and channel 0: expanded from capture_tc0_declaration() to profile the interrupt handler
+typedef arduino_due::tc_lib::capture<arduino_due::tc_lib::timer_ids::TIMER_TC0> capture_tc0_t;
+capture_tc0_t capture_tc0;
 
-IOInterface *io;
-EthernetServer *server;
-ControllerCommandHandler *command_handler;
-ControllerClientManager *client_manager;
+void TC0_Handler(void)
+{
+    uint32_t start = Profiler::cycles();
+    uint32_t status = TC_GetStatus(
+            arduino_due::tc_lib::tc_info<arduino_due::tc_lib::timer_ids::TIMER_TC0>::tc_p(),
+            arduino_due::tc_lib::tc_info<arduino_due::tc_lib::timer_ids::TIMER_TC0>::channel);
+    capture_tc0_t::tc_interrupt(status);
+    profiler.record(PROFILER_ISR_TC0, start);
+}
 
-void setup_server()
+// Encoder pulse callbacks, called from rb_loaded() in the capture interrupt
+
+/**
+ * Time of the encoder edge that loaded RB. The edge also restarts the counter, so its value is the
+ * age of the pulse in capture ticks regardless of how long the interrupt took to start.
+ */
+template<arduino_due::tc_lib::timer_ids TIMER>
+uint64_t capture_time(uint32_t ticks_per_usec)
 {
-    delay(100);
-    // Manually reset the Ethernet shield, as it does not happen automatically at power-on
-    pinMode(PIN_ETHERNET_RESET, OUTPUT);
-    digitalWrite(PIN_ETHERNET_RESET, LOW);
-    delay(200);
-    digitalWrite(PIN_ETHERNET_RESET, HIGH);
-    pinMode(PIN_ETHERNET_RESET, INPUT);
-    delay(100);
-
-    bool valid_ip_address = ip_address.fromString(SERVER_IP_ADDRESS);
-    if (!valid_ip_address) {
-        p("Invalid IP address: %s\n", SERVER_IP_ADDRESS);
-    }
+    uint32_t age = TC_ReadCV(arduino_due::tc_lib::tc_info<TIMER>::tc_p(), arduino_due::tc_lib::tc_info<TIMER>::channel);
+    return monotonic_clock.micros64() - age / ticks_per_usec;
+}
 
-    EthernetClass::init(PIN_ETHERNET_CS);
+void record_capture_pulse(uint32_t duty, uint32_t period)
+{
+    RotatorInputs inputs;
+    uint64_t time = capture_time<arduino_due::tc_lib::timer_ids::TIMER_TC0>(capture_tc0.ticks_per_usec());
+    int32_t fraction = encoder_corrections[AXIS_AZIMUTH].angle(duty, period);
+    publish_encoder_pulse(AXIS_AZIMUTH, duty, period, fraction, time, inputs);
+    encoder_comparators[AXIS_AZIMUTH].check(inputs.position);
+    history_recorders[AXIS_AZIMUTH].record(inputs);
+    capture_recorder.record(time, duty, period);
+}
 
-    EthernetClass::begin(mac_address, ip_address);
+#if ELEVATION_AXIS_ENABLED
+// TC6 and channel 0: elevation encoder on pin 5
+typedef arduino_due::tc_lib::capture<arduino_due::tc_lib::timer_ids::TIMER_TC6> capture_tc6_t;
+capture_tc6_t capture_tc6;
 
-    while (EthernetClass::hardwareStatus() == EthernetNoHardware) {
-        p("Ethernet shield not found\n");
-        delay(1000);
-        EthernetClass::begin(mac_address, ip_address);
-    }
+void TC6_Handler(void)
+{
+    uint32_t start = Profiler::cycles();
+    uint32_t status = TC_GetStatus(
+            arduino_due::tc_lib::tc_info<arduino_due::tc_lib::timer_ids::TIMER_TC6>::tc_p(),
+            arduino_due::tc_lib::tc_info<arduino_due::tc_lib::timer_ids::TIMER_TC6>::channel);
+    capture_tc6_t::tc_interrupt(status);
+    profiler.record(PROFILER_ISR_TC6, start);
+}
+
+void publish_elevation_pulse(uint32_t duty, uint32_t period)
+{
+    RotatorInputs inputs;
+    uint64_t time = capture_time<arduino_due::tc_lib::timer_ids::TIMER_TC6>(capture_tc6.ticks_per_usec());
+    int32_t fraction = encoder_corrections[AXIS_ELEVATION].angle(duty, period);
+    publish_encoder_pulse(AXIS_ELEVATION, duty, period, fraction, time, inputs);
+    encoder_comparators[AXIS_ELEVATION].check(inputs.position);
+    history_recorders[AXIS_ELEVATION].record(inputs);
+}
+#endif
+
+Axis *axes[AXIS_COUNT];
+EthernetServer *server;
+EthernetServer *rotctld_server;
+ControllerCommandHandler *command_handler;
+ControllerClientManager *client_manager;
 
-    p("Ethernet shield initialized\n");
+// Servicing the rotator from yield() keeps the limit protection running while a library call waits
+// in delay(), such as the power-up wait of the W5100 in EthernetClass::begin()
+static bool service_in_yield = false;
 
-    if (EthernetClass::linkStatus() == LinkOFF) {
-        p("Ethernet cable is not connected\n");
+void yield()
+{
+    if (service_in_yield) {
+        command_handler->update_state();
+        command_handler->stop_if_direction_target_reached();
     }
+}
 
+void start_servers()
+{
     server = new EthernetServer(tcp_port);
 
     server->begin();
 
-    p("TCP server is listening at %s:%d\n", IpAddressToString(EthernetClass::localIP()).c_str(), tcp_port);
+    IPAddress local_ip = EthernetClass::localIP();
+    LOG_INFO("TCP server is listening at " LOG_IP_FORMAT ":%d\n", LOG_IP_ARGS(local_ip), tcp_port);
+
+    rotctld_server = new EthernetServer(rotctld_tcp_port);
+
+    rotctld_server->begin();
+
+    LOG_INFO("rotctld TCP server is listening at " LOG_IP_FORMAT ":%d\n", LOG_IP_ARGS(local_ip), rotctld_tcp_port);
+    LOG_INFO("Listening %lu ms after boot\n", network_startup.get_ready_time());
 }
 
 void setup()
 {
     SERIAL_PORT.begin(SERIAL_PORT_SPEED);
 
-    p(APP_VERSION_STRING "\n");
+    profiler.begin();
+    latency_tracer.begin();
+    capture_tc0.set_pulse_callback(record_capture_pulse);
+
+    LOG_INFO(APP_VERSION_STRING "\n");
+    flight_recorder.record(FLIGHT_RECORDER_EVENT_BOOT);
+
+    SettingsStore::defaults(settings);
+    if (settings_store.load(settings)) {
+        LOG_INFO("Loaded settings %lu\n", (unsigned long) settings_store.get_sequence());
+    } else {
+        LOG_WARN("No saved settings, using defaults\n");
+    }
+    if (encoder_correction_store.load()) {
+        LOG_INFO("Loaded encoder correction %lu\n", (unsigned long) encoder_correction_store.get_sequence());
+    }
 
-    io = new IOInterface();
-    command_handler = new ControllerCommandHandler(io, ROTATOR_AZIMUTH_OFFSET_DEGREES);
+    axes[AXIS_AZIMUTH] = new RotatorAxis<arduino_due::tc_lib::timer_ids::TIMER_TC0, AzimuthPins>(capture_tc0,
+            {"CW", "CCW", &settings.azimuth_offset, &settings.azimuth_minimum, &settings.azimuth_maximum, 0,
+             &settings.azimuth_model});
+#if ELEVATION_AXIS_ENABLED
+    capture_tc6.set_pulse_callback(publish_elevation_pulse);
+    axes[AXIS_ELEVATION] = new RotatorAxis<arduino_due::tc_lib::timer_ids::TIMER_TC6, ElevationPins>(capture_tc6,
+            {"UP", "DOWN", &settings.elevation_offset, &settings.elevation_minimum, &settings.elevation_maximum,
+             ELEVATION_PARK, &settings.elevation_model});
+#endif
+    command_handler = new ControllerCommandHandler(axes);
+    command_handler->apply_settings();
     client_manager = new ControllerClientManager(command_handler);
+    client_manager->add_client(new SerialControllerClient<decltype(SERIAL_PORT)>(SERIAL_PORT));
 
-    setup_server();
+    ip_address = IPAddress(settings.ip_address[0], settings.ip_address[1], settings.ip_address[2],
+            settings.ip_address[3]);
+    network_startup.begin();
 }
 
 void loop()
 {
+    uint32_t loop_start = Profiler::cycles();
+    uint32_t time = loop_start;
+
+    command_handler->update_state();
+    time = profiler.record(PROFILER_STAGE_STATE, time);
+
     command_handler->stop_if_direction_target_reached();
-    client_manager->cleanup();
+    time = profiler.record(PROFILER_STAGE_STOP_CHECK, time);
 
-    EthernetClient new_client = server->accept();
+    client_manager->receive_input();
+    time = profiler.record(PROFILER_STAGE_RECEIVE, time);
 
-    if (new_client) {
-        client_manager->add_client(new_client);
+    client_manager->cleanup();
+    time = profiler.record(PROFILER_STAGE_CLEANUP, time);
+
+    if (network_startup.is_ready()) {
+        EthernetClient new_client = server->accept();
+
+        if (new_client) {
+            client_manager->add_client(new_client);
+        }
+
+        EthernetClient new_rotctld_client = rotctld_server->accept();
+
+        if (new_rotctld_client) {
+            client_manager->add_client(new_rotctld_client, CLIENT_PROTOCOL_ROTCTLD);
+        }
+    } else {
+        service_in_yield = true;
+        if (network_startup.step(mac_address, ip_address)) {
+            start_servers();
+        }
+        service_in_yield = false;
     }
+    time = profiler.record(PROFILER_STAGE_ACCEPT, time);
 
     bool push_to_clients = client_manager->is_time_to_push_to_clients();
 
-    String pwm_data_string;
     if (push_to_clients) {
-        pwm_data_reader.read();
-
         client_manager->push_to_monitoring_clients("STATE");
+        time = profiler.record(PROFILER_STAGE_PUSH, time);
     }
 
     client_manager->process_input();
+    time = profiler.record(PROFILER_STAGE_PROCESS_INPUT, time);
+
+    client_manager->flush_output();
+    time = profiler.record(PROFILER_STAGE_FLUSH, time);
+
+    log_flush();
+    profiler.record(PROFILER_STAGE_LOG, time);
+
+    profiler.record(PROFILER_STAGE_LOOP, loop_start);
 }
@@ -0,0 +1,78 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_MONOTONIC_CLOCK_H
+#define OH3AAROT_CONTROLLER_MONOTONIC_CLOCK_H
+
+#include <Arduino.h>
+
+/**
+ * 64-bit microsecond clock since boot: micros() extended with a count of its wraps (every 71 minutes).
+ * Safe to call from interrupt handlers. A wrap is only noticed when the clock is read at least once
+ * between two wraps, so the main loop reads it every tick, also while no encoder pulses arrive.
+ */
+class MonotonicClock {
+private:
+    volatile uint32_t high = 0;
+    volatile uint32_t last = 0;
+
+public:
+    uint64_t micros64()
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+
+        uint32_t now = micros();
+        if (now < last) {
+            high = high + 1;
+        }
+        last = now;
+        uint64_t time = ((uint64_t) high << 32) | now;
+
+        __set_PRIMASK(primask);
+        return time;
+    }
+
+    /**
+     * Converts a micros() timestamp from the last 71 minutes to the 64-bit clock.
+     */
+    uint64_t extend(uint32_t timestamp)
+    {
+        uint64_t now = micros64();
+        return now - (uint32_t) ((uint32_t) now - timestamp);
+    }
+
+    static void print(Print &output, uint64_t time)
+    {
+        char digits[21];
+        int length = 0;
+
+        do {
+            digits[length++] = (char) ('0' + time % 10);
+            time /= 10;
+        } while (time > 0);
+
+        while (length > 0) {
+            output.print(digits[--length]);
+        }
+    }
+};
+
+extern MonotonicClock monotonic_clock;
+
+#endif
@@ -0,0 +1,284 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_MOTION_CALIBRATION_H
+#define OH3AAROT_CONTROLLER_MOTION_CALIBRATION_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "flight_recorder.h"
+#include "motion_model.h"
+#include "rotator_axis.h"
+#include "settings.h"
+
+#define MOTION_CALIBRATION_RUN_COUNT (2 * MOTION_MODEL_SPEED_COUNT)
+
+#define MOTION_CALIBRATION_PHASE_POSITIONING 0
+#define MOTION_CALIBRATION_PHASE_MOVING 1
+#define MOTION_CALIBRATION_PHASE_STOPPING 2
+
+/**
+ * Identifies the motion model of one axis with test moves inside its limits: first to
+ * CALIBRATION_MARGIN above the minimum, then a clockwise and a counter-clockwise move at each
+ * calibrated speed. Each move measures the time to the first movement, the steady velocity over its
+ * second half, and after the relay drops, the coasting distance and the time to standstill.
+ *
+ * Stepped once per tick from the control loop. Any other command that moves the axis aborts it.
+ */
+class MotionCalibration {
+private:
+    Axis *axis = nullptr;
+    uint8_t status = MOTION_CALIBRATION_IDLE;
+    uint8_t phase = MOTION_CALIBRATION_PHASE_POSITIONING;
+    uint8_t run = 0; // Speed index times two plus the direction
+    double distance = 0;
+    MotionModel model{};
+
+    unsigned long phase_time = 0; // Relay switched on or off
+    double phase_position = 0;
+    bool moving = false;
+    unsigned long moving_time = 0;
+    bool midpoint_set = false;
+    unsigned long midpoint_time = 0;
+    double midpoint_position = 0;
+    unsigned long change_time = 0; // Last movement over CALIBRATION_MOTION_DEGREES
+    double change_position = 0;
+
+    uint8_t get_direction()
+    {
+        return run % 2;
+    }
+
+    int8_t get_relay_direction()
+    {
+        return (get_direction() == MOTION_DIRECTION_CW) ? 1 : -1;
+    }
+
+    void finish(uint8_t new_status)
+    {
+        if (new_status == MOTION_CALIBRATION_DONE) {
+            model.valid = 1;
+            axis->get_model() = model;
+        }
+        status = new_status;
+        axis->stop();
+        axis->set_speed(settings.speed);
+        flight_recorder.record(FLIGHT_RECORDER_EVENT_CALIBRATION, axis->get_index(), status, run);
+        LOG_INFO("Calibration of axis %d %s after %d runs\n", axis->get_index(),
+                (status == MOTION_CALIBRATION_DONE) ? "done" : "aborted", run);
+    }
+
+    void start_run(unsigned long now)
+    {
+        phase = MOTION_CALIBRATION_PHASE_MOVING;
+        phase_time = now;
+        phase_position = axis->get_position();
+        moving = false;
+        midpoint_set = false;
+
+        // Also clears a target left set when the positioning move was not needed
+        axis->stop();
+        axis->set_speed(motion_model_speed(run / 2));
+        if (get_direction() == MOTION_DIRECTION_CW) {
+            axis->move_cw();
+        } else {
+            axis->move_ccw();
+        }
+    }
+
+    void stop_run(unsigned long now, double position)
+    {
+        uint8_t direction = get_direction();
+        uint8_t index = run / 2;
+
+        if (moving) {
+            if (!midpoint_set) {
+                midpoint_time = moving_time;
+                midpoint_position = phase_position;
+            }
+
+            double velocity = (now > midpoint_time)
+                              ? fabs(position - midpoint_position) * 1000.0 / (now - midpoint_time) : 0;
+            model.velocity[direction][index] = (uint16_t) min(lround(velocity * 100), 65535L);
+
+            // The steady motion extrapolated back to the start position lags the relay by the dead
+            // time plus half of the time spent accelerating
+            double start_delay = (moving_time - phase_time) / 1000.0;
+            double lag = (velocity > 0)
+                         ? (midpoint_time - phase_time) / 1000.0 - fabs(midpoint_position - phase_position) / velocity
+                         : 0;
+            model.start_delay[direction] = (float) start_delay;
+            model.acceleration[direction] = (lag > start_delay) ? (float) (velocity / (2 * (lag - start_delay))) : 0;
+        } else {
+            model.velocity[direction][index] = 0;
+        }
+
+        axis->stop();
+        phase = MOTION_CALIBRATION_PHASE_STOPPING;
+        phase_time = now;
+        phase_position = position;
+        change_time = now;
+        change_position = position;
+    }
+
+    void step_moving(unsigned long now, double position)
+    {
+        double travelled = (position - phase_position) * get_relay_direction();
+        unsigned long elapsed = now - phase_time;
+
+        if (!moving) {
+            if (travelled >= CALIBRATION_MOTION_DEGREES) {
+                moving = true;
+                moving_time = now;
+            } else if (elapsed >= CALIBRATION_START_TIMEOUT) {
+                stop_run(now, position);
+            }
+            return;
+        }
+
+        if (!midpoint_set && (travelled >= distance / 2 || elapsed >= CALIBRATION_RUN_TIME / 2)) {
+            midpoint_set = true;
+            midpoint_time = now;
+            midpoint_position = position;
+        }
+
+        bool at_edge = (get_relay_direction() > 0)
+                       ? position >= axis->get_maximum() - CALIBRATION_MARGIN / 2.0
+                       : position <= axis->get_minimum() + CALIBRATION_MARGIN / 2.0;
+        if (travelled >= distance || elapsed >= CALIBRATION_RUN_TIME || at_edge) {
+            stop_run(now, position);
+        }
+    }
+
+    void step_stopping(unsigned long now, double position)
+    {
+        if (fabs(position - change_position) >= CALIBRATION_MOTION_DEGREES) {
+            change_time = now;
+            change_position = position;
+        }
+        if (now - change_time < CALIBRATION_SETTLE_TIME) {
+            return;
+        }
+
+        uint8_t direction = get_direction();
+        model.coast[direction][run / 2] = (uint16_t) min(lround(fabs(position - phase_position) * 100), 65535L);
+        model.stop_time[direction] = (change_time - phase_time) / 1000.0f;
+
+        run++;
+        if (run >= MOTION_CALIBRATION_RUN_COUNT) {
+            finish(MOTION_CALIBRATION_DONE);
+            return;
+        }
+        start_run(now);
+    }
+
+public:
+    /**
+     * Starts calibrating the axis, returns false when its range is too small for the test moves.
+     */
+    bool start(Axis *calibrated_axis)
+    {
+        double range = calibrated_axis->get_maximum() - calibrated_axis->get_minimum() - 2 * CALIBRATION_MARGIN;
+        if (range < 10 * CALIBRATION_MOTION_DEGREES) {
+            return false;
+        }
+
+        abort();
+
+        axis = calibrated_axis;
+        distance = min(range, (double) CALIBRATION_RUN_DEGREES);
+        memset(&model, 0, sizeof(model));
+        status = MOTION_CALIBRATION_RUNNING;
+        phase = MOTION_CALIBRATION_PHASE_POSITIONING;
+        run = 0;
+        change_time = millis();
+        change_position = axis->get_position();
+
+        axis->set_speed(100);
+        axis->set_target(axis->get_minimum() + CALIBRATION_MARGIN);
+        flight_recorder.record(FLIGHT_RECORDER_EVENT_CALIBRATION, axis->get_index(), status, 0);
+
+        return true;
+    }
+
+    void abort()
+    {
+        if (status == MOTION_CALIBRATION_RUNNING) {
+            finish(MOTION_CALIBRATION_ABORTED);
+        }
+    }
+
+    void step()
+    {
+        if (status != MOTION_CALIBRATION_RUNNING) {
+            return;
+        }
+
+        unsigned long now = millis();
+        double position = axis->get_position();
+        int8_t direction = axis->get_direction();
+
+        if (axis->get_state().fault) {
+            finish(MOTION_CALIBRATION_ABORTED);
+            return;
+        }
+
+        switch (phase) {
+            case MOTION_CALIBRATION_PHASE_POSITIONING:
+                if (fabs(position - change_position) >= CALIBRATION_MOTION_DEGREES || direction != 0) {
+                    change_time = now;
+                    change_position = position;
+                } else if (now - change_time >= CALIBRATION_SETTLE_TIME) {
+                    start_run(now);
+                }
+                break;
+            case MOTION_CALIBRATION_PHASE_MOVING:
+                // The relay dropped on its own: a limit switch or a stop from elsewhere
+                if (direction != get_relay_direction()) {
+                    finish(MOTION_CALIBRATION_ABORTED);
+                    return;
+                }
+                step_moving(now, position);
+                break;
+            default:
+                if (direction != 0) {
+                    finish(MOTION_CALIBRATION_ABORTED);
+                    return;
+                }
+                step_stopping(now, position);
+                break;
+        }
+    }
+
+    uint8_t get_status()
+    {
+        return status;
+    }
+
+    Axis *get_axis()
+    {
+        return axis;
+    }
+
+    uint8_t get_run()
+    {
+        return run;
+    }
+};
+
+#endif
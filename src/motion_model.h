@@ -0,0 +1,117 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_MOTION_MODEL_H
+#define OH3AAROT_CONTROLLER_MOTION_MODEL_H
+
+#include <stdint.h>
+
+#define MOTION_MODEL_SPEED_COUNT 5 // Speeds measured by CALIBRATE: 20, 40, ..., 100
+#define MOTION_MODEL_SPEED_STEP (100 / MOTION_MODEL_SPEED_COUNT)
+
+#define MOTION_DIRECTION_CW 0 // Also up
+#define MOTION_DIRECTION_CCW 1 // Also down
+
+#define MOTION_CALIBRATION_IDLE 0
+#define MOTION_CALIBRATION_RUNNING 1
+#define MOTION_CALIBRATION_DONE 2
+#define MOTION_CALIBRATION_ABORTED 3
+
+/**
+ * Motion of one axis identified by CALIBRATE, saved with the settings. Velocities and coasting
+ * distances are in hundredths of degrees (per second) to keep the settings record in a flash page.
+ */
+struct MotionModel {
+    uint16_t velocity[2][MOTION_MODEL_SPEED_COUNT]; // At each calibrated speed, per direction
+    uint16_t coast[2][MOTION_MODEL_SPEED_COUNT]; // Travel after the relay drops
+    float start_delay[2]; // seconds from the relay turning on to the first movement
+    float acceleration[2]; // degrees per second squared, mean until full speed
+    float stop_time[2]; // seconds from the relay dropping to standstill at full speed
+    uint8_t valid;
+};
+
+inline int motion_model_speed(int index)
+{
+    return (index + 1) * MOTION_MODEL_SPEED_STEP;
+}
+
+/**
+ * Velocity in degrees per second at the given speed setting, interpolated between the calibrated
+ * speeds. Speeds below the lowest calibrated one are interpolated towards zero velocity at zero speed.
+ */
+inline double motion_model_velocity(const MotionModel &model, uint8_t direction, int speed)
+{
+    double previous_speed = 0;
+    double previous_velocity = 0;
+
+    for (int i = 0; i < MOTION_MODEL_SPEED_COUNT; i++) {
+        double velocity = model.velocity[direction][i] / 100.0;
+        if (speed <= motion_model_speed(i)) {
+            return previous_velocity + (velocity - previous_velocity) * (speed - previous_speed)
+                                       / (motion_model_speed(i) - previous_speed);
+        }
+        previous_speed = motion_model_speed(i);
+        previous_velocity = velocity;
+    }
+
+    return previous_velocity;
+}
+
+/**
+ * Lowest speed setting that reaches the given velocity in both directions, or -1 when it cannot be reached.
+ */
+inline int motion_model_speed_for(const MotionModel &model, double velocity)
+{
+    for (int speed = 0; speed <= 100; speed++) {
+        if (motion_model_velocity(model, MOTION_DIRECTION_CW, speed) >= velocity
+            && motion_model_velocity(model, MOTION_DIRECTION_CCW, speed) >= velocity) {
+            return speed;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * Degrees the axis travels after the relay drops at the given velocity, interpolated between the
+ * calibrated velocities.
+ */
+inline double motion_model_coast(const MotionModel &model, uint8_t direction, double velocity)
+{
+    double previous_velocity = 0;
+    double previous_coast = 0;
+
+    for (int i = 0; i < MOTION_MODEL_SPEED_COUNT; i++) {
+        double calibrated_velocity = model.velocity[direction][i] / 100.0;
+        double coast = model.coast[direction][i] / 100.0;
+        if (calibrated_velocity <= previous_velocity) {
+            continue;
+        }
+        if (velocity <= calibrated_velocity) {
+            return previous_coast + (coast - previous_coast) * (velocity - previous_velocity)
+                                    / (calibrated_velocity - previous_velocity);
+        }
+        previous_velocity = calibrated_velocity;
+        previous_coast = coast;
+    }
+
+    // Faster than calibrated: the coasting distance grows at most linearly with the velocity
+    return (previous_velocity > 0) ? previous_coast * velocity / previous_velocity : 0;
+}
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "network_startup.h"
+#include "print.h"
+#include "socket_monitor.h"
+
+NetworkStartup network_startup;
+
+bool NetworkStartup::step(uint8_t *mac_address, IPAddress ip_address)
+{
+    switch (state) {
+        case NETWORK_STARTUP_POWER_ON:
+            if (!elapsed(ETHERNET_RESET_DELAY)) {
+                return false;
+            }
+            // Manually reset the Ethernet shield, as it does not happen automatically at power-on
+            pinMode(PIN_ETHERNET_RESET, OUTPUT);
+            digitalWrite(PIN_ETHERNET_RESET, LOW);
+            enter(NETWORK_STARTUP_RESET);
+            return false;
+
+        case NETWORK_STARTUP_RESET:
+            if (!elapsed(ETHERNET_RESET_PULSE_DURATION)) {
+                return false;
+            }
+            digitalWrite(PIN_ETHERNET_RESET, HIGH);
+            pinMode(PIN_ETHERNET_RESET, INPUT);
+            enter(NETWORK_STARTUP_RESET_RELEASED);
+            return false;
+
+        case NETWORK_STARTUP_RESET_RELEASED:
+            if (!elapsed(ETHERNET_RESET_DELAY)) {
+                return false;
+            }
+            EthernetClass::init(PIN_ETHERNET_CS);
+            enter(NETWORK_STARTUP_DETECT);
+            return false;
+
+        case NETWORK_STARTUP_DETECT:
+            EthernetClass::begin(mac_address, ip_address);
+
+            if (EthernetClass::hardwareStatus() == EthernetNoHardware) {
+                LOG_ERROR("Ethernet shield not found\n");
+                retries++;
+                enter(NETWORK_STARTUP_RETRY);
+                return false;
+            }
+
+            LOG_INFO("Ethernet shield initialized\n");
+            socket_monitor.verify_memory();
+            if (EthernetClass::linkStatus() == LinkOFF) {
+                LOG_WARN("Ethernet cable is not connected\n");
+            }
+
+            enter(NETWORK_STARTUP_READY);
+            ready_time = state_time;
+            return true;
+
+        case NETWORK_STARTUP_RETRY:
+            if (elapsed(ETHERNET_RETRY_INTERVAL)) {
+                enter(NETWORK_STARTUP_DETECT);
+            }
+            return false;
+
+        default:
+            return false;
+    }
+}
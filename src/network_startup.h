@@ -0,0 +1,93 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_NETWORK_STARTUP_H
+#define OH3AAROT_CONTROLLER_NETWORK_STARTUP_H
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "config.h"
+
+#define NETWORK_STARTUP_POWER_ON 0
+#define NETWORK_STARTUP_RESET 1
+#define NETWORK_STARTUP_RESET_RELEASED 2
+#define NETWORK_STARTUP_DETECT 3
+#define NETWORK_STARTUP_RETRY 4
+#define NETWORK_STARTUP_READY 5
+
+/**
+ * Brings up the W5100 in the background: each step() does what is due and returns, so the main
+ * loop keeps servicing the encoder, the limits and the serial console during the shield reset
+ * and while waiting for the shield to appear.
+ */
+class NetworkStartup {
+private:
+    uint8_t state = NETWORK_STARTUP_POWER_ON;
+    unsigned long state_time = 0;
+    unsigned long ready_time = 0;
+    uint32_t retries = 0;
+
+    void enter(uint8_t next_state)
+    {
+        state = next_state;
+        state_time = millis();
+    }
+
+    bool elapsed(unsigned long duration)
+    {
+        return millis() - state_time >= duration;
+    }
+
+public:
+    void begin()
+    {
+        enter(NETWORK_STARTUP_POWER_ON);
+    }
+
+    /**
+     * Advances the startup. Returns true once, when the shield has been initialized.
+     */
+    bool step(uint8_t *mac_address, IPAddress ip_address);
+
+    bool is_ready()
+    {
+        return state == NETWORK_STARTUP_READY;
+    }
+
+    /**
+     * Time from boot to the network being ready in milliseconds, 0 if not ready yet.
+     */
+    unsigned long get_ready_time()
+    {
+        return ready_time;
+    }
+
+    uint32_t get_retries()
+    {
+        return retries;
+    }
+
+    uint8_t get_state()
+    {
+        return state;
+    }
+};
+
+extern NetworkStartup network_startup;
+
+#endif
@@ -19,34 +19,138 @@
 #include <Arduino.h>
 #include "print.h"
 
-#define PRINTF_BUFFER_LENGTH 128
+#define LOG_LINE_LENGTH 128
 
-Print &printer = SERIAL_PORT;
+static LogRecord log_ring[LOG_RING_LENGTH];
 
-void p(const char *fmt, ...)
+// Indexes increase monotonically and wrap around naturally, slots are index % LOG_RING_LENGTH
+static volatile uint32_t log_write_index = 0;
+static volatile uint32_t log_read_index = 0;
+static volatile uint32_t log_dropped = 0;
+
+static uint32_t log_dropped_reported = 0;
+
+static char log_line[LOG_LINE_LENGTH];
+static size_t log_line_length = 0;
+static size_t log_line_written = 0;
+
+static bool log_enabled = true;
+static bool console_line_open = false;
+
+void set_log_enabled(bool enabled)
 {
-    char buf[PRINTF_BUFFER_LENGTH];
-    va_list args;
-    va_start(args, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, args);
-    va_end(args);
-    printer.print(buf);
+    log_enabled = enabled;
 }
 
-#ifdef F
+bool is_log_enabled()
+{
+    return log_enabled;
+}
+
+bool log_is_line_open()
+{
+    return log_line_written > 0 && log_line_written < log_line_length;
+}
+
+void log_set_console_line_open(bool open)
+{
+    console_line_open = open;
+}
+
+uint32_t log_dropped_count()
+{
+    return log_dropped;
+}
+
+bool log_enqueue(const char *format, const uintptr_t *arguments, uint8_t argument_count)
+{
+    uint32_t index = __atomic_load_n(&log_write_index, __ATOMIC_RELAXED);
+
+    // Reserve a slot: lock-free, so that interrupt handlers can log while the main loop is logging
+    do {
+        if (index - __atomic_load_n(&log_read_index, __ATOMIC_ACQUIRE) >= LOG_RING_LENGTH) {
+            __atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&log_write_index, &index, index + 1, true,
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    LogRecord &record = log_ring[index % LOG_RING_LENGTH];
+    record.format = format;
+    for (uint8_t i = 0; i < LOG_RECORD_ARGUMENT_COUNT; i++) {
+        record.arguments[i] = (i < argument_count) ? arguments[i] : 0;
+    }
+    __atomic_store_n(&record.ready, 1, __ATOMIC_RELEASE);
 
-void p(const __FlashStringHelper *fmt, ...)
+    return true;
+}
+
+static bool log_format_next()
 {
-    char buf[PRINTF_BUFFER_LENGTH];
-    va_list args;
-    va_start(args, fmt);
-#ifdef __AVR__
-    vsnprintf_P(buf, sizeof(buf), (const char *)fmt, args); // progmem for AVR
-#else
-    vsnprintf(buf, sizeof(buf), (const char *) fmt, args); // for the rest of the world
-#endif
-    va_end(args);
-    printer.print(buf);
+    uint32_t index = log_read_index;
+    LogRecord &record = log_ring[index % LOG_RING_LENGTH];
+
+    if (index == __atomic_load_n(&log_write_index, __ATOMIC_ACQUIRE)
+        || !__atomic_load_n(&record.ready, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    int length = 0;
+    if (log_enabled) {
+        length = snprintf(log_line, sizeof(log_line), record.format,
+                record.arguments[0], record.arguments[1], record.arguments[2],
+                record.arguments[3], record.arguments[4], record.arguments[5]);
+    }
+
+    record.ready = 0;
+    __atomic_store_n(&log_read_index, index + 1, __ATOMIC_RELEASE);
+
+    if (length < 0) {
+        length = 0;
+    } else if (length >= (int) sizeof(log_line)) {
+        length = sizeof(log_line) - 1;
+    }
+
+    log_line_length = length;
+    log_line_written = 0;
+
+    return true;
 }
 
-#endif
+void log_flush()
+{
+    // The serial console client finishes its line first
+    if (console_line_open) {
+        return;
+    }
+
+    if (log_dropped != log_dropped_reported && log_line_written == log_line_length) {
+        uint32_t dropped = log_dropped;
+        log_line_length = log_enabled
+                ? snprintf(log_line, sizeof(log_line), "Log: %lu messages dropped\n",
+                        (unsigned long) (dropped - log_dropped_reported))
+                : 0;
+        log_line_written = 0;
+        log_dropped_reported = dropped;
+    }
+
+    while (true) {
+        if (log_line_written == log_line_length && !log_format_next()) {
+            break;
+        }
+
+        size_t remaining = log_line_length - log_line_written;
+        if (remaining == 0) {
+            continue;
+        }
+
+        int available = SERIAL_PORT.availableForWrite();
+        if (available <= 0) {
+            break;
+        }
+
+        size_t length = remaining < (size_t) available ? remaining : (size_t) available;
+        SERIAL_PORT.write(reinterpret_cast<const uint8_t *>(&log_line[log_line_written]), length);
+        log_line_written += length;
+    }
+}
@@ -19,14 +19,115 @@
 #ifndef OH3AAROT_CONTROLLER_PRINT_H
 #define OH3AAROT_CONTROLLER_PRINT_H
 
+#include <stdint.h>
+#include "config.h"
+
 #ifdef SERIAL_PORT_USBVIRTUAL
 #define SERIAL_PORT SERIAL_PORT_USBVIRTUAL
 #else
 #define SERIAL_PORT Serial
 #endif
 
-void p(const char *fmt, ...);
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#define LOG_RECORD_ARGUMENT_COUNT 6
+
+// Log calls below LOG_LEVEL are removed at compile time, including the evaluation of their arguments
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) log_record(__VA_ARGS__)
+#else
+#define LOG_ERROR(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) log_record(__VA_ARGS__)
+#else
+#define LOG_WARN(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) log_record(__VA_ARGS__)
+#else
+#define LOG_INFO(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) log_record(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...) do {} while (0)
+#endif
+
+// IP addresses are logged as four integer arguments
+#define LOG_IP_FORMAT "%d.%d.%d.%d"
+#define LOG_IP_ARGS(ip) (ip)[0], (ip)[1], (ip)[2], (ip)[3]
+
+/**
+ * A log message waiting to be formatted: the format string pointer identifies the message.
+ * The format must be a string literal and the arguments integers or string literals,
+ * because formatting happens later in log_flush().
+ */
+struct LogRecord {
+    const char *format;
+    uintptr_t arguments[LOG_RECORD_ARGUMENT_COUNT];
+    volatile uint8_t ready;
+};
+
+bool log_enqueue(const char *format, const uintptr_t *arguments, uint8_t argument_count);
+
+template<typename T>
+inline uintptr_t log_argument(T *value)
+{
+    return reinterpret_cast<uintptr_t>(value);
+}
+
+inline uintptr_t log_argument(long value)
+{
+    return static_cast<uintptr_t>(value);
+}
+
+inline uintptr_t log_argument(unsigned long value)
+{
+    return static_cast<uintptr_t>(value);
+}
+
+inline uintptr_t log_argument(int value)
+{
+    return static_cast<uintptr_t>(value);
+}
+
+inline uintptr_t log_argument(unsigned int value)
+{
+    return static_cast<uintptr_t>(value);
+}
+
+template<typename... Args>
+inline bool log_record(const char *format, Args... args)
+{
+    static_assert(sizeof...(Args) <= LOG_RECORD_ARGUMENT_COUNT, "Too many log arguments");
+    const uintptr_t arguments[sizeof...(Args) + 1] = {log_argument(args)..., 0};
+    return log_enqueue(format, arguments, sizeof...(Args));
+}
+
+/**
+ * Formats and writes queued log records as long as the serial port has room. Call from idle time.
+ */
+void log_flush();
+
+uint32_t log_dropped_count();
+
+/**
+ * The log and the serial console client share the serial port and hand it over only at line
+ * boundaries: each writer waits while the other has written part of a line.
+ */
+bool log_is_line_open();
+void log_set_console_line_open(bool open);
 
-extern Print &printer;
+void set_log_enabled(bool enabled);
+bool is_log_enabled();
 
 #endif
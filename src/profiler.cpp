@@ -0,0 +1,72 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "profiler.h"
+
+#define PROFILER_OVERHEAD_SAMPLES 64
+
+Profiler profiler;
+
+static const char *const profiler_entry_names[PROFILER_ENTRY_COUNT] = {
+        "STATE",
+        "STOP_CHECK",
+        "RECEIVE",
+        "CLEANUP",
+        "ACCEPT",
+        "PUSH",
+        "PROCESS_INPUT",
+        "FLUSH",
+        "LOG",
+        "LOOP",
+        "ISR_TC0",
+        "ISR_THRESHOLD_1",
+        "ISR_THRESHOLD_2",
+        "ISR_LIMIT_1",
+        "ISR_LIMIT_2",
+        "ISR_TC6",
+        "ISR_COMPARATOR",
+        "ISR_CORRECTION",
+};
+
+void Profiler::begin()
+{
+    enable_cycle_counter();
+    reset();
+
+    // Measure the cost of back-to-back record() calls, using the loop total entry as scratch space
+    uint32_t start = cycles();
+    uint32_t time = start;
+    for (int i = 0; i < PROFILER_OVERHEAD_SAMPLES; i++) {
+        time = record(PROFILER_STAGE_LOOP, time);
+    }
+    overhead = (cycles() - start) / PROFILER_OVERHEAD_SAMPLES;
+
+    reset();
+}
+
+void Profiler::reset()
+{
+    for (auto &entry : entries) {
+        entry.clear();
+    }
+}
+
+const char *Profiler::get_entry_name(uint8_t entry_index)
+{
+    return entry_index < PROFILER_ENTRY_COUNT ? profiler_entry_names[entry_index] : "UNKNOWN";
+}
@@ -0,0 +1,247 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_PROFILER_H
+#define OH3AAROT_CONTROLLER_PROFILER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "client_output_buffer.h"
+
+// Main loop stages
+#define PROFILER_STAGE_STATE 0
+#define PROFILER_STAGE_STOP_CHECK 1
+#define PROFILER_STAGE_RECEIVE 2
+#define PROFILER_STAGE_CLEANUP 3
+#define PROFILER_STAGE_ACCEPT 4
+#define PROFILER_STAGE_PUSH 5
+#define PROFILER_STAGE_PROCESS_INPUT 6
+#define PROFILER_STAGE_FLUSH 7
+#define PROFILER_STAGE_LOG 8
+#define PROFILER_STAGE_LOOP 9
+
+// Interrupt handlers
+#define PROFILER_ISR_TC0 10
+#define PROFILER_ISR_THRESHOLD_1 11
+#define PROFILER_ISR_THRESHOLD_2 12
+#define PROFILER_ISR_LIMIT_1 13
+#define PROFILER_ISR_LIMIT_2 14 // The switch entries are shared by all axes
+#define PROFILER_ISR_TC6 15
+#define PROFILER_ISR_COMPARATOR 16 // Stop comparator check in the capture callback, while armed
+#define PROFILER_ISR_CORRECTION 17 // Encoder transfer function and nonlinearity correction of each pulse
+
+#define PROFILER_ENTRY_COUNT 18
+
+// Bucket n counts durations of 2^(n-1) to 2^n - 1 cycles, the last bucket everything longer
+#define PROFILER_HISTOGRAM_BUCKETS 20
+#define PROFILER_HISTOGRAM_LINE_BUCKETS 8 // Buckets per HIST output line
+
+// Longest output line: entry name (with the latency stage name), "HISTnn=" and the buckets
+#define PROFILER_NAME_MAX_LENGTH 24
+#define PROFILER_NUMBER_MAX_LENGTH 10
+#define PROFILER_LINE_MAX_LENGTH (PROFILER_NAME_MAX_LENGTH + 1 + 7 \
+        + PROFILER_HISTOGRAM_LINE_BUCKETS * (PROFILER_NUMBER_MAX_LENGTH + 1))
+
+static_assert(PROFILER_LINE_MAX_LENGTH <= CLIENT_OUTPUT_LINE_LENGTH, "Profiler output lines must not be split");
+
+struct ProfilerEntry {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t histogram[PROFILER_HISTOGRAM_BUCKETS];
+
+    static uint8_t bucket(uint32_t value)
+    {
+        uint8_t bucket = (value == 0) ? 0 : (uint8_t) (32 - __builtin_clz(value));
+        return (bucket < PROFILER_HISTOGRAM_BUCKETS) ? bucket : (PROFILER_HISTOGRAM_BUCKETS - 1);
+    }
+
+    inline void add(uint32_t value)
+    {
+        count++;
+        total += value;
+        if (value < min) {
+            min = value;
+        }
+        if (value > max) {
+            max = value;
+        }
+        histogram[bucket(value)]++;
+    }
+
+    void clear()
+    {
+        count = 0;
+        min = UINT32_MAX;
+        max = 0;
+        total = 0;
+        for (auto &bin : histogram) {
+            bin = 0;
+        }
+    }
+
+    /**
+     * Output lines of the entry: the summary and the HIST lines up to the last non-empty bucket.
+     */
+    uint8_t get_line_count() const
+    {
+        uint8_t last = 0;
+        for (uint8_t i = 0; i < PROFILER_HISTOGRAM_BUCKETS; i++) {
+            if (histogram[i] > 0) {
+                last = i;
+            }
+        }
+        return 2 + last / PROFILER_HISTOGRAM_LINE_BUCKETS;
+    }
+
+    /**
+     * Prints output line 0 as COUNT, MIN, MAX and MEAN and the following lines as HISTn=, where n is
+     * the first of the up to PROFILER_HISTOGRAM_LINE_BUCKETS buckets on the line.
+     */
+    void print_line(Print &output, uint8_t line) const
+    {
+        if (line > 0) {
+            print_histogram(output, (uint8_t) ((line - 1) * PROFILER_HISTOGRAM_LINE_BUCKETS),
+                    get_line_count() - 1 == line);
+            return;
+        }
+
+        output.print("COUNT=");
+        output.print(count);
+        output.print(" MIN=");
+        output.print(count > 0 ? min : 0);
+        output.print(" MAX=");
+        output.print(max);
+        output.print(" MEAN=");
+        output.print(count > 0 ? (uint32_t) (total / count) : 0);
+    }
+
+private:
+    void print_histogram(Print &output, uint8_t first, bool last_line) const
+    {
+        uint8_t end = first + PROFILER_HISTOGRAM_LINE_BUCKETS;
+        if (end > PROFILER_HISTOGRAM_BUCKETS) {
+            end = PROFILER_HISTOGRAM_BUCKETS;
+        }
+        if (last_line) {
+            while (end > first + 1 && histogram[end - 1] == 0) {
+                end--;
+            }
+        }
+
+        output.print("HIST");
+        if (first > 0) {
+            output.print(first);
+        }
+        output.print('=');
+        for (uint8_t i = first; i < end; i++) {
+            if (i > first) {
+                output.print(',');
+            }
+            output.print(histogram[i]);
+        }
+    }
+};
+
+/**
+ * Always-on cycle-accurate profiling of loop() stages and interrupt handlers using the Cortex-M3
+ * DWT cycle counter. Each entry is only updated from one context (the main loop or one interrupt
+ * handler), so no locking is needed.
+ */
+class Profiler {
+private:
+    ProfilerEntry entries[PROFILER_ENTRY_COUNT];
+    uint32_t overhead = 0;
+
+public:
+    static void enable_cycle_counter()
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+
+    static inline uint32_t cycles()
+    {
+        return DWT->CYCCNT;
+    }
+
+    void begin();
+
+    void reset();
+
+    /**
+     * Adds the time since start to the entry and returns the cycle counter after bookkeeping,
+     * so that consecutive stages can be chained without counting the profiler itself.
+     */
+    inline uint32_t record(uint8_t entry_index, uint32_t start)
+    {
+        entries[entry_index].add(cycles() - start);
+        return cycles();
+    }
+
+    const ProfilerEntry &get_entry(uint8_t entry_index)
+    {
+        return entries[entry_index];
+    }
+
+    /**
+     * Cycles spent by one record() call, measured at startup.
+     */
+    uint32_t get_overhead()
+    {
+        return overhead;
+    }
+
+    static const char *get_entry_name(uint8_t entry_index);
+};
+
+extern Profiler profiler;
+
+/**
+ * Streams the profiler statistics for the STATS command, a summary line and the HIST lines of each entry.
+ */
+class ProfilerStatsSource : public ClientOutputSource {
+private:
+    uint8_t index = 0;
+    uint8_t line = 0;
+
+public:
+    bool next(Print &output) override
+    {
+        if (index >= PROFILER_ENTRY_COUNT) {
+            output.println("OK STATS END");
+            return false;
+        }
+
+        const ProfilerEntry &entry = profiler.get_entry(index);
+        output.print(Profiler::get_entry_name(index));
+        output.print(' ');
+        entry.print_line(output, line);
+        output.print('\n');
+
+        if (++line >= entry.get_line_count()) {
+            line = 0;
+            index++;
+        }
+        return true;
+    }
+};
+
+#endif
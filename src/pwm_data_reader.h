@@ -21,6 +21,15 @@
 
 #include <Arduino.h>
 #include "tc_lib.h"
+#include "encoder_correction.h"
+#include "flight_recorder.h"
+
+#define PWM_FILTER_MAX_MEDIAN_LENGTH 7
+
+struct PwmFilterConfig {
+    uint8_t median_length; // Median of the last samples to reject glitches, 1 disables
+    double smoothing; // Weight of the previous value in exponential smoothing, 0 disables
+};
 
 template<arduino_due::tc_lib::timer_ids TIMER>
 class PwmDataReader {
@@ -28,22 +37,124 @@ private:
     arduino_due::tc_lib::capture <TIMER> &pwm_capture_pin;
     double duty_usecs = 0;
     double period_usecs = 0;
+    double raw_angle_degrees = 0;
     double angle_degrees = 0;
     bool overrun = false;
     bool stopped = false;
 
+    PwmFilterConfig filter;
+    double history[PWM_FILTER_MAX_MEDIAN_LENGTH];
+    uint8_t history_length = 0;
+    uint8_t history_index = 0;
+    bool filter_initialized = false;
+
+    // Difference of two angles in range -180..180
+    static double angle_difference(double a, double b)
+    {
+        double difference = fmod(a - b, 360);
+        if (difference > 180) {
+            difference -= 360;
+        } else if (difference < -180) {
+            difference += 360;
+        }
+        return difference;
+    }
+
+    static double normalize_angle(double angle)
+    {
+        angle = fmod(angle, 360);
+        return (angle < 0) ? angle + 360 : angle;
+    }
+
+    // Median of the history unwrapped around the newest sample, so that 359 and 1 are neighbours
+    double median(double newest)
+    {
+        double values[PWM_FILTER_MAX_MEDIAN_LENGTH];
+
+        for (uint8_t i = 0; i < history_length; i++) {
+            double value = newest + angle_difference(history[i], newest);
+            uint8_t j = i;
+            while (j > 0 && values[j - 1] > value) {
+                values[j] = values[j - 1];
+                j--;
+            }
+            values[j] = value;
+        }
+
+        return normalize_angle(values[history_length / 2]);
+    }
+
+    double apply_filter(double raw_angle)
+    {
+        double angle = raw_angle;
+
+        if (filter.median_length > 1) {
+            history[history_index] = raw_angle;
+            history_index = (history_index + 1) % filter.median_length;
+            if (history_length < filter.median_length) {
+                history_length++;
+            }
+            angle = median(raw_angle);
+        }
+
+        if (filter.smoothing > 0 && filter_initialized) {
+            angle = normalize_angle(angle_degrees + (1 - filter.smoothing) * angle_difference(angle, angle_degrees));
+        }
+        filter_initialized = true;
+
+        return angle;
+    }
+
 public:
-    PwmDataReader(arduino_due::tc_lib::capture <TIMER> &capture_pin, uint32_t capture_window) : pwm_capture_pin(
+    PwmDataReader(arduino_due::tc_lib::capture <TIMER> &capture_pin, uint32_t capture_window,
+            PwmFilterConfig filter_config = {PWM_FILTER_MEDIAN_LENGTH, PWM_FILTER_SMOOTHING}) : pwm_capture_pin(
             capture_pin)
     {
         pwm_capture_pin.config((capture_window / 100) << 1);
+        set_filter(filter_config);
     }
 
+    void set_filter(PwmFilterConfig filter_config)
+    {
+        if (filter_config.median_length < 1) {
+            filter_config.median_length = 1;
+        } else if (filter_config.median_length > PWM_FILTER_MAX_MEDIAN_LENGTH) {
+            filter_config.median_length = PWM_FILTER_MAX_MEDIAN_LENGTH;
+        }
+
+        this->filter = filter_config;
+        history_length = 0;
+        history_index = 0;
+        filter_initialized = false;
+    }
+
+    /**
+     * Reads the latest pulse and the capture status from the capture pin.
+     */
     void read()
     {
         uint32_t status, duty = 0, period = 0;
         status = this->pwm_capture_pin.get_duty_and_period(duty, period);
 
+        update(duty, period, encoder_fraction(duty, period));
+        update_status(status);
+    };
+
+    /**
+     * Reads only the capture status, restarting a stopped capture. The angle is kept.
+     */
+    void read_status()
+    {
+        uint32_t duty, period;
+        update_status(this->pwm_capture_pin.get_duty_and_period(duty, period));
+    }
+
+    /**
+     * Computes the angle from a pulse published by the capture interrupt handler, with the encoder
+     * angle of the pulse in 1/4096 turns.
+     */
+    void update(uint32_t duty, uint32_t period, int32_t fraction)
+    {
         auto ticks_per_usec = static_cast<double>(pwm_capture_pin.ticks_per_usec());
 
         if (ticks_per_usec > 0) {
@@ -55,14 +166,28 @@ public:
         }
 
         if (period_usecs > 0) {
-            this->angle_degrees = 360 * (duty_usecs / period_usecs);
+            this->raw_angle_degrees = 360.0 * fraction / (1 << ENCODER_POSITION_FRACTION_BITS);
+            this->angle_degrees = apply_filter(raw_angle_degrees);
         } else {
+            this->raw_angle_degrees = 0;
             this->angle_degrees = 0;
         }
+    }
 
+    void update_status(uint32_t status)
+    {
         this->overrun = pwm_capture_pin.is_overrun(status);
         this->stopped = pwm_capture_pin.is_stopped(status);
-    };
+
+        if (overrun) {
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_CAPTURE_OVERRUN, 0, stopped);
+        }
+    }
+
+    uint32_t ticks_per_usec()
+    {
+        return pwm_capture_pin.ticks_per_usec();
+    }
 
     String to_angle_string()
     {
@@ -89,6 +214,9 @@ public:
     double angle()
     { return angle_degrees; };
 
+    double raw_angle()
+    { return raw_angle_degrees; };
+
     bool is_overrun()
     { return overrun; };
 
@@ -96,6 +224,4 @@ public:
     { return stopped; };
 };
 
-extern PwmDataReader<arduino_due::tc_lib::timer_ids::TIMER_TC0> pwm_data_reader;
-
 #endif
@@ -0,0 +1,554 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_ROTATOR_AXIS_H
+#define OH3AAROT_CONTROLLER_ROTATOR_AXIS_H
+
+#include <Arduino.h>
+#include "tc_lib.h"
+#include "config.h"
+#include "print.h"
+#include "iointerface.h"
+#include "pwm_data_reader.h"
+#include "flight_recorder.h"
+#include "rotator_state.h"
+#include "encoder_comparator.h"
+#include "history_recorder.h"
+#include "monotonic_clock.h"
+#include "motion_model.h"
+#include "settings.h"
+
+// get_flags() with every flag set and direction names of up to 4 characters
+#define AXIS_FLAGS_MAX_LENGTH 40
+
+struct AxisConfig {
+    const char *cw_name; // Direction names in flags and MOVE commands
+    const char *ccw_name;
+    double *offset; // Settings of the axis
+    double *minimum;
+    double *maximum;
+    double park;
+    MotionModel *model; // Identified by CALIBRATE
+};
+
+#define AXIS_ETA_AVAILABLE 0
+#define AXIS_ETA_NO_TARGET 1
+#define AXIS_ETA_NOT_APPROACHING 2
+
+struct EncoderReading {
+    double angle; // Filtered
+    double raw_angle; // Of the last pulse
+    double period;
+    bool overrun;
+    bool stopped;
+};
+
+/**
+ * Control of one rotator axis: turns the inputs published by its interrupt handlers into a
+ * position once per tick and drives its relays towards the target. The work per tick is the
+ * same for every axis, so the controller runs all of them from one loop.
+ */
+class Axis {
+private:
+    AxisConfig config;
+    IOInterface io;
+    EncoderComparator &comparator;
+    uint32_t comparator_fired_count = 0;
+
+    double target = 0;
+    bool target_set = false;
+
+    RotatorState state{};
+    uint32_t state_pulses = 0;
+    bool position_valid = false;
+    unsigned long position_time = 0;
+
+    // Turns at the first valid position, from the threshold switches, minus the turns counted until then
+    int32_t turn_offset = 0;
+    uint32_t fault_count = 0;
+
+    // Difference of two angles in range -180..180
+    static double angle_difference(double a, double b)
+    {
+        double difference = fmod(a - b, 360);
+        if (difference > 180) {
+            difference -= 360;
+        } else if (difference < -180) {
+            difference += 360;
+        }
+        return difference;
+    }
+
+    int32_t initial_turns(double angle, uint8_t switches)
+    {
+        if (switches & ROTATOR_SWITCH_THRESHOLD_1) {
+            return (angle >= 270) ? -1 : 0;
+        }
+        if (switches & ROTATOR_SWITCH_THRESHOLD_2) {
+            return (angle < 110) ? 1 : 0;
+        }
+        // Without threshold switches the axis turns less than a full circle around zero
+        return (!io.hasThresholds() && angle > 180) ? -1 : 0;
+    }
+
+    /**
+     * True when the threshold switches agree with the tracked position: T1 is active below 0 and
+     * T2 above 360, within ROTATOR_THRESHOLD_TOLERANCE of the switch edges.
+     */
+    bool is_consistent(double position, uint8_t switches)
+    {
+        if (!io.hasThresholds()) {
+            return true;
+        }
+
+        bool threshold_1 = (switches & ROTATOR_SWITCH_THRESHOLD_1) != 0;
+        bool threshold_2 = (switches & ROTATOR_SWITCH_THRESHOLD_2) != 0;
+
+        if (threshold_1 ? (position > ROTATOR_THRESHOLD_TOLERANCE) : (position < -ROTATOR_THRESHOLD_TOLERANCE)) {
+            return false;
+        }
+        if (threshold_2 ? (position < 360 - ROTATOR_THRESHOLD_TOLERANCE)
+                        : (position > 360 + ROTATOR_THRESHOLD_TOLERANCE)) {
+            return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * Arms the comparator at the same adjusted target as the main loop check, converted back to
+     * the raw encoder position that the interrupt sees.
+     */
+    void arm_comparator()
+    {
+        if (!position_valid || !target_set || io.getClockwise() == io.getCounterClockwise()) {
+            comparator.disarm();
+            return;
+        }
+
+        int8_t direction = io.getClockwise() ? 1 : -1;
+        double stop_position = target - direction * get_stop_lead(direction) - *config.offset - turn_offset * 360.0;
+        comparator.arm(direction, EncoderComparator::to_position(stop_position));
+    }
+
+protected:
+    /**
+     * Updates the encoder of the axis from the inputs, new_pulse is true when a pulse has arrived
+     * since the last tick.
+     */
+    virtual EncoderReading read_encoder(const RotatorInputs &inputs, bool new_pulse) = 0;
+
+public:
+    template<typename PINS>
+    Axis(PINS pins, const AxisConfig &axis_config)
+            : config(axis_config), io(pins), comparator(encoder_comparators[PINS::axis])
+    {
+        comparator.begin(PINS::axis, PINS::cw, PINS::ccw);
+        history_recorders[PINS::axis].begin(PINS::cw, PINS::ccw);
+    }
+
+    virtual ~Axis() = default;
+
+    virtual void set_filter(PwmFilterConfig filter_config) = 0;
+
+    virtual uint32_t ticks_per_usec() = 0;
+
+    uint8_t get_index()
+    {
+        return io.getAxis();
+    }
+
+    /**
+     * Takes a consistent copy of the inputs published by the interrupt handlers. Everything during
+     * the rest of the tick uses this state, so the position and the flags always agree.
+     */
+    void update_state()
+    {
+        RotatorInputs inputs = rotator_inputs[io.getAxis()].read();
+
+        bool new_pulse = (inputs.pulses != state_pulses);
+        state_pulses = inputs.pulses;
+        EncoderReading reading = read_encoder(inputs, new_pulse);
+
+        if (!position_valid && state_pulses != 0 && reading.period > 0) {
+            position_valid = true;
+            position_time = millis();
+            turn_offset = initial_turns(reading.raw_angle, inputs.switches) - inputs.turns;
+            LOG_INFO("First valid position of axis %d %lu ms after boot\n", io.getAxis(), position_time);
+        }
+
+        // The turns count wraps of the raw angle, so unwrap the filtered angle around it
+        int32_t turns = inputs.turns + turn_offset;
+        double position = turns * 360.0 + reading.raw_angle + angle_difference(reading.angle, reading.raw_angle);
+
+        bool fault = position_valid && !is_consistent(position, inputs.switches);
+        if (fault && !state.fault) {
+            fault_count++;
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_TRACKING_FAULT, io.getAxis(), inputs.switches,
+                    (int32_t) (position * 100));
+            LOG_WARN("Axis %d: threshold switches 0x%x disagree with tracked position %ld\n", io.getAxis(),
+                    inputs.switches, (long) position);
+        }
+
+        state.pulses = inputs.pulses;
+        state.pulse_time = inputs.pulse_time;
+        state.encoder_position = inputs.position;
+        state.angle = reading.angle;
+        state.position = position + *config.offset;
+        state.turns = turns;
+        state.estimate = inputs.estimated_position * ESTIMATOR_SCALE + turn_offset * 360.0 + *config.offset;
+        if (inputs.period != 0) {
+            state.pulse_rate = ticks_per_usec() * 1e6 / inputs.period;
+        }
+        state.velocity = (inputs.period != 0 && !reading.stopped)
+                         ? inputs.estimated_velocity * ESTIMATOR_SCALE * state.pulse_rate
+                         : 0;
+        state.switches = inputs.switches;
+        state.fault = fault;
+        state.overrun = reading.overrun;
+
+        if (reading.stopped && !state.stopped) {
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_ENCODER_LOST, io.getAxis(), 0,
+                    (int32_t) (state.position * 100));
+            LOG_WARN("Axis %d: encoder pulses lost at %ld, stopping\n", io.getAxis(), (long) state.position);
+        }
+        state.stopped = reading.stopped;
+
+        // The position does not follow the axis without encoder pulses, so it must not move
+        if (state.stopped && (target_set || io.getClockwise() || io.getCounterClockwise())) {
+            stop();
+        }
+    }
+
+    const RotatorState &get_state()
+    {
+        return state;
+    }
+
+    double get_position()
+    {
+        return state.position;
+    }
+
+    double get_velocity()
+    {
+        return state.velocity;
+    }
+
+    /**
+     * Estimated position extrapolated from the last encoder pulse to the given time on the 64-bit
+     * clock, so that it does not lag by the age of the pulse.
+     */
+    double get_position_at(uint64_t time)
+    {
+        int64_t age = (int64_t) (time - state.pulse_time);
+        return state.estimate + state.velocity * age / 1e6;
+    }
+
+    uint64_t get_pulse_time()
+    {
+        return state.pulse_time;
+    }
+
+    /**
+     * Seconds until the axis reaches the point where it stops for the target, at the estimated
+     * velocity. Returns AXIS_ETA_AVAILABLE when the axis is moving towards its target.
+     */
+    int get_eta(double &seconds)
+    {
+        if (!target_set) {
+            return AXIS_ETA_NO_TARGET;
+        }
+
+        double velocity = get_velocity();
+        double remaining = target - get_position_at(monotonic_clock.micros64());
+        if (fabs(velocity) < ESTIMATOR_ETA_MINIMUM_VELOCITY || (remaining > 0) != (velocity > 0)) {
+            return AXIS_ETA_NOT_APPROACHING;
+        }
+
+        int8_t direction = (velocity > 0) ? 1 : -1;
+        remaining -= direction * get_stop_lead(direction);
+        seconds = max(remaining / velocity, 0.0);
+        return AXIS_ETA_AVAILABLE;
+    }
+
+    /**
+     * Degrees to add to an unwrapped encoder position of the interrupt to get the position of the axis.
+     */
+    double get_encoder_offset()
+    {
+        return turn_offset * 360.0 + *config.offset;
+    }
+
+    /**
+     * Degrees before the target at which the relay of the given direction drops: the distance the
+     * axis coasts from its current velocity when it has been calibrated, the angle threshold otherwise.
+     */
+    double get_stop_lead(int8_t direction)
+    {
+        if (!config.model->valid) {
+            return settings.angle_threshold;
+        }
+
+        return motion_model_coast(*config.model, (direction > 0) ? MOTION_DIRECTION_CW : MOTION_DIRECTION_CCW,
+                fabs(state.velocity));
+    }
+
+    MotionModel &get_model()
+    {
+        return *config.model;
+    }
+
+    bool is_position_valid()
+    {
+        return position_valid;
+    }
+
+    unsigned long get_position_time()
+    {
+        return position_time;
+    }
+
+    uint32_t get_fault_count()
+    {
+        return fault_count;
+    }
+
+    bool is_in_range(double angle)
+    {
+        return angle >= *config.minimum && angle <= *config.maximum;
+    }
+
+    double get_minimum()
+    {
+        return *config.minimum;
+    }
+
+    double get_maximum()
+    {
+        return *config.maximum;
+    }
+
+    const char *get_cw_name()
+    {
+        return config.cw_name;
+    }
+
+    const char *get_ccw_name()
+    {
+        return config.ccw_name;
+    }
+
+    void set_target(double angle)
+    {
+        double position = get_position();
+
+        comparator.disarm();
+        target = angle;
+        target_set = true;
+        flight_recorder.record(FLIGHT_RECORDER_EVENT_TARGET_SET, io.getAxis(), 0, (int32_t) (angle * 100));
+
+        if (position < (angle - settings.angle_threshold)) {
+            io.setCounterClockwise(false);
+            io.setClockwise(true);
+        } else if (position > (angle + settings.angle_threshold)) {
+            io.setClockwise(false);
+            io.setCounterClockwise(true);
+        } else {
+            io.setClockwise(false);
+            io.setCounterClockwise(false);
+        }
+        arm_comparator();
+    }
+
+    /**
+     * Direction of the active relay: 1 clockwise (up), -1 counter-clockwise (down), 0 when stopped.
+     */
+    int8_t get_direction()
+    {
+        if (io.getClockwise() == io.getCounterClockwise()) {
+            return 0;
+        }
+        return io.getClockwise() ? 1 : -1;
+    }
+
+    void stop_if_direction_target_reached()
+    {
+        double position = get_position();
+
+        uint32_t fired_count = comparator.get_fired_count();
+        if (fired_count != comparator_fired_count) {
+            // The interrupt has already dropped the relay
+            comparator_fired_count = fired_count;
+            if (target_set) {
+                target_set = false;
+                flight_recorder.record(FLIGHT_RECORDER_EVENT_TARGET_REACHED, io.getAxis(), 0,
+                        (int32_t) (position * 100));
+            }
+        }
+
+        if (target_set) {
+            if (io.getClockwise()) {
+                if (position >= (target - get_stop_lead(1))) {
+                    io.setClockwise(false);
+                    target_set = false;
+                    flight_recorder.record(FLIGHT_RECORDER_EVENT_TARGET_REACHED, io.getAxis(), 0,
+                            (int32_t) (position * 100));
+                }
+            }
+
+            if (io.getCounterClockwise()) {
+                if (position <= (target + get_stop_lead(-1))) {
+                    io.setCounterClockwise(false);
+                    target_set = false;
+                    flight_recorder.record(FLIGHT_RECORDER_EVENT_TARGET_REACHED, io.getAxis(), 0,
+                            (int32_t) (position * 100));
+                }
+            }
+        }
+
+        if ((state.switches & ROTATOR_SWITCH_LIMIT_2) && io.getClockwise()) {
+            io.setClockwise(false);
+            target_set = false;
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_LIMIT_STOP,
+                    FLIGHT_RECORDER_SOURCE(io.getAxis(), FLIGHT_RECORDER_INPUT_LIMIT_2));
+        }
+        if ((state.switches & ROTATOR_SWITCH_LIMIT_1) && io.getCounterClockwise()) {
+            io.setCounterClockwise(false);
+            target_set = false;
+            flight_recorder.record(FLIGHT_RECORDER_EVENT_LIMIT_STOP,
+                    FLIGHT_RECORDER_SOURCE(io.getAxis(), FLIGHT_RECORDER_INPUT_LIMIT_1));
+        }
+
+        // Re-armed every tick, so that offset and threshold changes and the first valid position apply
+        arm_comparator();
+    }
+
+    String get_flags()
+    {
+        String flags = String();
+
+        if (io.getClockwise()) {
+            flags.concat(config.cw_name);
+            flags.concat(",");
+        }
+        if (io.getCounterClockwise()) {
+            flags.concat(config.ccw_name);
+            flags.concat(",");
+        }
+        if (state.switches & ROTATOR_SWITCH_THRESHOLD_1) {
+            flags.concat("T1,");
+        }
+        if (state.switches & ROTATOR_SWITCH_THRESHOLD_2) {
+            flags.concat("T2,");
+        }
+        if (state.switches & ROTATOR_SWITCH_LIMIT_1) {
+            flags.concat("L1,");
+        }
+        if (state.switches & ROTATOR_SWITCH_LIMIT_2) {
+            flags.concat("L2,");
+        }
+        if (state.stopped) {
+            flags.concat("NOENC,");
+        }
+        if (state.fault) {
+            flags.concat("FAULT");
+        }
+        if (flags.endsWith(",")) {
+            flags.remove(flags.length() - 1, 1);
+        }
+
+        return flags;
+    }
+
+    int get_speed()
+    {
+        return io.getSpeed();
+    }
+
+    void set_speed(int speed)
+    {
+        io.setSpeed(speed);
+    }
+
+    void stop()
+    {
+        comparator.disarm();
+        io.setClockwise(false);
+        io.setCounterClockwise(false);
+        target_set = false;
+    }
+
+    void park()
+    {
+        set_target(config.park);
+    }
+
+    void move_cw()
+    {
+        comparator.disarm();
+        io.setCounterClockwise(false);
+        io.setClockwise(true);
+    }
+
+    void move_ccw()
+    {
+        comparator.disarm();
+        io.setClockwise(false);
+        io.setCounterClockwise(true);
+    }
+};
+
+/**
+ * Axis with its encoder captured by the given timer counter and its relays and switches on the
+ * given pin set.
+ */
+template<arduino_due::tc_lib::timer_ids TIMER, typename PINS>
+class RotatorAxis : public Axis {
+private:
+    PwmDataReader<TIMER> pwm_data_reader;
+
+protected:
+    EncoderReading read_encoder(const RotatorInputs &inputs, bool new_pulse) override
+    {
+        if (new_pulse) {
+            pwm_data_reader.update(inputs.duty, inputs.period, inputs.position & ENCODER_POSITION_MASK);
+        }
+        pwm_data_reader.read_status();
+
+        return {pwm_data_reader.angle(), pwm_data_reader.raw_angle(), pwm_data_reader.period(),
+                pwm_data_reader.is_overrun(), pwm_data_reader.is_stopped()};
+    }
+
+public:
+    RotatorAxis(arduino_due::tc_lib::capture<TIMER> &capture, const AxisConfig &axis_config)
+            : Axis(PINS(), axis_config), pwm_data_reader(capture, PWM_CAPTURE_WINDOW_DURATION)
+    {}
+
+    void set_filter(PwmFilterConfig filter_config) override
+    {
+        pwm_data_reader.set_filter(filter_config);
+    }
+
+    uint32_t ticks_per_usec() override
+    {
+        return pwm_data_reader.ticks_per_usec();
+    }
+};
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_ROTATOR_STATE_H
+#define OH3AAROT_CONTROLLER_ROTATOR_STATE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "seqlock.h"
+
+#define AXIS_AZIMUTH 0
+#define AXIS_ELEVATION 1
+#define AXIS_COUNT (ELEVATION_AXIS_ENABLED ? 2 : 1)
+
+#define ROTATOR_SWITCH_THRESHOLD_1 0x01
+#define ROTATOR_SWITCH_THRESHOLD_2 0x02
+#define ROTATOR_SWITCH_LIMIT_1 0x04
+#define ROTATOR_SWITCH_LIMIT_2 0x08
+
+#define ENCODER_POSITION_FRACTION_BITS 12 // Unwrapped encoder positions in the interrupt are in 1/4096 turns
+#define ENCODER_POSITION_MASK ((1 << ENCODER_POSITION_FRACTION_BITS) - 1)
+#define ENCODER_POSITION_HALF_TURN (1 << (ENCODER_POSITION_FRACTION_BITS - 1))
+#define ESTIMATOR_FRACTION_BITS 24 // Extra fraction bits of the estimated position and velocity
+
+// Degrees per unit of the estimated position and velocity (per encoder pulse)
+#define ESTIMATOR_SCALE (360.0 / (1LL << (ENCODER_POSITION_FRACTION_BITS + ESTIMATOR_FRACTION_BITS)))
+
+/**
+ * Inputs of one axis as seen by the interrupt handlers: the last encoder pulse and the threshold
+ * and limit switch levels at the time of the last change of either.
+ */
+struct RotatorInputs {
+    uint32_t pulses; // Count of encoder pulses, changes when a new pulse has been captured
+    uint64_t pulse_time; // Capture time of the last pulse on the 64-bit clock
+    uint32_t duty;
+    uint32_t period;
+    int32_t turns; // Encoder wraps from 360 to 0 minus wraps from 0 to 360
+    int32_t position; // Unwrapped encoder position of the last pulse
+    int64_t estimated_position; // Alpha-beta estimate at the last pulse, with ESTIMATOR_FRACTION_BITS
+    int32_t estimated_velocity; // Change of the estimate per pulse, in the same units
+    uint8_t switches;
+};
+
+/**
+ * Axis state derived from one consistent copy of the inputs, taken once per main loop tick.
+ */
+struct RotatorState {
+    uint32_t pulses;
+    uint64_t pulse_time;
+    int32_t encoder_position; // Unwrapped encoder position of the last pulse, without the turn offset
+    double angle; // Filtered encoder angle 0..360
+    double position; // Angle unwrapped with the tracked turns, including the offset
+    int32_t turns;
+    double estimate; // Estimated position at pulse_time, including the offset
+    double velocity; // Estimated degrees per second
+    double pulse_rate; // Encoder pulses per second
+    uint8_t switches;
+    bool fault; // Threshold switches disagree with the tracked position
+    bool overrun;
+    bool stopped;
+};
+
+extern SeqLock<RotatorInputs> rotator_inputs[AXIS_COUNT];
+
+/**
+ * Alpha-beta filter step for one encoder pulse, in fixed point. The sample interval is one encoder
+ * period, so the velocity is per pulse and the gains are shifts. The position and the velocity have
+ * the same fraction bits, so that slow movement far below one encoder step per pulse still adds up.
+ */
+inline void estimate_encoder_pulse(RotatorInputs &inputs, bool first)
+{
+    int64_t measured = (int64_t) inputs.position << ESTIMATOR_FRACTION_BITS;
+
+    if (first) {
+        inputs.estimated_position = measured;
+        inputs.estimated_velocity = 0;
+        return;
+    }
+
+    int64_t predicted = inputs.estimated_position + inputs.estimated_velocity;
+    int64_t residual = measured - predicted;
+
+    inputs.estimated_position = predicted + (residual >> ESTIMATOR_ALPHA_SHIFT);
+    inputs.estimated_velocity += (int32_t) (residual >> ESTIMATOR_BETA_SHIFT);
+}
+
+/**
+ * Called from the capture interrupt handler of the axis for each encoder pulse. The encoder is
+ * unwrapped here at the capture rate: an angle change of more than half a turn from the last pulse
+ * is taken as a wrap, down through 0 counting a turn up and up through 0 a turn down, which is correct
+ * as long as the axis moves less than half a turn between pulses. The fraction is the corrected
+ * encoder angle of the pulse in 1/4096 turns and the time is the capture time of the pulse on the
+ * 64-bit clock. The published inputs are copied to the given inputs for the rest of the interrupt.
+ */
+inline void publish_encoder_pulse(uint8_t axis, uint32_t duty, uint32_t period, int32_t fraction, uint64_t time,
+        RotatorInputs &published)
+{
+    rotator_inputs[axis].update([duty, period, time, fraction, &published](RotatorInputs &inputs) {
+        bool tracking = (inputs.period != 0 && period != 0);
+        if (tracking) {
+            int32_t difference = fraction - (inputs.position & ENCODER_POSITION_MASK);
+            if (difference < -ENCODER_POSITION_HALF_TURN) {
+                inputs.turns++;
+            } else if (difference > ENCODER_POSITION_HALF_TURN) {
+                inputs.turns--;
+            }
+        }
+        inputs.pulses++;
+        inputs.pulse_time = time;
+        inputs.duty = duty;
+        inputs.period = period;
+
+        if (period != 0) {
+            inputs.position = inputs.turns * (1 << ENCODER_POSITION_FRACTION_BITS) + fraction;
+            estimate_encoder_pulse(inputs, !tracking);
+        }
+        published = inputs;
+    });
+}
+
+/**
+ * Called from the pin interrupt handlers when a switch changes.
+ */
+inline void publish_switch(uint8_t axis, uint8_t mask, bool active)
+{
+    rotator_inputs[axis].update([mask, active](RotatorInputs &inputs) {
+        if (active) {
+            inputs.switches |= mask;
+        } else {
+            inputs.switches &= ~mask;
+        }
+    });
+}
+
+#endif
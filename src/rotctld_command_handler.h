@@ -0,0 +1,234 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_ROTCTLD_COMMAND_HANDLER_H
+#define OH3AAROT_CONTROLLER_ROTCTLD_COMMAND_HANDLER_H
+
+#include "controller_client.h"
+#include "controller_command_handler.h"
+
+// Hamlib return codes
+#define ROTCTLD_RPRT_OK 0
+#define ROTCTLD_RPRT_EINVAL -1
+#define ROTCTLD_RPRT_ENIMPL -4
+
+#define ROTCTLD_PROTOCOL_VERSION 1
+#define ROTCTLD_ROTATOR_MODEL 1
+
+#define ROTCTLD_MOVE_UP 2
+#define ROTCTLD_MOVE_DOWN 4
+#define ROTCTLD_MOVE_CCW 8
+#define ROTCTLD_MOVE_CW 16
+
+/**
+ * Hamlib rotctld network protocol on top of ControllerCommandHandler.
+ *
+ * Supports the short and long forms of get_pos (p), set_pos (P), stop (S), park (K), move (M),
+ * get_info (_), dump_state and quit (q). A leading '+', ';', '|' or ',' selects the extended
+ * response mode with the given separator, as in rotctld.
+ */
+class RotctldCommandHandler {
+private:
+    ControllerCommandHandler *handler;
+
+    static void print_extended_header(Print *response, const char *name, String &args, char separator)
+    {
+        response->print(name);
+        response->print(':');
+        if (args.length() > 0) {
+            response->print(' ');
+            response->print(args);
+        }
+        response->print(separator);
+    }
+
+    static void print_result(Print *response, int result)
+    {
+        response->print("RPRT ");
+        response->print(result);
+        response->print('\n');
+    }
+
+    static bool parse_double(String &value_string, double &value)
+    {
+        value_string.trim();
+        if (value_string.length() == 0) {
+            return false;
+        }
+
+        char *end;
+        value = strtod(value_string.c_str(), &end);
+        return *end == '\0';
+    }
+
+public:
+    explicit RotctldCommandHandler(ControllerCommandHandler *handler)
+    {
+        this->handler = handler;
+    }
+
+    bool handle_command(String command, ControllerClient *client, Print *response)
+    {
+        command.trim();
+
+        if (command.length() == 0) {
+            return true;
+        }
+
+        bool extended = false;
+        char separator = '\n';
+        char first = command.charAt(0);
+
+        if (first == '+' || first == ';' || first == '|' || first == ',') {
+            extended = true;
+            separator = (first == '+') ? '\n' : first;
+            command = command.substring(1);
+            command.trim();
+        }
+
+        int first_space = command.indexOf(' ');
+        String name;
+        String args;
+        if (first_space >= 0) {
+            name = command.substring(0, first_space);
+            args = command.substring(first_space + 1);
+            args.trim();
+        } else {
+            name = command;
+        }
+
+        if (name == "p" || name == "\\get_pos") {
+            if (extended) {
+                print_extended_header(response, "get_pos", args, separator);
+                response->print("Azimuth: ");
+            }
+            response->print(handler->get_az(), 6);
+            response->print(separator);
+            if (extended) {
+                response->print("Elevation: ");
+            }
+            response->print(handler->get_el(), 6);
+            response->print(separator);
+            if (extended) {
+                print_result(response, ROTCTLD_RPRT_OK);
+            }
+            return true;
+        }
+
+        if (name == "_" || name == "\\get_info") {
+            if (extended) {
+                print_extended_header(response, "get_info", args, separator);
+                response->print("Info: ");
+            }
+            response->print(APP_VERSION_STRING);
+            response->print(separator);
+            if (extended) {
+                print_result(response, ROTCTLD_RPRT_OK);
+            }
+            return true;
+        }
+
+        if (name == "\\dump_state") {
+            if (extended) {
+                print_extended_header(response, "dump_state", args, separator);
+            }
+            response->print(ROTCTLD_PROTOCOL_VERSION);
+            response->print(separator);
+            response->print(ROTCTLD_ROTATOR_MODEL);
+            response->print(separator);
+            response->print(settings.azimuth_minimum, 6);
+            response->print(separator);
+            response->print(settings.azimuth_maximum, 6);
+            response->print(separator);
+            response->print(ControllerCommandHandler::has_elevation() ? settings.elevation_minimum : 0.0, 6);
+            response->print(separator);
+            response->print(ControllerCommandHandler::has_elevation() ? settings.elevation_maximum : 0.0, 6);
+            response->print(separator);
+            if (extended) {
+                print_result(response, ROTCTLD_RPRT_OK);
+            }
+            return true;
+        }
+
+        if (name == "q" || name == "Q" || name == "\\quit") {
+            client->stop();
+            return true;
+        }
+
+        int result = ROTCTLD_RPRT_OK;
+        const char *long_name;
+
+        if (name == "P" || name == "\\set_pos") {
+            long_name = "set_pos";
+
+            int space = args.indexOf(' ');
+            String az_string = (space >= 0) ? args.substring(0, space) : args;
+            String el_string = (space >= 0) ? args.substring(space + 1) : String();
+            double az_angle;
+            double el_angle = 0;
+
+            // Without an elevation axis the elevation is ignored
+            if (!parse_double(az_string, az_angle) || !handler->is_valid_az(az_angle)) {
+                result = ROTCTLD_RPRT_EINVAL;
+            } else if (ControllerCommandHandler::has_elevation()
+                       && (!parse_double(el_string, el_angle) || !handler->is_valid_el(el_angle))) {
+                result = ROTCTLD_RPRT_EINVAL;
+            } else {
+                handler->set_az(az_angle);
+                handler->set_el(el_angle);
+            }
+        } else if (name == "S" || name == "\\stop") {
+            long_name = "stop";
+            handler->stop();
+        } else if (name == "K" || name == "\\park") {
+            long_name = "park";
+            handler->park();
+        } else if (name == "M" || name == "\\move") {
+            long_name = "move";
+
+            int space = args.indexOf(' ');
+            String direction_string = (space >= 0) ? args.substring(0, space) : args;
+            direction_string.trim();
+            long direction = direction_string.toInt();
+
+            if (direction == ROTCTLD_MOVE_CW) {
+                handler->move_cw();
+            } else if (direction == ROTCTLD_MOVE_CCW) {
+                handler->move_ccw();
+            } else if (direction == ROTCTLD_MOVE_UP && ControllerCommandHandler::has_elevation()) {
+                handler->move_up();
+            } else if (direction == ROTCTLD_MOVE_DOWN && ControllerCommandHandler::has_elevation()) {
+                handler->move_down();
+            } else {
+                result = ROTCTLD_RPRT_EINVAL;
+            }
+        } else {
+            print_result(response, ROTCTLD_RPRT_ENIMPL);
+            return false;
+        }
+
+        if (extended) {
+            print_extended_header(response, long_name, args, separator);
+        }
+        print_result(response, result);
+
+        return result == ROTCTLD_RPRT_OK;
+    }
+};
+
+#endif
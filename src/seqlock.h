@@ -0,0 +1,78 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_SEQLOCK_H
+#define OH3AAROT_CONTROLLER_SEQLOCK_H
+
+#include <Arduino.h>
+
+/**
+ * Sequence lock: interrupt handlers publish a value and the main loop takes consistent copies
+ * without disabling interrupts. The sequence is odd while a write is in progress and a reader
+ * retries until it has copied the value between two equal even sequence numbers.
+ *
+ * Writers are serialized by masking interrupts for the duration of the copy, so handlers of
+ * different priorities may all write.
+ */
+template<typename T>
+class SeqLock {
+private:
+    volatile uint32_t sequence = 0;
+    T value;
+
+public:
+    /**
+     * Calls update(T &) on the current value and publishes the result.
+     */
+    template<typename F>
+    inline void update(F update)
+    {
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+
+        sequence = sequence + 1;
+        __DMB();
+        update(value);
+        __DMB();
+        sequence = sequence + 1;
+
+        __set_PRIMASK(primask);
+    }
+
+    T read() const
+    {
+        T copy;
+        uint32_t start;
+
+        do {
+            start = sequence;
+            __DMB();
+            copy = value;
+            __DMB();
+        } while ((start & 1) != 0 || sequence != start);
+
+        return copy;
+    }
+
+    uint32_t get_sequence() const
+    {
+        return sequence;
+    }
+};
+
+#endif
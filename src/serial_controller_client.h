@@ -0,0 +1,90 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_SERIAL_CONTROLLER_CLIENT_H
+#define OH3AAROT_CONTROLLER_SERIAL_CONTROLLER_CLIENT_H
+
+#include "controller_client.h"
+
+#define SERIAL_CONSOLE_MODE_LOG 0
+#define SERIAL_CONSOLE_MODE_PROTOCOL 1
+
+/**
+ * The serial console as a protocol client. The port is always connected.
+ *
+ * In LOG mode the port carries both log messages and protocol responses, interleaved at line
+ * boundaries, which is convenient for interactive use. PROTOCOL mode turns log output off so that
+ * the port carries protocol traffic only.
+ */
+template<typename SERIAL_TYPE>
+class SerialControllerClient : public ControllerClient {
+private:
+    SERIAL_TYPE &serial;
+
+protected:
+    int read_transport(uint8_t *buffer, size_t length) override
+    {
+        size_t received = 0;
+
+        while (received < length && serial.available() > 0) {
+            int c = serial.read();
+            if (c < 0) {
+                break;
+            }
+            buffer[received++] = (uint8_t) c;
+        }
+
+        return (int) received;
+    }
+
+public:
+    explicit SerialControllerClient(SERIAL_TYPE &serial_port) : ControllerClient(CLIENT_PROTOCOL_NATIVE),
+                                                                serial(serial_port)
+    {
+        output.set_policy(CLIENT_OUTPUT_POLICY_DROP);
+        set_log_enabled(SERIAL_CONSOLE_DEFAULT_MODE == SERIAL_CONSOLE_MODE_LOG);
+    }
+
+    void flush_output() override
+    {
+        // The log finishes its line first
+        if (log_is_line_open()) {
+            return;
+        }
+
+        output.flush_to(serial);
+        log_set_console_line_open(output.is_line_open());
+    }
+
+    bool connected() override
+    {
+        return true;
+    }
+
+    void stop() override
+    {
+        set_monitor_enabled(false);
+    }
+
+    bool cleanup() override
+    {
+        return false;
+    }
+};
+
+#endif
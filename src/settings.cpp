@@ -0,0 +1,125 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <Ethernet.h>
+#include "settings.h"
+
+Settings settings;
+SettingsStore settings_store;
+
+bool SettingsStore::is_valid(const uint8_t *page, SettingsRecordHeader &header)
+{
+    memcpy(&header, page, sizeof(header));
+
+    if (header.magic != SETTINGS_MAGIC || header.version == 0 || header.version > SETTINGS_VERSION
+        || header.length > FLASH_STORAGE_PAGE_SIZE - sizeof(header)) {
+        return false;
+    }
+
+    SettingsRecordHeader unsigned_header = header;
+    unsigned_header.crc = 0;
+
+    uint32_t crc = FlashStorage::crc32(0, reinterpret_cast<const uint8_t *>(&unsigned_header), sizeof(unsigned_header));
+    crc = FlashStorage::crc32(crc, page + sizeof(header), header.length);
+
+    return crc == header.crc;
+}
+
+void SettingsStore::defaults(Settings &settings)
+{
+    memset(&settings, 0, sizeof(settings));
+
+    settings.azimuth_offset = ROTATOR_AZIMUTH_OFFSET_DEGREES;
+    settings.azimuth_minimum = AZIMUTH_MINIMUM;
+    settings.azimuth_maximum = AZIMUTH_MAXIMUM;
+    settings.angle_threshold = ANGLE_THRESHOLD;
+    settings.speed = DEFAULT_SPEED;
+    settings.filter_median_length = PWM_FILTER_MEDIAN_LENGTH;
+    settings.filter_smoothing = PWM_FILTER_SMOOTHING;
+    settings.elevation_offset = ROTATOR_ELEVATION_OFFSET_DEGREES;
+    settings.elevation_minimum = ELEVATION_MINIMUM;
+    settings.elevation_maximum = ELEVATION_MAXIMUM;
+
+    IPAddress ip_address;
+    ip_address.fromString(SERVER_IP_ADDRESS);
+    for (uint8_t i = 0; i < 4; i++) {
+        settings.ip_address[i] = ip_address[i];
+    }
+}
+
+bool SettingsStore::load(Settings &settings)
+{
+    int32_t newest_page = -1;
+    SettingsRecordHeader newest{};
+
+    for (uint32_t i = 0; i < FLASH_STORAGE_SETTINGS_PAGE_COUNT; i++) {
+        SettingsRecordHeader header;
+        if (!is_valid(FlashStorage::page(FLASH_STORAGE_SETTINGS_FIRST_PAGE + i), header)) {
+            continue;
+        }
+        if (newest_page < 0 || (int32_t) (header.sequence - newest.sequence) > 0) {
+            newest_page = (int32_t) i;
+            newest = header;
+        }
+    }
+
+    if (newest_page < 0) {
+        return false;
+    }
+
+    // Fields missing from records of older versions keep their defaults
+    defaults(settings);
+    size_t length = (newest.length < sizeof(settings)) ? newest.length : sizeof(settings);
+    memcpy(&settings, FlashStorage::page(FLASH_STORAGE_SETTINGS_FIRST_PAGE + newest_page) + sizeof(newest), length);
+
+    sequence = newest.sequence;
+    current_page = newest_page;
+
+    return true;
+}
+
+bool SettingsStore::save(const Settings &settings)
+{
+    uint8_t page[FLASH_STORAGE_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+
+    SettingsRecordHeader header;
+    header.magic = SETTINGS_MAGIC;
+    header.sequence = sequence + 1;
+    header.version = SETTINGS_VERSION;
+    header.length = sizeof(settings);
+    header.crc = 0;
+
+    header.crc = FlashStorage::crc32(0, reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+    header.crc = FlashStorage::crc32(header.crc, reinterpret_cast<const uint8_t *>(&settings), sizeof(settings));
+
+    memcpy(page, &header, sizeof(header));
+    memcpy(page + sizeof(header), &settings, sizeof(settings));
+
+    // A page that fails to program is skipped, the previous record stays valid meanwhile
+    for (uint32_t attempt = 0; attempt < FLASH_STORAGE_SETTINGS_PAGE_COUNT; attempt++) {
+        uint32_t index = (uint32_t) (current_page + 1 + attempt) % FLASH_STORAGE_SETTINGS_PAGE_COUNT;
+        if (FlashStorage::write_page(FLASH_STORAGE_SETTINGS_FIRST_PAGE + index, page)) {
+            sequence = header.sequence;
+            current_page = (int32_t) index;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,97 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_SETTINGS_H
+#define OH3AAROT_CONTROLLER_SETTINGS_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "flash_storage.h"
+#include "motion_model.h"
+
+#define SETTINGS_MAGIC 0x4F485253
+#define SETTINGS_VERSION 1
+
+/**
+ * Settings that can be changed at runtime and saved to flash. New fields are only ever
+ * appended: a record saved by an older version leaves the new fields at their defaults.
+ */
+struct Settings {
+    double azimuth_offset;
+    double azimuth_minimum;
+    double azimuth_maximum;
+    double angle_threshold;
+    uint8_t speed;
+    uint8_t ip_address[4]; // Applied at boot
+    uint8_t filter_median_length;
+    float filter_smoothing;
+    double elevation_offset;
+    double elevation_minimum;
+    double elevation_maximum;
+    MotionModel azimuth_model;
+    MotionModel elevation_model;
+};
+
+struct SettingsRecordHeader {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t version;
+    uint16_t length;
+    uint32_t crc; // CRC-32 of the header with this field zeroed and the settings
+};
+
+static_assert(sizeof(SettingsRecordHeader) + sizeof(Settings) <= FLASH_STORAGE_PAGE_SIZE,
+        "Settings do not fit in a flash page");
+
+/**
+ * Keeps settings records in the flash storage pages in turn, so that each page is erased only
+ * once every FLASH_STORAGE_SETTINGS_PAGE_COUNT saves. The valid record with the highest sequence number
+ * is the current one.
+ */
+class SettingsStore {
+private:
+    uint32_t sequence = 0;
+    int32_t current_page = -1;
+
+    static bool is_valid(const uint8_t *page, SettingsRecordHeader &header);
+
+public:
+    static void defaults(Settings &settings);
+
+    /**
+     * Loads the newest saved settings, leaving the settings untouched when nothing valid was found.
+     */
+    bool load(Settings &settings);
+
+    bool save(const Settings &settings);
+
+    uint32_t get_sequence()
+    {
+        return sequence;
+    }
+
+    int32_t get_page()
+    {
+        return current_page;
+    }
+};
+
+extern Settings settings;
+extern SettingsStore settings_store;
+
+#endif
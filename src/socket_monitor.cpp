@@ -0,0 +1,107 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <utility/w5100.h>
+
+#include "socket_monitor.h"
+#include "print.h"
+
+SocketMonitor socket_monitor;
+
+uint8_t SocketMonitor::memory_register(uint8_t size_kb)
+{
+    uint8_t code = 0;
+    while (code < 3 && (1 << code) < size_kb) {
+        code++;
+    }
+
+    uint8_t value = 0;
+    for (uint8_t i = 0; i < ETHERNET_SOCKET_COUNT; i++) {
+        value |= code << (2 * i);
+    }
+    return value;
+}
+
+bool SocketMonitor::verify_memory()
+{
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    uint8_t tx_memory = W5100.readTMSR();
+    uint8_t rx_memory = W5100.readRMSR();
+    SPI.endTransaction();
+
+    uint8_t expected = expected_memory_register();
+    if (tx_memory != expected || rx_memory != expected) {
+        LOG_WARN("W5100 socket memory TMSR=%d RMSR=%d, expected %d\n", tx_memory, rx_memory, expected);
+        return false;
+    }
+
+    return true;
+}
+
+static const char *socket_state_name(uint8_t state)
+{
+    switch (state) {
+        case 0x00:
+            return "CLOSED";
+        case 0x14:
+            return "LISTEN";
+        case 0x17:
+            return "ESTABLISHED";
+        case 0x1C:
+            return "CLOSE_WAIT";
+        default:
+            return "OTHER";
+    }
+}
+
+bool SocketStatsSource::next(Print &output)
+{
+    if (socket >= ETHERNET_SOCKET_COUNT) {
+        output.println("OK SOCKETS END");
+        return false;
+    }
+
+    SPI.beginTransaction(SPI_ETHERNET_SETTINGS);
+    uint8_t tx_memory = W5100.readTMSR();
+    uint8_t rx_memory = W5100.readRMSR();
+    uint8_t state = W5100.readSnSR(socket);
+    uint16_t port = W5100.readSnPORT(socket);
+    uint16_t tx_free = W5100.readSnTX_FSR(socket);
+    uint16_t rx_received = W5100.readSnRX_RSR(socket);
+    SPI.endTransaction();
+
+    output.print(socket);
+    output.print(" STATE=");
+    output.print(socket_state_name(state));
+    output.print(" PORT=");
+    output.print(port);
+    output.print(" TX_KB=");
+    output.print(SocketMonitor::buffer_size_kb(tx_memory, socket));
+    output.print(" TX_FREE=");
+    output.print(tx_free);
+    output.print(" RX_KB=");
+    output.print(SocketMonitor::buffer_size_kb(rx_memory, socket));
+    output.print(" RX_USED=");
+    output.print(rx_received);
+    output.print(" TX_FULL=");
+    output.print(socket_monitor.get_tx_full(socket));
+    output.print('\n');
+
+    socket++;
+    return true;
+}
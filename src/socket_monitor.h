@@ -0,0 +1,88 @@
+/**
+ * OH3AA antenna rotator controller firmware
+ * Copyright (C) 2020 Mikael Nousiainen OH3BHX <mikael.nousiainen@iki.fi>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OH3AAROT_CONTROLLER_SOCKET_MONITOR_H
+#define OH3AAROT_CONTROLLER_SOCKET_MONITOR_H
+
+#include <Arduino.h>
+#include <Ethernet.h>
+#include "config.h"
+#include "client_output_buffer.h"
+
+#define SOCKET_MEMORY_TOTAL_KB 8 // W5100 TX and RX memory, each
+
+/**
+ * W5100 socket memory and per-socket transmit statistics.
+ *
+ * The Ethernet library addresses the socket buffers as equal slices of the TX and RX memory and
+ * hands out sockets in whatever order they free up, so a socket cannot be sized for the role of
+ * the connection that will land on it. The expected layout is therefore the even split over
+ * ETHERNET_SOCKET_COUNT sockets, and verify_memory() checks that the chip has been set up that way.
+ */
+class SocketMonitor {
+private:
+    uint32_t tx_full[ETHERNET_SOCKET_COUNT]{};
+
+public:
+    /**
+     * TMSR/RMSR value for equal buffers of the given size: two bits per socket, 1, 2, 4 or 8 KB.
+     */
+    static uint8_t memory_register(uint8_t size_kb);
+
+    static uint8_t expected_memory_register()
+    {
+        return memory_register(SOCKET_MEMORY_TOTAL_KB / ETHERNET_SOCKET_COUNT);
+    }
+
+    /**
+     * Size of the socket buffer in KB as given by a TMSR/RMSR value.
+     */
+    static uint8_t buffer_size_kb(uint8_t memory_register, uint8_t socket)
+    {
+        return 1 << ((memory_register >> (2 * socket)) & 0x03);
+    }
+
+    bool verify_memory();
+
+    void record_tx_full(uint8_t socket)
+    {
+        if (socket < ETHERNET_SOCKET_COUNT) {
+            tx_full[socket]++;
+        }
+    }
+
+    uint32_t get_tx_full(uint8_t socket)
+    {
+        return (socket < ETHERNET_SOCKET_COUNT) ? tx_full[socket] : 0;
+    }
+};
+
+extern SocketMonitor socket_monitor;
+
+/**
+ * Streams the state of each W5100 socket for the SOCKETS? command.
+ */
+class SocketStatsSource : public ClientOutputSource {
+private:
+    uint8_t socket = 0;
+
+public:
+    bool next(Print &output) override;
+};
+
+#endif